@@ -7,52 +7,21 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <limits.h>
 #include <string.h>
-#include <unistd.h>
-#include <fcntl.h>
+#include <stdarg.h>
+#include <time.h>
+#include <pthread.h>
 #include "hdlc.h"
+#include "hdlc_priv.h"
 
 //#define DEBUG
-#define FLAG_SEQUENCE   0x7e    // Async HDLC flag
-#define CONTROL_ESCAPE  0x7d    // Control Sequence flag
-#define PPPINITFCS16    0xffff  // Initial FCS value
-#define PPPGOODFCS16    0xf0b8  // Good final FCS value
 #define ERROR           -1      // Return error code
-
-static unsigned short fcstab[256] = {
-      0x0000, 0x1189, 0x2312, 0x329b, 0x4624, 0x57ad, 0x6536, 0x74bf,
-      0x8c48, 0x9dc1, 0xaf5a, 0xbed3, 0xca6c, 0xdbe5, 0xe97e, 0xf8f7,
-      0x1081, 0x0108, 0x3393, 0x221a, 0x56a5, 0x472c, 0x75b7, 0x643e,
-      0x9cc9, 0x8d40, 0xbfdb, 0xae52, 0xdaed, 0xcb64, 0xf9ff, 0xe876,
-      0x2102, 0x308b, 0x0210, 0x1399, 0x6726, 0x76af, 0x4434, 0x55bd,
-      0xad4a, 0xbcc3, 0x8e58, 0x9fd1, 0xeb6e, 0xfae7, 0xc87c, 0xd9f5,
-      0x3183, 0x200a, 0x1291, 0x0318, 0x77a7, 0x662e, 0x54b5, 0x453c,
-      0xbdcb, 0xac42, 0x9ed9, 0x8f50, 0xfbef, 0xea66, 0xd8fd, 0xc974,
-      0x4204, 0x538d, 0x6116, 0x709f, 0x0420, 0x15a9, 0x2732, 0x36bb,
-      0xce4c, 0xdfc5, 0xed5e, 0xfcd7, 0x8868, 0x99e1, 0xab7a, 0xbaf3,
-      0x5285, 0x430c, 0x7197, 0x601e, 0x14a1, 0x0528, 0x37b3, 0x263a,
-      0xdecd, 0xcf44, 0xfddf, 0xec56, 0x98e9, 0x8960, 0xbbfb, 0xaa72,
-      0x6306, 0x728f, 0x4014, 0x519d, 0x2522, 0x34ab, 0x0630, 0x17b9,
-      0xef4e, 0xfec7, 0xcc5c, 0xddd5, 0xa96a, 0xb8e3, 0x8a78, 0x9bf1,
-      0x7387, 0x620e, 0x5095, 0x411c, 0x35a3, 0x242a, 0x16b1, 0x0738,
-      0xffcf, 0xee46, 0xdcdd, 0xcd54, 0xb9eb, 0xa862, 0x9af9, 0x8b70,
-      0x8408, 0x9581, 0xa71a, 0xb693, 0xc22c, 0xd3a5, 0xe13e, 0xf0b7,
-      0x0840, 0x19c9, 0x2b52, 0x3adb, 0x4e64, 0x5fed, 0x6d76, 0x7cff,
-      0x9489, 0x8500, 0xb79b, 0xa612, 0xd2ad, 0xc324, 0xf1bf, 0xe036,
-      0x18c1, 0x0948, 0x3bd3, 0x2a5a, 0x5ee5, 0x4f6c, 0x7df7, 0x6c7e,
-      0xa50a, 0xb483, 0x8618, 0x9791, 0xe32e, 0xf2a7, 0xc03c, 0xd1b5,
-      0x2942, 0x38cb, 0x0a50, 0x1bd9, 0x6f66, 0x7eef, 0x4c74, 0x5dfd,
-      0xb58b, 0xa402, 0x9699, 0x8710, 0xf3af, 0xe226, 0xd0bd, 0xc134,
-      0x39c3, 0x284a, 0x1ad1, 0x0b58, 0x7fe7, 0x6e6e, 0x5cf5, 0x4d7c,
-      0xc60c, 0xd785, 0xe51e, 0xf497, 0x8028, 0x91a1, 0xa33a, 0xb2b3,
-      0x4a44, 0x5bcd, 0x6956, 0x78df, 0x0c60, 0x1de9, 0x2f72, 0x3efb,
-      0xd68d, 0xc704, 0xf59f, 0xe416, 0x90a9, 0x8120, 0xb3bb, 0xa232,
-      0x5ac5, 0x4b4c, 0x79d7, 0x685e, 0x1ce1, 0x0d68, 0x3ff3, 0x2e7a,
-      0xe70e, 0xf687, 0xc41c, 0xd595, 0xa12a, 0xb0a3, 0x8238, 0x93b1,
-      0x6b46, 0x7acf, 0x4854, 0x59dd, 0x2d62, 0x3ceb, 0x0e70, 0x1ff9,
-      0xf78f, 0xe606, 0xd49d, 0xc514, 0xb1ab, 0xa022, 0x92b9, 0x8330,
-      0x7bc7, 0x6a4e, 0x58d5, 0x495c, 0x3de3, 0x2c6a, 0x1ef1, 0x0f78
-};
+#define FUSE_CHUNK      512     // Encoder runs FCS and escaping per chunk while it is in L1
+#define IOV_COPY_MIN    32      // Shorter input runs are copied next to the escapes, not referenced
+#define STREAM_TAIL     10      // Half an escape pair, escaped 32 bit FCS and closing flag
+#define SEGMENT_CHUNK   2048    // Unescaped bytes handed to a segment callback at most
 
 enum HDLC_StateType
 {
@@ -61,6 +30,13 @@ enum HDLC_StateType
     ESCAPED,
 };
 
+enum HDLC_StreamType
+{
+    STREAM_IDLE,        // No message being streamed
+    STREAM_DATA,        // Between hdlc_msg_encode_begin and hdlc_msg_encode_finish
+    STREAM_CLOSING      // FCS and closing flag waiting for room
+};
+
 enum HDLC_ErrorType
 {
     ERR_NO_DATA,
@@ -69,98 +45,297 @@ enum HDLC_ErrorType
 };
 
 // The special //!< comment creates doxygen information related to defines
-#define MAX_BLOCKS 5     // A simplistic way to become multi-thread safe for multiple simultaneous threads
+#define HANDLE_INDEX_BITS 20    // Registry slot index in the low bits of a handle
+#define HANDLE_INDEX_MASK ((1 << HANDLE_INDEX_BITS) - 1)
+#define HANDLE_GEN_MASK   0x7ff // Slot generation in bits 20-30, handles stay positive
+#define REG_PAGE_BITS     8     // Registry grows a page of slots at a time
+#define REG_PAGE_SIZE     (1 << REG_PAGE_BITS)
+#define REG_PAGES         (1 << (HANDLE_INDEX_BITS - REG_PAGE_BITS))
+#define SPAN_FULL   -1          // Decoder stopped, no room left behind the held messages
+#define SPAN_FRAME   1          // Decoder completed a message (good or bad FCS)
+#define SPAN_VIEW    2          // Decoder completed a message that was left in the input
+#define STATS_ALIGN 64          // Counters on their own cache line
+#define STAT_ADD(p, f, n) __atomic_fetch_add(&(p)->stats.f, (n), __ATOMIC_RELAXED)
 // Misc
 
 
 // Globally defined variables
 struct hdlc_buffer
 {
-    int   block;                // A memory block for multiple instances
-    int   size;                 // Maximum incoming message size
-    int   pfd[2];               // Two file descriptors for FIFO (byte parser)
+    // Decode state, one cache line touched per add/decode call
+    unsigned char  state;       // enum HDLC_StateType, state of the partial/complete buffer block
+    unsigned char  hunted;      // Data was discarded while looking for a flag
+    unsigned char  fcsLen;      // FCS size in bytes (2 or 4), fixed at init
+    unsigned char  rxMapped;    // rxMap holds more than FLAG and ESCAPE, use the map kernels
+    int            size;        // Maximum incoming message size
+    int            bufferDecodedLen;// Size of the message being decoded (FCS included until complete)
+    int            decodedStart;    // Offset of the message being decoded, messages before it are held by a batch
+    int            decodedCap;      // Size of bufferDecoded
+    unsigned char *bufferDecoded;   // Decoded messages, borrowed from the shared pool while a message is in flight
+    unsigned char *ring;        // Ring buffer for incoming data, borrowed while it holds data
+    unsigned int   ringSize;    // Capacity of the ring buffer (power of two)
+    unsigned int   ringHead;    // Write index, free running (masked on access)
+    unsigned int   ringTail;    // Read index, free running (masked on access)
+    unsigned int   ringHigh;    // High-water mark, flow off when reached
+    unsigned int   ringLow;     // Low-water mark, flow back on when drained to it
+    int            flowOff;     // Flow state, 1 between high-water and low-water
+
+    int            block;       // A memory block for multiple instances
+    hdlc_flow_cb   flowCb;      // Optional flow state change notification
+    void          *flowArg;     // Argument handed to flowCb
+
+    unsigned char *intoDst;     // Caller storage holding the open message (hdlc_decode_into), NULL for bufferDecoded
+    void          *intoArg;     // Owner of intoDst, handed to intoPut when the channel gives it back
+    hdlc_put_cb    intoPut;     // Gives intoDst back to its owner
+
+    unsigned char *bufferEncoded; // Outbound message, from the shared pool until hdlc_msg_encode_release
+    int            encodedCap;  // Size of bufferEncoded
+    int            txMapped;    // txMap holds more than FLAG and ESCAPE, use the map kernels
+    struct hdlc_accm txMap;     // Characters escaped on transmit (FLAG, ESCAPE, ACCM and extended map)
+    struct hdlc_accm rxMap;     // Characters discarded on receive, with FLAG and ESCAPE
 
-    unsigned char *bufferDecoded;   // Block of memory for single decoded message
-    int            bufferDecodedLen;// Size of single decoded message
+    int            streamState; // enum HDLC_StreamType, message streamed by hdlc_msg_encode_feed
+    unsigned int   streamFcs;   // FCS of the message fed so far
+    unsigned char  streamTail[STREAM_TAIL]; // Encoded bytes waiting for room in the caller's window
+    unsigned char  streamTailLen; // Bytes in streamTail
+    unsigned char  streamTailPos; // Bytes of streamTail already written
+    long long      streamOut;   // Encoded bytes written for the message
+    long long      streamRaw;   // Bytes before escaping (message, FCS and flags)
 
-    int   dataLenCRC;           // The data length for CRC calculations
-    unsigned char crc1;         // crc1 byte
-    unsigned char crc2;         // crc2 byte
-    unsigned short fcs;         // Frame Check Sequence
-    enum HDLC_StateType state;  // State of the partial/complete buffer block
+    unsigned int   segFcs;      // FCS of the segments delivered so far (hdlc_msg_decode_segments)
+    long long      segLen;      // Bytes of the message delivered so far
+    unsigned char  segHold[4];  // Last bytes received, the FCS if the message ends here
+    int            segHoldLen;  // Bytes in segHold
 
-    unsigned char *bufferEncoded; // An allocated memory segment for encoding outbound messages
+    struct hdlc_sync_rx syncRx; // Bit synchronous receive state (hdlc_sync_decode)
+
+    hdlc_log_cb    logCb;       // Optional decoder event notification
+    void          *logArg;      // Argument handed to logCb
+    int            logRate;     // Events reported per second (0 = no limit)
+    int            logCount;    // Events reported in the current second
+    int            logSuppressed; // Events dropped in the current second
+    time_t         logWindow;   // Current second
+
+    struct hdlc_stats stats __attribute__((aligned(STATS_ALIGN))); // Counters, written by the add/decode and encode threads
+};
+_Static_assert(offsetof(struct hdlc_buffer, block) <= STATS_ALIGN, "decode state spills out of its cache line");
+
+// Channel registry slot
+struct hdlc_slot
+{
+    struct hdlc_buffer *chan;   // Comm channel, NULL while the slot is free
+    int   gen;                  // Bumped when the channel is deleted, stale handles stop matching (read without the lock)
+    int   nextFree;             // Next free slot index (LIFO free list)
 };
 
 // Locally defined variables
-static struct hdlc_buffer *hdlc[MAX_BLOCKS+1] = {NULL};  // Block of hdlc comm channels
-static struct hdlc_buffer *ptr;                          // Pointer to one comm channel
+static struct hdlc_slot *registry[REG_PAGES];    // Pages of comm channel slots, allocated on demand and never moved
+static int regUsed = 1;                          // Slot indexes handed out so far (0 is reserved for "all")
+static int regFree = 0;                          // Head of the free slot list (0 = empty)
+static pthread_mutex_t regLock = PTHREAD_MUTEX_INITIALIZER; // Serializes allocate and free, not lookups
 
 // Locally defined functions (see below for function header information)
 static int hdlc_delete_it(int block);
-static int hdlc_check_bounds(int block);
+static struct hdlc_buffer *hdlc_check_bounds(int block);
+static int hdlc_register(struct hdlc_buffer *p);
+static void hdlc_unregister(struct hdlc_buffer *p);
+static void hdlc_slot_free(int idx);
+static int hdlc_legacy(void);
+static void hdlc_flow_update(struct hdlc_buffer *p);
+static int hdlc_decode_ring(struct hdlc_buffer *p, unsigned char *dst, int lim, struct hdlc_frame *frame);
+static int hdlc_decode_span(struct hdlc_buffer *p, unsigned char *dst, int lim,
+                            const unsigned char *in, int len, int view,
+                            int *used, struct hdlc_frame *frame);
+static void hdlc_release(struct hdlc_buffer *p);
+static int hdlc_hold_room(struct hdlc_buffer *p);
+static void hdlc_into_return(struct hdlc_buffer *p);
+static int hdlc_borrow(unsigned char **buf, int *cap, int need, int keep);
+static void hdlc_idle(struct hdlc_buffer *p);
+static void hdlc_frame_check(struct hdlc_buffer *p, struct hdlc_frame *frame, unsigned char *ptr, int len);
+static void hdlc_log(struct hdlc_buffer *p, int event, const char *fmt, ...);
+static void hdlc_count_out(struct hdlc_buffer *p, int txCnt, int raw);
+static int hdlc_stream_flush(struct hdlc_buffer *p, unsigned char *out, int cap);
+static void hdlc_segment_reset(struct hdlc_buffer *p);
+static void hdlc_segment_deliver(struct hdlc_buffer *p, unsigned char *seg, int *fill, hdlc_segment_cb cb, void *arg);
+static int hdlc_encode(struct hdlc_buffer *p, unsigned char *out, int cap, const unsigned char *in, int len);
+static inline int hdlc_encode_fcs(unsigned char *out, int cap, const unsigned char *in, int len,
+                                  const struct hdlc_accm *map, const int fcsLen);
 
 /**
  * @brief HDLC init buffer
  *
  * Initialize a buffer for incoming/outgoing messages and associate the buffer
- * block by returning its value.
+ * block by returning its value.  The incoming ring buffer gets the default capacity.
  *
  * @param[in] size - the incoming buffer size maximum
  *
  * @return -1 error,
- *          1-MAX_BLOCKS allocated message block for storing partial messages and used in decode
+ *         >0 handle of the allocated message block for storing partial messages and used in decode
  *
  * @note None
  * @warning None
  */
 int hdlc_init(int size)
 {
-    int val;
+    return hdlc_init_ring(size, 0);
+}
 
-    for (val = 1; val <= MAX_BLOCKS; val++) {
-        if (hdlc[val] == NULL) {
-            break;
-        }
-    }
+/**
+ * @brief HDLC init buffer with a ring capacity
+ *
+ * Initialize a buffer for incoming/outgoing messages and associate the buffer
+ * block by returning its value.  Incoming data is staged in a ring buffer of
+ * the requested capacity, rounded up to a power of two.
+ *
+ * @param[in] size     - the incoming buffer size maximum
+ * @param[in] capacity - ring buffer capacity in bytes (0 = HDLC_RING_DEFAULT or
+ *                       two worst case encoded messages, whichever is larger)
+ *
+ * @return -1 error,
+ *         >0 handle of the allocated message block for storing partial messages and used in decode
+ *
+ * @note The high-water mark defaults to 3/4 and the low-water mark to 1/4 of capacity
+ * @warning None
+ */
+int hdlc_init_ring(int size, int capacity)
+{
+    return hdlc_init_fcs(size, capacity, HDLC_FCS16);
+}
 
-    if (val >= MAX_BLOCKS) { // Failure in finding a free block
-        printf("hdlc: Failure allocating a free block. Maximum(%d) exceeded.",MAX_BLOCKS);
-        return -1; // Failure
-    }
-    printf("hdlc: Allocating block(%d)\n",val);
+/**
+ * @brief HDLC init buffer with an FCS width
+ *
+ * Same as hdlc_init_ring, with the frame check sequence negotiated for the
+ * link.  The width cannot change afterwards.
+ *
+ * @param[in] size     - the incoming buffer size maximum
+ * @param[in] capacity - ring buffer capacity in bytes (0 = default)
+ * @param[in] fcs      - HDLC_FCS16 or HDLC_FCS32
+ *
+ * @return -1 error,
+ *         >0 handle of the allocated message block for storing partial messages and used in decode
+ *
+ * @note None
+ * @warning None
+ */
+int hdlc_init_fcs(int size, int capacity, int fcs)
+{
+    hdlc_chan_t *p;
 
-    if (hdlc[val] == NULL)
-    {
-        int opt;
-        hdlc[val] = malloc(sizeof(struct hdlc_buffer));
-        ptr = hdlc[val]; // Make it easy to reference
-
-        ptr->block = val;
-        ptr->size  = size;
-        ptr->bufferDecoded = malloc(ptr->size*2);
-        ptr->bufferDecodedLen = 0;
-        ptr->dataLenCRC = 0;
-        ptr->crc1 = ptr->crc2 = 0;
-        ptr->fcs = PPPINITFCS16;
-        ptr->state = STARTING;
-        ptr->bufferEncoded = malloc(ptr->size*2 + 6);
-
-        if (pipe(ptr->pfd) == -1) { perror("pipe init"); return -1; } // Failed
-
-        // Set to NON BLOCKING
-        if ((opt = fcntl(ptr->pfd[0],F_GETFL,0)) < 0)
-            perror("hdlc fcntl get failure:");
-        opt |= O_NONBLOCK;
-        if (fcntl(ptr->pfd[0],F_SETFL,opt) < 0)
-            perror("hdlc fnctl set failure:");
-    }
-    else
-    { // Failed right now
-        printf("hdlc: Buffer already allocated\n");fflush(stdout);
+    if ((p = hdlc_chan_init_fcs(size, capacity, fcs)) == NULL || hdlc_register(p) < 0)
+    { // Failed
+        hdlc_chan_delete(p);
         return -1;
     }
-    return ptr->block; //  Right now only using one static block
+    return p->block;
+}
+
+/**
+ * @brief HDLC init channel
+ *
+ * Create a comm channel context for incoming/outgoing messages.  The channel
+ * is not entered in the handle registry, it is only reachable through the
+ * returned pointer and needs no locking as long as one thread at a time uses it.
+ *
+ * @param[in] size     - the incoming buffer size maximum
+ * @param[in] capacity - ring buffer capacity in bytes (0 = HDLC_RING_DEFAULT or
+ *                       two worst case encoded messages, whichever is larger)
+ *
+ * @return channel
+ *         NULL error
+ *
+ * @note The high-water mark defaults to 3/4 and the low-water mark to 1/4 of capacity
+ * @warning None
+ */
+hdlc_chan_t *hdlc_chan_init(int size, int capacity)
+{
+    return hdlc_chan_init_fcs(size, capacity, HDLC_FCS16);
+}
+
+/**
+ * @brief HDLC init channel with an FCS width
+ *
+ * Same as hdlc_chan_init, with the frame check sequence negotiated for the
+ * link.  The width cannot change afterwards.
+ *
+ * @param[in] size     - the incoming buffer size maximum
+ * @param[in] capacity - ring buffer capacity in bytes (0 = default)
+ * @param[in] fcs      - HDLC_FCS16 or HDLC_FCS32
+ *
+ * @return channel
+ *         NULL error
+ *
+ * @note None
+ * @warning None
+ */
+hdlc_chan_t *hdlc_chan_init_fcs(int size, int capacity, int fcs)
+{
+    hdlc_chan_t *p;
+    unsigned int ringSize;
+    int fcsLen = fcs / 8, encMax;
+
+    if (size <= 0 || capacity < 0 || (fcs != HDLC_FCS16 && fcs != HDLC_FCS32)) return NULL; // Failure
+
+    encMax = size*2 + 2 + fcsLen*2; // Flags, every byte and FCS byte escaped
+    if (capacity == 0)
+    { // Room for at least two worst case encoded messages
+        capacity = HDLC_RING_DEFAULT;
+        if (capacity < encMax * 2)
+            capacity = encMax * 2;
+    }
+    for (ringSize = 1; ringSize < (unsigned int)capacity; ringSize <<= 1)
+        ;
+
+    if ((p = aligned_alloc(STATS_ALIGN, sizeof(struct hdlc_buffer))) == NULL) return NULL; // Failure
+
+    // The buffers are borrowed from the shared pool once data comes in
+    p->block = 0; // Not registered
+    p->size  = size;
+    p->fcsLen = fcsLen;
+    p->ring = NULL;
+    p->ringSize = ringSize;
+    p->ringHead = p->ringTail = 0;
+    p->ringHigh = ringSize - ringSize/4;
+    p->ringLow  = ringSize/4;
+    p->flowOff = 0;
+    p->flowCb = NULL;
+    p->flowArg = NULL;
+    p->bufferDecoded = NULL;
+    p->bufferDecodedLen = 0;
+    p->intoDst = NULL;
+    p->decodedCap = 0;
+    p->decodedStart = 0;
+    p->state = STARTING;
+    p->hunted = 0;
+    p->bufferEncoded = NULL;
+    p->encodedCap = 0;
+    p->streamState = STREAM_IDLE;
+    p->segHoldLen = 0;
+    memset(&p->syncRx, 0, sizeof(p->syncRx));
+    hdlc_accm_chan(p, 0, 0, NULL); // Only FLAG and ESCAPE, until negotiated
+    p->logCb = NULL;
+    p->logArg = NULL;
+    p->logRate = 0;
+    p->logCount = 0;
+    p->logSuppressed = 0;
+    p->logWindow = 0;
+    memset(&p->stats, 0, sizeof(p->stats));
+    hdlc_mem_chan_account(sizeof(struct hdlc_buffer));
+    return p;
+}
+
+/**
+ * @brief HDLC channel FCS width
+ *
+ * @param[in] *chan - channel
+ *
+ * @return HDLC_FCS16 or HDLC_FCS32
+ *        -1 failure
+ */
+int hdlc_fcs_chan(hdlc_chan_t *chan)
+{
+    if (chan == NULL) return -1;
+    return chan->fcsLen * 8;
 }
 
 
@@ -177,7 +352,7 @@ int hdlc_init(int size)
  */
 int hdlc_delete(void)
 {
-    return hdlc_delete_num(1);
+    return hdlc_delete_num(hdlc_legacy());
 }
 
 /**
@@ -187,7 +362,7 @@ int hdlc_delete(void)
  *
  * @param[in] number - number representing buffer to deallocate memory (0 = all buffers)
  *
- * @return -1 error
+ * @return -1 error (or no buffer to delete)
  *          0 successful for buffer(s)
  *
  * @note None
@@ -195,14 +370,21 @@ int hdlc_delete(void)
  */
 int hdlc_delete_num(int number)
 {
-    int i,failed = 0;
+    struct hdlc_slot *s;
+    int i, deleted = 0, failed = 0;
 
     if (number == 0)
     { // Go through all comm blocks
-        printf("hdlc: Delete all blocks(1-%d)\n",MAX_BLOCKS);
-        for (i=1;i<=MAX_BLOCKS;i++)
-            if (hdlc_delete_it(i) < 0)
+        for (i = 1; i < regUsed; i++)
+        {
+            s = &registry[i >> REG_PAGE_BITS][i & (REG_PAGE_SIZE - 1)];
+            if (__atomic_load_n(&s->chan, __ATOMIC_ACQUIRE) == NULL) continue;
+            if (hdlc_delete_it(i | __atomic_load_n(&s->gen, __ATOMIC_ACQUIRE) << HANDLE_INDEX_BITS) < 0)
                 failed = 1;
+            else
+                deleted = 1;
+        }
+        if (!deleted) failed = 1; // Nothing to delete
     }
     else
     { // Delete on comm channel buffer
@@ -217,7 +399,10 @@ int hdlc_delete_num(int number)
 /**
  * @brief HDLC delete buffer block
  *
- * Delete a buffer block that has been allocated
+ * Delete a buffer block that has been allocated and put its registry slot
+ * back on the free list with a new generation.  The lookup and the slot
+ * release happen under the registry lock, so of two threads deleting the
+ * same handle only one gets the channel.
  *
  * @param[in] block - number representing buffer block
  *
@@ -226,37 +411,187 @@ int hdlc_delete_num(int number)
  */
 int hdlc_delete_it(int block)
 {
-    if (hdlc_check_bounds(block) < 0) return -1;
+    hdlc_chan_t *p;
+
+    pthread_mutex_lock(&regLock);
+    if ((p = hdlc_check_bounds(block)) != NULL)
+        hdlc_slot_free(block & HANDLE_INDEX_MASK);
+    pthread_mutex_unlock(&regLock);
+    if (p == NULL) return -1;
+    p->block = 0; // Out of the registry already
+    return hdlc_chan_delete(p);
+}
+
+/**
+ * @brief HDLC delete channel
+ *
+ * Free a channel created by hdlc_chan_init or hdlc_init.  A channel that has
+ * a handle is removed from the registry first.
+ *
+ * @param[in] *chan - channel (NULL is ignored)
+ *
+ * @return 0 pass
+ *        -1 failure
+ *
+ * @note None
+ * @warning No other thread may be using the channel
+ */
+int hdlc_chan_delete(hdlc_chan_t *chan)
+{
+    if (chan == NULL) return -1;
 
-    printf("hdlc: Deleting block(%d)\n", block);
-    ptr = hdlc[block]; // Point to hdlc channel of interest
-    free(ptr->bufferDecoded);
-    close(ptr->pfd[0]);
-    close(ptr->pfd[1]);
-    free(ptr);
-    hdlc[block] = NULL;
+    if (chan->block != 0)
+        hdlc_unregister(chan);
+    if (chan->intoDst != NULL)
+        chan->intoPut(chan->intoArg);
+    hdlc_mem_put(chan->bufferDecoded, chan->decodedCap);
+    hdlc_mem_put(chan->bufferEncoded, chan->encodedCap);
+    hdlc_mem_put(chan->ring, chan->ringSize);
+    hdlc_mem_chan_account(-(int)sizeof(struct hdlc_buffer));
+    free(chan);
     return 0; // Success
 }
 
+/**
+ * @brief HDLC channel of a handle
+ *
+ * Reach the channel API (hdlc_*_chan) for a block allocated with hdlc_init.
+ *
+ * @param[in] number - number representing buffer
+ *
+ * @return channel
+ *         NULL not allocated or stale handle
+ */
+hdlc_chan_t *hdlc_chan_get(int number)
+{
+    return hdlc_check_bounds(number);
+}
+
 /**
  * @brief HDLC check bounds
  *
- * Check the message block for proper memory allocation and range
+ * Look up the comm channel of a handle.  The handle must be in range, its
+ * slot allocated, and its generation must match the slot so a handle kept
+ * after hdlc_delete_num can not reach a channel that reused the slot.  The
+ * generation is read from the slot before and after the channel, never
+ * from the channel itself, which a concurrent delete may have freed.
  *
  * @param[in] block - number representing buffer block
  *
- * @return 0 pass
- *        -1 failure
+ * @return comm channel
+ *         NULL failure
  */
-int hdlc_check_bounds(int block)
+static struct hdlc_buffer *hdlc_check_bounds(int block)
 {
-    if (block > MAX_BLOCKS || block < 0 || hdlc[block] == NULL)
+    struct hdlc_slot *page, *s;
+    struct hdlc_buffer *p = NULL;
+    int idx = block & HANDLE_INDEX_MASK, gen = (unsigned int)block >> HANDLE_INDEX_BITS;
+
+    if (block > 0 && (page = __atomic_load_n(&registry[idx >> REG_PAGE_BITS], __ATOMIC_ACQUIRE)) != NULL)
     {
-        printf("hdlc: Not allocated or out of bounds for block (%d)\n",block);
-        return -1; // Failure
+        s = &page[idx & (REG_PAGE_SIZE - 1)];
+        if (__atomic_load_n(&s->gen, __ATOMIC_ACQUIRE) == gen)
+        {
+            p = __atomic_load_n(&s->chan, __ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&s->gen, __ATOMIC_ACQUIRE) != gen)
+                p = NULL; // Deleted meanwhile, the channel may be gone or another one
+        }
+    }
+    return p; // NULL when stale or out of bounds, callers return -1
+}
+
+/**
+ * @brief HDLC register a comm channel
+ *
+ * Take a slot off the free list, or the next never used slot (adding a
+ * registry page when needed), and assign the channel its handle.
+ *
+ * @param[in] *p - comm channel
+ *
+ * @return handle (slot index and generation)
+ *        -1 registry full or out of memory
+ */
+static int hdlc_register(struct hdlc_buffer *p)
+{
+    struct hdlc_slot *s, **page;
+    int idx;
+
+    pthread_mutex_lock(&regLock);
+    if (regFree != 0)
+    { // Reuse the most recently freed slot
+        idx = regFree;
+        s = &registry[idx >> REG_PAGE_BITS][idx & (REG_PAGE_SIZE - 1)];
+        regFree = s->nextFree;
     }
     else
-        return 0;  // Pass
+    { // Grow into the next unused slot
+        idx = regUsed;
+        page = &registry[idx >> REG_PAGE_BITS];
+        if (idx > HANDLE_INDEX_MASK ||
+            (*page == NULL && (*page = calloc(REG_PAGE_SIZE, sizeof(struct hdlc_slot))) == NULL))
+        {
+            pthread_mutex_unlock(&regLock);
+            return -1; // Failure
+        }
+        regUsed++;
+        s = &(*page)[idx & (REG_PAGE_SIZE - 1)];
+    }
+    p->block = idx | s->gen << HANDLE_INDEX_BITS;
+    __atomic_store_n(&s->chan, p, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&regLock);
+    return p->block;
+}
+
+/**
+ * @brief HDLC unregister a comm channel
+ *
+ * Clear the registry slot, bump its generation and put it on the free list
+ *
+ * @param[in] *p - comm channel
+ */
+static void hdlc_unregister(struct hdlc_buffer *p)
+{
+    pthread_mutex_lock(&regLock);
+    hdlc_slot_free(p->block & HANDLE_INDEX_MASK);
+    pthread_mutex_unlock(&regLock);
+    p->block = 0;
+}
+
+/**
+ * @brief HDLC free a registry slot
+ *
+ * Clear the slot before bumping its generation, a lookup that sees the new
+ * generation can then no longer see the old channel
+ *
+ * @param[in] idx - slot index
+ *
+ * @warning Call with regLock held
+ */
+static void hdlc_slot_free(int idx)
+{
+    struct hdlc_slot *s = &registry[idx >> REG_PAGE_BITS][idx & (REG_PAGE_SIZE - 1)];
+
+    __atomic_store_n(&s->chan, NULL, __ATOMIC_RELEASE);
+    __atomic_store_n(&s->gen, (s->gen + 1) & HANDLE_GEN_MASK, __ATOMIC_RELEASE);
+    s->nextFree = regFree;
+    regFree = idx;
+}
+
+/**
+ * @brief HDLC single buffer handle
+ *
+ * The single buffer API always works on registry slot 1, whatever handle
+ * generation currently lives there.
+ *
+ * @return handle of the channel in slot 1 (1 if there is none)
+ */
+static int hdlc_legacy(void)
+{
+    struct hdlc_slot *page = __atomic_load_n(&registry[0], __ATOMIC_ACQUIRE);
+
+    if (page != NULL)
+        return 1 | __atomic_load_n(&page[1].gen, __ATOMIC_ACQUIRE) << HANDLE_INDEX_BITS;
+    return 1;
 }
 
 /**
@@ -273,7 +608,7 @@ int hdlc_check_bounds(int block)
  */
 int hdlc_msg_add(unsigned char *in, int size)
 {
-    return hdlc_msg_add_num(1,in,size);
+    return hdlc_msg_add_num(hdlc_legacy(),in,size);
 }
 
 /**
@@ -286,217 +621,1563 @@ int hdlc_msg_add(unsigned char *in, int size)
  * @param[in] *in   - input buffer address
  * @param[in] size   - size of input buffer
  *
- * @return 0 indicates no data was written to requested buffer (FIFO)
- *         1-size size of decoded data in out buffer
+ * @return 0 indicates no data was written to requested buffer (FIFO full)
+ *         1-size amount of data copied into the buffer, less than size when
+ *                the buffer filled up (the caller keeps the remainder)
  *        -1 failure
  *
- * @note None
+ * @note Data is never dropped; once the high-water mark is reached the flow
+ *       state turns off (see hdlc_flow_num) until decoding drains the buffer
  * @warning None
  */
 int hdlc_msg_add_num(int number, unsigned char *in, int size)
 {
     // This is where the lookup would be for the block number
-    if (hdlc_check_bounds(number) < 0) return -1;
+    return hdlc_msg_add_chan(hdlc_check_bounds(number), in, size);
+}
 
-    if (in == NULL || size <= 0)
+/**
+ * @brief HDLC add incoming message content to a channel
+ *
+ * Add incoming message content that could contain multiple messages or just a
+ * partial message.  This is a storage container for the incoming data.
+ *
+ * @param[in] *chan - channel to add data to
+ * @param[in] *in   - input buffer address
+ * @param[in] size  - size of input buffer
+ *
+ * @return 0 indicates no data was written to requested buffer (FIFO full)
+ *         1-size amount of data copied into the buffer, less than size when
+ *                the buffer filled up (the caller keeps the remainder)
+ *        -1 failure
+ *
+ * @note Data is never dropped; once the high-water mark is reached the flow
+ *       state turns off (see hdlc_flow_chan) until decoding drains the buffer
+ * @warning None
+ */
+int hdlc_msg_add_chan(hdlc_chan_t *chan, const unsigned char *in, int size)
+{
+    unsigned int head, space, first;
+    int cap;
+
+    if (chan == NULL || in == NULL || size <= 0)
     { // incoming size is invalid or no data
         return -1;
     }
+    if (chan->ring == NULL && (chan->ring = hdlc_mem_get(chan->ringSize, &cap)) == NULL)
+        return -1;
+
+    space = chan->ringSize - (chan->ringHead - chan->ringTail);
+    if ((unsigned int)size > space)
+    { // Short copy, caller applies backpressure with the rest
+        STAT_ADD(chan, droppedInput, size - space);
+        size = space;
+    }
+    STAT_ADD(chan, bytesIn, size);
 
-    // Rewrite the data to an unnamed pipe to abstract from original fd
-    if (write(hdlc[number]->pfd[1],in,size) != size) { perror("pipe write:"); return 0;}
+    // Copy into the ring in at most two pieces (up to the wrap and after it)
+    head = chan->ringHead & (chan->ringSize - 1);
+    first = chan->ringSize - head;
+    if (first > (unsigned int)size)
+        first = size;
+    memcpy(chan->ring + head, in, first);
+    memcpy(chan->ring, in + first, size - first);
+    chan->ringHead += size;
 
+    hdlc_flow_update(chan);
     return size; // Identifies the amount of data copied correctly
 }
 
-#ifdef DEBUG
 /**
- * @brief HDLC buffer dump
+ * @brief HDLC get room to receive into
  *
- * Dump incoming and outgoing messages for debug of interface
+ * Hand out the free part of the ring up to its end, so that received data
+ * can be read straight into the channel (no copy through hdlc_msg_add_chan).
+ * Tell the channel how much was written with hdlc_msg_add_commit.
  *
- * @param[in] *buffer - input buffer address
- * @param[in] size    - size of input buffer
- * @param[in] *dir    - direction of interface
+ * @param[in] *chan  - channel
+ * @param[out] **span - where to write the received data
  *
- * @note None
- * @warning None
+ * @return -1 failure
+ *          0 ring full, decode first
+ *          x bytes that can be written at span
+ *
+ * @note A wrapped ring takes two calls to fill completely
+ * @warning The span is valid until the commit, decoding in between may hand
+ *          an empty ring back to the shared pool
  */
-void dump_buffer(unsigned char *buffer, int size,char *dir)
+int hdlc_msg_add_span(hdlc_chan_t *chan, unsigned char **span)
 {
-    int i;
-    printf("hdlc buffer size(%d) %3s:",size,dir);
-    for (i=0; i < size; i++)
-    {
-        printf("%02X ",0xff & buffer[i]);
-    }
-    printf("\n");
+    unsigned int head, space;
+    int cap;
+
+    if (chan == NULL || span == NULL) return -1;
+    if (chan->ring == NULL && (chan->ring = hdlc_mem_get(chan->ringSize, &cap)) == NULL)
+        return -1;
+
+    head = chan->ringHead & (chan->ringSize - 1);
+    space = chan->ringSize - (chan->ringHead - chan->ringTail);
+    if (space > chan->ringSize - head)
+        space = chan->ringSize - head; // Up to the wrap
+    *span = chan->ring + head;
+    return space;
 }
-#endif
 
 /**
- * @brief HDLC search through buffer and decode a message(s) if one available
- *
- * Search through buffer for any message(s), if available.  The current state for a
- * partial message read will be saved and continued upon next call.
+ * @brief HDLC add data written to a receive span
  *
- * @param[out] **out  - address of message pointer set to valid message, if found otherwise NULL
+ * @param[in] *chan - channel
+ * @param[in] size  - bytes written at the span from hdlc_msg_add_span
  *
- * @return 0 No complete message in buffer currently
- *         1-size size of decoded data in out buffer
- *         -1 failure
+ * @return -1 failure (more than the span)
+ *          x size added
  *
  * @note None
  * @warning None
  */
-int hdlc_msg_decode(unsigned char **out)
+int hdlc_msg_add_commit(hdlc_chan_t *chan, int size)
 {
-    return hdlc_msg_decode_num(1,out);
+    unsigned char *span;
+
+    if (size < 0 || hdlc_msg_add_span(chan, &span) < size) return -1;
+
+    STAT_ADD(chan, bytesIn, size);
+    chan->ringHead += size;
+    hdlc_flow_update(chan);
+    return size;
 }
 
 /**
- * @brief HDLC search through current buffer and decode a message(s) if one available
- *
- * Search through buffer for any message(s), if available.  The current state for a
- * partial message read will be saved and continued upon next call.
+ * @brief HDLC set flow control watermarks
  *
- * @param[in] number - number representing buffer to look for additional messages
- * @param[out] **out  - address of message pointer set to valid message, if found otherwise NULL
+ * See hdlc_flow_chan
  *
- * @return 0 No complete message in buffer currently
- *         1-size size of decoded data in out buffer
- *         -1 failure
+ * @param[in] number - number representing buffer
+ * @param[in] high   - high-water mark in bytes (0 = keep current)
+ * @param[in] low    - low-water mark in bytes, less than high
+ * @param[in] cb     - called on every flow state change, may be NULL
+ * @param[in] *arg   - handed back to cb
  *
- * @note None
- * @warning None
+ * @return 0 pass
+ *        -1 failure
  */
-int hdlc_msg_decode_num(int number, unsigned char **out)
+int hdlc_flow_num(int number, int high, int low, hdlc_flow_cb cb, void *arg)
 {
-    unsigned char c;
-    int num;
-    static int cnt=0;
-
-    if (hdlc_check_bounds(number) < 0) return -1;
-    ptr = hdlc[number]; // Make it easy to reference
-   
-    while ((num=read(ptr->pfd[0],&c,1)) > 0)
-    { // Got one character from the unnamed pipe
-        // printf("byte: %03d num(%d) %02X \n", cnt, num,c);fflush(stdout);
-        cnt++;
-        switch (ptr->state)
-        {
-            case STARTING:
-                if (c == FLAG_SEQUENCE)
-                { // Started and got flag
-                    ptr->crc1 = ptr->crc2 = ptr->bufferDecodedLen = ptr->dataLenCRC = 0; // Reset
-                    ptr->fcs = PPPINITFCS16;
-                    ptr->state = STARTED;
-                    cnt=1;
-                }
-                break;
-            case STARTED:
-                if (c == FLAG_SEQUENCE)
-                {
-                    if (ptr->bufferDecodedLen == 0)
-                    { // Got two FLAG SEQUENCES in a row
-                        ptr->dataLenCRC = 0;
-                        ptr->fcs = PPPINITFCS16;
-                    }
-                    else if (ptr->fcs != PPPGOODFCS16)
-                    { // Failed to achieve fast frame check sequence (FCS)
-                        printf("Failed FCS for %d bytes with FCS(%04X) instead of %04X\n", ptr->bufferDecodedLen, ptr->fcs, PPPGOODFCS16);
-                        //printf("Original Buffer: "); dump_buffer(ptr->bufferDecoded, ptr->bufferDecodedLe, "FCS failed");
-                        ptr->state = STARTING;
-                    }
-                    else // Good message with FCS
-                    { // FCS == PPPGOODFCS16
-#ifdef DEBUG
-                        dump_buffer(ptr->bufferDecoded, ptr->bufferDecodedLen,"IN");
-#endif
-                        ptr->state = STARTING;
-                        *out = ptr->bufferDecoded;
-                        return ptr->bufferDecodedLen;
-                    }
-                }
-                else if (c == CONTROL_ESCAPE)
-                    ptr->state = ESCAPED;
-                else // Everything else
-                {
-                    if (ptr->dataLenCRC >= 2)
-                    {
-                        if (ptr->bufferDecodedLen >= ptr->size * 2)
-                        { // No end
-                            printf("Failed finding end.  Resync.\n");
-                            ptr->state = STARTING;
-                        }
-                        ptr->bufferDecoded[ptr->bufferDecodedLen++] = ptr->crc1;
-                    }
-                    ptr->crc1 = ptr->crc2;
-                    ptr->crc2 = c;
-                    ptr->dataLenCRC++;
-                    ptr->fcs = (ptr->fcs >> 8) ^ fcstab[(ptr->fcs ^ c) & 0xff];
-                }
-                break;
-            case ESCAPED:
-                if (c == FLAG_SEQUENCE)
-                {
-                    ptr->bufferDecodedLen = ptr->dataLenCRC = 0;
-                    ptr->fcs = PPPINITFCS16;
-                    ptr->state = STARTED;
-                }
-                else
-                {
-                    c ^= 0x20;
-                    if (ptr->dataLenCRC >= 2)
-                    {
-                        if (ptr->bufferDecodedLen >= ptr->size * 2)
-                        {
-                            printf("Overran buffer on ESCAPED.  Resync.\n");
-                            ptr->state = STARTING;
-                        }
-                        ptr->bufferDecoded[ptr->bufferDecodedLen++] = ptr->crc1;
-                    }
-                    ptr->crc1 = ptr->crc2;
-                    ptr->crc2 = c;
-                    ptr->dataLenCRC++;
-                    ptr->fcs = (ptr->fcs >> 8) ^ fcstab[(ptr->fcs ^ c) & 0xff];
-                    ptr->state = STARTED;
-                }
-                break;
-        }
-    }
-    *out = NULL;
-    return 0;
+    return hdlc_flow_chan(hdlc_check_bounds(number), high, low, cb, arg);
 }
 
 /**
- * @brief HDLC encode buffer used for output
+ * @brief HDLC set channel flow control watermarks
  *
- * Encode an HDLC like framing, See RFC 1662 for any additional information.
+ * Configure the high-water and low-water marks of the incoming ring buffer.
+ * The flow state turns off when the buffered data reaches the high-water mark
+ * and back on when decoding drains it down to the low-water mark.
  *
- * @param[in] *in  - input message buffer address
- * @param[in] len  - size of incoming buffer
- * @param[out] **out - address of message pointer set to valid HDLC encoded message buffer
+ * @param[in] *chan - channel
+ * @param[in] high  - high-water mark in bytes (0 = keep current)
+ * @param[in] low   - low-water mark in bytes, less than high
+ * @param[in] cb    - called on every flow state change, may be NULL
+ * @param[in] *arg  - handed back to cb
  *
- * @return -1 Failed to create a buffer
- *         x  size of data in out buffer
+ * @return 0 pass
+ *        -1 failure
  *
- * @note None
+ * @note cb runs on the thread that adds or decodes data on the channel
  * @warning None
  */
-int hdlc_msg_encode(unsigned char *in, int len, unsigned char **out)
+int hdlc_flow_chan(hdlc_chan_t *chan, int high, int low, hdlc_flow_cb cb, void *arg)
 {
-    return hdlc_msg_encode_num(1,in,len,out);
+    if (chan == NULL) return -1;
+
+    if (high == 0) high = chan->ringHigh;
+    if (high < 0 || low < 0 || low >= high || (unsigned int)high > chan->ringSize)
+        return -1; // Invalid marks
+
+    chan->ringHigh = high;
+    chan->ringLow  = low;
+    chan->flowCb   = cb;
+    chan->flowArg  = arg;
+    hdlc_flow_update(chan);
+    return 0;
 }
 
 /**
- * @brief HDLC encode buffer used for output
+ * @brief HDLC flow state
  *
- * Encode an HDLC like framing, See RFC 1662 for any additional information.
+ * @param[in] number - number representing buffer
  *
- * @param[in] number - block number representing buffer
- * @param[in] *in  - input message buffer address
- * @param[in] len  - size of incoming buffer
+ * @return 1 flow off, stop adding data until it turns back on
+ *         0 flow on
+ *        -1 failure
+ */
+int hdlc_flow_state_num(int number)
+{
+    return hdlc_flow_state_chan(hdlc_check_bounds(number));
+}
+
+/**
+ * @brief HDLC channel flow state
+ *
+ * @param[in] *chan - channel
+ *
+ * @return 1 flow off, stop adding data until it turns back on
+ *         0 flow on
+ *        -1 failure
+ */
+int hdlc_flow_state_chan(hdlc_chan_t *chan)
+{
+    if (chan == NULL) return -1;
+    return chan->flowOff;
+}
+
+/**
+ * @brief HDLC amount of buffered incoming data
+ *
+ * @param[in] number - number representing buffer
+ *
+ * @return bytes waiting to be decoded
+ *        -1 failure
+ */
+int hdlc_msg_pending_num(int number)
+{
+    return hdlc_msg_pending_chan(hdlc_check_bounds(number));
+}
+
+/**
+ * @brief HDLC amount of buffered incoming data on a channel
+ *
+ * @param[in] *chan - channel
+ *
+ * @return bytes waiting to be decoded
+ *        -1 failure
+ */
+int hdlc_msg_pending_chan(hdlc_chan_t *chan)
+{
+    if (chan == NULL) return -1;
+    return chan->ringHead - chan->ringTail;
+}
+
+/**
+ * @brief HDLC amount of free incoming buffer space
+ *
+ * @param[in] number - number representing buffer
+ *
+ * @return bytes that hdlc_msg_add_num can accept right now
+ *        -1 failure
+ */
+int hdlc_msg_space_num(int number)
+{
+    return hdlc_msg_space_chan(hdlc_check_bounds(number));
+}
+
+/**
+ * @brief HDLC amount of free incoming buffer space on a channel
+ *
+ * @param[in] *chan - channel
+ *
+ * @return bytes that hdlc_msg_add_chan can accept right now
+ *        -1 failure
+ */
+int hdlc_msg_space_chan(hdlc_chan_t *chan)
+{
+    if (chan == NULL) return -1;
+    return chan->ringSize - (chan->ringHead - chan->ringTail);
+}
+
+/**
+ * @brief HDLC set the async control character maps
+ *
+ * See hdlc_accm_chan
+ *
+ * @param[in] number - number representing buffer
+ * @param[in] tx     - control characters (bit c for 0x00-0x1F) escaped on transmit
+ * @param[in] rx     - control characters discarded on receive
+ * @param[in] *ext   - 32 byte extended transmit map, NULL for none
+ *
+ * @return 0 pass
+ *        -1 failure
+ */
+int hdlc_accm_num(int number, unsigned int tx, unsigned int rx, const unsigned char *ext)
+{
+    return hdlc_accm_chan(hdlc_check_bounds(number), tx, rx, ext);
+}
+
+/**
+ * @brief HDLC set the channel async control character maps
+ *
+ * Apply the ACCM negotiated by LCP (RFC 1662).  On transmit, the control
+ * characters of tx and every character of the extended map are escaped, on
+ * top of FLAG SEQUENCE and CONTROL ESCAPE.  On receive, control characters
+ * of rx that arrive unescaped were added by the link and are dropped.  All
+ * zero (the default) escapes FLAG SEQUENCE and CONTROL ESCAPE only and runs
+ * the plain kernels.
+ *
+ * @param[in] *chan - channel
+ * @param[in] tx    - control characters (bit c for 0x00-0x1F) escaped on transmit
+ * @param[in] rx    - control characters discarded on receive
+ * @param[in] *ext  - 32 byte extended transmit map, bit (c & 7) of ext[c >> 3]
+ *                    for character c, NULL for none
+ *
+ * @return 0 pass
+ *        -1 failure (0x5E in the extended map, it would escape to an abort)
+ *
+ * @note Change the maps between messages, on the threads that encode and decode
+ * @warning None
+ */
+int hdlc_accm_chan(hdlc_chan_t *chan, unsigned int tx, unsigned int rx, const unsigned char *ext)
+{
+    int c;
+
+    if (chan == NULL || (ext != NULL && (ext[0x5e >> 3] & (1 << (0x5e & 7))))) return -1;
+
+    memset(&chan->txMap, 0, sizeof(chan->txMap));
+    memset(&chan->rxMap, 0, sizeof(chan->rxMap));
+    hdlc_accm_add(&chan->txMap, FLAG_SEQUENCE);
+    hdlc_accm_add(&chan->txMap, CONTROL_ESCAPE);
+    hdlc_accm_add(&chan->rxMap, FLAG_SEQUENCE);
+    hdlc_accm_add(&chan->rxMap, CONTROL_ESCAPE);
+    for (c = 0; c < 32; c++)
+    {
+        if (tx & (1u << c)) hdlc_accm_add(&chan->txMap, c);
+        if (rx & (1u << c)) hdlc_accm_add(&chan->rxMap, c);
+    }
+    chan->txMapped = (tx != 0);
+    if (ext != NULL)
+    {
+        for (c = 0; c < 256; c++)
+            if (ext[c >> 3] & (1 << (c & 7)))
+            {
+                hdlc_accm_add(&chan->txMap, c);
+                chan->txMapped |= (c != FLAG_SEQUENCE && c != CONTROL_ESCAPE);
+            }
+    }
+    chan->rxMapped = (rx != 0);
+    return 0;
+}
+
+/**
+ * @brief HDLC channel counters
+ *
+ * See hdlc_stats_chan
+ *
+ * @param[in] number - number representing buffer
+ * @param[out] *snap - counters, may be NULL when only resetting
+ * @param[in] reset  - 1 to zero the counters as they are read
+ *
+ * @return 0 pass
+ *        -1 failure
+ */
+int hdlc_stats_num(int number, struct hdlc_stats *snap, int reset)
+{
+    return hdlc_stats_chan(hdlc_check_bounds(number), snap, reset);
+}
+
+/**
+ * @brief HDLC channel counters
+ *
+ * Take a snapshot of the channel counters, optionally zeroing them.  The
+ * counters are updated with relaxed atomics, so a snapshot can be taken
+ * from any thread while the channel is in use; each counter is exact but
+ * they are not read at one instant.
+ *
+ * @param[in] *chan  - channel
+ * @param[out] *snap - counters, may be NULL when only resetting
+ * @param[in] reset  - 1 to zero the counters as they are read
+ *
+ * @return 0 pass
+ *        -1 failure
+ *
+ * @note With reset no count is lost or seen twice between two snapshots
+ * @warning None
+ */
+int hdlc_stats_chan(hdlc_chan_t *chan, struct hdlc_stats *snap, int reset)
+{
+    unsigned long long *src, *dst, v;
+    unsigned int i;
+
+    if (chan == NULL || (snap == NULL && !reset)) return -1;
+
+    src = (unsigned long long *)&chan->stats;
+    dst = (unsigned long long *)snap;
+    for (i = 0; i < sizeof(struct hdlc_stats) / sizeof(*src); i++)
+    {
+        if (reset)
+            v = __atomic_exchange_n(&src[i], 0, __ATOMIC_RELAXED);
+        else
+            v = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+        if (dst != NULL) dst[i] = v;
+    }
+    return 0;
+}
+
+/**
+ * @brief HDLC count dropped messages
+ *
+ * Decoded messages that a worker or frame pool had no buffer for
+ *
+ * @param[in] *p - comm channel
+ * @param[in] n  - messages lost
+ */
+void hdlc_count_dropped(struct hdlc_buffer *p, int n)
+{
+    STAT_ADD(p, framesDropped, n);
+}
+
+/**
+ * @brief HDLC set the decoder event log
+ *
+ * See hdlc_log_chan
+ *
+ * @param[in] number - number representing buffer
+ * @param[in] cb     - called on decoder events, NULL for none
+ * @param[in] *arg   - handed back to cb
+ * @param[in] rate   - events reported per second (0 = no limit)
+ *
+ * @return 0 pass
+ *        -1 failure
+ */
+int hdlc_log_num(int number, hdlc_log_cb cb, void *arg, int rate)
+{
+    return hdlc_log_chan(hdlc_check_bounds(number), cb, arg, rate);
+}
+
+/**
+ * @brief HDLC set the channel decoder event log
+ *
+ * Decoder errors (failed FCS, overrun) are always counted, see
+ * hdlc_stats_chan.  They are also reported to cb, at most rate times per
+ * second; the number held back is reported with HDLC_LOG_SUPPRESSED.
+ * Channels are silent until a callback is set.
+ *
+ * @param[in] *chan - channel
+ * @param[in] cb    - called on decoder events, NULL for none
+ * @param[in] *arg  - handed back to cb
+ * @param[in] rate  - events reported per second (0 = no limit)
+ *
+ * @return 0 pass
+ *        -1 failure
+ *
+ * @note cb runs on the thread that decodes the channel
+ * @warning None
+ */
+int hdlc_log_chan(hdlc_chan_t *chan, hdlc_log_cb cb, void *arg, int rate)
+{
+    if (chan == NULL || rate < 0) return -1;
+
+    chan->logCb = cb;
+    chan->logArg = arg;
+    chan->logRate = rate;
+    chan->logCount = 0;
+    chan->logSuppressed = 0;
+    chan->logWindow = 0;
+    return 0;
+}
+
+/**
+ * @brief HDLC memory used by a channel
+ *
+ * See hdlc_mem_chan
+ *
+ * @param[in] number - number representing buffer
+ *
+ * @return -1 failure
+ *          x bytes
+ */
+long long hdlc_mem_num(int number)
+{
+    return hdlc_mem_chan(hdlc_check_bounds(number));
+}
+
+/**
+ * @brief HDLC memory used by a channel
+ *
+ * The context plus the buffers the channel holds right now.  An idle channel
+ * (nothing buffered, nothing held) holds no ring and no decode storage; the
+ * encode buffer stays from the first hdlc_msg_encode_chan or
+ * hdlc_msg_encode_iov on.
+ *
+ * @param[in] *chan - channel
+ *
+ * @return -1 failure
+ *          x bytes
+ *
+ * @note Call from the thread using the channel, see hdlc_mem_stats for all
+ * @warning None
+ */
+long long hdlc_mem_chan(hdlc_chan_t *chan)
+{
+    long long bytes;
+
+    if (chan == NULL) return -1;
+
+    bytes = sizeof(*chan) + chan->decodedCap + chan->encodedCap;
+    if (chan->ring != NULL)
+        bytes += chan->ringSize;
+    return bytes;
+}
+
+/**
+ * @brief HDLC flow state update
+ *
+ * Apply the high-water/low-water hysteresis after the ring level changed
+ *
+ * @param[in] *p - comm channel
+ */
+static void hdlc_flow_update(struct hdlc_buffer *p)
+{
+    unsigned int level = p->ringHead - p->ringTail;
+
+    if (!p->flowOff && level >= p->ringHigh)
+        p->flowOff = 1;
+    else if (p->flowOff && level <= p->ringLow)
+        p->flowOff = 0;
+    else
+        return; // No change
+
+    if (p->flowCb)
+        p->flowCb(p->flowOff, p->flowArg);
+}
+
+#ifdef DEBUG
+/**
+ * @brief HDLC buffer dump
+ *
+ * Dump incoming and outgoing messages for debug of interface
+ *
+ * @param[in] *buffer - input buffer address
+ * @param[in] size    - size of input buffer
+ * @param[in] *dir    - direction of interface
+ *
+ * @note None
+ * @warning None
+ */
+void dump_buffer(unsigned char *buffer, int size,char *dir)
+{
+    int i;
+    printf("hdlc buffer size(%d) %3s:",size,dir);
+    for (i=0; i < size; i++)
+    {
+        printf("%02X ",0xff & buffer[i]);
+    }
+    printf("\n");
+}
+#endif
+
+/**
+ * @brief HDLC search through buffer and decode a message(s) if one available
+ *
+ * Search through buffer for any message(s), if available.  The current state for a
+ * partial message read will be saved and continued upon next call.
+ *
+ * @param[out] **out  - address of message pointer set to valid message, if found otherwise NULL
+ *
+ * @return 0 No complete message in buffer currently
+ *         1-size size of decoded data in out buffer
+ *         -1 failure
+ *
+ * @note None
+ * @warning None
+ */
+int hdlc_msg_decode(unsigned char **out)
+{
+    return hdlc_msg_decode_num(hdlc_legacy(),out);
+}
+
+/**
+ * @brief HDLC search through current buffer and decode a message(s) if one available
+ *
+ * Search through buffer for any message(s), if available.  The current state for a
+ * partial message read will be saved and continued upon next call.
+ *
+ * @param[in] number - number representing buffer to look for additional messages
+ * @param[out] **out  - address of message pointer set to valid message, if found otherwise NULL
+ *
+ * @return 0 No complete message in buffer currently
+ *         1-size size of decoded data in out buffer
+ *         -1 failure
+ *
+ * @note The ring buffer is handed to the decoder one contiguous span at a time
+ * @warning None
+ */
+int hdlc_msg_decode_num(int number, unsigned char **out)
+{
+    return hdlc_msg_decode_chan(hdlc_check_bounds(number), out);
+}
+
+/**
+ * @brief HDLC search through a channel and decode a message if one available
+ *
+ * Search through buffer for any message(s), if available.  The current state for a
+ * partial message read will be saved and continued upon next call.
+ *
+ * @param[in] *chan  - channel to look for additional messages
+ * @param[out] **out - address of message pointer set to valid message, if found otherwise NULL
+ *
+ * @return 0 No complete message in buffer currently
+ *         1-size size of decoded data in out buffer
+ *         -1 failure
+ *
+ * @note The ring buffer is handed to the decoder one contiguous span at a time
+ * @warning The message is valid until the next decode call on the channel
+ */
+int hdlc_msg_decode_chan(hdlc_chan_t *chan, unsigned char **out)
+{
+    struct hdlc_frame frame;
+    int ret;
+
+    *out = NULL;
+    if (chan == NULL) return -1;
+
+    hdlc_release(chan); // The previous message (or batch) is no longer needed
+    if (chan->ringTail != chan->ringHead)
+    {
+        hdlc_into_return(chan);
+        if (hdlc_borrow(&chan->bufferDecoded, &chan->decodedCap, chan->size*2 + chan->fcsLen,
+                        chan->state != STARTING ? chan->bufferDecodedLen : 0) != 0)
+            return -1;
+        while ((ret = hdlc_decode_ring(chan, chan->bufferDecoded, chan->decodedCap, &frame)) == SPAN_FRAME)
+        {
+            if (frame.status == HDLC_FRAME_OK)
+            { // Complete message, the rest stays buffered for the next call
+                *out = frame.ptr;
+                return frame.len;
+            }
+        }
+    }
+    hdlc_idle(chan);
+    return 0;
+}
+
+/**
+ * @brief HDLC decode every complete message in a channel
+ *
+ * Decode all complete messages currently buffered, up to max, in one call.
+ * Each descriptor points into channel storage that stays valid until
+ * hdlc_msg_release_batch (or the next hdlc_msg_decode_chan) on the channel,
+ * so further batches can be decoded while earlier ones are still held.
+ * Messages that fail the FCS are reported with HDLC_FRAME_BAD_FCS.
+ *
+ * @param[in] *chan     - channel to decode
+ * @param[out] frames[] - descriptors of the decoded messages
+ * @param[in] max       - size of frames[]
+ *
+ * @return 0-max number of descriptors filled in.  Fewer than max with data
+ *         still buffered means the held messages use up the storage;
+ *         release the batch and call again.
+ *        -1 failure
+ *
+ * @note The storage grows to the ring capacity plus one message on first use
+ * @warning None
+ */
+int hdlc_msg_decode_batch(hdlc_chan_t *chan, struct hdlc_frame frames[], int max)
+{
+    int n = 0;
+
+    if (chan == NULL || frames == NULL || max <= 0) return -1;
+    if (hdlc_hold_room(chan) != 0) return -1;
+
+    while (n < max && hdlc_decode_ring(chan, chan->bufferDecoded + chan->decodedStart,
+                                       chan->decodedCap - chan->decodedStart, &frames[n]) == SPAN_FRAME)
+    { // Hold the message until the batch is released
+        chan->decodedStart += frames[n].len;
+        n++;
+    }
+    hdlc_idle(chan);
+    return n;
+}
+
+/**
+ * @brief HDLC decode messages straight from the caller's buffer
+ *
+ * Decode a block of received data without copying it into the ring.  A
+ * message with no escapes that lies entirely inside the block is returned as
+ * a view into it.  Anything else (escaped bytes, a message started by an
+ * earlier call or still open at the end of the block) is unescaped into the
+ * channel's storage and held like a batch.  The views stay valid as long as
+ * the caller keeps the block unchanged, the copies until
+ * hdlc_msg_release_batch.  A message left open at the end of the block is
+ * completed by the next call.
+ *
+ * @param[in] *chan     - channel
+ * @param[in] *in       - received data
+ * @param[in] len       - size of the data
+ * @param[out] frames[] - descriptors of the decoded messages
+ * @param[in] max       - number of descriptors available
+ * @param[out] *used    - amount of the data consumed, the rest has to be
+ *                        handed in again after a release
+ *
+ * @return number of messages decoded (good or bad FCS, see status)
+ *        -1 failure
+ *
+ * @note The ring must be empty, data added with hdlc_msg_add_chan has to be
+ *       decoded before switching to this call
+ * @warning hdlc_msg_decode_chan releases the held copies
+ */
+int hdlc_msg_decode_view(hdlc_chan_t *chan, const unsigned char *in, int len,
+                         struct hdlc_frame frames[], int max, int *used)
+{
+    int i = 0, n = 0, u, ret;
+
+    if (chan == NULL || in == NULL || len < 0 || frames == NULL || max <= 0 || used == NULL) return -1;
+    if (chan->ringTail != chan->ringHead) return -1; // Would interleave with the buffered data
+    if (hdlc_hold_room(chan) != 0) return -1;
+
+    while (n < max && i < len)
+    {
+        ret = hdlc_decode_span(chan, chan->bufferDecoded + chan->decodedStart, chan->decodedCap - chan->decodedStart,
+                               in + i, len - i, 1, &u, &frames[n]);
+        i += u;
+        if (ret == SPAN_FULL) break;
+        if (ret == SPAN_FRAME) // Copied, hold it until the release
+            chan->decodedStart += frames[n].len;
+        if (ret != 0) n++;
+    }
+    STAT_ADD(chan, bytesIn, i);
+    hdlc_idle(chan);
+    *used = i;
+    return n;
+}
+
+/**
+ * @brief HDLC release a batch
+ *
+ * Give back the storage of every message returned by hdlc_msg_decode_batch
+ * or copied by hdlc_msg_decode_view
+ *
+ * @param[in] *chan - channel
+ *
+ * @return 0 pass
+ *        -1 failure
+ */
+int hdlc_msg_release_batch(hdlc_chan_t *chan)
+{
+    if (chan == NULL) return -1;
+    hdlc_release(chan);
+    hdlc_idle(chan);
+    return 0;
+}
+
+/**
+ * @brief HDLC decode the next message into the caller's storage
+ *
+ * One step of hdlc_msg_decode_batch, but the message is unescaped straight
+ * into dst instead of the channel storage, for callers that hand it over in
+ * their own buffers (hdlc_pool_decode).  A message still open when the ring
+ * runs dry or dst fills up stays in dst: the channel keeps dst (see
+ * hdlc_decode_held) and the next call carries on with it, so every byte is
+ * unescaped once.  Handing over other storage moves the open message there
+ * and gives the kept one back through put.
+ *
+ * @param[in] *p      - comm channel
+ * @param[out] *dst   - storage for the message and its FCS
+ * @param[in] cap     - size of dst
+ * @param[in] *arg    - owner of dst, handed to put
+ * @param[in] put     - gives dst back once the channel no longer keeps it
+ * @param[out] *frame - descriptor of the message, in dst
+ *
+ * @return 1                message completed (good or bad FCS)
+ *         0                all buffered data consumed
+ *         HDLC_ERR_NO_ROOM dst is too small, frame->len is the room the
+ *                          message may take
+ *
+ * @note Releases any batch held on the channel
+ * @warning dst kept by the channel belongs to it until put is called, do not
+ *          release it
+ */
+int hdlc_decode_into(struct hdlc_buffer *p, unsigned char *dst, int cap, void *arg, hdlc_put_cb put,
+                     struct hdlc_frame *frame)
+{
+    int ret, part;
+
+    hdlc_release(p);
+    part = p->state != STARTING ? p->bufferDecodedLen : 0;
+    if (part > cap)
+    {
+        frame->len = p->size*2 + p->fcsLen;
+        return HDLC_ERR_NO_ROOM;
+    }
+    if (p->intoDst != dst)
+    { // Move the open message over, once
+        if (part > 0)
+            memcpy(dst, p->intoDst != NULL ? p->intoDst : p->bufferDecoded, part);
+        if (p->intoDst != NULL)
+            p->intoPut(p->intoArg);
+    }
+    p->intoDst = NULL;
+
+    ret = hdlc_decode_ring(p, dst, cap, frame);
+    if (ret != SPAN_FRAME && p->state != STARTING && p->bufferDecodedLen > 0)
+    { // Keep dst for the rest of the message
+        p->intoDst = dst;
+        p->intoArg = arg;
+        p->intoPut = put;
+    }
+    hdlc_idle(p);
+    if (ret == SPAN_FULL)
+    {
+        frame->len = p->size*2 + p->fcsLen;
+        return HDLC_ERR_NO_ROOM;
+    }
+    return ret == SPAN_FRAME;
+}
+
+/**
+ * @brief HDLC storage kept by hdlc_decode_into
+ *
+ * @param[in] *p - comm channel
+ *
+ * @return owner (arg) of the storage holding the open message, NULL for none
+ */
+void *hdlc_decode_held(struct hdlc_buffer *p)
+{
+    return p->intoDst != NULL ? p->intoArg : NULL;
+}
+
+/**
+ * @brief HDLC decode handing messages over in segments
+ *
+ * Decode received data without holding whole messages: the unescaped data
+ * goes to cb as HDLC_SEGMENT_DATA segments while it arrives, then the
+ * verdict (HDLC_SEGMENT_OK, HDLC_SEGMENT_BAD_FCS or HDLC_SEGMENT_ABORT)
+ * tells the consumer to commit or discard what it got.  The FCS runs over
+ * the segments as they go, only the last FCS bytes are kept between calls.
+ * Messages of any size take SEGMENT_CHUNK bytes of stack.
+ *
+ * @param[in] *chan - channel
+ * @param[in] *in   - received data, all of it is consumed
+ * @param[in] len   - size of data
+ * @param[in] cb    - segment and verdict callback
+ * @param[in] *arg  - argument handed to cb
+ *
+ * @return HDLC_ERR_PARAM invalid argument
+ *         x              messages completed (good or bad FCS)
+ *
+ * @note The channel size does not apply, segments never hold the FCS
+ * @warning Do not mix with the other decoders on the same channel, they
+ *          share the receive state
+ */
+int hdlc_msg_decode_segments(hdlc_chan_t *chan, const unsigned char *in, int len, hdlc_segment_cb cb, void *arg)
+{
+    unsigned char seg[4 + SEGMENT_CHUNK]; // Held FCS candidates, then the new data
+    const unsigned char *q;
+    unsigned int fcs, good;
+    int i = 0, n, w, fill, frames = 0;
+    unsigned char c;
+
+    if (chan == NULL || (in == NULL && len > 0) || len < 0 || cb == NULL) return HDLC_ERR_PARAM;
+
+    STAT_ADD(chan, bytesIn, len);
+    fill = chan->segHoldLen;
+    memcpy(seg, chan->segHold, fill);
+    while (i < len)
+    {
+        switch (chan->state)
+        {
+            case STARTING:
+                q = memchr(in + i, FLAG_SEQUENCE, len - i);
+                if (q == NULL)
+                { // No flag in the rest of the data, nothing to keep
+                    chan->hunted = 1;
+                    i = len;
+                    break;
+                }
+                if (q != in + i || chan->hunted)
+                { // Skipped data to get here
+                    STAT_ADD(chan, resyncs, 1);
+                    chan->hunted = 0;
+                }
+                i = q - in + 1;
+                hdlc_segment_reset(chan);
+                fill = 0;
+                chan->state = STARTED;
+                break;
+            case STARTED:
+                if (chan->rxMapped)
+                    w = hdlc_unescape_map(seg + fill, sizeof(seg) - fill, in + i, len - i, &n, &chan->rxMap);
+                else
+                    w = hdlc_unescape(seg + fill, sizeof(seg) - fill, in + i, len - i, &n);
+                fill += w;
+                if (n != w) STAT_ADD(chan, escapesIn, n - w);
+                i += n;
+                if (i == len) break;
+
+                if (in[i] != FLAG_SEQUENCE && in[i] != CONTROL_ESCAPE)
+                { // Segment full
+                    hdlc_segment_deliver(chan, seg, &fill, cb, arg);
+                    break;
+                }
+
+                if (in[i++] == CONTROL_ESCAPE)
+                {
+                    STAT_ADD(chan, escapesIn, 1);
+                    chan->state = ESCAPED;
+                    break;
+                }
+                if (chan->segLen + fill <= chan->fcsLen)
+                { // Got two FLAG SEQUENCES in a row (or only an FCS)
+                    fill = 0;
+                    break;
+                }
+
+                // Closing flag, it also opens the next message
+                hdlc_segment_deliver(chan, seg, &fill, cb, arg);
+                if (chan->fcsLen == 4)
+                {
+                    fcs = hdlc_fcs32(chan->segFcs, seg, 4);
+                    good = PPPGOODFCS32;
+                }
+                else
+                {
+                    fcs = hdlc_fcs16(chan->segFcs, seg, 2);
+                    good = PPPGOODFCS16;
+                }
+                if (fcs == good)
+                {
+                    STAT_ADD(chan, framesOk, 1);
+                    cb(chan, HDLC_SEGMENT_OK, NULL, 0, arg);
+                }
+                else
+                {
+                    STAT_ADD(chan, fcsErrors, 1);
+                    hdlc_log(chan, HDLC_LOG_FCS, "Failed FCS for %lld bytes with FCS(%0*X) instead of %0*X",
+                             chan->segLen, chan->fcsLen*2, fcs, chan->fcsLen*2, good);
+                    cb(chan, HDLC_SEGMENT_BAD_FCS, NULL, 0, arg);
+                }
+                frames++;
+                hdlc_segment_reset(chan);
+                fill = 0;
+                break;
+            case ESCAPED:
+                c = in[i++];
+                if (chan->rxMapped && c != FLAG_SEQUENCE && c != CONTROL_ESCAPE && hdlc_accm_has(&chan->rxMap, c))
+                { // Discarded, the escape applies to the next character
+                    STAT_ADD(chan, escapesIn, 1);
+                }
+                else if (c == FLAG_SEQUENCE)
+                { // Aborted message, the flag opens the next one
+                    STAT_ADD(chan, aborts, 1);
+                    if (chan->segLen > 0)
+                        cb(chan, HDLC_SEGMENT_ABORT, NULL, 0, arg);
+                    hdlc_segment_reset(chan);
+                    fill = 0;
+                    chan->state = STARTED;
+                }
+                else
+                {
+                    if (fill == (int)sizeof(seg))
+                        hdlc_segment_deliver(chan, seg, &fill, cb, arg);
+                    seg[fill++] = c ^ 0x20;
+                    chan->state = STARTED;
+                }
+                break;
+        }
+    }
+
+    if (chan->state != STARTING)
+    { // Hand over what came in, keep what may be the FCS
+        hdlc_segment_deliver(chan, seg, &fill, cb, arg);
+        memcpy(chan->segHold, seg, fill);
+        chan->segHoldLen = fill;
+    }
+    return frames;
+}
+
+/**
+ * @brief HDLC start a message in segment mode
+ *
+ * @param[in] *p - comm channel
+ */
+static void hdlc_segment_reset(struct hdlc_buffer *p)
+{
+    p->segFcs = (p->fcsLen == 4) ? PPPINITFCS32 : PPPINITFCS16;
+    p->segLen = 0;
+    p->segHoldLen = 0;
+}
+
+/**
+ * @brief HDLC hand the data received so far to the segment callback
+ *
+ * Everything but the last FCS size bytes, they are the FCS if the message
+ * ends next
+ *
+ * @param[in] *p       - comm channel
+ * @param[in,out] *seg - unescaped data, the kept bytes move to the front
+ * @param[in,out] *fill - bytes in seg
+ * @param[in] cb       - segment callback
+ * @param[in] *arg     - argument handed to cb
+ */
+static void hdlc_segment_deliver(struct hdlc_buffer *p, unsigned char *seg, int *fill, hdlc_segment_cb cb, void *arg)
+{
+    int n = *fill - p->fcsLen;
+
+    if (n <= 0) return;
+
+    if (p->fcsLen == 4)
+        p->segFcs = hdlc_fcs32(p->segFcs, seg, n);
+    else
+        p->segFcs = hdlc_fcs16(p->segFcs, seg, n);
+    cb(p, HDLC_SEGMENT_DATA, seg, n, arg);
+    p->segLen += n;
+    memmove(seg, seg + n, p->fcsLen);
+    *fill = p->fcsLen;
+}
+
+/**
+ * @brief HDLC worst case bit synchronous size
+ *
+ * Two flags, a stuffed zero after every five bits of message and FCS, and
+ * the idle bits filling the last byte
+ *
+ * @param[in] len - size of the message
+ *
+ * @return bytes needed to encode any message of len bytes
+ *
+ * @note Covers both FCS widths
+ * @warning None
+ */
+int hdlc_sync_encoded_bound(int len)
+{
+    return len + len/4 + 10;
+}
+
+/**
+ * @brief HDLC encode a message for a bit synchronous line
+ *
+ * Opening flag, message and FCS bit stuffed, closing flag, bits sent least
+ * significant first.  The last byte is filled with idle ones, so encoded
+ * messages can be sent back to back.  The ACCM does not apply.
+ *
+ * @param[in] *chan - channel (FCS width and size)
+ * @param[in] *in   - message
+ * @param[in] len   - size of message
+ * @param[out] *out - line bytes
+ * @param[in] cap   - size of out, hdlc_sync_encoded_bound always fits
+ *
+ * @return HDLC_ERR_PARAM   invalid argument
+ *         HDLC_ERR_MAX_LEN message bigger than the channel size
+ *         HDLC_ERR_NO_ROOM encoded message does not fit in out
+ *         x                size of data in out
+ *
+ * @note None
+ * @warning None
+ */
+int hdlc_sync_encode_buf(hdlc_chan_t *chan, const unsigned char *in, int len, unsigned char *out, int cap)
+{
+    struct hdlc_sync_tx tx = {0, 0, 0};
+    unsigned char c[4];
+    unsigned int fcs;
+    int i, w, txCnt;
+
+    if (chan == NULL || (in == NULL && len > 0) || len < 0 || out == NULL || cap < 0)
+        return HDLC_ERR_PARAM;
+    if (len > chan->size) return HDLC_ERR_MAX_LEN;
+
+    if (chan->fcsLen == 4)
+        fcs = ~hdlc_fcs32(PPPINITFCS32, in, len);
+    else
+        fcs = ~hdlc_fcs16(PPPINITFCS16, in, len);
+    for (i = 0; i < chan->fcsLen; i++) // Least significant byte first
+        c[i] = fcs >> (8*i);
+
+    if ((txCnt = hdlc_sync_flag(&tx, out, cap)) < 0) return HDLC_ERR_NO_ROOM;
+    if ((w = hdlc_sync_stuff(&tx, out + txCnt, cap - txCnt, in, len)) < 0) return HDLC_ERR_NO_ROOM;
+    txCnt += w;
+    if ((w = hdlc_sync_stuff(&tx, out + txCnt, cap - txCnt, c, chan->fcsLen)) < 0) return HDLC_ERR_NO_ROOM;
+    txCnt += w;
+    if ((w = hdlc_sync_flag(&tx, out + txCnt, cap - txCnt)) < 0) return HDLC_ERR_NO_ROOM;
+    txCnt += w;
+    if ((w = hdlc_sync_pad(&tx, out + txCnt, cap - txCnt)) < 0) return HDLC_ERR_NO_ROOM;
+    txCnt += w;
+
+    hdlc_count_out(chan, txCnt, len + 2 + chan->fcsLen);
+    return txCnt;
+}
+
+/**
+ * @brief HDLC decode a bit synchronous line
+ *
+ * Find the flags wherever they fall in the bytes, destuff the messages
+ * between them and hand each one to cb with its FCS checked.  A message
+ * that does not end on a byte boundary is reported with HDLC_FRAME_BAD_FCS,
+ * seven ones in a row abort it.  The partial message and the bits of a
+ * partial byte are kept in the channel between calls.
+ *
+ * @param[in] *chan - channel
+ * @param[in] *in   - line bytes, all of them are consumed
+ * @param[in] len   - size of in
+ * @param[in] cb    - message callback
+ * @param[in] *arg  - argument handed to cb
+ *
+ * @return HDLC_ERR_PARAM  invalid argument
+ *         HDLC_ERR_NO_MEM no memory for the message
+ *         x               messages completed (good or bad FCS)
+ *
+ * @note The ACCM does not apply, bit stuffing makes every byte transparent
+ * @warning Do not mix with the async decoders on the same channel
+ */
+int hdlc_sync_decode(hdlc_chan_t *chan, const unsigned char *in, int len, hdlc_frame_cb cb, void *arg)
+{
+    struct hdlc_frame frame;
+    int i = 0, n, stop, frames = 0;
+
+    if (chan == NULL || (in == NULL && len > 0) || len < 0 || cb == NULL) return HDLC_ERR_PARAM;
+    if (len == 0) return 0;
+    if (hdlc_borrow(&chan->bufferDecoded, &chan->decodedCap, chan->size + chan->fcsLen,
+                    chan->bufferDecodedLen) != 0)
+        return HDLC_ERR_NO_MEM;
+
+    STAT_ADD(chan, bytesIn, len);
+    while (i < len)
+    {
+        stop = hdlc_sync_destuff(&chan->syncRx, chan->bufferDecoded, chan->size + chan->fcsLen,
+                                 &chan->bufferDecodedLen, in + i, len - i, &n);
+        i += n;
+        switch (stop)
+        {
+            case SYNC_MORE:
+                continue; // Message still open
+            case SYNC_FRAME:
+                if (chan->bufferDecodedLen > chan->fcsLen)
+                {
+                    hdlc_frame_check(chan, &frame, chan->bufferDecoded, chan->bufferDecodedLen);
+                    cb(chan, &frame, arg);
+                    frames++;
+                } // Else only an FCS, ignored like two flags in a row
+                break;
+            case SYNC_BAD:
+                STAT_ADD(chan, fcsErrors, 1);
+                hdlc_log(chan, HDLC_LOG_FCS, "Failed alignment after %d bytes", chan->bufferDecodedLen);
+                frame.ptr = chan->bufferDecoded;
+                frame.len = chan->bufferDecodedLen;
+                frame.status = HDLC_FRAME_BAD_FCS;
+                cb(chan, &frame, arg);
+                frames++;
+                break;
+            case SYNC_ABORT:
+                STAT_ADD(chan, aborts, 1);
+                break;
+            case SYNC_FULL:
+                STAT_ADD(chan, overruns, 1);
+                hdlc_log(chan, HDLC_LOG_OVERRUN, "Failed finding end.  Resync.");
+                break;
+        }
+        chan->bufferDecodedLen = 0;
+    }
+    if (chan->bufferDecodedLen == 0)
+        hdlc_idle(chan); // No message open, the storage can go back
+    return frames;
+}
+
+/**
+ * @brief HDLC make room to hold decoded messages
+ *
+ * Borrow storage big enough for everything the ring can buffer to fit in
+ * one batch.  Only done while nothing is held, since the storage moves.
+ *
+ * @param[in] *p - comm channel
+ *
+ * @return 0 pass
+ *        -1 failure
+ */
+static int hdlc_hold_room(struct hdlc_buffer *p)
+{
+    hdlc_into_return(p);
+    if (p->decodedStart != 0) return 0;
+    return hdlc_borrow(&p->bufferDecoded, &p->decodedCap, p->ringSize + p->size*2 + p->fcsLen,
+                       p->state != STARTING ? p->bufferDecodedLen : 0);
+}
+
+/**
+ * @brief HDLC take the open message back from hdlc_decode_into storage
+ *
+ * Copy it to the channel storage for the other decoders and give the
+ * caller's storage back
+ *
+ * @param[in] *p - comm channel
+ */
+static void hdlc_into_return(struct hdlc_buffer *p)
+{
+    if (p->intoDst == NULL) return;
+
+    if (p->state != STARTING && p->bufferDecodedLen > 0)
+    {
+        if (hdlc_borrow(&p->bufferDecoded, &p->decodedCap, p->size*2 + p->fcsLen, 0) == 0)
+            memcpy(p->bufferDecoded, p->intoDst, p->bufferDecodedLen);
+        else
+        { // Out of memory, the message is lost
+            STAT_ADD(p, framesDropped, 1);
+            p->state = STARTING;
+        }
+    }
+    p->intoPut(p->intoArg);
+    p->intoDst = NULL;
+}
+
+/**
+ * @brief HDLC borrow or grow a buffer
+ *
+ * Take a buffer of at least need bytes from the shared pool, unless the one
+ * held is big enough already, and move what it holds over
+ *
+ * @param[in,out] **buf - buffer held (NULL for none)
+ * @param[in,out] *cap  - its size
+ * @param[in] need      - bytes needed
+ * @param[in] keep      - bytes to move to the new buffer
+ *
+ * @return 0 pass
+ *        -1 failure, the buffer held is unchanged
+ */
+static int hdlc_borrow(unsigned char **buf, int *cap, int need, int keep)
+{
+    unsigned char *grown;
+    int got;
+
+    if (*buf != NULL && *cap >= need) return 0;
+    if ((grown = hdlc_mem_get(need, &got)) == NULL) return -1;
+    if (keep > 0)
+        memcpy(grown, *buf, keep);
+    hdlc_mem_put(*buf, *cap);
+    *buf = grown;
+    *cap = got;
+    return 0;
+}
+
+/**
+ * @brief HDLC hand idle buffers back
+ *
+ * Give an empty ring and the decode storage back to the shared pool, the
+ * storage only when no message is held or partly decoded
+ *
+ * @param[in] *p - comm channel
+ */
+static void hdlc_idle(struct hdlc_buffer *p)
+{
+    if (p->ring != NULL && p->ringHead == p->ringTail)
+    {
+        hdlc_mem_put(p->ring, p->ringSize);
+        p->ring = NULL;
+    }
+    if (p->bufferDecoded != NULL && p->decodedStart == 0 &&
+        (p->state == STARTING || p->bufferDecodedLen == 0 || p->intoDst != NULL))
+    {
+        hdlc_mem_put(p->bufferDecoded, p->decodedCap);
+        p->bufferDecoded = NULL;
+        p->decodedCap = 0;
+    }
+}
+
+/**
+ * @brief HDLC release held messages
+ *
+ * Move the message being decoded (if any) back to the start of the storage
+ *
+ * @param[in] *p - comm channel
+ */
+static void hdlc_release(struct hdlc_buffer *p)
+{
+    if (p->decodedStart == 0) return;
+
+    if (p->state != STARTING && p->bufferDecodedLen > 0)
+        memmove(p->bufferDecoded, p->bufferDecoded + p->decodedStart, p->bufferDecodedLen);
+    p->decodedStart = 0;
+}
+
+/**
+ * @brief HDLC decode the ring buffer up to the next message
+ *
+ * Hand the ring buffer to the decoder one contiguous span at a time (up to
+ * the write index or the end of the ring, whichever is first)
+ *
+ * @param[in] *p      - comm channel
+ * @param[out] *dst   - storage of the message being decoded
+ * @param[in] lim     - size of dst
+ * @param[out] *frame - descriptor of the message, if one completed
+ *
+ * @return SPAN_FRAME message completed (good or bad FCS)
+ *         SPAN_FULL  no room left in dst
+ *         0          all buffered data consumed
+ */
+static int hdlc_decode_ring(struct hdlc_buffer *p, unsigned char *dst, int lim, struct hdlc_frame *frame)
+{
+    unsigned int tail, span;
+    int ret = 0, used;
+
+    while (p->ringTail != p->ringHead)
+    {
+        tail = p->ringTail & (p->ringSize - 1);
+        span = p->ringHead - p->ringTail;
+        if (span > p->ringSize - tail)
+            span = p->ringSize - tail;
+
+        ret = hdlc_decode_span(p, dst, lim, p->ring + tail, span, 0, &used, frame);
+        p->ringTail += used;
+        if (ret != 0) break; // The rest stays buffered for the next call
+    }
+    hdlc_flow_update(p);
+    return ret;
+}
+
+/**
+ * @brief HDLC decode a contiguous span of incoming data
+ *
+ * Run the STARTING/STARTED/ESCAPED state machine over a block of input.  In
+ * STARTED the unescape kernel copies everything up to the next flag in bulk,
+ * so the state machine only sees flags, escapes split across calls and
+ * aborts.  The FCS bytes are stored along with the data; at the closing flag
+ * the FCS engine runs once over the whole message and the FCS is peeled off.
+ *
+ * @param[in] *p      - comm channel holding the partial message state
+ * @param[out] *dst   - storage of the message being decoded, bufferDecodedLen
+ *                      bytes of it decoded already
+ * @param[in] lim     - size of dst, less than the largest message stops with
+ *                      SPAN_FULL instead of an overrun
+ * @param[in] *in     - span of incoming data
+ * @param[in] len     - size of the span
+ * @param[in] view    - leave messages with no escapes in the span
+ * @param[out] *used  - amount of the span consumed
+ * @param[out] *frame - descriptor of the message, if one completed
+ *
+ * @return 0 span consumed without completing a message
+ *         SPAN_FRAME message completed, the span is consumed up to and
+ *                    including the closing flag
+ *         SPAN_VIEW  same, but the message was left in the span
+ *         SPAN_FULL  stopped because dst has no room left
+ */
+static int hdlc_decode_span(struct hdlc_buffer *p, unsigned char *dst, int lim,
+                            const unsigned char *in, int len, int view,
+                            int *used, struct hdlc_frame *frame)
+{
+    const unsigned char *q;
+    int i = 0, n, w, max = p->size*2 + p->fcsLen;
+    unsigned char c;
+
+    if (lim > max) lim = max;
+
+    while (i < len)
+    {
+        switch (p->state)
+        {
+            case STARTING:
+                q = memchr(in + i, FLAG_SEQUENCE, len - i);
+                if (q == NULL)
+                { // No flag in the rest of the span, nothing to keep
+                    p->hunted = 1;
+                    i = len;
+                    break;
+                }
+                if (q != in + i || p->hunted)
+                { // Skipped data to get here
+                    STAT_ADD(p, resyncs, 1);
+                    p->hunted = 0;
+                }
+                i = q - in + 1; // Started and got flag
+                p->bufferDecodedLen = 0; // Reset
+                p->state = STARTED;
+                break;
+            case STARTED:
+                if (view && p->bufferDecodedLen == 0)
+                { // Nothing copied yet, a message with no escapes can stay where it is
+                    if (p->rxMapped)
+                        n = hdlc_scan_map(in + i, len - i, &p->rxMap);
+                    else
+                        n = hdlc_scan(in + i, len - i);
+                    if (i + n < len && in[i + n] == FLAG_SEQUENCE && n > p->fcsLen && n <= max)
+                    {
+                        hdlc_frame_check(p, frame, (unsigned char *)in + i, n);
+                        *used = i + n + 1;
+                        return SPAN_VIEW;
+                    }
+                }
+                if (p->rxMapped)
+                    w = hdlc_unescape_map(dst + p->bufferDecodedLen, lim - p->bufferDecodedLen, in + i, len - i,
+                                          &n, &p->rxMap);
+                else
+                    w = hdlc_unescape(dst + p->bufferDecodedLen, lim - p->bufferDecodedLen, in + i, len - i, &n);
+                p->bufferDecodedLen += w;
+                if (n != w) STAT_ADD(p, escapesIn, n - w);
+                i += n;
+                if (i == len) break;
+
+                if (in[i] != FLAG_SEQUENCE && in[i] != CONTROL_ESCAPE)
+                { // Out of room
+                    if (lim < max)
+                    { // Only because of held messages (or a small dst), resume with more room
+                        *used = i;
+                        return SPAN_FULL;
+                    }
+                    // No end
+                    STAT_ADD(p, overruns, 1);
+                    hdlc_log(p, HDLC_LOG_OVERRUN, "Failed finding end.  Resync.");
+                    p->state = STARTING;
+                    break;
+                }
+
+                if (in[i++] == CONTROL_ESCAPE)
+                {
+                    STAT_ADD(p, escapesIn, 1);
+                    p->state = ESCAPED;
+                }
+                else if (p->bufferDecodedLen <= p->fcsLen)
+                { // Got two FLAG SEQUENCES in a row (or only an FCS)
+                    p->bufferDecodedLen = 0;
+                }
+                else
+                { // Closing flag, it also opens the next message (RFC 1662 shared flag)
+                    hdlc_frame_check(p, frame, dst, p->bufferDecodedLen);
+                    p->bufferDecodedLen = 0;
+                    *used = i;
+                    return SPAN_FRAME;
+                }
+                break;
+            case ESCAPED:
+                c = in[i++];
+                if (p->rxMapped && c != FLAG_SEQUENCE && c != CONTROL_ESCAPE && hdlc_accm_has(&p->rxMap, c))
+                { // Discarded, the escape applies to the next character
+                    STAT_ADD(p, escapesIn, 1);
+                }
+                else if (c == FLAG_SEQUENCE)
+                { // Aborted message, the flag opens the next one
+                    STAT_ADD(p, aborts, 1);
+                    p->bufferDecodedLen = 0;
+                    p->state = STARTED;
+                }
+                else if (p->bufferDecodedLen >= lim)
+                {
+                    if (lim < max)
+                    { // Only because of held messages (or a small dst), resume with more room
+                        *used = i - 1;
+                        return SPAN_FULL;
+                    }
+                    STAT_ADD(p, overruns, 1);
+                    hdlc_log(p, HDLC_LOG_OVERRUN, "Overran buffer on ESCAPED.  Resync.");
+                    p->state = STARTING;
+                }
+                else
+                {
+                    dst[p->bufferDecodedLen++] = c ^ 0x20;
+                    p->state = STARTED;
+                }
+                break;
+        }
+    }
+    *used = len;
+    return 0;
+}
+
+/**
+ * @brief HDLC check a complete message
+ *
+ * Run the FCS engine once over the message and drop the two FCS bytes
+ *
+ * @param[in] *p      - comm channel
+ * @param[out] *frame - descriptor of the message
+ * @param[in] *ptr    - message, FCS included
+ * @param[in] len     - size of the message, FCS included
+ */
+static void hdlc_frame_check(struct hdlc_buffer *p, struct hdlc_frame *frame, unsigned char *ptr, int len)
+{
+    unsigned int fcs, good;
+
+    if (p->fcsLen == 4)
+    {
+        fcs = hdlc_fcs32(PPPINITFCS32, ptr, len);
+        good = PPPGOODFCS32;
+    }
+    else
+    {
+        fcs = hdlc_fcs16(PPPINITFCS16, ptr, len);
+        good = PPPGOODFCS16;
+    }
+
+    frame->ptr = ptr;
+    frame->len = len - p->fcsLen;
+    frame->status = HDLC_FRAME_OK;
+    if (fcs != good)
+    { // Failed to achieve fast frame check sequence (FCS)
+        STAT_ADD(p, fcsErrors, 1);
+        hdlc_log(p, HDLC_LOG_FCS, "Failed FCS for %d bytes with FCS(%0*X) instead of %0*X",
+                 frame->len, p->fcsLen*2, fcs, p->fcsLen*2, good);
+        frame->status = HDLC_FRAME_BAD_FCS;
+        return;
+    }
+    STAT_ADD(p, framesOk, 1);
+#ifdef DEBUG
+    dump_buffer(ptr, frame->len,"IN");
+#endif
+}
+
+/**
+ * @brief HDLC report a decoder event
+ *
+ * Hand the event to the channel's log callback, at most logRate events per
+ * second.  The number of events held back is reported when the next second
+ * starts with an event.
+ *
+ * @param[in] *p   - comm channel
+ * @param[in] event - enum hdlc_log_event
+ * @param[in] *fmt - printf style message
+ */
+static void hdlc_log(struct hdlc_buffer *p, int event, const char *fmt, ...)
+{
+    char msg[96];
+    va_list ap;
+    time_t now;
+
+    if (p->logCb == NULL) return; // Silent
+
+    now = time(NULL);
+    if (now != p->logWindow)
+    { // New second
+        if (p->logSuppressed > 0)
+        {
+            snprintf(msg, sizeof(msg), "%d messages suppressed", p->logSuppressed);
+            p->logCb(p, HDLC_LOG_SUPPRESSED, msg, p->logArg);
+        }
+        p->logWindow = now;
+        p->logCount = 0;
+        p->logSuppressed = 0;
+    }
+    if (p->logRate > 0 && p->logCount >= p->logRate)
+    {
+        p->logSuppressed++;
+        return;
+    }
+    p->logCount++;
+
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+    p->logCb(p, event, msg, p->logArg);
+}
+
+/**
+ * @brief HDLC encode buffer used for output
+ *
+ * Encode an HDLC like framing, See RFC 1662 for any additional information.
+ *
+ * @param[in] *in  - input message buffer address
+ * @param[in] len  - size of incoming buffer
+ * @param[out] **out - address of message pointer set to valid HDLC encoded message buffer
+ *
+ * @return -1 Failed to create a buffer
+ *         x  size of data in out buffer
+ *
+ * @note None
+ * @warning None
+ */
+int hdlc_msg_encode(unsigned char *in, int len, unsigned char **out)
+{
+    return hdlc_msg_encode_num(hdlc_legacy(),in,len,out);
+}
+
+/**
+ * @brief HDLC encode buffer used for output
+ *
+ * Encode an HDLC like framing, See RFC 1662 for any additional information.
+ *
+ * @param[in] number - block number representing buffer
+ * @param[in] *in  - input message buffer address
+ * @param[in] len  - size of incoming buffer
  * @param[out] **out - address of message pointer set to valid HDLC encoded message buffer
  *
  * @return -1 Failed to create a buffer
@@ -507,49 +2188,540 @@ int hdlc_msg_encode(unsigned char *in, int len, unsigned char **out)
  */
 int hdlc_msg_encode_num(int number, unsigned char *in, int len, unsigned char **out)
 {
-    unsigned short fcs = PPPINITFCS16;
-    unsigned char c;
-    int i, txCnt = 0;
+    return hdlc_msg_encode_chan(hdlc_check_bounds(number), in, len, out);
+}
 
-    if (hdlc_check_bounds(number) < 0 || in == NULL)
-    {
-        *out = NULL;
+/**
+ * @brief HDLC encode buffer used for output on a channel
+ *
+ * Encode an HDLC like framing, See RFC 1662 for any additional information.
+ *
+ * @param[in] *chan  - channel
+ * @param[in] *in    - input message buffer address
+ * @param[in] len    - size of incoming buffer
+ * @param[out] **out - address of message pointer set to valid HDLC encoded message buffer
+ *
+ * @return -1 Failed to create a buffer
+ *          0 message too big for the channel
+ *          x size of data in out buffer
+ *
+ * @note The buffer stays with the channel until hdlc_msg_encode_release
+ * @warning The encoded message is valid until the next encode call on the
+ *          channel or hdlc_msg_encode_release
+ */
+int hdlc_msg_encode_chan(hdlc_chan_t *chan, const unsigned char *in, int len, unsigned char **out)
+{
+    int txCnt;
+
+    *out = NULL;
+    if (chan == NULL || in == NULL || len < 0)
+        return -1;
+
+    if (hdlc_borrow(&chan->bufferEncoded, &chan->encodedCap, chan->size*2 + 2 + chan->fcsLen*2, 0) != 0)
         return -1;
+    // Buffer to big even considering worst case checksum
+    txCnt = hdlc_encode(chan, chan->bufferEncoded, chan->size*2 + 2 + chan->fcsLen*2, in, len);
+    if (txCnt < 0) return 0;
+    hdlc_count_out(chan, txCnt, len + 2 + chan->fcsLen);
+    *out = chan->bufferEncoded;
+    return txCnt;
+}
+
+/**
+ * @brief HDLC release the encoded message
+ *
+ * Give the buffer of hdlc_msg_encode_chan and hdlc_msg_encode_iov back to the
+ * shared pool once the caller is done with the message.  The encoders writing
+ * to caller memory leave it alone, so it is not given back on its own.
+ *
+ * @param[in] *chan - channel
+ *
+ * @return 0 pass
+ *        -1 failure
+ *
+ * @note The next hdlc_msg_encode_chan or hdlc_msg_encode_iov borrows it again
+ * @warning None
+ */
+int hdlc_msg_encode_release(hdlc_chan_t *chan)
+{
+    if (chan == NULL) return -1;
+    hdlc_mem_put(chan->bufferEncoded, chan->encodedCap);
+    chan->bufferEncoded = NULL;
+    chan->encodedCap = 0;
+    return 0;
+}
+
+/**
+ * @brief HDLC encode a message into the caller's buffer
+ *
+ * Same framing as hdlc_msg_encode_chan, written to memory owned by the
+ * caller (TX slab, DMA or UART ring) so that many frames of a channel can be
+ * in flight at once.  A buffer of hdlc_encoded_bound(len, width) bytes always fits.
+ *
+ * @param[in] *chan - channel
+ * @param[in] *in   - input message buffer address
+ * @param[in] len   - size of incoming buffer (at most the channel size)
+ * @param[out] *out - encoded message
+ * @param[in] cap   - size of out
+ *
+ * @return HDLC_ERR_PARAM   invalid argument
+ *         HDLC_ERR_MAX_LEN message bigger than the channel size
+ *         HDLC_ERR_NO_ROOM encoded message does not fit in out
+ *         x                size of data in out
+ *
+ * @note Only the channel size is used, the channel may encode concurrently
+ *       into its own buffer from the same thread
+ * @warning None
+ */
+int hdlc_msg_encode_buf(hdlc_chan_t *chan, const unsigned char *in, int len, unsigned char *out, int cap)
+{
+    int txCnt;
+
+    if (chan == NULL || (in == NULL && len > 0) || len < 0 || out == NULL || cap < 0)
+        return HDLC_ERR_PARAM;
+    if (len > chan->size) return HDLC_ERR_MAX_LEN;
+
+    txCnt = hdlc_encode(chan, out, cap, in, len);
+    if (txCnt < 0) return HDLC_ERR_NO_ROOM;
+    hdlc_count_out(chan, txCnt, len + 2 + chan->fcsLen);
+    return txCnt;
+}
+
+/**
+ * @brief HDLC encode several messages back to back
+ *
+ * Pack the messages into one contiguous buffer, the flag closing one message
+ * opens the next one (RFC 1662).  The sum of hdlc_encoded_bound for each
+ * message, less one byte per message after the first, always fits.
+ *
+ * @param[in] *chan - channel
+ * @param[in] *in   - messages
+ * @param[in] n     - number of messages
+ * @param[out] *out - encoded messages
+ * @param[in] cap   - size of out
+ *
+ * @return HDLC_ERR_PARAM   invalid argument
+ *         HDLC_ERR_MAX_LEN a message is bigger than the channel size
+ *         HDLC_ERR_NO_ROOM encoded messages do not fit in out
+ *         x                size of data in out
+ *
+ * @note None
+ * @warning None
+ */
+int hdlc_msg_encode_batch(hdlc_chan_t *chan, const struct iovec *in, int n, unsigned char *out, int cap)
+{
+    int k, w, txCnt = 0, raw = 1;
+
+    if (chan == NULL || (in == NULL && n > 0) || n < 0 || out == NULL || cap < 0)
+        return HDLC_ERR_PARAM;
+    if (n == 0) return 0;
+
+    for (k = 0; k < n; k++)
+    {
+        if (in[k].iov_base == NULL && in[k].iov_len > 0) return HDLC_ERR_PARAM;
+        if (in[k].iov_len > (size_t)chan->size) return HDLC_ERR_MAX_LEN;
+
+        // Start on the closing flag of the previous message
+        w = hdlc_encode(chan, out + txCnt, cap - txCnt, in[k].iov_base, in[k].iov_len);
+        if (w < 0) return HDLC_ERR_NO_ROOM;
+        txCnt += w - 1;
+        raw += in[k].iov_len + chan->fcsLen + 1; // Message, FCS and flag
+    }
+    hdlc_count_out(chan, txCnt + 1, raw);
+    return txCnt + 1;
+}
+
+/**
+ * @brief HDLC worst case encoded size
+ *
+ * Opening flag, every byte escaped, escaped FCS and closing flag, the same
+ * as hdlc::Codec::encoded_bound
+ *
+ * @param[in] len - size of the message
+ * @param[in] fcs - HDLC_FCS16 or HDLC_FCS32, see hdlc_fcs_chan
+ *
+ * @return HDLC_ERR_PARAM invalid width or len out of range
+ *         x              bytes needed to encode any message of len bytes
+ *
+ * @note None
+ * @warning None
+ */
+int hdlc_encoded_bound(int len, int fcs)
+{
+    if ((fcs != HDLC_FCS16 && fcs != HDLC_FCS32) || len < 0 || len > (INT_MAX - 10) / 2)
+        return HDLC_ERR_PARAM;
+    return 2*len + 2 + 2*(fcs / 8);
+}
+
+/**
+ * @brief HDLC frame a message, FCS width known at compile time
+ *
+ * Inlined once per width so the chunk loop holds no width test.
+ *
+ * @param[out] *out - encoded message
+ * @param[in] cap   - size of out
+ * @param[in] *in   - message
+ * @param[in] len   - size of message
+ * @param[in] *map  - characters to escape, NULL for FLAG SEQUENCE and CONTROL ESCAPE only
+ * @param[in] fcsLen - FCS size in bytes (constant 2 or 4)
+ *
+ * @return size of the encoded message
+ *        -1 out too small
+ */
+static inline __attribute__((always_inline))
+int hdlc_encode_fcs(unsigned char *out, int cap, const unsigned char *in, int len,
+                    const struct hdlc_accm *map, const int fcsLen)
+{
+    unsigned int fcs = (fcsLen == 4) ? PPPINITFCS32 : PPPINITFCS16;
+    unsigned char c[4];
+    int i, n, w, txCnt = 0;
+
+    if (cap < 2 + fcsLen*2) return -1; // Not even an empty frame
+    out[txCnt++] = FLAG_SEQUENCE;
+    for (i = 0; i < len; i += n)
+    {
+        n = (len - i < FUSE_CHUNK) ? len - i : FUSE_CHUNK;
+        if (fcsLen == 4)
+            fcs = hdlc_fcs32(fcs, in + i, n);
+        else
+            fcs = hdlc_fcs16(fcs, in + i, n);
+        if (map != NULL) // Keep room for FCS and flag
+            w = hdlc_escape_map(out + txCnt, cap - 1 - fcsLen*2 - txCnt, in + i, n, len - i, map);
+        else
+            w = hdlc_escape(out + txCnt, cap - 1 - fcsLen*2 - txCnt, in + i, n, len - i);
+        if (w < 0) return -1;
+        txCnt += w;
+    }
+    fcs = ~fcs;
+    for (i = 0; i < fcsLen; i++) // Least significant byte first
+        c[i] = fcs >> (8*i);
+    if (map != NULL)
+        txCnt += hdlc_escape_map(out + txCnt, fcsLen*2, c, fcsLen, fcsLen, map);
+    else
+        txCnt += hdlc_escape(out + txCnt, fcsLen*2, c, fcsLen, fcsLen); // Encode any FLAG SEQUENCE or CONTROL SEQUENCE
+    out[txCnt++] = FLAG_SEQUENCE;
+
+#ifdef DEBUG
+    dump_buffer(out,txCnt,"OUT");
+#endif
+    return txCnt;
+}
+
+/**
+ * @brief HDLC frame a message
+ *
+ * Flag, FCS and escaping in one pass chunk by chunk while the data is in L1,
+ * escaped FCS and closing flag
+ *
+ * @param[in] *p    - comm channel (FCS width and transmit map)
+ * @param[out] *out - encoded message
+ * @param[in] cap   - size of out
+ * @param[in] *in   - message
+ * @param[in] len   - size of message
+ *
+ * @return size of the encoded message
+ *        -1 out too small
+ */
+static int hdlc_encode(struct hdlc_buffer *p, unsigned char *out, int cap, const unsigned char *in, int len)
+{
+    const struct hdlc_accm *map = p->txMapped ? &p->txMap : NULL;
+
+    if (p->fcsLen == 4)
+        return hdlc_encode_fcs(out, cap, in, len, map, 4);
+    return hdlc_encode_fcs(out, cap, in, len, map, 2);
+}
+
+/**
+ * @brief HDLC count encoded output
+ *
+ * @param[in] *p   - comm channel
+ * @param[in] txCnt - encoded bytes produced
+ * @param[in] raw  - bytes before escaping (messages, FCS and flags)
+ */
+static void hdlc_count_out(struct hdlc_buffer *p, int txCnt, int raw)
+{
+    STAT_ADD(p, bytesOut, txCnt);
+    if (txCnt != raw) STAT_ADD(p, escapesOut, txCnt - raw);
+}
+
+/**
+ * @brief HDLC encode a message gathered from several buffers
+ *
+ * Run the FCS and the escaping across all the input segments and describe
+ * the encoded message as a list ready for writev().  Runs of input that need
+ * no escaping are referenced where they are, the flags, escape pairs, FCS
+ * and short runs are written to the channel's encode buffer.  When the list
+ * runs short the rest of the message is copied.
+ *
+ * @param[in] *chan  - channel
+ * @param[in] *in    - segments of the message
+ * @param[in] n      - number of segments
+ * @param[out] *out  - encoded message, pointing into the input and the channel
+ * @param[in] outmax - number of entries available in out (at least 1)
+ *
+ * @return HDLC_ERR_PARAM   invalid argument
+ *         HDLC_ERR_NO_MEM  no memory for the encode buffer
+ *         HDLC_ERR_MAX_LEN message bigger than the channel size
+ *         x                number of entries used in out
+ *
+ * @note None
+ * @warning The encoded message is valid until the next encode call on the
+ *          channel or hdlc_msg_encode_release, and as long as the input is
+ *          unchanged
+ */
+int hdlc_msg_encode_iov(hdlc_chan_t *chan, const struct iovec *in, int n, struct iovec *out, int outmax)
+{
+    unsigned int fcs;
+    const unsigned char *seg;
+    unsigned char *scratch, c[4];
+    size_t total = 0;
+    int s, i, r, len, cnt = 0, mark = 0, txCnt = 0;
+
+    if (chan == NULL || (in == NULL && n > 0) || n < 0 || out == NULL || outmax <= 0)
+        return HDLC_ERR_PARAM;
+    for (s = 0; s < n; s++)
+    { // The encode buffer then holds the worst case
+        if (in[s].iov_base == NULL && in[s].iov_len > 0) return HDLC_ERR_PARAM;
+        total += in[s].iov_len;
+        if (total > (size_t)chan->size) return HDLC_ERR_MAX_LEN;
     }
 
-    ptr = hdlc[number]; // Make it easy to reference
-    ptr->bufferEncoded[txCnt++] = FLAG_SEQUENCE;
-    for (i = 0; i < len; i++)
-    { // Iterate through full length of buffer and encode any FLAG SEQUENCE or CONTROL ESCAPE
-        c = *(in+i);
-        fcs = (fcs >> 8) ^ fcstab[(fcs ^ c) & 0xff];
-        if (c == FLAG_SEQUENCE || c == CONTROL_ESCAPE)
+    if (hdlc_borrow(&chan->bufferEncoded, &chan->encodedCap, chan->size*2 + 2 + chan->fcsLen*2, 0) != 0)
+        return HDLC_ERR_NO_MEM;
+
+    fcs = (chan->fcsLen == 4) ? PPPINITFCS32 : PPPINITFCS16;
+    scratch = chan->bufferEncoded;
+    scratch[txCnt++] = FLAG_SEQUENCE;
+    for (s = 0; s < n; s++)
+    {
+        seg = in[s].iov_base;
+        len = in[s].iov_len;
+
+        if (chan->fcsLen == 4) // Once per segment
+            fcs = hdlc_fcs32(fcs, seg, len);
+        else
+            fcs = hdlc_fcs16(fcs, seg, len);
+        for (i = 0; i < len; )
         {
-            ptr->bufferEncoded[txCnt++] = CONTROL_ESCAPE;
-            c ^= 0x20;
+            r = chan->txMapped ? hdlc_scan_map(seg + i, len - i, &chan->txMap) : hdlc_scan(seg + i, len - i);
+            if (r >= IOV_COPY_MIN && cnt + (txCnt > mark) + 2 <= outmax)
+            { // Long run, point at the input (still room for the encode buffer after it)
+                if (txCnt > mark)
+                {
+                    out[cnt].iov_base = scratch + mark;
+                    out[cnt++].iov_len = txCnt - mark;
+                    mark = txCnt;
+                }
+                out[cnt].iov_base = (void *)(seg + i);
+                out[cnt++].iov_len = r;
+            }
+            else
+            {
+                memcpy(scratch + txCnt, seg + i, r);
+                txCnt += r;
+            }
+            i += r;
+            if (i < len)
+            { // FLAG SEQUENCE, CONTROL ESCAPE or mapped character
+                scratch[txCnt++] = CONTROL_ESCAPE;
+                scratch[txCnt++] = seg[i++] ^ 0x20;
+            }
         }
-        ptr->bufferEncoded[txCnt++] = c;
-        // Buffer to big even considering worst case checksum
-        if (txCnt > ptr->size*2 + 1) { *out = NULL; return 0; }
-    }
-    fcs ^= 0xffff;
-    for (len = 0, c = fcs & 0xff; len < 2; len++, c = fcs >> 8)
-    { // Go through the fcs and encode any FLAG SEQUENCE or CONTROL SEQUENCE
-        if (c == FLAG_SEQUENCE || c == CONTROL_ESCAPE)
-        {
-            ptr->bufferEncoded[txCnt++] = CONTROL_ESCAPE;
-            ptr->bufferEncoded[txCnt++] = c ^ 0x20;
+    }
+    fcs = ~fcs;
+    for (i = 0; i < chan->fcsLen; i++) // Least significant byte first
+        c[i] = fcs >> (8*i);
+    if (chan->txMapped)
+        txCnt += hdlc_escape_map(scratch + txCnt, chan->fcsLen*2, c, chan->fcsLen, chan->fcsLen, &chan->txMap);
+    else
+        txCnt += hdlc_escape(scratch + txCnt, chan->fcsLen*2, c, chan->fcsLen, chan->fcsLen); // Encode any FLAG SEQUENCE or CONTROL SEQUENCE
+    scratch[txCnt++] = FLAG_SEQUENCE;
+    out[cnt].iov_base = scratch + mark;
+    out[cnt++].iov_len = txCnt - mark;
+
+    for (s = 0, len = 0; s < cnt; s++)
+        len += out[s].iov_len;
+    hdlc_count_out(chan, len, total + 2 + chan->fcsLen);
+    return cnt;
+}
+
+/**
+ * @brief HDLC start streaming a message
+ *
+ * Encode a message of any size through a window of any size (DMA buffer,
+ * UART FIFO) without holding the whole message or its encoding: begin,
+ * hdlc_msg_encode_feed the message in pieces as it is read, then
+ * hdlc_msg_encode_finish.  The framing is the same as hdlc_msg_encode_buf,
+ * the opening flag goes out with the first feed.
+ *
+ * @param[in] *chan - channel
+ *
+ * @return HDLC_ERR_PARAM invalid argument
+ *         0              pass
+ *
+ * @note The channel size does not apply, one message streams at a time on a
+ *       channel and the other encoders may be used in between
+ * @warning A message not finished yet is dropped, the receiver sees it run
+ *          into the next one and fail the FCS
+ */
+int hdlc_msg_encode_begin(hdlc_chan_t *chan)
+{
+    if (chan == NULL) return HDLC_ERR_PARAM;
+
+    chan->streamState = STREAM_DATA;
+    chan->streamFcs = (chan->fcsLen == 4) ? PPPINITFCS32 : PPPINITFCS16;
+    chan->streamTail[0] = FLAG_SEQUENCE;
+    chan->streamTailLen = 1;
+    chan->streamTailPos = 0;
+    chan->streamOut = 0;
+    chan->streamRaw = 1;
+    return 0;
+}
+
+/**
+ * @brief HDLC stream the next piece of a message
+ *
+ * Run the FCS and the escaping over as much of the input as fits in the
+ * window, the rest is left for the next call.  An escape pair may be split
+ * across windows.
+ *
+ * @param[in] *chan  - channel, after hdlc_msg_encode_begin
+ * @param[in] *in    - next piece of the message
+ * @param[in] len    - size of the piece
+ * @param[out] *out  - window for the encoded data
+ * @param[in] cap    - size of out
+ * @param[out] *used - bytes of in consumed, feed the rest again
+ *
+ * @return HDLC_ERR_PARAM invalid argument or no message started
+ *         x              size of data in out
+ *
+ * @note None
+ * @warning None
+ */
+int hdlc_msg_encode_feed(hdlc_chan_t *chan, const unsigned char *in, int len, unsigned char *out, int cap, int *used)
+{
+    const struct hdlc_accm *map;
+    int i = 0, n, r, txCnt;
+
+    if (chan == NULL || (in == NULL && len > 0) || len < 0 || out == NULL || cap < 0 || used == NULL)
+        return HDLC_ERR_PARAM;
+    if (chan->streamState != STREAM_DATA) return HDLC_ERR_PARAM;
+    map = chan->txMapped ? &chan->txMap : NULL;
+
+    txCnt = hdlc_stream_flush(chan, out, cap);
+    while (i < len && txCnt < cap && chan->streamTailPos == chan->streamTailLen)
+    {
+        n = (len - i < FUSE_CHUNK) ? len - i : FUSE_CHUNK;
+        if (cap - txCnt >= n*2)
+        { // Worst case fits, fused kernel
+            if (map != NULL)
+                txCnt += hdlc_escape_map(out + txCnt, cap - txCnt, in + i, n, len - i, map);
+            else
+                txCnt += hdlc_escape(out + txCnt, cap - txCnt, in + i, n, len - i);
+            i += n;
+            continue;
+        }
+
+        // Fill the rest of the window run by run
+        if (n > cap - txCnt) n = cap - txCnt;
+        r = map ? hdlc_scan_map(in + i, n, map) : hdlc_scan(in + i, n);
+        memcpy(out + txCnt, in + i, r);
+        txCnt += r;
+        i += r;
+        if (r < n)
+        { // FLAG SEQUENCE, CONTROL ESCAPE or mapped character
+            out[txCnt++] = CONTROL_ESCAPE;
+            if (txCnt < cap)
+                out[txCnt++] = in[i] ^ 0x20;
+            else
+            { // Second half waits for the next window
+                chan->streamTail[0] = in[i] ^ 0x20;
+                chan->streamTailLen = 1;
+                chan->streamTailPos = 0;
+            }
+            i++;
         }
+    }
+    if (chan->fcsLen == 4)
+        chan->streamFcs = hdlc_fcs32(chan->streamFcs, in, i);
+    else
+        chan->streamFcs = hdlc_fcs16(chan->streamFcs, in, i);
+    chan->streamOut += txCnt;
+    chan->streamRaw += i;
+    *used = i;
+    return txCnt;
+}
+
+/**
+ * @brief HDLC end a streamed message
+ *
+ * Write the escaped FCS and the closing flag, with whatever the last feed
+ * left pending.  Call again until it returns 0 when the window is small.
+ *
+ * @param[in] *chan - channel, after hdlc_msg_encode_begin
+ * @param[out] *out - window for the encoded data
+ * @param[in] cap   - size of out (at least 1)
+ *
+ * @return HDLC_ERR_PARAM invalid argument
+ *         0              message complete, nothing left to write
+ *         x              size of data in out
+ *
+ * @note None
+ * @warning None
+ */
+int hdlc_msg_encode_finish(hdlc_chan_t *chan, unsigned char *out, int cap)
+{
+    unsigned int fcs;
+    unsigned char c[4];
+    int i, left, txCnt;
+
+    if (chan == NULL || out == NULL || cap <= 0) return HDLC_ERR_PARAM;
+    if (chan->streamState == STREAM_IDLE) return 0;
+
+    if (chan->streamState == STREAM_DATA)
+    { // Queue the FCS and flag behind anything still pending
+        left = chan->streamTailLen - chan->streamTailPos;
+        memmove(chan->streamTail, chan->streamTail + chan->streamTailPos, left);
+        fcs = ~chan->streamFcs;
+        for (i = 0; i < chan->fcsLen; i++) // Least significant byte first
+            c[i] = fcs >> (8*i);
+        if (chan->txMapped)
+            left += hdlc_escape_map(chan->streamTail + left, chan->fcsLen*2, c, chan->fcsLen, chan->fcsLen, &chan->txMap);
         else
-            ptr->bufferEncoded[txCnt++] = c;
+            left += hdlc_escape(chan->streamTail + left, chan->fcsLen*2, c, chan->fcsLen, chan->fcsLen);
+        chan->streamTail[left++] = FLAG_SEQUENCE;
+        chan->streamTailLen = left;
+        chan->streamTailPos = 0;
+        chan->streamRaw += chan->fcsLen + 1;
+        chan->streamState = STREAM_CLOSING;
     }
-    ptr->bufferEncoded[txCnt++] = FLAG_SEQUENCE;
-    *out = ptr->bufferEncoded;
 
-#ifdef DEBUG
-    dump_buffer(*out,txCnt,"OUT");
-#endif
+    txCnt = hdlc_stream_flush(chan, out, cap);
+    chan->streamOut += txCnt;
+    if (chan->streamTailPos == chan->streamTailLen)
+    { // Whole message out
+        STAT_ADD(chan, bytesOut, chan->streamOut);
+        if (chan->streamOut != chan->streamRaw) STAT_ADD(chan, escapesOut, chan->streamOut - chan->streamRaw);
+        chan->streamState = STREAM_IDLE;
+    }
     return txCnt;
 }
 
+/**
+ * @brief HDLC write the pending bytes of a streamed message
+ *
+ * @param[in] *p    - comm channel
+ * @param[out] *out - window for the encoded data
+ * @param[in] cap   - size of out
+ *
+ * @return bytes written
+ */
+static int hdlc_stream_flush(struct hdlc_buffer *p, unsigned char *out, int cap)
+{
+    int n = p->streamTailLen - p->streamTailPos;
 
+    if (n > cap) n = cap;
+    memcpy(out, p->streamTail + p->streamTailPos, n);
+    p->streamTailPos += n;
+    return n;
+}
@@ -4,14 +4,143 @@
  *
  * This is the header file for parsing multiple hdlc frames from multiple
  * interfaces either using a byte by byte read, or block read
+ *
+ * Threading contract:
+ *  - The codec keeps no hidden per-call state; everything lives in the channel.
+ *  - Distinct channels may be used from different threads at the same time
+ *    without any locking.
+ *  - One channel must only be used by one thread at a time; the caller
+ *    serializes access to a shared channel.
+ *  - hdlc_init and hdlc_delete_num, and the handle lookups done by every
+ *    *_num call, are safe from any thread.  A channel must not be deleted
+ *    while another thread is still using it.
+ *  - hdlc_fcs_select and hdlc_simd_select should be called before other
+ *    threads start using the codec.
  */
 #ifndef HDLC_H
 #define HDLC_H
 
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define HDLC_MAX        1027
+#define HDLC_RING_DEFAULT 65536 // Default incoming ring buffer capacity
+
+#define HDLC_FCS16_INIT 0xffff // Initial frame check sequence (FCS) value
+#define HDLC_FCS16_GOOD 0xf0b8 // FCS over a message followed by its own FCS
+#define HDLC_FCS32_INIT 0xffffffff // Same for the 32 bit FCS
+#define HDLC_FCS32_GOOD 0xdebb20e3
+
+// Channel FCS widths (bits), fixed when the channel is created
+#define HDLC_FCS16      16      // 16 bit PPP FCS (default)
+#define HDLC_FCS32      32      // 32 bit FCS (RFC 1662 section C.3)
+
+#define HDLC_ACCM_ALL   0xffffffff // Escape every control character (RFC 1662 default before LCP)
+
+// Error codes returned by the encoders writing to caller memory
+#define HDLC_ERR_PARAM   -1     // Invalid argument
+#define HDLC_ERR_MAX_LEN -2     // Message bigger than the channel size
+#define HDLC_ERR_NO_ROOM -3     // Output buffer too small for the encoded message
+#define HDLC_ERR_IO      -4     // Descriptor write or file access failed (hdlc_reactor.h, hdlc_capture.h)
+#define HDLC_ERR_NO_MEM  -5     // Allocation failed (hdlc_sync_decode, hdlc_msg_encode_iov, hdlc_reactor.h, hdlc_capture.h)
+
+// Frame check sequence engines, HDLC_FCS_AUTO picks the fastest one supported
+enum hdlc_fcs_engine
+{
+    HDLC_FCS_AUTO,
+    HDLC_FCS_BYTE,      // One table lookup per byte (reference)
+    HDLC_FCS_SLICE8,    // Slice-by-8 tables
+    HDLC_FCS_SLICE16,   // Slice-by-16 tables
+    HDLC_FCS_CLMUL      // Carry-less multiply (PCLMULQDQ) folding
+};
+
+// Instruction sets for the octet stuffing kernels, HDLC_SIMD_AUTO picks the best one
+enum hdlc_simd_level
+{
+    HDLC_SIMD_AUTO,
+    HDLC_SIMD_SCALAR,   // One byte at a time
+    HDLC_SIMD_SSE2,     // 16 bytes per step
+    HDLC_SIMD_AVX2      // 32 bytes per step
+};
+
+// Comm channel context, created with hdlc_chan_init or reached from a handle with hdlc_chan_get
+typedef struct hdlc_buffer hdlc_chan_t;
+
+// Status of a decoded message
+enum hdlc_frame_status
+{
+    HDLC_FRAME_OK,      // Good FCS
+    HDLC_FRAME_BAD_FCS  // Complete message that failed the FCS
+};
+
+// Decoded message descriptor
+struct hdlc_frame
+{
+    unsigned char *ptr; // Message data (FCS removed)
+    int            len; // Size of message data
+    int            status; // enum hdlc_frame_status
+};
+
+// Flow state change notification, xoff = 1 at high-water and 0 at low-water
+typedef void (*hdlc_flow_cb)(int xoff, void *arg);
+
+// Channel counters, see hdlc_stats_chan
+struct hdlc_stats
+{
+    unsigned long long framesOk;     // Messages decoded with a good FCS
+    unsigned long long fcsErrors;    // Complete messages that failed the FCS
+    unsigned long long overruns;     // Messages bigger than the channel size (no end found)
+    unsigned long long aborts;       // Messages aborted by CONTROL ESCAPE + FLAG SEQUENCE
+    unsigned long long resyncs;      // Flag hunts that had to discard data
+    unsigned long long bytesIn;      // Raw bytes added (or decoded in place)
+    unsigned long long bytesOut;     // Encoded bytes produced
+    unsigned long long escapesIn;    // CONTROL ESCAPE (and ACCM discarded) bytes removed while decoding
+    unsigned long long escapesOut;   // CONTROL ESCAPE bytes inserted while encoding (bit stuffing in sync mode)
+    unsigned long long droppedInput; // Bytes refused by a full ring (left with the caller)
+    unsigned long long framesDropped; // Decoded messages lost for want of a buffer to hand them over in (hdlc_workers.h, hdlc_pool.h)
+};
+
+// Decoder events handed to the log callback
+enum hdlc_log_event
+{
+    HDLC_LOG_FCS,       // Message failed the FCS
+    HDLC_LOG_OVERRUN,   // No end within the channel size, resync
+    HDLC_LOG_SUPPRESSED // Messages dropped by the rate limit (reported once the window ends)
+};
+
+// Decoder event notification, msg is only valid during the call
+typedef void (*hdlc_log_cb)(hdlc_chan_t *chan, int event, const char *msg, void *arg);
+
+// Segment decoder events, see hdlc_msg_decode_segments
+enum hdlc_segment_event
+{
+    HDLC_SEGMENT_DATA,      // Next piece of the message being received
+    HDLC_SEGMENT_OK,        // Message complete with a good FCS, commit what was delivered
+    HDLC_SEGMENT_BAD_FCS,   // Message complete but failed the FCS, discard it
+    HDLC_SEGMENT_ABORT      // Message aborted by the sender, discard it (only after data was delivered)
+};
+
+// Segment delivery, seg is only valid during the call (NULL for the verdicts)
+typedef void (*hdlc_segment_cb)(hdlc_chan_t *chan, int event, const unsigned char *seg, int len, void *arg);
+
+// Bit synchronous message delivery, the frame is only valid during the call
+typedef void (*hdlc_frame_cb)(hdlc_chan_t *chan, const struct hdlc_frame *frame, void *arg);
+
+// Memory used by all channels
+struct hdlc_mem
+{
+    unsigned long long used;    // Channel contexts and the buffers they borrowed
+    unsigned long long cached;  // Idle buffers kept in the shared pool (see hdlc_mem_trim)
+    int                channels; // Channels alive
+};
 
 // Globally defined functions
 int hdlc_init(int size);
+int hdlc_init_ring(int size, int capacity);
+int hdlc_init_fcs(int size, int capacity, int fcs);
 
 // API calls that only interact with a single comm channel/buffer (number = 1)
 int hdlc_delete(void);
@@ -25,4 +154,66 @@ int hdlc_msg_add_num(int number, unsigned char *in, int size);
 int hdlc_msg_decode_num(int number, unsigned char **out);
 int hdlc_msg_encode_num(int number, unsigned char *in, int len, unsigned char **out);
 
+// Incoming buffer level and backpressure
+int hdlc_flow_num(int number, int high, int low, hdlc_flow_cb cb, void *arg);
+int hdlc_flow_state_num(int number);
+int hdlc_msg_pending_num(int number);
+int hdlc_msg_space_num(int number);
+int hdlc_accm_num(int number, unsigned int tx, unsigned int rx, const unsigned char *ext);
+int hdlc_stats_num(int number, struct hdlc_stats *snap, int reset);
+int hdlc_log_num(int number, hdlc_log_cb cb, void *arg, int rate);
+long long hdlc_mem_num(int number);
+
+// Reentrant API on channel contexts, the *_num calls above are wrappers of these
+hdlc_chan_t *hdlc_chan_init(int size, int capacity);
+hdlc_chan_t *hdlc_chan_init_fcs(int size, int capacity, int fcs);
+int hdlc_fcs_chan(hdlc_chan_t *chan);
+hdlc_chan_t *hdlc_chan_get(int number);
+int hdlc_chan_delete(hdlc_chan_t *chan);
+int hdlc_msg_add_chan(hdlc_chan_t *chan, const unsigned char *in, int size);
+int hdlc_msg_add_span(hdlc_chan_t *chan, unsigned char **span);
+int hdlc_msg_add_commit(hdlc_chan_t *chan, int size);
+int hdlc_msg_decode_chan(hdlc_chan_t *chan, unsigned char **out);
+int hdlc_msg_encode_chan(hdlc_chan_t *chan, const unsigned char *in, int len, unsigned char **out);
+int hdlc_msg_encode_release(hdlc_chan_t *chan);
+int hdlc_msg_encode_buf(hdlc_chan_t *chan, const unsigned char *in, int len, unsigned char *out, int cap);
+int hdlc_encoded_bound(int len, int fcs);
+int hdlc_msg_encode_batch(hdlc_chan_t *chan, const struct iovec *in, int n, unsigned char *out, int cap);
+int hdlc_msg_encode_iov(hdlc_chan_t *chan, const struct iovec *in, int n, struct iovec *out, int outmax);
+int hdlc_msg_encode_begin(hdlc_chan_t *chan);
+int hdlc_msg_encode_feed(hdlc_chan_t *chan, const unsigned char *in, int len, unsigned char *out, int cap, int *used);
+int hdlc_msg_encode_finish(hdlc_chan_t *chan, unsigned char *out, int cap);
+int hdlc_msg_decode_batch(hdlc_chan_t *chan, struct hdlc_frame frames[], int max);
+int hdlc_msg_release_batch(hdlc_chan_t *chan);
+int hdlc_msg_decode_view(hdlc_chan_t *chan, const unsigned char *in, int len,
+                         struct hdlc_frame frames[], int max, int *used);
+int hdlc_msg_decode_segments(hdlc_chan_t *chan, const unsigned char *in, int len, hdlc_segment_cb cb, void *arg);
+int hdlc_sync_encode_buf(hdlc_chan_t *chan, const unsigned char *in, int len, unsigned char *out, int cap);
+int hdlc_sync_encoded_bound(int len);
+int hdlc_sync_decode(hdlc_chan_t *chan, const unsigned char *in, int len, hdlc_frame_cb cb, void *arg);
+int hdlc_flow_chan(hdlc_chan_t *chan, int high, int low, hdlc_flow_cb cb, void *arg);
+int hdlc_flow_state_chan(hdlc_chan_t *chan);
+int hdlc_msg_pending_chan(hdlc_chan_t *chan);
+int hdlc_msg_space_chan(hdlc_chan_t *chan);
+int hdlc_accm_chan(hdlc_chan_t *chan, unsigned int tx, unsigned int rx, const unsigned char *ext);
+int hdlc_stats_chan(hdlc_chan_t *chan, struct hdlc_stats *snap, int reset);
+int hdlc_log_chan(hdlc_chan_t *chan, hdlc_log_cb cb, void *arg, int rate);
+long long hdlc_mem_chan(hdlc_chan_t *chan);
+
+// Memory accounting and the buffer pool shared by the channels
+int hdlc_mem_stats(struct hdlc_mem *mem);
+long long hdlc_mem_trim(void);
+
+// Frame check sequence engine shared by the codec and external tooling
+unsigned short hdlc_fcs16(unsigned short fcs, const unsigned char *buf, int len);
+unsigned int hdlc_fcs32(unsigned int fcs, const unsigned char *buf, int len);
+int hdlc_fcs_select(enum hdlc_fcs_engine engine);
+enum hdlc_fcs_engine hdlc_fcs_selected(void);
+int hdlc_simd_select(enum hdlc_simd_level level);
+enum hdlc_simd_level hdlc_simd_selected(void);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
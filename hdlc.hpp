@@ -0,0 +1,704 @@
+/*!
+ * @file
+ * @author Mark Koi
+ *
+ * This is the header only C++20 version of the hdlc codec.  The link
+ * configuration (FCS width, async control character map, largest frame) is
+ * fixed by template parameters, so every Codec is compiled for one link:
+ * the FCS tables and folding constants are generated at compile time, the
+ * escape tests become constants and the hot loops are inlined into the
+ * caller.  The framing is the same as hdlc.c byte for byte, frames encoded
+ * by one decode with the other.
+ *
+ *  - Codec<Fcs, Accm, MaxFrame>::encode is stateless, any thread.
+ *  - A Codec object holds the decode state of one link, one thread at a time.
+ *  - No allocation, no exceptions.
+ *
+ * Differences with the C channel: only the async control characters
+ * (0x00-0x1f) can be mapped, and a message longer than MaxFrame is an
+ * overrun (the C channel stores up to twice its size).
+ */
+#ifndef HDLC_HPP
+#define HDLC_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HDLC_HPP_X86 1          // SSE2 escape, PCLMULQDQ and AVX2 picked at runtime
+#include <immintrin.h>
+#endif
+
+namespace hdlc
+{
+
+inline constexpr std::uint8_t flag_sequence = 0x7e;  // Async HDLC flag
+inline constexpr std::uint8_t control_escape = 0x7d; // Control Sequence flag
+
+// Errors returned by encode, same values as HDLC_ERR_* in hdlc.h
+enum Error : int
+{
+    ErrParam  = -1,     // Invalid argument
+    ErrMaxLen = -2,     // Message bigger than MaxFrame
+    ErrNoRoom = -3      // Output buffer too small for the encoded message
+};
+
+// 16 bit PPP FCS
+struct Fcs16
+{
+    using value_type = std::uint16_t;
+    static constexpr int bytes = 2;
+    static constexpr std::uint32_t poly = 0x8408;     // x^16 + x^12 + x^5 + 1, bit reversed
+    static constexpr std::uint32_t init = 0xffff;
+    static constexpr std::uint32_t good = 0xf0b8;
+};
+
+// 32 bit FCS (RFC 1662 section C.3)
+struct Fcs32
+{
+    using value_type = std::uint32_t;
+    static constexpr int bytes = 4;
+    static constexpr std::uint32_t poly = 0xedb88320; // IEEE 802.3 CRC-32, bit reversed
+    static constexpr std::uint32_t init = 0xffffffff;
+    static constexpr std::uint32_t good = 0xdebb20e3;
+};
+
+// Async control character maps, bit c set: character c is escaped on
+// transmit (Tx) or dropped when received unescaped (Rx)
+template <std::uint32_t Tx = 0, std::uint32_t Rx = Tx>
+struct Accm
+{
+    static constexpr std::uint32_t tx = Tx;
+    static constexpr std::uint32_t rx = Rx;
+};
+
+using AccmNone = Accm<0>;           // Only FLAG and ESCAPE (negotiated ACCM of 0)
+using AccmAll = Accm<0xffffffff>;   // Every control character (RFC 1662 default)
+
+namespace detail
+{
+
+/**
+ * @brief Slice-by-16 FCS tables
+ *
+ * tab[k][b]: FCS of byte b followed by k zero bytes
+ *
+ * @return tables, built at compile time
+ */
+template <class T, std::uint32_t Poly>
+constexpr std::array<std::array<T, 256>, 16> slice_tables()
+{
+    std::array<std::array<T, 256>, 16> tab{};
+
+    for (int i = 0; i < 256; i++)
+    {
+        std::uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? (c >> 1) ^ Poly : c >> 1;
+        tab[0][i] = static_cast<T>(c);
+    }
+    for (int k = 1; k < 16; k++)
+        for (int i = 0; i < 256; i++)
+            tab[k][i] = static_cast<T>((tab[k-1][i] >> 8) ^ tab[0][tab[k-1][i] & 0xff]);
+    return tab;
+}
+
+/**
+ * @brief x^n modulo an FCS polynomial, as a folding constant
+ *
+ * @param[in] n     - power of x
+ * @param[in] rpoly - polynomial, bit reversed without the x^w term
+ * @param[in] w     - degree of the polynomial
+ *
+ * @return x^n mod P bit reflected (x^0 in bit 63)
+ */
+constexpr std::uint64_t xpow(int n, std::uint32_t rpoly, int w)
+{
+    std::uint64_t poly = 0, r = 1, k = 0;
+
+    for (int i = 0; i < w; i++)
+        if (rpoly & (1u << i))
+            poly |= 1ull << (w - 1 - i);
+    while (n--)
+    {
+        r <<= 1;
+        if (r & (1ull << w))
+            r ^= (1ull << w) | poly;
+    }
+    for (int i = 0; i < w; i++)
+        if (r & (1ull << i))
+            k |= 1ull << (63 - i);
+    return k;
+}
+
+/**
+ * @brief Byte classes of a control character map
+ *
+ * @return map[c] true for FLAG, ESCAPE and the control characters in mask
+ */
+constexpr std::array<bool, 256> special(std::uint32_t mask)
+{
+    std::array<bool, 256> map{};
+
+    for (int c = 0; c < 0x20; c++)
+        map[c] = (mask >> c) & 1;
+    map[flag_sequence] = map[control_escape] = true;
+    return map;
+}
+
+#ifdef HDLC_HPP_X86
+// CPU features, checked once at startup
+inline const bool have_clmul = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+inline const bool have_avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+} // namespace detail
+
+// Frame check sequence engine for one FCS width
+template <class F>
+struct FcsEngine
+{
+    using T = typename F::value_type;
+
+    static constexpr auto tab = detail::slice_tables<T, F::poly>();
+    alignas(16) static constexpr std::uint64_t k512[2] = {detail::xpow(512 + 63, F::poly, F::bytes * 8),
+                                                          detail::xpow(512 - 1, F::poly, F::bytes * 8)};
+    alignas(16) static constexpr std::uint64_t k128[2] = {detail::xpow(128 + 63, F::poly, F::bytes * 8),
+                                                          detail::xpow(128 - 1, F::poly, F::bytes * 8)};
+
+    /**
+     * @brief FCS one byte per table lookup
+     *
+     * @param[in] fcs  - current frame check sequence
+     * @param[in] *buf - data
+     * @param[in] len  - size of data
+     *
+     * @return updated frame check sequence
+     */
+    static T bytes(T fcs, const std::uint8_t *buf, std::size_t len) noexcept
+    {
+        while (len-- > 0)
+            fcs = static_cast<T>((fcs >> 8) ^ tab[0][(fcs ^ *buf++) & 0xff]);
+        return fcs;
+    }
+
+    /**
+     * @brief FCS sixteen bytes per step
+     *
+     * @param[in] fcs  - current frame check sequence
+     * @param[in] *buf - data
+     * @param[in] len  - size of data
+     *
+     * @return updated frame check sequence
+     */
+    static T slice16(T fcs, const std::uint8_t *buf, std::size_t len) noexcept
+    {
+        std::uint32_t c, x;
+
+        while (len >= 16)
+        {
+            c = fcs;
+            for (int i = 0; i < F::bytes; i++) // The running FCS covers the first bytes
+                c ^= static_cast<std::uint32_t>(buf[i]) << (8 * i);
+            x = 0;
+            for (int i = 0; i < F::bytes; i++)
+                x ^= tab[15 - i][(c >> (8 * i)) & 0xff];
+            for (int i = F::bytes; i < 16; i++)
+                x ^= tab[15 - i][buf[i]];
+            fcs = static_cast<T>(x);
+            buf += 16;
+            len -= 16;
+        }
+        return bytes(fcs, buf, len);
+    }
+
+#ifdef HDLC_HPP_X86
+    /**
+     * @brief Fold a 128 bit remainder ahead
+     *
+     * @param[in] x - remainder
+     * @param[in] k - folding constants for the distance
+     *
+     * @return folded remainder
+     */
+    __attribute__((target("pclmul,sse4.1")))
+    static __m128i fold(__m128i x, __m128i k) noexcept
+    {
+        return _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), _mm_clmulepi64_si128(x, k, 0x11));
+    }
+
+    /**
+     * @brief FCS by carry-less multiply folding, same scheme as hdlc_fcs.c
+     *
+     * @param[in] fcs  - current frame check sequence
+     * @param[in] *buf - data, at least 64 bytes
+     * @param[in] len  - size of data
+     *
+     * @return updated frame check sequence
+     */
+    __attribute__((target("pclmul,sse4.1")))
+    static T clmul(T fcs, const std::uint8_t *buf, std::size_t len) noexcept
+    {
+        alignas(16) std::uint8_t rem[16];
+        std::size_t n = len & ~static_cast<std::size_t>(15);
+        const std::uint8_t *p = buf + 64, *end = buf + n;
+        __m128i x0, x1, x2, x3, k;
+
+        x0 = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(buf)), _mm_cvtsi32_si128(fcs));
+        x1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 16));
+        x2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 32));
+        x3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(buf + 48));
+
+        k = _mm_load_si128(reinterpret_cast<const __m128i *>(k512));
+        for (; end - p >= 64; p += 64)
+        { // Four lanes, each folded 512 bits ahead
+            x0 = _mm_xor_si128(fold(x0, k), _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+            x1 = _mm_xor_si128(fold(x1, k), _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16)));
+            x2 = _mm_xor_si128(fold(x2, k), _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 32)));
+            x3 = _mm_xor_si128(fold(x3, k), _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 48)));
+        }
+
+        k = _mm_load_si128(reinterpret_cast<const __m128i *>(k128));
+        x0 = _mm_xor_si128(fold(x0, k), x1);
+        x0 = _mm_xor_si128(fold(x0, k), x2);
+        x0 = _mm_xor_si128(fold(x0, k), x3);
+        for (; p < end; p += 16)
+            x0 = _mm_xor_si128(fold(x0, k), _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+
+        _mm_store_si128(reinterpret_cast<__m128i *>(rem), x0);
+        return bytes(slice16(0, rem, 16), end, len & 15);
+    }
+#endif
+
+    /**
+     * @brief FCS with the fastest engine for the size and CPU
+     *
+     * @param[in] fcs  - current frame check sequence
+     * @param[in] *buf - data
+     * @param[in] len  - size of data
+     *
+     * @return updated frame check sequence
+     */
+    static T update(T fcs, const std::uint8_t *buf, std::size_t len) noexcept
+    {
+#ifdef HDLC_HPP_X86
+        if (len >= 64 && detail::have_clmul)
+            return clmul(fcs, buf, len);
+#endif
+        return slice16(fcs, buf, len);
+    }
+};
+
+// Codec for one link configuration
+template <class Fcs = Fcs16, class Map = AccmNone, std::size_t MaxFrame = 1500>
+class Codec
+{
+    static_assert(MaxFrame > 0 && MaxFrame <= 0x7fffffff - 16, "MaxFrame out of range");
+
+    using Engine = FcsEngine<Fcs>;
+    using T = typename Fcs::value_type;
+
+    static constexpr auto txSpecial = detail::special(Map::tx);  // Escaped on transmit
+    static constexpr auto rxSpecial = detail::special(Map::rx);  // Stops the receive copy
+
+    enum class State : std::uint8_t
+    {
+        Hunt,       // Looking for a flag
+        Frame,      // Copying a message
+        Escaped     // Got CONTROL ESCAPE
+    };
+
+public:
+    // Worst case encoded size of a MaxFrame message
+    static constexpr std::size_t max_encoded = 2 + 2 * (MaxFrame + Fcs::bytes);
+
+    /**
+     * @brief Worst case encoded size
+     *
+     * @param[in] len - message size
+     *
+     * @return bytes an encoded message of len bytes takes at most
+     */
+    static constexpr std::size_t encoded_bound(std::size_t len) noexcept
+    {
+        return 2 + 2 * (len + Fcs::bytes);
+    }
+
+    /**
+     * @brief Encode a message
+     *
+     * Same framing as hdlc_msg_encode_buf on a channel with the same FCS
+     * width and transmit ACCM
+     *
+     * @param[in] in   - message
+     * @param[out] out - encoded message, encoded_bound(in.size()) always fits
+     *
+     * @return ErrMaxLen message bigger than MaxFrame
+     *         ErrNoRoom out too small
+     *         x         size of the encoded message
+     */
+    static std::ptrdiff_t encode(std::span<const std::uint8_t> in, std::span<std::uint8_t> out) noexcept
+    {
+        const std::uint8_t *src = in.data();
+        std::uint8_t *o = out.data(), *end = out.data() + out.size();
+        std::uint8_t fcs[Fcs::bytes], c;
+        std::size_t len = in.size(), i = 0;
+        T sum;
+
+        if (len > MaxFrame) return ErrMaxLen;
+        if (out.size() < 2) return ErrNoRoom;
+
+        sum = static_cast<T>(~Engine::update(static_cast<T>(Fcs::init), src, len));
+        for (int k = 0; k < Fcs::bytes; k++) // Least significant byte first
+            fcs[k] = static_cast<std::uint8_t>(sum >> (8 * k));
+
+        *o++ = flag_sequence;
+#ifdef HDLC_HPP_X86
+        if (detail::have_avx2)
+            escape_avx2(src, len, i, o, end);
+        else
+            escape_sse2(src, len, i, o, end);
+#endif
+        if (static_cast<std::size_t>(end - o) >= 2 * (len - i))
+        { // Room for the worst case, no branch on the bytes
+            for (; i < len; i++)
+            {
+                c = src[i];
+                o[0] = txSpecial[c] ? control_escape : c;
+                o[1] = c ^ 0x20;
+                o += 1 + txSpecial[c];
+            }
+        }
+        for (; i < len; i++)
+        {
+            if (end - o < (txSpecial[src[i]] ? 2 : 1)) return ErrNoRoom;
+            if (txSpecial[src[i]])
+            {
+                *o++ = control_escape;
+                *o++ = src[i] ^ 0x20;
+            }
+            else
+                *o++ = src[i];
+        }
+        for (int k = 0; k < Fcs::bytes; k++)
+        {
+            if (end - o < (txSpecial[fcs[k]] ? 2 : 1)) return ErrNoRoom;
+            if (txSpecial[fcs[k]])
+            {
+                *o++ = control_escape;
+                *o++ = fcs[k] ^ 0x20;
+            }
+            else
+                *o++ = fcs[k];
+        }
+        if (o == end) return ErrNoRoom;
+        *o++ = flag_sequence;
+        return o - out.data();
+    }
+
+    /**
+     * @brief Decode received data
+     *
+     * Run the receive state machine over a block of data, messages may span
+     * calls.  Every complete message is handed to onFrame(msg, ok), msg
+     * without its FCS and only valid during the call, ok false when it
+     * failed the FCS.
+     *
+     * @param[in] in       - received data, all of it is consumed
+     * @param[in] onFrame  - called for every complete message
+     *
+     * @return number of messages handed to onFrame
+     */
+    template <class OnFrame>
+    std::size_t decode(std::span<const std::uint8_t> in, OnFrame &&onFrame)
+    {
+        const std::uint8_t *src = in.data(), *q;
+        std::size_t len = in.size(), i = 0, frames = 0;
+        std::uint8_t c;
+
+        while (i < len)
+        {
+            switch (state)
+            {
+                case State::Hunt:
+                    if ((q = static_cast<const std::uint8_t *>(std::memchr(src + i, flag_sequence, len - i))) == nullptr)
+                        return frames;
+                    i = q - src + 1;
+                    used = 0;
+                    state = State::Frame;
+                    break;
+                case State::Frame:
+#ifdef HDLC_HPP_X86
+                    if (detail::have_avx2)
+                        unescape_avx2(src, len, i);
+                    else
+                        unescape_sse2(src, len, i);
+#endif
+                    while (i < len && !rxSpecial[src[i]] && used < buf.size())
+                        buf[used++] = src[i++];
+                    if (i == len) break;
+
+                    c = src[i++];
+                    if (c == control_escape)
+                        state = State::Escaped;
+                    else if (c == flag_sequence)
+                    { // Closing flag, it also opens the next message
+                        if (used > Fcs::bytes)
+                        {
+                            onFrame(std::span<const std::uint8_t>(buf.data(), used - Fcs::bytes),
+                                    Engine::update(static_cast<T>(Fcs::init), buf.data(), used) == Fcs::good);
+                            frames++;
+                        }
+                        used = 0;
+                    }
+                    else if (!rxSpecial[c])
+                    { // No end within MaxFrame
+                        state = State::Hunt;
+                        overruns++;
+                    }
+                    break; // Anything else is a mapped character, dropped
+                case State::Escaped:
+                    c = src[i++];
+                    if (c < 0x20 && rxSpecial[c])
+                        break; // Dropped, the escape applies to the next character
+                    if (c == flag_sequence)
+                    { // Aborted message, the flag opens the next one
+                        used = 0;
+                        aborts++;
+                        state = State::Frame;
+                    }
+                    else if (used == buf.size())
+                    {
+                        state = State::Hunt;
+                        overruns++;
+                    }
+                    else
+                    {
+                        buf[used++] = c ^ 0x20;
+                        state = State::Frame;
+                    }
+                    break;
+            }
+        }
+        return frames;
+    }
+
+    /**
+     * @brief Drop a partly received message and hunt for the next flag
+     */
+    void reset() noexcept
+    {
+        state = State::Hunt;
+        used = 0;
+    }
+
+    std::uint64_t overruns = 0; // Messages dropped for running past MaxFrame
+    std::uint64_t aborts = 0;   // Messages aborted by the sender
+
+private:
+#ifdef HDLC_HPP_X86
+    /**
+     * @brief Drop the candidates that are not in the map
+     *
+     * The vector compare flags every control character, only a partial map
+     * needs the table.
+     *
+     * @param[in] m   - candidate bits
+     * @param[in] map - byte classes
+     * @param[in] *p  - data the bits are for
+     *
+     * @return bits of the special bytes
+     */
+    template <std::uint32_t Mask>
+    static unsigned int mapped(unsigned int m, const std::array<bool, 256> &map, const std::uint8_t *p) noexcept
+    {
+        if constexpr (Mask != 0 && Mask != 0xffffffff)
+            for (unsigned int b = m; b != 0; b &= b - 1)
+                if (!map[p[__builtin_ctz(b)]])
+                    m &= ~(1u << __builtin_ctz(b));
+        return m;
+    }
+
+    /**
+     * @brief Escape 16 bytes per step (SSE2)
+     *
+     * The block is stored whole, then every special byte is written as its
+     * escape pair and the rest of the block stored again behind it.
+     *
+     * @param[in] *src   - message
+     * @param[in] len    - size of message
+     * @param[in,out] i  - bytes of src done
+     * @param[in,out] *o - end of the encoded data
+     * @param[in] *end   - end of the output buffer
+     */
+    static void escape_sse2(const std::uint8_t *src, std::size_t len, std::size_t &i, std::uint8_t *&o,
+                            const std::uint8_t *end) noexcept
+    {
+        const __m128i f = _mm_set1_epi8(flag_sequence), e = _mm_set1_epi8(control_escape);
+        const __m128i top = _mm_set1_epi8(0x1f);
+        __m128i v, m;
+        unsigned int bits, t, d;
+
+        // A step reads 32 bytes and writes up to 48
+        while (i + 32 <= len && end - o >= 48)
+        {
+            v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+            m = _mm_or_si128(_mm_cmpeq_epi8(v, f), _mm_cmpeq_epi8(v, e));
+            if constexpr (Map::tx != 0) // Control characters
+                m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(v, top), v));
+            bits = mapped<Map::tx>(_mm_movemask_epi8(m), txSpecial, src + i);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(o), v);
+            for (d = 0; bits != 0; bits &= bits - 1, d++)
+            {
+                t = __builtin_ctz(bits);
+                o[t + d] = control_escape;
+                o[t + d + 1] = src[i + t] ^ 0x20;
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(o + t + d + 2),
+                                 _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + t + 1)));
+            }
+            i += 16;
+            o += 16 + d;
+        }
+    }
+
+    /**
+     * @brief Escape 32 bytes per step (AVX2)
+     *
+     * Same as escape_sse2 with 32 byte blocks
+     *
+     * @param[in] *src   - message
+     * @param[in] len    - size of message
+     * @param[in,out] i  - bytes of src done
+     * @param[in,out] *o - end of the encoded data
+     * @param[in] *end   - end of the output buffer
+     */
+    __attribute__((target("avx2")))
+    static void escape_avx2(const std::uint8_t *src, std::size_t len, std::size_t &i, std::uint8_t *&o,
+                            const std::uint8_t *end) noexcept
+    {
+        const __m256i f = _mm256_set1_epi8(flag_sequence), e = _mm256_set1_epi8(control_escape);
+        const __m256i top = _mm256_set1_epi8(0x1f);
+        __m256i v, m;
+        unsigned int bits, t, d;
+
+        // A step reads 64 bytes and writes up to 96
+        while (i + 64 <= len && end - o >= 96)
+        {
+            v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+            m = _mm256_or_si256(_mm256_cmpeq_epi8(v, f), _mm256_cmpeq_epi8(v, e));
+            if constexpr (Map::tx != 0)
+                m = _mm256_or_si256(m, _mm256_cmpeq_epi8(_mm256_min_epu8(v, top), v));
+            bits = mapped<Map::tx>(_mm256_movemask_epi8(m), txSpecial, src + i);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(o), v);
+            for (d = 0; bits != 0; bits &= bits - 1, d++)
+            {
+                t = __builtin_ctz(bits);
+                o[t + d] = control_escape;
+                o[t + d + 1] = src[i + t] ^ 0x20;
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(o + t + d + 2),
+                                    _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i + t + 1)));
+            }
+            i += 32;
+            o += 32 + d;
+        }
+        _mm256_zeroupper();
+    }
+
+    /**
+     * @brief Copy a message 16 bytes per step (SSE2)
+     *
+     * The block is stored whole and the copy advanced to the first special
+     * byte.  A plain escape pair is taken in place, anything else (flag,
+     * mapped character, escape split across calls) is left to the state
+     * machine.
+     *
+     * @param[in] *src  - received data
+     * @param[in] len   - size of data
+     * @param[in,out] i - bytes of src done
+     */
+    void unescape_sse2(const std::uint8_t *src, std::size_t len, std::size_t &i) noexcept
+    {
+        const __m128i f = _mm_set1_epi8(flag_sequence), e = _mm_set1_epi8(control_escape);
+        const __m128i top = _mm_set1_epi8(0x1f);
+        __m128i v, m;
+        unsigned int bits, t;
+
+        while (i + 16 <= len && buf.size() - used >= 16)
+        {
+            v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+            m = _mm_or_si128(_mm_cmpeq_epi8(v, f), _mm_cmpeq_epi8(v, e));
+            if constexpr (Map::rx != 0)
+                m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(v, top), v));
+            bits = mapped<Map::rx>(_mm_movemask_epi8(m), rxSpecial, src + i);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(buf.data() + used), v);
+            if (bits == 0)
+            {
+                i += 16;
+                used += 16;
+                continue;
+            }
+            t = __builtin_ctz(bits);
+            i += t;
+            used += t;
+            if (src[i] != control_escape || i + 1 == len || rxSpecial[src[i + 1]])
+                break;
+            buf[used++] = src[i + 1] ^ 0x20;
+            i += 2;
+        }
+    }
+
+    /**
+     * @brief Copy a message 32 bytes per step (AVX2)
+     *
+     * Same as unescape_sse2 with 32 byte blocks
+     *
+     * @param[in] *src  - received data
+     * @param[in] len   - size of data
+     * @param[in,out] i - bytes of src done
+     */
+    __attribute__((target("avx2")))
+    void unescape_avx2(const std::uint8_t *src, std::size_t len, std::size_t &i) noexcept
+    {
+        const __m256i f = _mm256_set1_epi8(flag_sequence), e = _mm256_set1_epi8(control_escape);
+        const __m256i top = _mm256_set1_epi8(0x1f);
+        __m256i v, m;
+        unsigned int bits, t;
+
+        while (i + 32 <= len && buf.size() - used >= 32)
+        {
+            v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+            m = _mm256_or_si256(_mm256_cmpeq_epi8(v, f), _mm256_cmpeq_epi8(v, e));
+            if constexpr (Map::rx != 0)
+                m = _mm256_or_si256(m, _mm256_cmpeq_epi8(_mm256_min_epu8(v, top), v));
+            bits = mapped<Map::rx>(_mm256_movemask_epi8(m), rxSpecial, src + i);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(buf.data() + used), v);
+            if (bits == 0)
+            {
+                i += 32;
+                used += 32;
+                continue;
+            }
+            t = __builtin_ctz(bits);
+            i += t;
+            used += t;
+            if (src[i] != control_escape || i + 1 == len || rxSpecial[src[i + 1]])
+                break;
+            buf[used++] = src[i + 1] ^ 0x20;
+            i += 2;
+        }
+        _mm256_zeroupper();
+    }
+#endif
+
+    std::array<std::uint8_t, MaxFrame + Fcs::bytes> buf; // Message being received, FCS included
+    std::size_t used = 0;       // Bytes in buf
+    State state = State::Hunt;
+};
+
+} // namespace hdlc
+
+#endif
@@ -0,0 +1,869 @@
+/*!
+ * @file
+ * @author Mark Koi
+ *
+ * This file is the main entry point for the hdlc micro benchmarks.  It times
+ * the FCS engines, the encoder, the decoder and its unescape kernels alone
+ * (no rand() or printf in the timed loops) over a sweep of payload sizes,
+ * escape densities, input chunking and channel counts, for every FCS engine
+ * and SIMD level the CPU supports, then the bit synchronous framing mode and
+ * the decode worker pool from one thread up to one per core.  Results go to
+ * stdout as JSON, one case per line.
+ *
+ * @note Build with "make hdlc_bench" (optimized)
+ * @warning None
+ */
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include "hdlc.h"
+#include "hdlc_priv.h"
+#include "hdlc_workers.h"
+
+#define DEFAULT_DURATION 50     // Milliseconds per case
+#define STREAM_BYTES     (256 * 1024) // Encoded frames decoded per pass
+#define READ_CHUNK       65536  // "Whole" input chunking, a large read()
+#define KERNEL_HPP       (HDLC_SIMD_AVX2 + 1) // C++ Codec (hdlc.hpp), after the SIMD levels
+#define WORKER_CHANNELS  64     // Channels fed to the decode worker pool
+#define WORKER_SIZE      1500   // Payload of the frames fed to the worker pool
+
+// Decoders timed by decode_case
+enum decoder
+{
+    DECODE_RING,        // hdlc_msg_add_chan and hdlc_msg_decode_batch
+    DECODE_VIEW,        // hdlc_msg_decode_view
+    DECODE_HPP,         // C++ Codec
+    DECODE_SEGMENTS     // hdlc_msg_decode_segments
+};
+
+// Bit at a time synchronous decoder, the baseline of the sync tables
+struct bitloop
+{
+    unsigned int raw;       // Flag detector, the newest line bit in bit 7
+    unsigned int acc;       // Data bits of the byte being put together
+    int          bits;      // Bits in acc
+    int          ones;      // Data ones in a row
+    int          skip;      // Flag bits still in the detector
+    int          inFrame;   // Flag seen, no abort since
+    int          n;         // Message bytes
+};
+
+// Payload escape densities
+enum density
+{
+    DENSITY_NONE,       // No flag or escape bytes
+    DENSITY_1,          // 1% flag bytes
+    DENSITY_50,         // 50% flag bytes
+    DENSITY_ALL,        // Every byte a flag
+    DENSITIES
+};
+
+static const int sizes[] = {16, 64, 256, 1500, 4096, 65536};
+static const char *density_name[DENSITIES] = {"0%", "1%", "50%", "all7e"};
+static const char *engine_name[] = {"auto", "byte", "slice8", "slice16", "clmul"};
+static const char *level_name[] = {"auto", "scalar", "sse2", "avx2", "hpp"};
+
+static double duration = DEFAULT_DURATION / 1000.0;
+static int first = 1;
+static volatile unsigned int sink; // Keeps the timed results alive
+
+// Local functions
+void print_usage(char *argv[]);
+double now(void);
+void fill(unsigned char *buf, int size, int density);
+void fill_percent(unsigned char *buf, int size, int percent);
+void report(const char *op, const char *kernel, int size, const char *density, const char *chunk,
+            int channels, long frames, long bytes, double secs);
+void bench_fcs(void);
+void bench_encode(void);
+void bench_encode_stream(void);
+void bench_decode(void);
+void bench_unescape(void);
+void decode_case(int size, int density, int chunk, int channels, int mode);
+void segment_cb(hdlc_chan_t *chan, int event, const unsigned char *seg, int len, void *arg);
+void bench_sync(void);
+void sync_cb(hdlc_chan_t *chan, const struct hdlc_frame *frame, void *arg);
+void bench_workers(void);
+int bitloop_encode(const unsigned char *in, int len, unsigned char *out);
+int bitloop_decode(struct bitloop *bl, const unsigned char *in, int len, unsigned char *msg, int cap);
+
+// C++ Codec entry points (hdlc_bench_hpp.cpp)
+int hpp_encode(const unsigned char *in, int len, unsigned char *out, int cap, int accm);
+void *hpp_decoder_init(void);
+int hpp_decode(void *dec, const unsigned char *in, int len);
+void hpp_decoder_delete(void *dec);
+
+
+/**
+ * @brief Main routine
+ *
+ * Run the selected benchmarks
+ *
+ * @param[in] argc - the number(count) of arguments coming into the function
+ * @param[in] argv - the arguments themselves
+ * @return 0 successful
+ *
+ * @note None
+ * @warning None
+ */
+int main (int argc, char *argv[])
+{
+    int opt, fcs = 1, encode = 1, decode = 1, sync = 1, workers = 1;
+
+    while ((opt = getopt(argc, argv, "hd:o:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'd':
+                duration = strtol(optarg, NULL, 10) / 1000.0;
+                break;
+            case 'o':
+                fcs = strcmp(optarg, "fcs") == 0;
+                encode = strcmp(optarg, "encode") == 0;
+                decode = strcmp(optarg, "decode") == 0;
+                sync = strcmp(optarg, "sync") == 0;
+                workers = strcmp(optarg, "workers") == 0;
+                break;
+            case 'h':
+                print_usage(argv);
+                exit(0);
+                break;
+            default:
+                print_usage(argv);
+                exit(1);
+                break;
+        }
+    }
+
+    printf("{\"bench\": \"hdlc\", \"duration_ms\": %.0f, \"fcs_auto\": \"%s\", \"simd_auto\": \"%s\", \"results\": [\n",
+           duration * 1000, engine_name[hdlc_fcs_selected()], level_name[hdlc_simd_selected()]);
+    if (fcs) bench_fcs();
+    if (encode) bench_encode();
+    if (encode) bench_encode_stream();
+    if (decode) bench_decode();
+    if (decode) bench_unescape();
+    if (sync) bench_sync();
+    if (workers) bench_workers();
+    printf("\n]}\n");
+    return 0;
+}
+
+/**
+ * @brief bench_fcs
+ *
+ * Every FCS engine over every payload size, 16 and 32 bit
+ *
+ * @note None
+ * @warning None
+ */
+void bench_fcs(void)
+{
+    unsigned char *buf;
+    unsigned int fcs;
+    long frames;
+    double start, secs = 0;
+    int e, s, wide;
+
+    assert((buf = malloc(sizes[5])) != NULL);
+    fill(buf, sizes[5], DENSITY_1);
+    for (wide = 0; wide <= 1; wide++)
+    for (e = HDLC_FCS_BYTE; e <= HDLC_FCS_CLMUL; e++)
+    {
+        if (hdlc_fcs_select(e) < 0) continue; // Not supported by this CPU
+        for (s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++)
+        {
+            fcs = 0;
+            frames = 0;
+            start = now();
+            do
+            {
+                if (wide)
+                    fcs += hdlc_fcs32(HDLC_FCS32_INIT, buf, sizes[s]);
+                else
+                    fcs += hdlc_fcs16(HDLC_FCS16_INIT, buf, sizes[s]);
+                frames++;
+            } while ((frames & 63) || (secs = now() - start) < duration);
+            sink += fcs;
+            report(wide ? "fcs32" : "fcs", engine_name[e], sizes[s], "-", "-", 1, frames, frames * sizes[s], secs);
+        }
+    }
+    hdlc_fcs_select(HDLC_FCS_AUTO);
+    free(buf);
+}
+
+/**
+ * @brief bench_encode
+ *
+ * Every SIMD level and the C++ Codec over every payload size and escape
+ * density
+ *
+ * @note None
+ * @warning None
+ */
+void bench_encode(void)
+{
+    unsigned char *buf, *out;
+    hdlc_chan_t *chan;
+    long frames;
+    double start, secs = 0;
+    int l, s, d, cap, accm;
+
+    cap = hdlc_encoded_bound(sizes[5], HDLC_FCS16);
+    assert((buf = malloc(sizes[5])) != NULL && (out = malloc(cap)) != NULL);
+    assert((chan = hdlc_chan_init(sizes[5], 0)) != NULL);
+    for (accm = 0; accm <= 1; accm++)
+    for (l = HDLC_SIMD_SCALAR; l <= KERNEL_HPP; l++)
+    {
+        hdlc_accm_chan(chan, accm ? HDLC_ACCM_ALL : 0, 0, NULL);
+        if (l != KERNEL_HPP && hdlc_simd_select(l) < 0) continue; // Not supported by this CPU
+        for (d = 0; d < DENSITIES; d++)
+        {
+            fill(buf, sizes[5], d);
+            for (s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++)
+            {
+                frames = 0;
+                start = now();
+                do
+                {
+                    if (l == KERNEL_HPP)
+                        sink += hpp_encode(buf, sizes[s], out, cap, accm);
+                    else
+                        sink += hdlc_msg_encode_buf(chan, buf, sizes[s], out, cap);
+                    frames++;
+                } while ((frames & 15) || (secs = now() - start) < duration);
+                report(accm ? "encode_accm" : "encode", level_name[l], sizes[s], density_name[d], "-", 1,
+                       frames, frames * sizes[s], secs);
+            }
+        }
+    }
+    hdlc_simd_select(HDLC_SIMD_AUTO);
+    hdlc_chan_delete(chan);
+    free(buf);
+    free(out);
+}
+
+/**
+ * @brief bench_encode_stream
+ *
+ * Streaming encoder through DMA sized windows, 1% escapes, the message fed
+ * in read() sized pieces
+ *
+ * @note None
+ * @warning None
+ */
+void bench_encode_stream(void)
+{
+    static const int windows[] = {64, 512, 4096};
+    static const int stream_sizes[] = {1500, 65536, 1 << 20};
+    unsigned char *buf, out[4096];
+    char chunk[16];
+    hdlc_chan_t *chan;
+    long frames;
+    double start, secs = 0;
+    int w, s, pos, used, size;
+
+    assert((buf = malloc(stream_sizes[2])) != NULL);
+    assert((chan = hdlc_chan_init(1500, 0)) != NULL); // Smaller than most of the messages
+    fill(buf, stream_sizes[2], DENSITY_1);
+    for (w = 0; w < (int)(sizeof(windows) / sizeof(windows[0])); w++)
+        for (s = 0; s < (int)(sizeof(stream_sizes) / sizeof(stream_sizes[0])); s++)
+        {
+            size = stream_sizes[s];
+            frames = 0;
+            start = now();
+            do
+            {
+                hdlc_msg_encode_begin(chan);
+                for (pos = 0; pos < size; pos += used)
+                    sink += hdlc_msg_encode_feed(chan, buf + pos, (size - pos < READ_CHUNK) ? size - pos : READ_CHUNK,
+                                                 out, windows[w], &used);
+                while (hdlc_msg_encode_finish(chan, out, windows[w]) > 0)
+                    ;
+                frames++;
+            } while ((frames & 3) || (secs = now() - start) < duration);
+            snprintf(chunk, sizeof(chunk), "%d", windows[w]);
+            report("encode_stream", level_name[hdlc_simd_selected()], size, density_name[DENSITY_1], chunk, 1,
+                   frames, frames * size, secs);
+        }
+    hdlc_chan_delete(chan);
+    free(buf);
+}
+
+/**
+ * @brief bench_decode
+ *
+ * Every SIMD level over every payload size and escape density read in large
+ * chunks, ring and in place decoder, the same for the C++ Codec and the
+ * segment decoder, then the chunking and channel count sweeps around 1500
+ * and 256 byte frames with 1% escapes
+ *
+ * @note None
+ * @warning None
+ */
+void bench_decode(void)
+{
+    static const int chunks[] = {1, 7, 64, 512, READ_CHUNK};
+    static const int channels[] = {1, 16, 256, 1024};
+    int l, s, d, c;
+
+    for (l = HDLC_SIMD_SCALAR; l <= HDLC_SIMD_AVX2; l++)
+    {
+        if (hdlc_simd_select(l) < 0) continue; // Not supported by this CPU
+        for (d = 0; d < DENSITIES; d++)
+            for (s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++)
+                decode_case(sizes[s], d, READ_CHUNK, 1, DECODE_RING);
+        for (s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++)
+            decode_case(sizes[s], DENSITY_1, READ_CHUNK, 1, DECODE_VIEW);
+    }
+    hdlc_simd_select(HDLC_SIMD_AUTO);
+    for (d = 0; d < DENSITIES; d++)
+        for (s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++)
+            decode_case(sizes[s], d, READ_CHUNK, 1, DECODE_HPP);
+    for (d = 0; d < DENSITIES; d++)
+        for (s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); s++)
+            decode_case(sizes[s], d, READ_CHUNK, 1, DECODE_SEGMENTS);
+
+    for (c = 0; c < (int)(sizeof(chunks) / sizeof(chunks[0])); c++)
+        decode_case(1500, DENSITY_1, chunks[c], 1, DECODE_RING);
+    for (c = 0; c < (int)(sizeof(channels) / sizeof(channels[0])); c++)
+        decode_case(256, DENSITY_1, READ_CHUNK, channels[c], DECODE_RING);
+}
+
+/**
+ * @brief bench_unescape
+ *
+ * The unescape kernel alone at every SIMD level over a 1500 byte frame, the
+ * escape density swept finer than the other cases to show where the SIMD
+ * kernels hand dense blocks over to the scalar one
+ *
+ * @note None
+ * @warning None
+ */
+void bench_unescape(void)
+{
+    static const int percent[] = {0, 1, 5, 10, 20, 30, 50, 75, 100};
+    unsigned char *buf, *enc, *out;
+    char density[8];
+    hdlc_chan_t *chan;
+    long frames;
+    double start, secs = 0;
+    int l, p, cap, len, used;
+
+    cap = hdlc_encoded_bound(WORKER_SIZE, HDLC_FCS16);
+    assert((buf = malloc(WORKER_SIZE)) != NULL && (enc = malloc(cap)) != NULL && (out = malloc(cap)) != NULL);
+    assert((chan = hdlc_chan_init(WORKER_SIZE, 0)) != NULL);
+    for (p = 0; p < (int)(sizeof(percent) / sizeof(percent[0])); p++)
+    {
+        fill_percent(buf, WORKER_SIZE, percent[p]);
+        assert((len = hdlc_msg_encode_buf(chan, buf, WORKER_SIZE, enc, cap)) > 0);
+        snprintf(density, sizeof(density), "%d%%", percent[p]);
+        for (l = HDLC_SIMD_SCALAR; l <= HDLC_SIMD_AVX2; l++)
+        {
+            if (hdlc_simd_select(l) < 0) continue; // Not supported by this CPU
+            frames = 0;
+            start = now();
+            do
+            { // Opening flag skipped, the kernel stops at the closing one
+                sink += hdlc_unescape(out, cap, enc + 1, len - 1, &used);
+                frames++;
+            } while ((frames & 63) || (secs = now() - start) < duration);
+            report("unescape", level_name[l], WORKER_SIZE, density, "-", 1, frames, frames * WORKER_SIZE, secs);
+        }
+    }
+    hdlc_simd_select(HDLC_SIMD_AUTO);
+    hdlc_chan_delete(chan);
+    free(buf);
+    free(enc);
+    free(out);
+}
+
+/**
+ * @brief decode_case
+ *
+ * Time the decoding of a stream of encoded frames handed over in chunks to
+ * each channel in turn, all frames taken out after every chunk
+ *
+ * @param[in] size     - payload size
+ * @param[in] density  - escape density of the payload
+ * @param[in] chunk    - bytes handed to the decoder at a time
+ * @param[in] channels - channels decoding the same stream in turn
+ * @param[in] mode     - enum decoder
+ *
+ * @note None
+ * @warning None
+ */
+void decode_case(int size, int density, int chunk, int channels, int mode)
+{
+    struct hdlc_frame frames[64];
+    hdlc_chan_t **chan;
+    void *hpp = NULL;
+    unsigned char *buf, *stream;
+    long decoded = 0, passes = 0;
+    double start, secs = 0;
+    int per, len, slen = 0, cap, i, c, off, n, k, used;
+    char chunk_name[16];
+
+    per = STREAM_BYTES / hdlc_encoded_bound(size, HDLC_FCS16);
+    if (per < 4) per = 4;
+    cap = per * hdlc_encoded_bound(size, HDLC_FCS16);
+    assert((buf = malloc(size)) != NULL && (stream = malloc(cap)) != NULL);
+    assert((chan = malloc(channels * sizeof(*chan))) != NULL);
+    for (c = 0; c < channels; c++)
+        assert((chan[c] = hdlc_chan_init(size, 0)) != NULL);
+    if (mode == DECODE_HPP)
+        assert((hpp = hpp_decoder_init()) != NULL);
+
+    fill(buf, size, density);
+    for (i = 0; i < per; i++)
+    {
+        assert((len = hdlc_msg_encode_buf(chan[0], buf, size, stream + slen, cap - slen)) > 0);
+        slen += len;
+    }
+
+    start = now();
+    do
+    {
+        for (c = 0; c < channels; c++)
+        {
+            for (off = 0; off < slen; off += n)
+            {
+                n = (slen - off < chunk) ? slen - off : chunk;
+                if (mode == DECODE_HPP)
+                    decoded += hpp_decode(hpp, stream + off, n);
+                else if (mode == DECODE_SEGMENTS)
+                    decoded += hdlc_msg_decode_segments(chan[c], stream + off, n, segment_cb, NULL);
+                else if (mode == DECODE_VIEW)
+                {
+                    k = hdlc_msg_decode_view(chan[c], stream + off, n, frames, 64, &used);
+                    n = used;
+                    decoded += k;
+                }
+                else
+                {
+                    n = hdlc_msg_add_chan(chan[c], stream + off, n); // Short when the ring is full
+                    while ((k = hdlc_msg_decode_batch(chan[c], frames, 64)) > 0)
+                    {
+                        decoded += k;
+                        hdlc_msg_release_batch(chan[c]);
+                    }
+                }
+                hdlc_msg_release_batch(chan[c]);
+            }
+        }
+        passes++;
+    } while ((secs = now() - start) < duration);
+    assert(decoded == passes * per * channels);
+
+    if (chunk == READ_CHUNK)
+        strcpy(chunk_name, "read");
+    else
+        sprintf(chunk_name, "%d", chunk);
+    report(mode == DECODE_VIEW ? "decode_view" : (mode == DECODE_SEGMENTS ? "decode_segments" : "decode"),
+           level_name[mode == DECODE_HPP ? KERNEL_HPP : hdlc_simd_selected()], size, density_name[density],
+           chunk_name, channels, decoded, decoded * size, secs);
+
+    for (c = 0; c < channels; c++)
+        hdlc_chan_delete(chan[c]);
+    hpp_decoder_delete(hpp);
+    free(chan);
+    free(buf);
+    free(stream);
+}
+
+/**
+ * @brief bench_sync
+ *
+ * Bit synchronous encoder and decoder over the payload sizes, with flag
+ * bytes (six ones) as the stuffing density, next to the bit at a time loops
+ * they replace
+ *
+ * @note None
+ * @warning None
+ */
+void bench_sync(void)
+{
+    static const int sync_sizes[] = {64, 1500, 65536};
+    struct bitloop bl;
+    unsigned char *buf, *out, *stream, *msg;
+    hdlc_chan_t *chan;
+    long frames, decoded, passes;
+    double start, secs = 0;
+    int s, d, k, per, len, slen, cap;
+
+    cap = hdlc_sync_encoded_bound(sync_sizes[2]);
+    assert((buf = malloc(sync_sizes[2])) != NULL && (out = malloc(cap)) != NULL);
+    assert((stream = malloc(STREAM_BYTES + 2 * cap)) != NULL && (msg = malloc(sync_sizes[2] + 2)) != NULL);
+    assert((chan = hdlc_chan_init(sync_sizes[2], 0)) != NULL);
+    for (d = DENSITY_NONE; d <= DENSITY_50; d++)
+    {
+        fill(buf, sync_sizes[2], d);
+        for (s = 0; s < (int)(sizeof(sync_sizes) / sizeof(sync_sizes[0])); s++)
+        {
+            for (k = 0; k < 2; k++)
+            {
+                frames = 0;
+                start = now();
+                do
+                {
+                    if (k)
+                        sink += bitloop_encode(buf, sync_sizes[s], out);
+                    else
+                        sink += hdlc_sync_encode_buf(chan, buf, sync_sizes[s], out, cap);
+                    frames++;
+                } while ((frames & 15) || (secs = now() - start) < duration);
+                report("sync_encode", k ? "bitloop" : "table", sync_sizes[s], density_name[d], "-", 1,
+                       frames, frames * sync_sizes[s], secs);
+            }
+
+            for (per = 0, slen = 0; slen < STREAM_BYTES || per < 4; per++)
+            {
+                assert((len = hdlc_sync_encode_buf(chan, buf, sync_sizes[s], stream + slen, cap)) > 0);
+                slen += len;
+            }
+            for (k = 0; k < 2; k++)
+            {
+                memset(&bl, 0, sizeof(bl));
+                decoded = passes = 0;
+                start = now();
+                do
+                {
+                    if (k)
+                        decoded += bitloop_decode(&bl, stream, slen, msg, sync_sizes[s] + 2);
+                    else
+                        decoded += hdlc_sync_decode(chan, stream, slen, sync_cb, NULL);
+                    passes++;
+                } while ((secs = now() - start) < duration);
+                assert(decoded == passes * per);
+                report("sync_decode", k ? "bitloop" : "table", sync_sizes[s], density_name[d], "read", 1,
+                       decoded, decoded * sync_sizes[s], secs);
+            }
+        }
+    }
+    hdlc_chan_delete(chan);
+    free(buf);
+    free(out);
+    free(stream);
+    free(msg);
+}
+
+/**
+ * @brief bench_workers
+ *
+ * Decode worker pool on 1, 2, 4 ... threads up to one per core, the frames
+ * (1% escapes) encoded before the run and fed to every channel in turn from
+ * this thread, which also takes the decoded frames back
+ *
+ * @note The feed is a copy per frame, far from the decode cost
+ * @warning None
+ */
+void bench_workers(void)
+{
+    hdlc_workers_t *w;
+    struct hdlc_msg *msg;
+    unsigned char *buf, *enc;
+    int block[WORKER_CHANNELS];
+    long sent, got;
+    double start, secs;
+    int cores, t, c, len, done, cap = hdlc_encoded_bound(WORKER_SIZE, HDLC_FCS16);
+    char name[16];
+
+    if ((cores = sysconf(_SC_NPROCESSORS_ONLN)) < 1) cores = 1;
+    assert((buf = malloc(WORKER_SIZE)) != NULL && (enc = malloc(cap)) != NULL);
+    for (c = 0; c < WORKER_CHANNELS; c++)
+        assert((block[c] = hdlc_init(WORKER_SIZE)) >= 0);
+    fill(buf, WORKER_SIZE, DENSITY_1);
+    assert((len = hdlc_msg_encode_buf(hdlc_chan_get(block[0]), buf, WORKER_SIZE, enc, cap)) > 0);
+
+    for (t = 1; ; t = (t * 2 < cores) ? t * 2 : cores)
+    {
+        assert((w = hdlc_workers_init(t, WORKER_CHANNELS, 1)) != NULL);
+        for (c = 0; c < WORKER_CHANNELS; c++)
+            assert(hdlc_workers_attach(w, block[c], 0) == c);
+        sent = got = 0;
+        start = now();
+        do
+        {
+            for (c = 0; c < WORKER_CHANNELS; c++, sent++)
+            {
+                for (done = 0; done < len; )
+                {
+                    done += hdlc_workers_add(w, c, enc + done, len - done);
+                    if (done == len) break;
+                    if ((msg = hdlc_workers_recv(w, 0, 0)) == NULL)
+                        sched_yield(); // Workers behind, nothing to take back
+                    for (; msg != NULL; msg = hdlc_workers_recv(w, 0, 0), got++)
+                    {
+                        sink += msg->len;
+                        hdlc_msg_free(msg);
+                    }
+                }
+            }
+        } while (now() - start < duration);
+        for (; got < sent; got++)
+        { // What is still in flight
+            assert((msg = hdlc_workers_recv(w, 0, 1)) != NULL && msg->status == HDLC_FRAME_OK);
+            sink += msg->len;
+            hdlc_msg_free(msg);
+        }
+        secs = now() - start;
+        snprintf(name, sizeof(name), "%d thread%s", t, t > 1 ? "s" : "");
+        report("workers", name, WORKER_SIZE, density_name[DENSITY_1], "-", WORKER_CHANNELS, got, got * WORKER_SIZE, secs);
+        assert(hdlc_workers_delete(w) == 0);
+        if (t == cores) break;
+    }
+    for (c = 0; c < WORKER_CHANNELS; c++)
+        hdlc_delete_num(block[c]);
+    free(buf);
+    free(enc);
+}
+
+/**
+ * @brief sync_cb
+ *
+ * Touch every message like the C consumer would
+ *
+ * @param[in] *chan  - channel
+ * @param[in] *frame - message
+ * @param[in] *arg   - unused
+ */
+void sync_cb(hdlc_chan_t *chan, const struct hdlc_frame *frame, void *arg)
+{
+    (void)chan;
+    (void)arg;
+    sink += frame->len + frame->status + frame->ptr[0];
+}
+
+/**
+ * @brief bitloop_encode
+ *
+ * Bit synchronous frame one bit at a time, 16 bit FCS, the way it is done
+ * without the tables
+ *
+ * @param[in] *in   - message
+ * @param[in] len   - size of message
+ * @param[out] *out - line bytes, hdlc_sync_encoded_bound(len)
+ *
+ * @return size of the line
+ */
+int bitloop_encode(const unsigned char *in, int len, unsigned char *out)
+{
+    unsigned int fcs = ~hdlc_fcs16(HDLC_FCS16_INIT, in, len) & 0xffff, acc = 0, b;
+    int i, k, bits = 0, ones = 0, w = 0;
+
+    for (i = -1; i <= len + 2; i++)
+        for (k = 0; k < 8; k++)
+        {
+            if (i < 0 || i == len + 2)
+                b = (0x7e >> k) & 1; // Flags
+            else
+                b = (((i < len) ? in[i] : fcs >> (8 * (i - len))) >> k) & 1;
+            acc |= b << bits++;
+            ones = (b && i >= 0 && i < len + 2) ? ones + 1 : 0;
+            if (ones == 5)
+            {
+                bits++;
+                ones = 0;
+            }
+            if (bits >= 8)
+            {
+                out[w++] = acc;
+                acc >>= 8;
+                bits -= 8;
+            }
+        }
+    if (bits > 0)
+        out[w++] = acc | (0xff << bits);
+    return w;
+}
+
+/**
+ * @brief bitloop_decode
+ *
+ * Bit synchronous deframe one bit at a time, 16 bit FCS, the way it is done
+ * without the tables
+ *
+ * @param[in,out] *bl - decoder state
+ * @param[in] *in     - line bytes
+ * @param[in] len     - size of in
+ * @param[out] *msg   - message storage
+ * @param[in] cap     - size of msg
+ *
+ * @return good messages
+ */
+int bitloop_decode(struct bitloop *bl, const unsigned char *in, int len, unsigned char *msg, int cap)
+{
+    unsigned int leave;
+    int i, k, good = 0;
+
+    for (i = 0; i < len; i++)
+        for (k = 0; k < 8; k++)
+        {
+            leave = bl->raw & 1;
+            bl->raw = bl->raw >> 1 | ((in[i] >> k) & 1) << 7;
+            if (bl->inFrame)
+            {
+                if (bl->skip)
+                    bl->skip--;
+                else if (leave || bl->ones < 5)
+                {
+                    bl->acc |= leave << bl->bits++;
+                    bl->ones = leave ? bl->ones + 1 : 0;
+                }
+                else
+                    bl->ones = 0;
+                if (bl->bits == 8)
+                {
+                    if (bl->n < cap)
+                        msg[bl->n++] = bl->acc;
+                    bl->acc = bl->bits = 0;
+                }
+            }
+            if (bl->raw == 0x7e)
+            {
+                if (bl->inFrame && bl->n > 2 && bl->bits == 0 &&
+                    hdlc_fcs16(HDLC_FCS16_INIT, msg, bl->n) == HDLC_FCS16_GOOD)
+                {
+                    sink += msg[0];
+                    good++;
+                }
+                bl->inFrame = 1;
+                bl->skip = 8;
+                bl->acc = bl->bits = bl->ones = bl->n = 0;
+            }
+            else if ((bl->raw & 0xfe) == 0xfe)
+                bl->inFrame = 0;
+        }
+    return good;
+}
+
+/**
+ * @brief fill
+ *
+ * Random payload at one of the standard escape densities
+ *
+ * @param[out] *buf   - payload
+ * @param[in] size    - size of payload
+ * @param[in] density - enum density
+ *
+ * @note Same payload on every run (fixed seed)
+ * @warning None
+ */
+void fill(unsigned char *buf, int size, int density)
+{
+    static const int percent[DENSITIES] = {0, 1, 50, 100};
+
+    fill_percent(buf, size, percent[density]);
+}
+
+/**
+ * @brief fill_percent
+ *
+ * Random payload with the given share of flag bytes, no other byte needs
+ * escaping
+ *
+ * @param[out] *buf   - payload
+ * @param[in] size    - size of payload
+ * @param[in] percent - flag bytes in 100
+ *
+ * @note Same payload on every run (fixed seed)
+ * @warning None
+ */
+void fill_percent(unsigned char *buf, int size, int percent)
+{
+    int i;
+
+    srand(1);
+    for (i = 0; i < size; i++)
+    {
+        if (rand() % 100 < percent)
+            buf[i] = 0x7e;
+        else
+            do buf[i] = rand(); while (buf[i] == 0x7e || buf[i] == 0x7d);
+    }
+}
+
+/**
+ * @brief report
+ *
+ * One JSON result line
+ *
+ * @param[in] *op      - operation timed
+ * @param[in] *kernel  - FCS engine or SIMD level
+ * @param[in] size     - payload size
+ * @param[in] *density - escape density
+ * @param[in] *chunk   - input chunking
+ * @param[in] channels - channel count
+ * @param[in] frames   - frames processed
+ * @param[in] bytes    - payload bytes processed
+ * @param[in] secs     - time taken
+ *
+ * @note None
+ * @warning None
+ */
+void report(const char *op, const char *kernel, int size, const char *density, const char *chunk,
+            int channels, long frames, long bytes, double secs)
+{
+    printf("%s  {\"op\": \"%s\", \"kernel\": \"%s\", \"size\": %d, \"density\": \"%s\", \"chunk\": \"%s\", "
+           "\"channels\": %d, \"mb_s\": %.1f, \"frames_s\": %.0f, \"ns_frame\": %.1f}",
+           first ? "" : ",\n", op, kernel, size, density, chunk, channels,
+           bytes / secs / 1e6, frames / secs, secs * 1e9 / frames);
+    first = 0;
+    fflush(stdout);
+}
+
+/**
+ * @brief now
+ *
+ * @return monotonic time in seconds
+ *
+ * @note None
+ * @warning None
+ */
+double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief print_usage
+ *
+ * Dump the argv usage for this hdlc benchmark program
+ *
+ * @param[in] argv - the arguments themselves
+ *
+ * @note None
+ * @warning None
+ */
+void print_usage(char *argv[])
+{
+        printf("Usage:\n");
+        printf("%s [-dho]\n", *argv);
+        printf("   -d <ms>             time spent on each case.  Default = %d\n", DEFAULT_DURATION);
+        printf("   -h                  help menu for options\n");
+        printf("   -o <op>             only run fcs, encode, decode, sync or workers\n");
+}
+
+/**
+ * @brief segment_cb
+ *
+ * Touch every segment like the C consumer would
+ *
+ * @param[in] *chan - channel
+ * @param[in] event - enum hdlc_segment_event
+ * @param[in] *seg  - segment
+ * @param[in] len   - size of segment
+ * @param[in] *arg  - unused
+ */
+void segment_cb(hdlc_chan_t *chan, int event, const unsigned char *seg, int len, void *arg)
+{
+    (void)chan;
+    (void)arg;
+    sink += event + len + (len > 0 ? seg[0] : 0);
+}
@@ -0,0 +1,82 @@
+/*!
+ * @file
+ * @author Mark Koi
+ *
+ * This file instantiates the C++ codec (hdlc.hpp) for the hdlc micro
+ * benchmarks, one link configuration per entry point, so hdlc_bench.c can
+ * time it next to the C channel.
+ */
+#include <new>
+#include "hdlc.hpp"
+
+#define BENCH_MAX_FRAME 65536   // Largest payload of the benchmark sweep
+
+using Codec16 = hdlc::Codec<hdlc::Fcs16, hdlc::AccmNone, BENCH_MAX_FRAME>;
+using Codec16All = hdlc::Codec<hdlc::Fcs16, hdlc::AccmAll, BENCH_MAX_FRAME>;
+
+extern "C"
+{
+int hpp_encode(const unsigned char *in, int len, unsigned char *out, int cap, int accm);
+void *hpp_decoder_init(void);
+int hpp_decode(void *dec, const unsigned char *in, int len);
+void hpp_decoder_delete(void *dec);
+}
+
+/**
+ * @brief hpp_encode
+ *
+ * Encode with the 16 bit FCS Codec
+ *
+ * @param[in] *in   - message
+ * @param[in] len   - size of message
+ * @param[out] *out - encoded message
+ * @param[in] cap   - size of out
+ * @param[in] accm  - 1 escape every control character, 0 none
+ *
+ * @return size of the encoded message, or an hdlc::Error
+ */
+int hpp_encode(const unsigned char *in, int len, unsigned char *out, int cap, int accm)
+{
+    if (accm)
+        return Codec16All::encode({in, (size_t)len}, {out, (size_t)cap});
+    return Codec16::encode({in, (size_t)len}, {out, (size_t)cap});
+}
+
+/**
+ * @brief hpp_decoder_init
+ *
+ * @return 16 bit FCS decoder, NULL failure
+ */
+void *hpp_decoder_init(void)
+{
+    return new (std::nothrow) Codec16;
+}
+
+/**
+ * @brief hpp_decode
+ *
+ * @param[in] *dec - decoder from hpp_decoder_init
+ * @param[in] *in  - received data
+ * @param[in] len  - size of data
+ *
+ * @return messages decoded
+ */
+int hpp_decode(void *dec, const unsigned char *in, int len)
+{
+    static volatile unsigned int sink; // Touch every message like the C consumer would
+
+    return static_cast<Codec16 *>(dec)->decode({in, (size_t)len}, [](std::span<const unsigned char> msg, bool ok)
+    {
+        sink = sink + msg.size() + ok;
+    });
+}
+
+/**
+ * @brief hpp_decoder_delete
+ *
+ * @param[in] *dec - decoder from hpp_decoder_init
+ */
+void hpp_decoder_delete(void *dec)
+{
+    delete static_cast<Codec16 *>(dec);
+}
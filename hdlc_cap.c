@@ -0,0 +1,243 @@
+/*!
+ * @file
+ * @author Mark Koi
+ *
+ * This file is the main entry point for the capture decoding tool.  It
+ * decodes a raw capture file (the received byte stream of a link) on all
+ * the cores, prints the totals and optionally the frames, and can save the
+ * frame index so later runs list or dump frames without decoding the whole
+ * capture again.
+ *
+ * @note Build with "make hdlc_cap" (optimized)
+ * @warning None
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "hdlc.h"
+#include "hdlc_capture.h"
+
+// Listing settings
+struct listing
+{
+    int       list;     // Print every frame
+    int       hex;      // Print the messages too
+    long long frames;   // Frames seen
+};
+
+// Locally defined functions (see below for function header information)
+void print_usage(char *argv[]);
+double now(void);
+int list_cb(const struct hdlc_cap_frame *frame, void *arg);
+int list_index(const char *index, const char *path, struct listing *ls);
+
+/**
+ * @brief main
+ *
+ * Parse the options, then decode, index or list the capture
+ *
+ * @param[in] argc - number of arguments
+ * @param[in] argv - the arguments themselves
+ *
+ * @return 0 pass
+ *         1 failure
+ *
+ * @note None
+ * @warning None
+ */
+int main (int argc, char *argv[])
+{
+    struct hdlc_cap_conf conf;
+    struct hdlc_stats stats;
+    struct listing ls;
+    const char *index = NULL, *path;
+    long long frames;
+    double start, secs;
+    int opt, read = 0;
+
+    memset(&conf, 0, sizeof(conf));
+    memset(&ls, 0, sizeof(ls));
+    while ((opt = getopt(argc, argv, "f:hi:lm:o:s:t:x")) != -1)
+    {
+        switch (opt)
+        {
+            case 'f':
+                conf.fcs = strtol(optarg, NULL, 10);
+                break;
+            case 'i':
+                index = optarg;
+                read = 1;
+                break;
+            case 'l':
+                ls.list = 1;
+                break;
+            case 'm':
+                conf.size = strtol(optarg, NULL, 10);
+                break;
+            case 'o':
+                index = optarg;
+                read = 0;
+                break;
+            case 's':
+                conf.shard = strtoll(optarg, NULL, 10);
+                break;
+            case 't':
+                conf.threads = strtol(optarg, NULL, 10);
+                break;
+            case 'x':
+                ls.list = 1;
+                ls.hex = 1;
+                break;
+            case 'h':
+                print_usage(argv);
+                exit(0);
+                break;
+            default:
+                print_usage(argv);
+                exit(1);
+                break;
+        }
+    }
+    if (optind != argc - 1)
+    {
+        print_usage(argv);
+        exit(1);
+    }
+    path = argv[optind];
+
+    if (read)
+        return list_index(index, path, &ls);
+
+    start = now();
+    if (index != NULL)
+        frames = hdlc_capture_index(path, index, &conf, &stats);
+    else
+        frames = hdlc_capture_file(path, &conf, list_cb, &ls, &stats);
+    secs = now() - start;
+    if (frames < 0)
+    {
+        fprintf(stderr, "%s: failed decoding %s (%lld)\n", *argv, path, frames);
+        return 1;
+    }
+    if (index != NULL && ls.list && list_index(index, path, &ls) != 0) return 1;
+
+    printf("frames %lld ok %llu bad %llu aborts %llu overruns %llu, %llu bytes in %.3f s (%.0f MB/s)\n",
+           frames, stats.framesOk, stats.fcsErrors, stats.aborts, stats.overruns, stats.bytesIn, secs,
+           secs > 0 ? stats.bytesIn / secs / 1e6 : 0.0);
+    return 0;
+}
+
+/**
+ * @brief list_cb
+ *
+ * Print a frame: index, capture offset, capture bytes, message size and
+ * status, then the message in hex with -x
+ *
+ * @param[in] *frame - frame
+ * @param[in] *arg   - struct listing
+ *
+ * @return 0 continue
+ */
+int list_cb(const struct hdlc_cap_frame *frame, void *arg)
+{
+    struct listing *ls = arg;
+    int i;
+
+    if (ls->list)
+    {
+        printf("%lld %lld %d %d %s", ls->frames, frame->offset, frame->raw, frame->len,
+               frame->status == HDLC_FRAME_OK ? "ok" : "bad");
+        if (ls->hex)
+        {
+            printf(" ");
+            for (i = 0; i < frame->len; i++)
+                printf("%02X", frame->ptr[i]);
+        }
+        printf("\n");
+    }
+    ls->frames++;
+    return 0;
+}
+
+/**
+ * @brief list_index
+ *
+ * Print every frame of the capture through its index
+ *
+ * @param[in] *index - index file
+ * @param[in] *path  - capture file
+ * @param[in] *ls    - listing settings
+ *
+ * @return 0 pass
+ *         1 failure
+ */
+int list_index(const char *index, const char *path, struct listing *ls)
+{
+    struct hdlc_cap_frame frame;
+    hdlc_index_t *ix;
+    long long n, count;
+
+    if ((ix = hdlc_index_open(index, path)) == NULL)
+    {
+        fprintf(stderr, "failed opening index %s of %s\n", index, path);
+        return 1;
+    }
+    count = hdlc_index_count(ix);
+    ls->frames = 0;
+    for (n = 0; n < count; n++)
+    {
+        if (hdlc_index_frame(ix, n, &frame) != 0)
+        {
+            fprintf(stderr, "frame %lld does not match the capture\n", n);
+            hdlc_index_close(ix);
+            return 1;
+        }
+        if (ls->list) list_cb(&frame, ls);
+    }
+    if (!ls->list) printf("frames %lld\n", count);
+    hdlc_index_close(ix);
+    return 0;
+}
+
+/**
+ * @brief now
+ *
+ * @return monotonic time in seconds
+ *
+ * @note None
+ * @warning None
+ */
+double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief print_usage
+ *
+ * Dump the argv usage for this capture decoding program
+ *
+ * @param[in] argv - the arguments themselves
+ *
+ * @note None
+ * @warning None
+ */
+void print_usage(char *argv[])
+{
+        printf("Usage:\n");
+        printf("%s [-fhilmostx] capture\n", *argv);
+        printf("   -f <16|32>          FCS width.  Default = 16\n");
+        printf("   -h                  help menu for options\n");
+        printf("   -i <index>          list the frames through a saved index instead of decoding\n");
+        printf("   -l                  list the frames: number, offset, capture bytes, size, status\n");
+        printf("   -m <size>           largest message.  Default = %d\n", HDLC_MAX);
+        printf("   -o <index>          save the frame index\n");
+        printf("   -s <bytes>          capture bytes per shard.  Default = %d\n", HDLC_CAP_SHARD);
+        printf("   -t <threads>        decode threads.  Default = one per core\n");
+        printf("   -x                  list the frames with the messages in hex\n");
+}
@@ -0,0 +1,786 @@
+/*!
+ * @file
+ * @author Mark Koi
+ *
+ * This file holds the offline capture decoder.  The capture is mapped and
+ * cut into fixed size shards, each one moved forward to the first FLAG
+ * SEQUENCE at or after its nominal start: a flag byte is never part of an
+ * escaped message (an escaped flag is 7D 5E, and 7D 7E is an abort that the
+ * flag ends), so every decoder is in the same state right after it, whatever
+ * came before.  A shard decodes the messages that open inside it up to the
+ * next shard's first flag, which closes its last message, so a message that
+ * crosses the nominal edge is never split.  The messages between two flags
+ * are decoded with the escape and FCS kernels straight from the mapping,
+ * without channels: those with no escapes stay where they are, the others
+ * go to the shard's own buffer.  The worker threads decode at most a window
+ * of shards ahead of the calling thread, which hands the frames to the
+ * callback in capture order, so the memory used does not grow with the
+ * capture.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "hdlc.h"
+#include "hdlc_priv.h"
+#include "hdlc_capture.h"
+
+#define CAP_WINDOW      2       // Shards decoded ahead of the delivery, per thread
+#define CAP_RECS        1024    // Initial frames per shard
+#define CAP_SIZE_MAX    ((0x7fffffff - 16) / 4) // Largest channel size, twice the message limit fits an int
+#define INDEX_MAGIC     "HDLCIDX1"
+#define INDEX_HEAD      32      // Magic, capture size, frames, FCS width, channel size
+#define INDEX_REC       16      // Offset, raw size, size with the status in bit 31 (little endian)
+
+// Shard slot states
+#define SHARD_FREE      0       // Not taken yet, or delivered
+#define SHARD_BUSY      1       // Decoding
+#define SHARD_DONE      2       // Frames ready for the delivery
+#define SHARD_FAILED    3       // Out of memory
+
+// Frame decoded by a shard
+struct hdlc_cap_rec
+{
+    long long offset;           // Capture offset of the first byte after the opening flag
+    long long data;             // Message in the shard buffer, -1 when it was left in the capture
+    int       raw;              // Capture bytes up to the closing flag
+    int       len;              // Size of message data
+    int       status;           // enum hdlc_frame_status
+};
+
+// Decode results of one shard, the slots are reused for shard, shard + window, ...
+struct hdlc_cap_shard
+{
+    struct hdlc_cap_rec *recs;
+    int                  nrecs;
+    int                  maxrecs;
+    unsigned char       *blob;      // Messages that had escapes
+    long long            blobLen;
+    long long            blobCap;
+    struct hdlc_stats    stats;
+    int                  state;     // SHARD_*
+};
+
+// Capture decoding run
+struct hdlc_cap_run
+{
+    const unsigned char   *buf;
+    long long              len;
+    long long              shard;       // Nominal shard size
+    long long              nshards;
+    long long              next;        // Next shard to decode
+    long long              delivered;   // Shards handed to the callback
+    int                    max;         // Largest message with its FCS, the channel's limit
+    int                    fcsLen;
+    int                    window;      // Slots
+    int                    stop;        // Workers exit
+    struct hdlc_cap_shard *slots;
+    pthread_mutex_t        lock;
+    pthread_cond_t         cond;        // Shard done, delivered or stop
+};
+
+// Opened index
+struct hdlc_index
+{
+    const unsigned char *map;       // Index file
+    long long            mapLen;
+    const unsigned char *cap;       // Capture file
+    long long            capLen;
+    long long            count;     // Frames
+    int                  max;
+    int                  fcsLen;
+    unsigned char       *buf;       // Last message that had escapes
+};
+
+// Index writer state
+struct hdlc_cap_writer
+{
+    FILE *f;
+    int   err;
+};
+
+// Locally defined functions (see below for function header information)
+static void *hdlc_cap_worker(void *arg);
+static int hdlc_cap_shard_decode(struct hdlc_cap_run *run, long long k, struct hdlc_cap_shard *s);
+static int hdlc_cap_message(const unsigned char *seg, long long raw, int max, int fcsLen, unsigned char *out,
+                            struct hdlc_cap_frame *frame, struct hdlc_stats *stats);
+static long long hdlc_cap_flag(const struct hdlc_cap_run *run, long long pos);
+static void hdlc_cap_stats_add(struct hdlc_stats *sum, const struct hdlc_stats *add);
+static void hdlc_cap_settings(const struct hdlc_cap_conf *conf, int *size, int *fcs);
+static const unsigned char *hdlc_cap_map(const char *path, long long *len);
+static void hdlc_cap_unmap(const unsigned char *buf, long long len);
+static int hdlc_cap_write_cb(const struct hdlc_cap_frame *frame, void *arg);
+static void hdlc_cap_put(unsigned char *out, unsigned long long v, int n);
+static unsigned long long hdlc_cap_get(const unsigned char *in, int n);
+
+/**
+ * @brief HDLC decode a capture in memory
+ *
+ * Decode the capture on conf->threads threads, a shard at a time, and hand
+ * every message (good or bad FCS) to cb in capture order
+ *
+ * @param[in] *buf   - capture
+ * @param[in] len    - size of capture
+ * @param[in] *conf  - settings, NULL for the defaults
+ * @param[in] cb     - frame callback, called from this thread
+ * @param[in] *arg   - argument handed to cb
+ * @param[out] *stats - decoder counters of the frames handed over, NULL for none
+ *
+ * @return HDLC_ERR_PARAM  invalid argument
+ *         HDLC_ERR_NO_MEM out of memory or threads
+ *         x               frames handed to cb
+ *
+ * @note Data before the first flag and an unfinished message at the end
+ *       are not frames, the same as for a channel fed the whole capture
+ * @warning None
+ */
+long long hdlc_capture_decode(const unsigned char *buf, long long len, const struct hdlc_cap_conf *conf,
+                              hdlc_capture_cb cb, void *arg, struct hdlc_stats *stats)
+{
+    struct hdlc_cap_run run;
+    struct hdlc_cap_shard *s;
+    struct hdlc_cap_rec *r;
+    struct hdlc_cap_frame frame;
+    pthread_t *threads;
+    long long k, frames = 0;
+    int nthreads = 0, started, size, fcs, i, state, quit = 0;
+
+    if ((buf == NULL && len > 0) || len < 0 || cb == NULL) return HDLC_ERR_PARAM;
+    hdlc_cap_settings(conf, &size, &fcs);
+    if (size <= 0 || size > CAP_SIZE_MAX || (fcs != HDLC_FCS16 && fcs != HDLC_FCS32))
+        return HDLC_ERR_PARAM;
+    if (stats != NULL) memset(stats, 0, sizeof(*stats));
+    if (len == 0) return 0;
+
+    memset(&run, 0, sizeof(run));
+    run.buf = buf;
+    run.len = len;
+    run.shard = (conf != NULL && conf->shard > 0) ? conf->shard : HDLC_CAP_SHARD;
+    run.nshards = (len + run.shard - 1) / run.shard;
+    run.fcsLen = fcs / 8;
+    run.max = size*2 + run.fcsLen;
+    if (conf != NULL) nthreads = conf->threads;
+    if (nthreads <= 0) nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads <= 0) nthreads = 1;
+    if (nthreads > run.nshards) nthreads = run.nshards;
+    run.window = (run.nshards < (long long)nthreads * CAP_WINDOW) ? run.nshards : nthreads * CAP_WINDOW;
+
+    run.slots = calloc(run.window, sizeof(*run.slots));
+    threads = malloc(nthreads * sizeof(*threads));
+    if (run.slots == NULL || threads == NULL)
+    {
+        free(run.slots);
+        free(threads);
+        return HDLC_ERR_NO_MEM;
+    }
+    pthread_mutex_init(&run.lock, NULL);
+    pthread_cond_init(&run.cond, NULL);
+    for (started = 0; started < nthreads; started++)
+        if (pthread_create(&threads[started], NULL, hdlc_cap_worker, &run) != 0) break;
+
+    for (k = 0; k < run.nshards && started > 0 && !quit; k++)
+    {
+        s = &run.slots[k % run.window];
+        pthread_mutex_lock(&run.lock);
+        while (s->state != SHARD_DONE && s->state != SHARD_FAILED)
+            pthread_cond_wait(&run.cond, &run.lock);
+        state = s->state;
+        pthread_mutex_unlock(&run.lock);
+        if (state == SHARD_FAILED) break;
+
+        for (i = 0; i < s->nrecs && !quit; i++)
+        {
+            r = &s->recs[i];
+            frame.ptr = (r->data < 0) ? buf + r->offset : s->blob + r->data;
+            frame.len = r->len;
+            frame.status = r->status;
+            frame.offset = r->offset;
+            frame.raw = r->raw;
+            frames++;
+            quit = cb(&frame, arg);
+        }
+        if (stats != NULL) hdlc_cap_stats_add(stats, &s->stats);
+
+        pthread_mutex_lock(&run.lock);
+        s->state = SHARD_FREE;
+        run.delivered = k + 1;
+        pthread_cond_broadcast(&run.cond);
+        pthread_mutex_unlock(&run.lock);
+    }
+
+    pthread_mutex_lock(&run.lock);
+    run.stop = 1;
+    pthread_cond_broadcast(&run.cond);
+    pthread_mutex_unlock(&run.lock);
+    for (i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    for (i = 0; i < run.window; i++)
+    {
+        free(run.slots[i].recs);
+        free(run.slots[i].blob);
+    }
+    free(run.slots);
+    free(threads);
+    pthread_mutex_destroy(&run.lock);
+    pthread_cond_destroy(&run.cond);
+    if (started == 0 || (k < run.nshards && !quit)) return HDLC_ERR_NO_MEM; // Threads or memory ran out
+    return frames;
+}
+
+/**
+ * @brief HDLC decode a capture file
+ *
+ * Map the file and decode it with hdlc_capture_decode
+ *
+ * @param[in] *path  - capture file
+ * @param[in] *conf  - settings, NULL for the defaults
+ * @param[in] cb     - frame callback, called from this thread
+ * @param[in] *arg   - argument handed to cb
+ * @param[out] *stats - decoder counters of the frames handed over, NULL for none
+ *
+ * @return HDLC_ERR_PARAM  invalid argument
+ *         HDLC_ERR_NO_MEM out of memory or threads
+ *         HDLC_ERR_IO     the file could not be mapped
+ *         x               frames handed to cb
+ *
+ * @note None
+ * @warning The file must not shrink while it is decoded
+ */
+long long hdlc_capture_file(const char *path, const struct hdlc_cap_conf *conf,
+                            hdlc_capture_cb cb, void *arg, struct hdlc_stats *stats)
+{
+    const unsigned char *buf;
+    long long len, ret;
+
+    if (path == NULL || cb == NULL) return HDLC_ERR_PARAM;
+    if ((buf = hdlc_cap_map(path, &len)) == NULL) return HDLC_ERR_IO;
+    ret = hdlc_capture_decode(buf, len, conf, cb, arg, stats);
+    hdlc_cap_unmap(buf, len);
+    return ret;
+}
+
+/**
+ * @brief HDLC index a capture file
+ *
+ * Decode the capture file and write the list of its frames to the index
+ * file: a 32 byte header and 16 bytes per frame holding its capture offset,
+ * its capture size and its message size and status
+ *
+ * @param[in] *path  - capture file
+ * @param[in] *index - index file, replaced
+ * @param[in] *conf  - settings, NULL for the defaults
+ * @param[out] *stats - decoder counters, NULL for none
+ *
+ * @return HDLC_ERR_PARAM  invalid argument
+ *         HDLC_ERR_NO_MEM out of memory or threads
+ *         HDLC_ERR_IO     a file could not be mapped or written
+ *         x               frames in the index
+ *
+ * @note None
+ * @warning None
+ */
+long long hdlc_capture_index(const char *path, const char *index, const struct hdlc_cap_conf *conf,
+                             struct hdlc_stats *stats)
+{
+    struct hdlc_cap_writer w;
+    unsigned char head[INDEX_HEAD];
+    const unsigned char *buf;
+    long long len, frames;
+    int size, fcs;
+
+    if (path == NULL || index == NULL) return HDLC_ERR_PARAM;
+    if ((buf = hdlc_cap_map(path, &len)) == NULL) return HDLC_ERR_IO;
+    if ((w.f = fopen(index, "wb")) == NULL)
+    {
+        hdlc_cap_unmap(buf, len);
+        return HDLC_ERR_IO;
+    }
+    w.err = 0;
+    hdlc_cap_settings(conf, &size, &fcs);
+    memcpy(head, INDEX_MAGIC, 8);
+    hdlc_cap_put(head + 8, len, 8);
+    hdlc_cap_put(head + 16, 0, 8); // Frames, once they are known
+    hdlc_cap_put(head + 24, fcs, 4);
+    hdlc_cap_put(head + 28, size, 4);
+    if (fwrite(head, INDEX_HEAD, 1, w.f) != 1) w.err = 1;
+
+    frames = w.err ? 0 : hdlc_capture_decode(buf, len, conf, hdlc_cap_write_cb, &w, stats);
+    hdlc_cap_unmap(buf, len);
+    if (frames >= 0 && !w.err)
+    {
+        hdlc_cap_put(head + 16, frames, 8);
+        if (fseek(w.f, 0, SEEK_SET) != 0 || fwrite(head, INDEX_HEAD, 1, w.f) != 1) w.err = 1;
+    }
+    if (fclose(w.f) != 0) w.err = 1;
+    if (frames < 0 || w.err)
+    {
+        unlink(index);
+        return frames < 0 ? frames : HDLC_ERR_IO;
+    }
+    return frames;
+}
+
+/**
+ * @brief HDLC open a capture index
+ *
+ * Map an index written by hdlc_capture_index and the capture it lists
+ *
+ * @param[in] *index - index file
+ * @param[in] *path  - capture file
+ *
+ * @return NULL failure, or the capture is not the one indexed
+ *         x    index
+ *
+ * @note None
+ * @warning None
+ */
+hdlc_index_t *hdlc_index_open(const char *index, const char *path)
+{
+    hdlc_index_t *ix;
+    int size, fcs;
+
+    if (index == NULL || path == NULL) return NULL;
+    if ((ix = calloc(1, sizeof(*ix))) == NULL) return NULL;
+    if ((ix->map = hdlc_cap_map(index, &ix->mapLen)) == NULL)
+    {
+        free(ix);
+        return NULL;
+    }
+    if ((ix->cap = hdlc_cap_map(path, &ix->capLen)) == NULL)
+    {
+        hdlc_cap_unmap(ix->map, ix->mapLen);
+        free(ix);
+        return NULL;
+    }
+
+    if (ix->mapLen >= INDEX_HEAD && memcmp(ix->map, INDEX_MAGIC, 8) == 0)
+    {
+        ix->count = hdlc_cap_get(ix->map + 16, 8);
+        fcs = hdlc_cap_get(ix->map + 24, 4);
+        size = hdlc_cap_get(ix->map + 28, 4);
+        ix->fcsLen = fcs / 8;
+        ix->max = size*2 + ix->fcsLen;
+        if ((long long)hdlc_cap_get(ix->map + 8, 8) == ix->capLen && ix->count >= 0 &&
+            ix->count <= (ix->mapLen - INDEX_HEAD) / INDEX_REC && ix->mapLen == INDEX_HEAD + ix->count * INDEX_REC &&
+            (fcs == HDLC_FCS16 || fcs == HDLC_FCS32) && size > 0 && size <= CAP_SIZE_MAX &&
+            (ix->buf = malloc(ix->max)) != NULL)
+            return ix;
+    }
+    hdlc_index_close(ix);
+    return NULL;
+}
+
+/**
+ * @brief HDLC frames in a capture index
+ *
+ * @param[in] *ix - index
+ *
+ * @return -1 failure
+ *         x  frames
+ *
+ * @note None
+ * @warning None
+ */
+long long hdlc_index_count(hdlc_index_t *ix)
+{
+    if (ix == NULL) return -1;
+    return ix->count;
+}
+
+/**
+ * @brief HDLC read a frame through a capture index
+ *
+ * Decode frame n again from its own bytes of the capture
+ *
+ * @param[in] *ix     - index
+ * @param[in] n       - frame, 0 for the first one in the capture
+ * @param[out] *frame - frame, ptr valid until the next call on ix
+ *
+ * @return 0 pass
+ *        -1 failure, n out of range or the capture changed
+ *
+ * @note None
+ * @warning None
+ */
+int hdlc_index_frame(hdlc_index_t *ix, long long n, struct hdlc_cap_frame *frame)
+{
+    const unsigned char *rec;
+    struct hdlc_stats stats;
+    unsigned int len;
+    long long offset;
+    int raw;
+
+    if (ix == NULL || frame == NULL || n < 0 || n >= ix->count) return -1;
+
+    rec = ix->map + INDEX_HEAD + n * INDEX_REC;
+    offset = hdlc_cap_get(rec, 8);
+    raw = hdlc_cap_get(rec + 8, 4);
+    len = hdlc_cap_get(rec + 12, 4);
+    if (offset < 1 || raw <= 0 || offset + raw >= ix->capLen ||
+        ix->cap[offset - 1] != FLAG_SEQUENCE || ix->cap[offset + raw] != FLAG_SEQUENCE)
+        return -1;
+    if (hdlc_cap_message(ix->cap + offset, raw, ix->max, ix->fcsLen, ix->buf, frame, &stats) == 0) return -1;
+    if ((unsigned int)frame->len != (len & 0x7fffffff) || (unsigned int)frame->status != len >> 31) return -1;
+    frame->offset = offset;
+    frame->raw = raw;
+    return 0;
+}
+
+/**
+ * @brief HDLC close a capture index
+ *
+ * @param[in] *ix - index
+ *
+ * @return 0 pass
+ *        -1 failure
+ *
+ * @note None
+ * @warning None
+ */
+int hdlc_index_close(hdlc_index_t *ix)
+{
+    if (ix == NULL) return -1;
+    hdlc_cap_unmap(ix->map, ix->mapLen);
+    hdlc_cap_unmap(ix->cap, ix->capLen);
+    free(ix->buf);
+    free(ix);
+    return 0;
+}
+
+/**
+ * @brief HDLC capture worker thread
+ *
+ * Take the next shard while it is within the window of the delivery and
+ * decode it into its slot
+ *
+ * @param[in] *arg - struct hdlc_cap_run
+ *
+ * @return NULL
+ */
+static void *hdlc_cap_worker(void *arg)
+{
+    struct hdlc_cap_run *run = arg;
+    struct hdlc_cap_shard *s;
+    long long k;
+    int ret;
+
+    pthread_mutex_lock(&run->lock);
+    for (;;)
+    {
+        while (!run->stop && run->next < run->nshards && run->next >= run->delivered + run->window)
+            pthread_cond_wait(&run->cond, &run->lock);
+        if (run->stop || run->next >= run->nshards) break;
+        k = run->next++;
+        s = &run->slots[k % run->window];
+        s->state = SHARD_BUSY;
+        pthread_mutex_unlock(&run->lock);
+
+        ret = hdlc_cap_shard_decode(run, k, s);
+
+        pthread_mutex_lock(&run->lock);
+        s->state = (ret == 0) ? SHARD_DONE : SHARD_FAILED;
+        pthread_cond_broadcast(&run->cond);
+    }
+    pthread_mutex_unlock(&run->lock);
+    return NULL;
+}
+
+/**
+ * @brief HDLC decode a capture shard
+ *
+ * Decode every message between two flags, from the shard's first flag to
+ * the next shard's first flag (or the end of the capture)
+ *
+ * @param[in] *run - capture run
+ * @param[in] k    - shard
+ * @param[out] *s  - slot taking the frames
+ *
+ * @return 0 pass
+ *        -1 out of memory
+ */
+static int hdlc_cap_shard_decode(struct hdlc_cap_run *run, long long k, struct hdlc_cap_shard *s)
+{
+    const unsigned char *buf = run->buf, *q;
+    struct hdlc_cap_frame frame;
+    struct hdlc_cap_rec *r;
+    long long p, end, lim, raw, need;
+    unsigned char *grown;
+
+    s->nrecs = 0;
+    s->blobLen = 0;
+    memset(&s->stats, 0, sizeof(s->stats));
+    p = (k == 0) ? 0 : hdlc_cap_flag(run, k * run->shard);
+    end = (k + 1 == run->nshards) ? run->len : hdlc_cap_flag(run, (k + 1) * run->shard);
+    if (p >= end) return 0; // A message spans the whole nominal shard
+    s->stats.bytesIn = end - p;
+    lim = (end < run->len) ? end + 1 : end; // The next shard's first flag closes the last message
+
+    if (buf[p] != FLAG_SEQUENCE)
+    { // Start of the capture, hunt for the first flag
+        s->stats.resyncs++;
+        if ((q = memchr(buf + p, FLAG_SEQUENCE, lim - p)) == NULL) return 0;
+        p = q - buf;
+    }
+
+    while ((q = memchr(buf + p + 1, FLAG_SEQUENCE, lim - p - 1)) != NULL)
+    {
+        raw = q - buf - p - 1;
+        if (raw > 0)
+        {
+            if (s->nrecs == s->maxrecs)
+            {
+                need = s->maxrecs ? s->maxrecs * 2 : CAP_RECS;
+                if ((grown = realloc(s->recs, need * sizeof(*s->recs))) == NULL) return -1;
+                s->recs = (struct hdlc_cap_rec *)grown;
+                s->maxrecs = need;
+            }
+            need = s->blobLen + (raw < run->max ? raw : run->max);
+            if (need > s->blobCap)
+            {
+                need = (need > 2 * s->blobCap) ? need : 2 * s->blobCap;
+                if ((grown = realloc(s->blob, need)) == NULL) return -1;
+                s->blob = grown;
+                s->blobCap = need;
+            }
+
+            if (hdlc_cap_message(buf + p + 1, raw, run->max, run->fcsLen, s->blob + s->blobLen, &frame, &s->stats))
+            {
+                r = &s->recs[s->nrecs++];
+                r->offset = p + 1;
+                r->raw = raw;
+                r->len = frame.len;
+                r->status = frame.status;
+                if (frame.ptr == buf + p + 1)
+                    r->data = -1;
+                else
+                {
+                    r->data = s->blobLen;
+                    s->blobLen += frame.len;
+                }
+            }
+        }
+        p = q - buf;
+    }
+    return 0;
+}
+
+/**
+ * @brief HDLC capture decode one message
+ *
+ * Decode the bytes between two flags the way a channel would: left in
+ * place when there are no escapes, else unescaped to out, then checked
+ *
+ * @param[in] *seg    - capture bytes after the opening flag, up to the closing one
+ * @param[in] raw     - number of them
+ * @param[in] max     - largest message with its FCS
+ * @param[in] fcsLen  - FCS bytes
+ * @param[out] *out   - room for min(raw, max) bytes
+ * @param[out] *frame - message (ptr, len and status)
+ * @param[in,out] *stats - decoder counters
+ *
+ * @return 1 message
+ *         0 none: aborted, too big or too short
+ */
+static int hdlc_cap_message(const unsigned char *seg, long long raw, int max, int fcsLen, unsigned char *out,
+                            struct hdlc_cap_frame *frame, struct hdlc_stats *stats)
+{
+    const unsigned char *ptr = seg;
+    int n = 0, len;
+
+    if (raw <= 2LL * max)
+        n = hdlc_scan(seg, raw);
+    if (raw > 2LL * max)
+    { // At least half of it is message, too big whatever it holds
+        len = max + 1;
+    }
+    else if (n == raw)
+    { // No escapes
+        len = raw;
+    }
+    else
+    {
+        len = hdlc_unescape(out, max, seg, raw, &n);
+        stats->escapesIn += n - len;
+        if (n == raw - 1 && seg[n] == CONTROL_ESCAPE)
+        { // Escape + flag
+            stats->escapesIn++;
+            stats->aborts++;
+            return 0;
+        }
+        if (n < raw) len = max + 1;
+        ptr = out;
+    }
+
+    if (len > max)
+    { // No end within the channel limit, hunt for the next flag
+        stats->overruns++;
+        stats->resyncs++;
+        return 0;
+    }
+    if (len <= fcsLen) return 0; // Two flags in a row, or only an FCS
+
+    frame->ptr = ptr;
+    frame->len = len - fcsLen;
+    if (fcsLen == 4)
+        frame->status = (hdlc_fcs32(PPPINITFCS32, ptr, len) == PPPGOODFCS32) ? HDLC_FRAME_OK : HDLC_FRAME_BAD_FCS;
+    else
+        frame->status = (hdlc_fcs16(PPPINITFCS16, ptr, len) == PPPGOODFCS16) ? HDLC_FRAME_OK : HDLC_FRAME_BAD_FCS;
+    if (frame->status == HDLC_FRAME_OK)
+        stats->framesOk++;
+    else
+        stats->fcsErrors++;
+    return 1;
+}
+
+/**
+ * @brief HDLC capture find a flag
+ *
+ * @param[in] *run - capture run
+ * @param[in] pos  - where to look from
+ *
+ * @return offset of the first FLAG SEQUENCE at or after pos, the capture size if none
+ */
+static long long hdlc_cap_flag(const struct hdlc_cap_run *run, long long pos)
+{
+    const unsigned char *q;
+
+    if (pos >= run->len) return run->len;
+    q = memchr(run->buf + pos, FLAG_SEQUENCE, run->len - pos);
+    return (q == NULL) ? run->len : q - run->buf;
+}
+
+/**
+ * @brief HDLC capture add up decoder counters
+ *
+ * @param[in,out] *sum - total
+ * @param[in] *add     - counters of one shard
+ */
+static void hdlc_cap_stats_add(struct hdlc_stats *sum, const struct hdlc_stats *add)
+{
+    sum->framesOk += add->framesOk;
+    sum->fcsErrors += add->fcsErrors;
+    sum->overruns += add->overruns;
+    sum->aborts += add->aborts;
+    sum->resyncs += add->resyncs;
+    sum->bytesIn += add->bytesIn;
+    sum->escapesIn += add->escapesIn;
+}
+
+/**
+ * @brief HDLC capture channel settings
+ *
+ * @param[in] *conf - settings, NULL for the defaults
+ * @param[out] *size - largest message
+ * @param[out] *fcs  - FCS width
+ */
+static void hdlc_cap_settings(const struct hdlc_cap_conf *conf, int *size, int *fcs)
+{
+    *size = (conf != NULL && conf->size != 0) ? conf->size : HDLC_MAX;
+    *fcs = (conf != NULL && conf->fcs != 0) ? conf->fcs : HDLC_FCS16;
+}
+
+/**
+ * @brief HDLC map a file
+ *
+ * @param[in] *path - file
+ * @param[out] *len - its size
+ *
+ * @return NULL failure
+ *         x    read only mapping (an empty string for an empty file)
+ */
+static const unsigned char *hdlc_cap_map(const char *path, long long *len)
+{
+    struct stat st;
+    void *map;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0) return NULL;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return NULL;
+    }
+    *len = st.st_size;
+    if (*len == 0)
+    {
+        close(fd);
+        return (const unsigned char *)"";
+    }
+    map = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+    madvise(map, *len, MADV_SEQUENTIAL); // Every thread reads its shard front to back
+    return map;
+}
+
+/**
+ * @brief HDLC unmap a file
+ *
+ * @param[in] *buf - mapping from hdlc_cap_map
+ * @param[in] len  - its size
+ */
+static void hdlc_cap_unmap(const unsigned char *buf, long long len)
+{
+    if (len > 0) munmap((void *)buf, len);
+}
+
+/**
+ * @brief HDLC capture index writer
+ *
+ * Append the index record of a frame
+ *
+ * @param[in] *frame - frame
+ * @param[in] *arg   - struct hdlc_cap_writer
+ *
+ * @return 0 continue
+ *         1 stop, the index could not be written
+ */
+static int hdlc_cap_write_cb(const struct hdlc_cap_frame *frame, void *arg)
+{
+    struct hdlc_cap_writer *w = arg;
+    unsigned char rec[INDEX_REC];
+
+    hdlc_cap_put(rec, frame->offset, 8);
+    hdlc_cap_put(rec + 8, frame->raw, 4);
+    hdlc_cap_put(rec + 12, (unsigned int)frame->len | (unsigned int)frame->status << 31, 4);
+    if (fwrite(rec, INDEX_REC, 1, w->f) != 1) w->err = 1;
+    return w->err;
+}
+
+/**
+ * @brief HDLC store a little endian number
+ *
+ * @param[out] *out - n bytes
+ * @param[in] v     - number
+ * @param[in] n     - bytes to store
+ */
+static void hdlc_cap_put(unsigned char *out, unsigned long long v, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        out[i] = v >> (8 * i);
+}
+
+/**
+ * @brief HDLC load a little endian number
+ *
+ * @param[in] *in - n bytes
+ * @param[in] n   - bytes to load
+ *
+ * @return number
+ */
+static unsigned long long hdlc_cap_get(const unsigned char *in, int n)
+{
+    unsigned long long v = 0;
+    int i;
+
+    for (i = n - 1; i >= 0; i--)
+        v = v << 8 | in[i];
+    return v;
+}
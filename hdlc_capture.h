@@ -0,0 +1,62 @@
+/*!
+ * @file
+ * @author Mark Koi
+ *
+ * This is the header file for the offline decoder of raw capture files (the
+ * received byte stream of a link recorded to disk).
+ *
+ *  - The capture is mapped, not read, and cut into shards at FLAG SEQUENCE
+ *    bytes, which never occur inside an escaped message.  A message that
+ *    crosses the nominal shard edge belongs to the shard it starts in.
+ *  - Shards decode on all the cores, the frames reach the callback from the
+ *    calling thread in capture order, with their capture offset.
+ *  - hdlc_capture_index saves that list as an index of 16 bytes per frame,
+ *    hdlc_index_open and hdlc_index_frame then reach any frame again by
+ *    decoding only its own bytes.
+ *
+ * The control character map is not applied (received control characters
+ * are kept), the same as a channel with the default map.
+ */
+#ifndef HDLC_CAPTURE_H
+#define HDLC_CAPTURE_H
+
+#include "hdlc.h"
+
+#define HDLC_CAP_SHARD  (4 << 20) // Default capture bytes per shard
+
+typedef struct hdlc_index hdlc_index_t;
+
+// Capture decoding settings, a NULL config or a zero field takes the default
+struct hdlc_cap_conf
+{
+    int       size;     // Largest message, default HDLC_MAX
+    int       fcs;      // HDLC_FCS16 (default) or HDLC_FCS32
+    int       threads;  // Decode threads, default one per core
+    long long shard;    // Capture bytes per shard, default HDLC_CAP_SHARD
+};
+
+// Frame found in a capture
+struct hdlc_cap_frame
+{
+    const unsigned char *ptr;   // Message data (FCS removed), only valid during the call
+    int                  len;   // Size of message data
+    int                  status; // enum hdlc_frame_status
+    long long            offset; // Capture offset of the first byte after the opening flag
+    int                  raw;   // Capture bytes up to the closing flag
+};
+
+// Frame delivery in capture order, return non zero to stop
+typedef int (*hdlc_capture_cb)(const struct hdlc_cap_frame *frame, void *arg);
+
+long long hdlc_capture_decode(const unsigned char *buf, long long len, const struct hdlc_cap_conf *conf,
+                              hdlc_capture_cb cb, void *arg, struct hdlc_stats *stats);
+long long hdlc_capture_file(const char *path, const struct hdlc_cap_conf *conf,
+                            hdlc_capture_cb cb, void *arg, struct hdlc_stats *stats);
+long long hdlc_capture_index(const char *path, const char *index, const struct hdlc_cap_conf *conf,
+                             struct hdlc_stats *stats);
+hdlc_index_t *hdlc_index_open(const char *index, const char *path);
+long long hdlc_index_count(hdlc_index_t *ix);
+int hdlc_index_frame(hdlc_index_t *ix, long long n, struct hdlc_cap_frame *frame);
+int hdlc_index_close(hdlc_index_t *ix);
+
+#endif
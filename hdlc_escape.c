@@ -0,0 +1,1124 @@
+/*!
+ * @file
+ * @author Mark Koi
+ *
+ * This file holds the octet stuffing kernels used by the hdlc codec.  Each
+ * kernel comes in an AVX2 (32 bytes per step), SSE2 (16 bytes per step) and
+ * scalar flavour, selected at runtime by CPU feature detection.  The ACCM
+ * kernels classify bytes against a 256 bit character map with a nibble
+ * table lookup (PSHUFB), so they need SSSE3 at the SSE2 level.
+ */
+#include <pthread.h>
+#include "hdlc.h"
+#include "hdlc_priv.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HDLC_HAVE_SIMD 1        // Compiler can build the SSE2/AVX2 kernels
+#define UNESCAPE_DENSE  4       // Escapes per 16 bytes past which a block that cannot be collapsed goes scalar
+#define UNESCAPE_RUN    256     // Bytes then handed to the scalar kernel, one call per block costs more than it saves
+#include <immintrin.h>
+#endif
+
+typedef int (*hdlc_escape_fn)(unsigned char *out, int cap, const unsigned char *in, int len, int avail);
+typedef int (*hdlc_unescape_fn)(unsigned char *out, int cap, const unsigned char *in, int len, int *used);
+typedef int (*hdlc_scan_fn)(const unsigned char *in, int len);
+typedef int (*hdlc_escape_map_fn)(unsigned char *out, int cap, const unsigned char *in, int len, int avail,
+                                  const struct hdlc_accm *map);
+typedef int (*hdlc_unescape_map_fn)(unsigned char *out, int cap, const unsigned char *in, int len, int *used,
+                                    const struct hdlc_accm *map);
+typedef int (*hdlc_scan_map_fn)(const unsigned char *in, int len, const struct hdlc_accm *map);
+
+// Locally defined variables
+static pthread_once_t simd_once = PTHREAD_ONCE_INIT;
+static hdlc_escape_fn escape = NULL;            // Kernels in use
+static hdlc_unescape_fn unescape = NULL;
+static hdlc_scan_fn scan = NULL;
+static hdlc_escape_map_fn escapeMap = NULL;
+static hdlc_unescape_map_fn unescapeMap = NULL;
+static hdlc_scan_map_fn scanMap = NULL;
+static enum hdlc_simd_level simdlevel = HDLC_SIMD_AUTO;
+#ifdef HDLC_HAVE_SIMD
+static unsigned long long compactIdx[256];      // PSHUFB indices of the kept bytes, by bitmap of the 8 dropped
+static unsigned char compactKept[256];          // Bytes kept, by the same bitmap (no POPCNT before SSE4.2)
+static int compactOk = 0;                       // SSE2 unescape may collapse dense blocks (SSSE3)
+#endif
+
+// Locally defined functions (see below for function header information)
+static void hdlc_simd_init(void);
+static int hdlc_simd_use(enum hdlc_simd_level level);
+static int hdlc_escape_scalar(unsigned char *out, int cap, const unsigned char *in, int len, int avail);
+static int hdlc_unescape_scalar(unsigned char *out, int cap, const unsigned char *in, int len, int *used);
+static int hdlc_scan_scalar(const unsigned char *in, int len);
+static int hdlc_escape_map_scalar(unsigned char *out, int cap, const unsigned char *in, int len, int avail,
+                                  const struct hdlc_accm *map);
+static int hdlc_unescape_map_scalar(unsigned char *out, int cap, const unsigned char *in, int len, int *used,
+                                    const struct hdlc_accm *map);
+static int hdlc_scan_map_scalar(const unsigned char *in, int len, const struct hdlc_accm *map);
+#ifdef HDLC_HAVE_SIMD
+static int hdlc_escape_sse2(unsigned char *out, int cap, const unsigned char *in, int len, int avail);
+static int hdlc_escape_avx2(unsigned char *out, int cap, const unsigned char *in, int len, int avail);
+static int hdlc_unescape_sse2(unsigned char *out, int cap, const unsigned char *in, int len, int *used);
+static int hdlc_unescape_avx2(unsigned char *out, int cap, const unsigned char *in, int len, int *used);
+static int hdlc_scan_sse2(const unsigned char *in, int len);
+static int hdlc_scan_avx2(const unsigned char *in, int len);
+static int hdlc_escape_map_ssse3(unsigned char *out, int cap, const unsigned char *in, int len, int avail,
+                                 const struct hdlc_accm *map);
+static int hdlc_escape_map_avx2(unsigned char *out, int cap, const unsigned char *in, int len, int avail,
+                                const struct hdlc_accm *map);
+static int hdlc_unescape_map_ssse3(unsigned char *out, int cap, const unsigned char *in, int len, int *used,
+                                   const struct hdlc_accm *map);
+static int hdlc_scan_map_ssse3(const unsigned char *in, int len, const struct hdlc_accm *map);
+static int hdlc_scan_map_avx2(const unsigned char *in, int len, const struct hdlc_accm *map);
+#endif
+
+/**
+ * @brief HDLC select SIMD kernels
+ *
+ * Force a specific instruction set for the octet stuffing kernels
+ * (benchmarks, comparisons) or go back to the best one the CPU supports.
+ *
+ * @param[in] level - HDLC_SIMD_AUTO or a specific instruction set
+ *
+ * @return level now in use
+ *        -1 level not supported by this CPU or build
+ *
+ * @note Select the level before starting threads that use the codec
+ * @warning None
+ */
+int hdlc_simd_select(enum hdlc_simd_level level)
+{
+    pthread_once(&simd_once, hdlc_simd_init);
+    return hdlc_simd_use(level);
+}
+
+/**
+ * @brief HDLC SIMD kernels in use
+ *
+ * @return level selected by hdlc_simd_select (never HDLC_SIMD_AUTO)
+ */
+enum hdlc_simd_level hdlc_simd_selected(void)
+{
+    pthread_once(&simd_once, hdlc_simd_init);
+    return simdlevel;
+}
+
+/**
+ * @brief HDLC escape a block of data
+ *
+ * Copy data to the output and escape every FLAG SEQUENCE and CONTROL ESCAPE.
+ * Runs without escapes are copied with wide stores, only the lanes that
+ * need escaping are expanded.
+ *
+ * @param[out] *out - output buffer
+ * @param[in] cap   - room in the output buffer, never written past
+ * @param[in] *in   - data to escape
+ * @param[in] len   - size of data to escape
+ * @param[in] avail - readable bytes at in (>= len), lets kernels load ahead
+ *
+ * @return size of escaped data in out
+ *        -1 escaped data does not fit in cap
+ *
+ * @note None
+ * @warning None
+ */
+int hdlc_escape(unsigned char *out, int cap, const unsigned char *in, int len, int avail)
+{
+    pthread_once(&simd_once, hdlc_simd_init);
+    return escape(out, cap, in, len, avail);
+}
+
+/**
+ * @brief HDLC unescape a block of data
+ *
+ * Copy data to the output and undo every control escape, stopping at the
+ * first FLAG SEQUENCE.  Flags and escapes are located a block at a time and
+ * everything between them is copied with wide stores.
+ *
+ * @param[out] *out  - output buffer
+ * @param[in] cap    - room in the output buffer, never written past
+ * @param[in] *in    - data to unescape
+ * @param[in] len    - size of data to unescape
+ * @param[out] *used - amount of data consumed
+ *
+ * @return size of unescaped data in out.  On return in[*used] (if *used < len)
+ *         is a FLAG SEQUENCE, a CONTROL ESCAPE that is the last byte or is
+ *         followed by a flag, or the byte that did not fit in cap.
+ *
+ * @note None
+ * @warning None
+ */
+int hdlc_unescape(unsigned char *out, int cap, const unsigned char *in, int len, int *used)
+{
+    pthread_once(&simd_once, hdlc_simd_init);
+    return unescape(out, cap, in, len, used);
+}
+
+/**
+ * @brief HDLC find the next flag or control escape
+ *
+ * @param[in] *in - data to scan
+ * @param[in] len - size of data
+ *
+ * @return offset of the first FLAG SEQUENCE or CONTROL ESCAPE, len if none
+ *
+ * @note None
+ * @warning None
+ */
+int hdlc_scan(const unsigned char *in, int len)
+{
+    pthread_once(&simd_once, hdlc_simd_init);
+    return scan(in, len);
+}
+
+/**
+ * @brief HDLC escape a block of data with a character map
+ *
+ * Same as hdlc_escape, escaping every character in the map (which holds
+ * FLAG SEQUENCE and CONTROL ESCAPE).
+ *
+ * @param[out] *out - output buffer
+ * @param[in] cap   - room in the output buffer, never written past
+ * @param[in] *in   - data to escape
+ * @param[in] len   - size of data to escape
+ * @param[in] avail - readable bytes at in (>= len), lets kernels load ahead
+ * @param[in] *map  - characters to escape
+ *
+ * @return size of escaped data in out
+ *        -1 escaped data does not fit in cap
+ *
+ * @note None
+ * @warning None
+ */
+int hdlc_escape_map(unsigned char *out, int cap, const unsigned char *in, int len, int avail,
+                    const struct hdlc_accm *map)
+{
+    pthread_once(&simd_once, hdlc_simd_init);
+    return escapeMap(out, cap, in, len, avail, map);
+}
+
+/**
+ * @brief HDLC unescape a block of data with a character map
+ *
+ * Same as hdlc_unescape, also discarding the characters of the map other
+ * than FLAG SEQUENCE and CONTROL ESCAPE wherever they show up (RFC 1662,
+ * they were added by the link, the peer escapes the real ones).
+ *
+ * @param[out] *out  - output buffer
+ * @param[in] cap    - room in the output buffer, never written past
+ * @param[in] *in    - data to unescape
+ * @param[in] len    - size of data to unescape
+ * @param[out] *used - amount of data consumed
+ * @param[in] *map   - characters to discard, with FLAG SEQUENCE and CONTROL ESCAPE
+ *
+ * @return size of unescaped data in out.  On return in[*used] (if *used < len)
+ *         is a FLAG SEQUENCE, a CONTROL ESCAPE followed only by discarded
+ *         characters and possibly a flag, or the byte that did not fit in cap.
+ *
+ * @note None
+ * @warning None
+ */
+int hdlc_unescape_map(unsigned char *out, int cap, const unsigned char *in, int len, int *used,
+                      const struct hdlc_accm *map)
+{
+    pthread_once(&simd_once, hdlc_simd_init);
+    return unescapeMap(out, cap, in, len, used, map);
+}
+
+/**
+ * @brief HDLC find the next character of a map
+ *
+ * @param[in] *in  - data to scan
+ * @param[in] len  - size of data
+ * @param[in] *map - characters to look for
+ *
+ * @return offset of the first character in the map, len if none
+ *
+ * @note None
+ * @warning None
+ */
+int hdlc_scan_map(const unsigned char *in, int len, const struct hdlc_accm *map)
+{
+    pthread_once(&simd_once, hdlc_simd_init);
+    return scanMap(in, len, map);
+}
+
+/**
+ * @brief HDLC SIMD kernel init
+ *
+ * Pick the kernels for this CPU.  Runs once per process.
+ */
+static void hdlc_simd_init(void)
+{
+#ifdef HDLC_HAVE_SIMD
+    unsigned int drop, j, n;
+
+    for (drop = 0; drop < 256; drop++)
+    { // Kept bytes in order, the unused indices point at byte 0
+        for (j = 0, n = 0; j < 8; j++)
+            if (!(drop >> j & 1))
+                compactIdx[drop] |= (unsigned long long)j << (8 * n++);
+        compactKept[drop] = n;
+    }
+#endif
+    hdlc_simd_use(HDLC_SIMD_AUTO);
+}
+
+/**
+ * @brief HDLC switch SIMD kernels
+ *
+ * @param[in] level - HDLC_SIMD_AUTO or a specific instruction set
+ *
+ * @return level now in use
+ *        -1 level not supported by this CPU or build
+ */
+static int hdlc_simd_use(enum hdlc_simd_level level)
+{
+    switch (level)
+    {
+        case HDLC_SIMD_AUTO:
+#ifdef HDLC_HAVE_SIMD
+            if (__builtin_cpu_supports("avx2"))
+                return hdlc_simd_use(HDLC_SIMD_AVX2);
+            if (__builtin_cpu_supports("sse2"))
+                return hdlc_simd_use(HDLC_SIMD_SSE2);
+#endif
+            return hdlc_simd_use(HDLC_SIMD_SCALAR);
+        case HDLC_SIMD_SCALAR:
+            escape = hdlc_escape_scalar;
+            unescape = hdlc_unescape_scalar;
+            scan = hdlc_scan_scalar;
+            escapeMap = hdlc_escape_map_scalar;
+            unescapeMap = hdlc_unescape_map_scalar;
+            scanMap = hdlc_scan_map_scalar;
+            break;
+#ifdef HDLC_HAVE_SIMD
+        case HDLC_SIMD_SSE2:
+            if (!__builtin_cpu_supports("sse2")) return -1; // Not supported
+            escape = hdlc_escape_sse2;
+            unescape = hdlc_unescape_sse2;
+            scan = hdlc_scan_sse2;
+            compactOk = __builtin_cpu_supports("ssse3");
+            if (compactOk)
+            {
+                escapeMap = hdlc_escape_map_ssse3;
+                unescapeMap = hdlc_unescape_map_ssse3;
+                scanMap = hdlc_scan_map_ssse3;
+            }
+            else
+            { // No PSHUFB, the map kernels stay table driven
+                escapeMap = hdlc_escape_map_scalar;
+                unescapeMap = hdlc_unescape_map_scalar;
+                scanMap = hdlc_scan_map_scalar;
+            }
+            break;
+        case HDLC_SIMD_AVX2:
+            if (!__builtin_cpu_supports("avx2")) return -1; // Not supported
+            escape = hdlc_escape_avx2;
+            unescape = hdlc_unescape_avx2;
+            scan = hdlc_scan_avx2;
+            escapeMap = hdlc_escape_map_avx2;
+            unescapeMap = hdlc_unescape_map_ssse3; // Stops at every discarded character, wider steps do not pay
+            scanMap = hdlc_scan_map_avx2;
+            break;
+#endif
+        default:
+            return -1; // Unknown or not built
+    }
+    simdlevel = level;
+    return level;
+}
+
+/**
+ * @brief HDLC escape a block of data, one byte at a time
+ *
+ * @param[out] *out - output buffer
+ * @param[in] cap   - room in the output buffer
+ * @param[in] *in   - data to escape
+ * @param[in] len   - size of data to escape
+ * @param[in] avail - readable bytes at in (unused)
+ *
+ * @return size of escaped data in out
+ *        -1 escaped data does not fit in cap
+ */
+static int hdlc_escape_scalar(unsigned char *out, int cap, const unsigned char *in, int len, int avail)
+{
+    unsigned char c;
+    int i, o = 0, room = cap >= len * 2; // Worst case fits, skip the bounds checks
+
+    (void)avail;
+    for (i = 0; i < len; i++)
+    {
+        c = in[i];
+        if (c == FLAG_SEQUENCE || c == CONTROL_ESCAPE)
+        {
+            if (!room && o + 2 > cap) return -1; // Buffer too small
+            out[o++] = CONTROL_ESCAPE;
+            c ^= 0x20;
+        }
+        else if (!room && o >= cap)
+            return -1; // Buffer too small
+        out[o++] = c;
+    }
+    return o;
+}
+
+/**
+ * @brief HDLC unescape a block of data, one byte at a time
+ *
+ * @param[out] *out  - output buffer
+ * @param[in] cap    - room in the output buffer
+ * @param[in] *in    - data to unescape
+ * @param[in] len    - size of data to unescape
+ * @param[out] *used - amount of data consumed
+ *
+ * @return size of unescaped data in out
+ */
+static int hdlc_unescape_scalar(unsigned char *out, int cap, const unsigned char *in, int len, int *used)
+{
+    unsigned char c;
+    int i = 0, o = 0;
+
+    while (i < len && o < cap)
+    {
+        c = in[i];
+        if (c == FLAG_SEQUENCE)
+            break; // End of message, left for the caller
+        if (c == CONTROL_ESCAPE)
+        {
+            if (i + 1 == len || in[i + 1] == FLAG_SEQUENCE)
+                break; // Escape split across calls or aborted message
+            c = in[++i] ^ 0x20;
+        }
+        out[o++] = c;
+        i++;
+    }
+    *used = i;
+    return o;
+}
+
+/**
+ * @brief HDLC find the next flag or control escape, one byte at a time
+ *
+ * @param[in] *in - data to scan
+ * @param[in] len - size of data
+ *
+ * @return offset of the first FLAG SEQUENCE or CONTROL ESCAPE, len if none
+ */
+static int hdlc_scan_scalar(const unsigned char *in, int len)
+{
+    int i;
+
+    for (i = 0; i < len; i++)
+        if (in[i] == FLAG_SEQUENCE || in[i] == CONTROL_ESCAPE)
+            break;
+    return i;
+}
+
+/**
+ * @brief HDLC escape a block of data with a character map, one byte at a time
+ *
+ * @param[out] *out - output buffer
+ * @param[in] cap   - room in the output buffer
+ * @param[in] *in   - data to escape
+ * @param[in] len   - size of data to escape
+ * @param[in] avail - readable bytes at in (unused)
+ * @param[in] *map  - characters to escape
+ *
+ * @return size of escaped data in out
+ *        -1 escaped data does not fit in cap
+ */
+static int hdlc_escape_map_scalar(unsigned char *out, int cap, const unsigned char *in, int len, int avail,
+                                  const struct hdlc_accm *map)
+{
+    unsigned char c;
+    int i, o = 0, room = cap >= len * 2; // Worst case fits, skip the bounds checks
+
+    (void)avail;
+    for (i = 0; i < len; i++)
+    {
+        c = in[i];
+        if (hdlc_accm_has(map, c))
+        {
+            if (!room && o + 2 > cap) return -1; // Buffer too small
+            out[o++] = CONTROL_ESCAPE;
+            c ^= 0x20;
+        }
+        else if (!room && o >= cap)
+            return -1; // Buffer too small
+        out[o++] = c;
+    }
+    return o;
+}
+
+/**
+ * @brief HDLC unescape a block of data with a character map, one byte at a time
+ *
+ * @param[out] *out  - output buffer
+ * @param[in] cap    - room in the output buffer
+ * @param[in] *in    - data to unescape
+ * @param[in] len    - size of data to unescape
+ * @param[out] *used - amount of data consumed
+ * @param[in] *map   - characters to discard, with FLAG SEQUENCE and CONTROL ESCAPE
+ *
+ * @return size of unescaped data in out
+ */
+static int hdlc_unescape_map_scalar(unsigned char *out, int cap, const unsigned char *in, int len, int *used,
+                                    const struct hdlc_accm *map)
+{
+    unsigned char c;
+    int i = 0, j, o = 0;
+
+    while (i < len)
+    {
+        c = in[i];
+        if (hdlc_accm_has(map, c))
+        {
+            if (c == FLAG_SEQUENCE)
+                break; // End of message, left for the caller
+            if (c != CONTROL_ESCAPE)
+            { // Discarded, takes no room
+                i++;
+                continue;
+            }
+            for (j = i + 1; j < len && in[j] != FLAG_SEQUENCE && in[j] != CONTROL_ESCAPE &&
+                            hdlc_accm_has(map, in[j]); j++)
+                ; // Discarded characters between the escape and its byte
+            if (j == len || in[j] == FLAG_SEQUENCE || o >= cap)
+                break; // Escape split across calls, aborted message or no room
+            c = in[j] ^ 0x20;
+            i = j;
+        }
+        else if (o >= cap)
+            break;
+        out[o++] = c;
+        i++;
+    }
+    *used = i;
+    return o;
+}
+
+/**
+ * @brief HDLC find the next character of a map, one byte at a time
+ *
+ * @param[in] *in  - data to scan
+ * @param[in] len  - size of data
+ * @param[in] *map - characters to look for
+ *
+ * @return offset of the first character in the map, len if none
+ */
+static int hdlc_scan_map_scalar(const unsigned char *in, int len, const struct hdlc_accm *map)
+{
+    int i;
+
+    for (i = 0; i < len; i++)
+        if (hdlc_accm_has(map, in[i]))
+            break;
+    return i;
+}
+
+#ifdef HDLC_HAVE_SIMD
+/**
+ * @brief HDLC escape a block of data, 16 bytes per step (SSE2)
+ *
+ * Every step stores the block as is.  For each lane that needs escaping the
+ * escape pair is written and the rest of the block is stored again one byte
+ * further along, so the cost is one store per escaped byte.
+ *
+ * @param[out] *out - output buffer
+ * @param[in] cap   - room in the output buffer
+ * @param[in] *in   - data to escape
+ * @param[in] len   - size of data to escape
+ * @param[in] avail - readable bytes at in, a step may load 16 bytes past its block
+ *
+ * @return size of escaped data in out
+ *        -1 escaped data does not fit in cap
+ */
+__attribute__((target("sse2")))
+static int hdlc_escape_sse2(unsigned char *out, int cap, const unsigned char *in, int len, int avail)
+{
+    const __m128i flag = _mm_set1_epi8(FLAG_SEQUENCE), esc = _mm_set1_epi8(CONTROL_ESCAPE);
+    __m128i v;
+    unsigned int m;
+    int i = 0, o = 0, d, t, rest;
+
+    // Worst case a step reads 32 bytes and writes 16 past its expanded block
+    while (i + 16 <= len && i + 32 <= avail && o + 48 <= cap)
+    {
+        v = _mm_loadu_si128((const __m128i *)(in + i));
+        m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, flag), _mm_cmpeq_epi8(v, esc)));
+        _mm_storeu_si128((__m128i *)(out + o), v);
+        for (d = 0; m; m &= m - 1, d++)
+        { // Expand only the lanes that need escaping
+            t = __builtin_ctz(m);
+            out[o + t + d] = CONTROL_ESCAPE;
+            out[o + t + d + 1] = in[i + t] ^ 0x20;
+            _mm_storeu_si128((__m128i *)(out + o + t + d + 2),
+                             _mm_loadu_si128((const __m128i *)(in + i + t + 1)));
+        }
+        i += 16;
+        o += 16 + d;
+    }
+
+    rest = hdlc_escape_scalar(out + o, cap - o, in + i, len - i, avail - i);
+    return (rest < 0) ? -1 : o + rest;
+}
+
+/**
+ * @brief HDLC escape a block of data, 32 bytes per step (AVX2)
+ *
+ * Same as the SSE2 kernel with 32 byte blocks, the tail is left to SSE2.
+ *
+ * @param[out] *out - output buffer
+ * @param[in] cap   - room in the output buffer
+ * @param[in] *in   - data to escape
+ * @param[in] len   - size of data to escape
+ * @param[in] avail - readable bytes at in, a step may load 32 bytes past its block
+ *
+ * @return size of escaped data in out
+ *        -1 escaped data does not fit in cap
+ */
+__attribute__((target("avx2")))
+static int hdlc_escape_avx2(unsigned char *out, int cap, const unsigned char *in, int len, int avail)
+{
+    const __m256i flag = _mm256_set1_epi8(FLAG_SEQUENCE), esc = _mm256_set1_epi8(CONTROL_ESCAPE);
+    __m256i v;
+    unsigned int m;
+    int i = 0, o = 0, d, t, rest;
+
+    // Worst case a step reads 64 bytes and writes 32 past its expanded block
+    while (i + 32 <= len && i + 64 <= avail && o + 96 <= cap)
+    {
+        v = _mm256_loadu_si256((const __m256i *)(in + i));
+        m = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, flag), _mm256_cmpeq_epi8(v, esc)));
+        _mm256_storeu_si256((__m256i *)(out + o), v);
+        for (d = 0; m; m &= m - 1, d++)
+        { // Expand only the lanes that need escaping
+            t = __builtin_ctz(m);
+            out[o + t + d] = CONTROL_ESCAPE;
+            out[o + t + d + 1] = in[i + t] ^ 0x20;
+            _mm256_storeu_si256((__m256i *)(out + o + t + d + 2),
+                                _mm256_loadu_si256((const __m256i *)(in + i + t + 1)));
+        }
+        i += 32;
+        o += 32 + d;
+    }
+    _mm256_zeroupper(); // Avoid AVX/SSE transition stalls in the SSE code that follows
+
+    rest = hdlc_escape_sse2(out + o, cap - o, in + i, len - i, avail - i);
+    return (rest < 0) ? -1 : o + rest;
+}
+
+/**
+ * @brief HDLC drop the escapes from 16 bytes already XORed in place (SSSE3)
+ *
+ * Each half is squeezed with one PSHUFB through the index table, the halves
+ * are then stored back to back.
+ *
+ * @param[out] *out - output buffer, room for 16 bytes
+ * @param[in] x     - block with the escaped bytes XORed back
+ * @param[in] drop  - bitmap of the bytes to drop
+ *
+ * @return size of data kept in out
+ */
+__attribute__((target("ssse3")))
+static inline int hdlc_compact_ssse3(unsigned char *out, __m128i x, unsigned int drop)
+{
+    unsigned int lo = drop & 0xff, hi = drop >> 8 & 0xff;
+    __m128i r;
+    int n;
+
+    r = _mm_shuffle_epi8(x, _mm_set_epi64x(compactIdx[hi] + 0x0808080808080808ull, compactIdx[lo]));
+    n = compactKept[lo];
+    _mm_storel_epi64((__m128i *)out, r);
+    _mm_storel_epi64((__m128i *)(out + n), _mm_srli_si128(r, 8));
+    return n + compactKept[hi];
+}
+
+/**
+ * @brief HDLC unescape a block of data, 16 bytes per step (SSE2)
+ *
+ * Two compares and two movemasks give bitmaps of the flags and escapes in
+ * the block.  A block without either is stored as is.  A block with escapes
+ * only is XORed with the escape compare shifted one lane up and the escapes
+ * are squeezed out with PSHUFB, when the CPU has it.  Otherwise the block is
+ * stored and every escape is collapsed in place: the unescaped byte is
+ * written and the rest of the input is stored again right behind it, up to
+ * the flag if any.  Past UNESCAPE_DENSE escapes that costs more than the
+ * scalar kernel, which then takes the next UNESCAPE_RUN bytes.
+ *
+ * @param[out] *out  - output buffer
+ * @param[in] cap    - room in the output buffer
+ * @param[in] *in    - data to unescape
+ * @param[in] len    - size of data to unescape
+ * @param[out] *used - amount of data consumed
+ *
+ * @return size of unescaped data in out
+ */
+__attribute__((target("sse2")))
+static int hdlc_unescape_sse2(unsigned char *out, int cap, const unsigned char *in, int len, int *used)
+{
+    const __m128i flag = _mm_set1_epi8(FLAG_SEQUENCE), esc = _mm_set1_epi8(CONTROL_ESCAPE);
+    const __m128i bit5 = _mm_set1_epi8(0x20);
+    __m128i v, e;
+    unsigned int m, f;
+    int i = 0, o = 0, d, p, t, rest;
+
+    // Worst case a step reads 17 bytes and writes 16 past its block
+    while (i + 33 <= len && o + 32 <= cap)
+    {
+        v = _mm_loadu_si128((const __m128i *)(in + i));
+        e = _mm_cmpeq_epi8(v, esc);
+        f = _mm_movemask_epi8(_mm_cmpeq_epi8(v, flag));
+        m = _mm_movemask_epi8(e);
+        if ((m | f) == 0)
+        { // Nothing special in the block
+            _mm_storeu_si128((__m128i *)(out + o), v);
+            i += 16;
+            o += 16;
+            continue;
+        }
+        if (f == 0 && (m & m << 1) == 0 && compactOk)
+        { // Escapes only, collapse the whole block (an escape in the last lane goes with the next one)
+            o += hdlc_compact_ssse3(out + o, _mm_xor_si128(v, _mm_and_si128(_mm_slli_si128(e, 1), bit5)), m);
+            i += (m & 0x8000) ? 15 : 16;
+            continue;
+        }
+        if (16 - compactKept[m & 0xff] - compactKept[m >> 8] > UNESCAPE_DENSE)
+        { // Too many escapes for one store each
+            t = (len - i < UNESCAPE_RUN) ? len - i : UNESCAPE_RUN;
+            o += hdlc_unescape_scalar(out + o, cap - o, in + i, t, &t);
+            i += t;
+            if (t == 0)
+                break; // Flag or aborted message
+            continue;
+        }
+        _mm_storeu_si128((__m128i *)(out + o), v);
+        for (m |= f, d = 0, p = 0; m; m &= m - 1)
+        {
+            t = __builtin_ctz(m);
+            if (t < p)
+                continue; // Escaped byte of the pair before
+            if (in[i + t] == FLAG_SEQUENCE || in[i + t + 1] == FLAG_SEQUENCE)
+                break; // Flag or aborted message
+            out[o + t - d] = in[i + t + 1] ^ 0x20;
+            _mm_storeu_si128((__m128i *)(out + o + t - d + 1), _mm_loadu_si128((const __m128i *)(in + i + t + 2)));
+            d++;
+            p = t + 2;
+        }
+        if (m)
+        { // Stopped on the bit at t
+            i += t;
+            o += t - d;
+            break;
+        }
+        p = (p > 16) ? p : 16; // The last pair may end past the block
+        i += p;
+        o += p - d;
+    }
+
+    rest = hdlc_unescape_scalar(out + o, cap - o, in + i, len - i, &t);
+    *used = i + t;
+    return o + rest;
+}
+
+/**
+ * @brief HDLC unescape a block of data, 32 bytes per step (AVX2)
+ *
+ * Same as the SSE2 kernel with 32 byte blocks, the tail is left to SSE2.
+ *
+ * @param[out] *out  - output buffer
+ * @param[in] cap    - room in the output buffer
+ * @param[in] *in    - data to unescape
+ * @param[in] len    - size of data to unescape
+ * @param[out] *used - amount of data consumed
+ *
+ * @return size of unescaped data in out
+ */
+__attribute__((target("avx2")))
+static int hdlc_unescape_avx2(unsigned char *out, int cap, const unsigned char *in, int len, int *used)
+{
+    const __m256i flag = _mm256_set1_epi8(FLAG_SEQUENCE), esc = _mm256_set1_epi8(CONTROL_ESCAPE);
+    const __m256i bit5 = _mm256_set1_epi8(0x20);
+    __m256i v, e;
+    unsigned int m, f;
+    int i = 0, o = 0, d, p, t, rest;
+
+    // Worst case a step reads 33 bytes and writes 32 past its block
+    while (i + 65 <= len && o + 64 <= cap)
+    {
+        v = _mm256_loadu_si256((const __m256i *)(in + i));
+        e = _mm256_cmpeq_epi8(v, esc);
+        f = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, flag));
+        m = _mm256_movemask_epi8(e);
+        if ((m | f) == 0)
+        { // Nothing special in the block
+            _mm256_storeu_si256((__m256i *)(out + o), v);
+            i += 32;
+            o += 32;
+            continue;
+        }
+        if (f == 0 && (m & m << 1) == 0)
+        { // Escapes only, collapse the whole block (the shift carries lane 15 into lane 16)
+            e = _mm256_alignr_epi8(e, _mm256_permute2x128_si256(e, e, 0x08), 15);
+            v = _mm256_xor_si256(v, _mm256_and_si256(e, bit5));
+            o += hdlc_compact_ssse3(out + o, _mm256_castsi256_si128(v), m);
+            o += hdlc_compact_ssse3(out + o, _mm256_extracti128_si256(v, 1), m >> 16);
+            i += (m & 0x80000000u) ? 31 : 32;
+            continue;
+        }
+        if (__builtin_popcount(m) > 2 * UNESCAPE_DENSE)
+        { // Too many escapes for one store each
+            t = (len - i < UNESCAPE_RUN) ? len - i : UNESCAPE_RUN;
+            o += hdlc_unescape_scalar(out + o, cap - o, in + i, t, &t);
+            i += t;
+            if (t == 0)
+                break; // Flag or aborted message
+            continue;
+        }
+        _mm256_storeu_si256((__m256i *)(out + o), v);
+        for (m |= f, d = 0, p = 0; m; m &= m - 1)
+        {
+            t = __builtin_ctz(m);
+            if (t < p)
+                continue; // Escaped byte of the pair before
+            if (in[i + t] == FLAG_SEQUENCE || in[i + t + 1] == FLAG_SEQUENCE)
+                break; // Flag or aborted message
+            out[o + t - d] = in[i + t + 1] ^ 0x20;
+            _mm256_storeu_si256((__m256i *)(out + o + t - d + 1),
+                                _mm256_loadu_si256((const __m256i *)(in + i + t + 2)));
+            d++;
+            p = t + 2;
+        }
+        if (m)
+        { // Stopped on the bit at t
+            i += t;
+            o += t - d;
+            break;
+        }
+        p = (p > 32) ? p : 32; // The last pair may end past the block
+        i += p;
+        o += p - d;
+    }
+    _mm256_zeroupper(); // Avoid AVX/SSE transition stalls in the SSE code that follows
+
+    rest = hdlc_unescape_sse2(out + o, cap - o, in + i, len - i, &t);
+    *used = i + t;
+    return o + rest;
+}
+
+/**
+ * @brief HDLC find the next flag or control escape, 32 bytes per step (SSE2)
+ *
+ * @param[in] *in - data to scan
+ * @param[in] len - size of data
+ *
+ * @return offset of the first FLAG SEQUENCE or CONTROL ESCAPE, len if none
+ */
+__attribute__((target("sse2")))
+static int hdlc_scan_sse2(const unsigned char *in, int len)
+{
+    const __m128i flag = _mm_set1_epi8(FLAG_SEQUENCE), esc = _mm_set1_epi8(CONTROL_ESCAPE);
+    __m128i v0, v1;
+    unsigned int m;
+    int i = 0;
+
+    for (; i + 32 <= len; i += 32)
+    {
+        v0 = _mm_loadu_si128((const __m128i *)(in + i));
+        v1 = _mm_loadu_si128((const __m128i *)(in + i + 16));
+        m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v0, flag), _mm_cmpeq_epi8(v0, esc))) |
+            (unsigned int)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v1, flag), _mm_cmpeq_epi8(v1, esc))) << 16;
+        if (m != 0)
+            return i + __builtin_ctz(m);
+    }
+    return i + hdlc_scan_scalar(in + i, len - i);
+}
+
+/**
+ * @brief HDLC find the next flag or control escape, 64 bytes per step (AVX2)
+ *
+ * @param[in] *in - data to scan
+ * @param[in] len - size of data
+ *
+ * @return offset of the first FLAG SEQUENCE or CONTROL ESCAPE, len if none
+ */
+__attribute__((target("avx2")))
+static int hdlc_scan_avx2(const unsigned char *in, int len)
+{
+    const __m256i flag = _mm256_set1_epi8(FLAG_SEQUENCE), esc = _mm256_set1_epi8(CONTROL_ESCAPE);
+    __m256i v0, v1;
+    unsigned long long m;
+    int i = 0;
+
+    for (; i + 64 <= len; i += 64)
+    {
+        v0 = _mm256_loadu_si256((const __m256i *)(in + i));
+        v1 = _mm256_loadu_si256((const __m256i *)(in + i + 32));
+        m = (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v0, flag), _mm256_cmpeq_epi8(v0, esc))) |
+            (unsigned long long)(unsigned int)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v1, flag), _mm256_cmpeq_epi8(v1, esc))) << 32;
+        if (m != 0)
+        {
+            _mm256_zeroupper();
+            return i + __builtin_ctzll(m);
+        }
+    }
+    _mm256_zeroupper(); // Avoid AVX/SSE transition stalls in the SSE code that follows
+    return i + hdlc_scan_sse2(in + i, len - i);
+}
+
+/**
+ * @brief HDLC classify 16 bytes against a character map (SSSE3)
+ *
+ * The low nibble of each byte picks a row of the map (one table for each
+ * half of the character set, the other half reads zero through the PSHUFB
+ * high bit), the high nibble picks the bit in the row.
+ *
+ * @param[in] v    - bytes
+ * @param[in] lo   - map rows for 0x00-0x7F
+ * @param[in] hi   - map rows for 0x80-0xFF
+ *
+ * @return 0xFF in the lanes whose byte is in the map
+ */
+__attribute__((target("ssse3")))
+static inline __m128i hdlc_classify_ssse3(__m128i v, __m128i lo, __m128i hi)
+{
+    const __m128i nib = _mm_set1_epi8((char)0x8f), top = _mm_set1_epi8((char)0x80), seven = _mm_set1_epi8(7);
+    const __m128i bits = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    __m128i rows, bit;
+
+    rows = _mm_or_si128(_mm_shuffle_epi8(lo, _mm_and_si128(v, nib)),
+                        _mm_shuffle_epi8(hi, _mm_and_si128(_mm_xor_si128(v, top), nib)));
+    bit = _mm_shuffle_epi8(bits, _mm_and_si128(_mm_srli_epi16(v, 4), seven));
+    return _mm_cmpeq_epi8(_mm_and_si128(rows, bit), bit);
+}
+
+/**
+ * @brief HDLC classify 32 bytes against a character map (AVX2)
+ *
+ * Same as the SSSE3 classifier, the map rows are repeated in both lanes.
+ *
+ * @param[in] v    - bytes
+ * @param[in] lo   - map rows for 0x00-0x7F
+ * @param[in] hi   - map rows for 0x80-0xFF
+ *
+ * @return 0xFF in the lanes whose byte is in the map
+ */
+__attribute__((target("avx2")))
+static inline __m256i hdlc_classify_avx2(__m256i v, __m256i lo, __m256i hi)
+{
+    const __m256i nib = _mm256_set1_epi8((char)0x8f), top = _mm256_set1_epi8((char)0x80), seven = _mm256_set1_epi8(7);
+    const __m256i bits = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128,
+                                          1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    __m256i rows, bit;
+
+    rows = _mm256_or_si256(_mm256_shuffle_epi8(lo, _mm256_and_si256(v, nib)),
+                           _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_xor_si256(v, top), nib)));
+    bit = _mm256_shuffle_epi8(bits, _mm256_and_si256(_mm256_srli_epi16(v, 4), seven));
+    return _mm256_cmpeq_epi8(_mm256_and_si256(rows, bit), bit);
+}
+
+/**
+ * @brief HDLC escape a block of data with a character map, 16 bytes per step (SSSE3)
+ *
+ * Same as the SSE2 kernel, the lanes to escape come from the map classifier.
+ *
+ * @param[out] *out - output buffer
+ * @param[in] cap   - room in the output buffer
+ * @param[in] *in   - data to escape
+ * @param[in] len   - size of data to escape
+ * @param[in] avail - readable bytes at in, a step may load 16 bytes past its block
+ * @param[in] *map  - characters to escape
+ *
+ * @return size of escaped data in out
+ *        -1 escaped data does not fit in cap
+ */
+__attribute__((target("ssse3")))
+static int hdlc_escape_map_ssse3(unsigned char *out, int cap, const unsigned char *in, int len, int avail,
+                                 const struct hdlc_accm *map)
+{
+    const __m128i lo = _mm_loadu_si128((const __m128i *)map->lo), hi = _mm_loadu_si128((const __m128i *)map->hi);
+    __m128i v;
+    unsigned int m;
+    int i = 0, o = 0, d, t, rest;
+
+    // Worst case a step reads 32 bytes and writes 16 past its expanded block
+    while (i + 16 <= len && i + 32 <= avail && o + 48 <= cap)
+    {
+        v = _mm_loadu_si128((const __m128i *)(in + i));
+        m = _mm_movemask_epi8(hdlc_classify_ssse3(v, lo, hi));
+        _mm_storeu_si128((__m128i *)(out + o), v);
+        for (d = 0; m; m &= m - 1, d++)
+        { // Expand only the lanes that need escaping
+            t = __builtin_ctz(m);
+            out[o + t + d] = CONTROL_ESCAPE;
+            out[o + t + d + 1] = in[i + t] ^ 0x20;
+            _mm_storeu_si128((__m128i *)(out + o + t + d + 2),
+                             _mm_loadu_si128((const __m128i *)(in + i + t + 1)));
+        }
+        i += 16;
+        o += 16 + d;
+    }
+
+    rest = hdlc_escape_map_scalar(out + o, cap - o, in + i, len - i, avail - i, map);
+    return (rest < 0) ? -1 : o + rest;
+}
+
+/**
+ * @brief HDLC escape a block of data with a character map, 32 bytes per step (AVX2)
+ *
+ * @param[out] *out - output buffer
+ * @param[in] cap   - room in the output buffer
+ * @param[in] *in   - data to escape
+ * @param[in] len   - size of data to escape
+ * @param[in] avail - readable bytes at in, a step may load 32 bytes past its block
+ * @param[in] *map  - characters to escape
+ *
+ * @return size of escaped data in out
+ *        -1 escaped data does not fit in cap
+ */
+__attribute__((target("avx2")))
+static int hdlc_escape_map_avx2(unsigned char *out, int cap, const unsigned char *in, int len, int avail,
+                                const struct hdlc_accm *map)
+{
+    const __m256i lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)map->lo));
+    const __m256i hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)map->hi));
+    __m256i v;
+    unsigned int m;
+    int i = 0, o = 0, d, t, rest;
+
+    // Worst case a step reads 64 bytes and writes 32 past its expanded block
+    while (i + 32 <= len && i + 64 <= avail && o + 96 <= cap)
+    {
+        v = _mm256_loadu_si256((const __m256i *)(in + i));
+        m = _mm256_movemask_epi8(hdlc_classify_avx2(v, lo, hi));
+        _mm256_storeu_si256((__m256i *)(out + o), v);
+        for (d = 0; m; m &= m - 1, d++)
+        { // Expand only the lanes that need escaping
+            t = __builtin_ctz(m);
+            out[o + t + d] = CONTROL_ESCAPE;
+            out[o + t + d + 1] = in[i + t] ^ 0x20;
+            _mm256_storeu_si256((__m256i *)(out + o + t + d + 2),
+                                _mm256_loadu_si256((const __m256i *)(in + i + t + 1)));
+        }
+        i += 32;
+        o += 32 + d;
+    }
+    _mm256_zeroupper(); // Avoid AVX/SSE transition stalls in the SSE code that follows
+
+    rest = hdlc_escape_map_ssse3(out + o, cap - o, in + i, len - i, avail - i, map);
+    return (rest < 0) ? -1 : o + rest;
+}
+
+/**
+ * @brief HDLC unescape a block of data with a character map, 16 bytes per step (SSSE3)
+ *
+ * Blocks with nothing from the map are stored as is.  Otherwise the output
+ * advances to the first mapped byte, which is dropped (discarded character)
+ * or collapsed with the next one (escape pair).  An escape followed by a
+ * discarded character is left to the scalar loop, with the rest of the data.
+ *
+ * @param[out] *out  - output buffer
+ * @param[in] cap    - room in the output buffer
+ * @param[in] *in    - data to unescape
+ * @param[in] len    - size of data to unescape
+ * @param[out] *used - amount of data consumed
+ * @param[in] *map   - characters to discard, with FLAG SEQUENCE and CONTROL ESCAPE
+ *
+ * @return size of unescaped data in out
+ */
+__attribute__((target("ssse3")))
+static int hdlc_unescape_map_ssse3(unsigned char *out, int cap, const unsigned char *in, int len, int *used,
+                                   const struct hdlc_accm *map)
+{
+    const __m128i lo = _mm_loadu_si128((const __m128i *)map->lo), hi = _mm_loadu_si128((const __m128i *)map->hi);
+    __m128i v;
+    unsigned int m;
+    int i = 0, o = 0, t, rest;
+
+    while (i + 16 <= len && o + 16 <= cap)
+    {
+        v = _mm_loadu_si128((const __m128i *)(in + i));
+        m = _mm_movemask_epi8(hdlc_classify_ssse3(v, lo, hi));
+        _mm_storeu_si128((__m128i *)(out + o), v);
+        if (m == 0)
+        { // Nothing special in the block
+            i += 16;
+            o += 16;
+            continue;
+        }
+        t = __builtin_ctz(m);
+        i += t;
+        o += t;
+        if (in[i] == FLAG_SEQUENCE)
+            break;
+        if (in[i] != CONTROL_ESCAPE)
+        { // Discarded
+            i++;
+            continue;
+        }
+        if (i + 1 == len || hdlc_accm_has(map, in[i + 1]))
+            break; // Flag, escape split across calls or something to discard in between
+        out[o++] = in[i + 1] ^ 0x20;
+        i += 2;
+    }
+
+    rest = hdlc_unescape_map_scalar(out + o, cap - o, in + i, len - i, &t, map);
+    *used = i + t;
+    return o + rest;
+}
+
+/**
+ * @brief HDLC find the next character of a map, 16 bytes per step (SSSE3)
+ *
+ * @param[in] *in  - data to scan
+ * @param[in] len  - size of data
+ * @param[in] *map - characters to look for
+ *
+ * @return offset of the first character in the map, len if none
+ */
+__attribute__((target("ssse3")))
+static int hdlc_scan_map_ssse3(const unsigned char *in, int len, const struct hdlc_accm *map)
+{
+    const __m128i lo = _mm_loadu_si128((const __m128i *)map->lo), hi = _mm_loadu_si128((const __m128i *)map->hi);
+    unsigned int m;
+    int i = 0;
+
+    for (; i + 16 <= len; i += 16)
+    {
+        m = _mm_movemask_epi8(hdlc_classify_ssse3(_mm_loadu_si128((const __m128i *)(in + i)), lo, hi));
+        if (m != 0)
+            return i + __builtin_ctz(m);
+    }
+    return i + hdlc_scan_map_scalar(in + i, len - i, map);
+}
+
+/**
+ * @brief HDLC find the next character of a map, 32 bytes per step (AVX2)
+ *
+ * @param[in] *in  - data to scan
+ * @param[in] len  - size of data
+ * @param[in] *map - characters to look for
+ *
+ * @return offset of the first character in the map, len if none
+ */
+__attribute__((target("avx2")))
+static int hdlc_scan_map_avx2(const unsigned char *in, int len, const struct hdlc_accm *map)
+{
+    const __m256i lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)map->lo));
+    const __m256i hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)map->hi));
+    unsigned int m;
+    int i = 0;
+
+    for (; i + 32 <= len; i += 32)
+    {
+        m = _mm256_movemask_epi8(hdlc_classify_avx2(_mm256_loadu_si256((const __m256i *)(in + i)), lo, hi));
+        if (m != 0)
+        {
+            _mm256_zeroupper();
+            return i + __builtin_ctz(m);
+        }
+    }
+    _mm256_zeroupper(); // Avoid AVX/SSE transition stalls in the SSE code that follows
+    return i + hdlc_scan_map_ssse3(in + i, len - i, map);
+}
+#endif
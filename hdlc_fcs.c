@@ -0,0 +1,553 @@
+/*!
+ * @file
+ * @author Mark Koi
+ *
+ * This file holds the frame check sequence (FCS) engines shared by the hdlc
+ * encoder, decoder and external tooling, for the 16 and 32 bit FCS of
+ * RFC 1662.  The byte at a time table loop is kept as the reference, with
+ * slice-by-8/16 tables and a carry-less multiply (PCLMULQDQ) folding kernel
+ * selected at runtime by CPU feature detection.
+ */
+#include <pthread.h>
+#include "hdlc.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HDLC_HAVE_CLMUL 1       // Compiler can build the PCLMULQDQ kernel
+#include <immintrin.h>
+#endif
+
+#define FCS16_POLY      0x8408  // x^16 + x^12 + x^5 + 1, bit reversed
+#define FCS32_POLY      0xedb88320 // IEEE 802.3 CRC-32, bit reversed
+#define CLMUL_MIN       64      // Shorter buffers are faster on the slice tables
+
+static const unsigned short fcstab[256] = {
+      0x0000, 0x1189, 0x2312, 0x329b, 0x4624, 0x57ad, 0x6536, 0x74bf,
+      0x8c48, 0x9dc1, 0xaf5a, 0xbed3, 0xca6c, 0xdbe5, 0xe97e, 0xf8f7,
+      0x1081, 0x0108, 0x3393, 0x221a, 0x56a5, 0x472c, 0x75b7, 0x643e,
+      0x9cc9, 0x8d40, 0xbfdb, 0xae52, 0xdaed, 0xcb64, 0xf9ff, 0xe876,
+      0x2102, 0x308b, 0x0210, 0x1399, 0x6726, 0x76af, 0x4434, 0x55bd,
+      0xad4a, 0xbcc3, 0x8e58, 0x9fd1, 0xeb6e, 0xfae7, 0xc87c, 0xd9f5,
+      0x3183, 0x200a, 0x1291, 0x0318, 0x77a7, 0x662e, 0x54b5, 0x453c,
+      0xbdcb, 0xac42, 0x9ed9, 0x8f50, 0xfbef, 0xea66, 0xd8fd, 0xc974,
+      0x4204, 0x538d, 0x6116, 0x709f, 0x0420, 0x15a9, 0x2732, 0x36bb,
+      0xce4c, 0xdfc5, 0xed5e, 0xfcd7, 0x8868, 0x99e1, 0xab7a, 0xbaf3,
+      0x5285, 0x430c, 0x7197, 0x601e, 0x14a1, 0x0528, 0x37b3, 0x263a,
+      0xdecd, 0xcf44, 0xfddf, 0xec56, 0x98e9, 0x8960, 0xbbfb, 0xaa72,
+      0x6306, 0x728f, 0x4014, 0x519d, 0x2522, 0x34ab, 0x0630, 0x17b9,
+      0xef4e, 0xfec7, 0xcc5c, 0xddd5, 0xa96a, 0xb8e3, 0x8a78, 0x9bf1,
+      0x7387, 0x620e, 0x5095, 0x411c, 0x35a3, 0x242a, 0x16b1, 0x0738,
+      0xffcf, 0xee46, 0xdcdd, 0xcd54, 0xb9eb, 0xa862, 0x9af9, 0x8b70,
+      0x8408, 0x9581, 0xa71a, 0xb693, 0xc22c, 0xd3a5, 0xe13e, 0xf0b7,
+      0x0840, 0x19c9, 0x2b52, 0x3adb, 0x4e64, 0x5fed, 0x6d76, 0x7cff,
+      0x9489, 0x8500, 0xb79b, 0xa612, 0xd2ad, 0xc324, 0xf1bf, 0xe036,
+      0x18c1, 0x0948, 0x3bd3, 0x2a5a, 0x5ee5, 0x4f6c, 0x7df7, 0x6c7e,
+      0xa50a, 0xb483, 0x8618, 0x9791, 0xe32e, 0xf2a7, 0xc03c, 0xd1b5,
+      0x2942, 0x38cb, 0x0a50, 0x1bd9, 0x6f66, 0x7eef, 0x4c74, 0x5dfd,
+      0xb58b, 0xa402, 0x9699, 0x8710, 0xf3af, 0xe226, 0xd0bd, 0xc134,
+      0x39c3, 0x284a, 0x1ad1, 0x0b58, 0x7fe7, 0x6e6e, 0x5cf5, 0x4d7c,
+      0xc60c, 0xd785, 0xe51e, 0xf497, 0x8028, 0x91a1, 0xa33a, 0xb2b3,
+      0x4a44, 0x5bcd, 0x6956, 0x78df, 0x0c60, 0x1de9, 0x2f72, 0x3efb,
+      0xd68d, 0xc704, 0xf59f, 0xe416, 0x90a9, 0x8120, 0xb3bb, 0xa232,
+      0x5ac5, 0x4b4c, 0x79d7, 0x685e, 0x1ce1, 0x0d68, 0x3ff3, 0x2e7a,
+      0xe70e, 0xf687, 0xc41c, 0xd595, 0xa12a, 0xb0a3, 0x8238, 0x93b1,
+      0x6b46, 0x7acf, 0x4854, 0x59dd, 0x2d62, 0x3ceb, 0x0e70, 0x1ff9,
+      0xf78f, 0xe606, 0xd49d, 0xc514, 0xb1ab, 0xa022, 0x92b9, 0x8330,
+      0x7bc7, 0x6a4e, 0x58d5, 0x495c, 0x3de3, 0x2c6a, 0x1ef1, 0x0f78
+};
+
+typedef unsigned short (*hdlc_fcs16_fn)(unsigned short fcs, const unsigned char *buf, int len);
+typedef unsigned int (*hdlc_fcs32_fn)(unsigned int fcs, const unsigned char *buf, int len);
+
+// Carry-less multiply folding constants, x^n mod P in bit reflected form
+struct hdlc_fold
+{
+    unsigned long long k512[2]; // Fold four blocks ahead: x^(512+63), x^(512-1)
+    unsigned long long k128[2]; // Fold one block ahead:   x^(128+63), x^(128-1)
+};
+
+// Locally defined variables
+static unsigned short fcs16slice[16][256];    // fcs16slice[k][b]: byte b followed by k zeros
+static struct hdlc_fold fcs16fold;             // Folding constants for FCS-16
+static unsigned int fcs32slice[16][256];       // Same for FCS-32
+static struct hdlc_fold fcs32fold;             // Folding constants for FCS-32
+static pthread_once_t fcs_once = PTHREAD_ONCE_INIT;
+static hdlc_fcs16_fn fcs16 = NULL;             // Engine in use
+static hdlc_fcs32_fn fcs32 = NULL;             // Engine in use, same kind as fcs16
+static enum hdlc_fcs_engine fcs16engine = HDLC_FCS_AUTO;
+
+// Locally defined functions (see below for function header information)
+static void hdlc_fcs_init(void);
+static int hdlc_fcs_use(enum hdlc_fcs_engine engine);
+static unsigned short hdlc_fcs16_byte(unsigned short fcs, const unsigned char *buf, int len);
+static unsigned short hdlc_fcs16_slice8(unsigned short fcs, const unsigned char *buf, int len);
+static unsigned short hdlc_fcs16_slice16(unsigned short fcs, const unsigned char *buf, int len);
+#ifdef HDLC_HAVE_CLMUL
+static unsigned short hdlc_fcs16_clmul(unsigned short fcs, const unsigned char *buf, int len);
+#endif
+static unsigned int hdlc_fcs32_byte(unsigned int fcs, const unsigned char *buf, int len);
+static unsigned int hdlc_fcs32_slice8(unsigned int fcs, const unsigned char *buf, int len);
+static unsigned int hdlc_fcs32_slice16(unsigned int fcs, const unsigned char *buf, int len);
+#ifdef HDLC_HAVE_CLMUL
+static unsigned int hdlc_fcs32_clmul(unsigned int fcs, const unsigned char *buf, int len);
+#endif
+
+/**
+ * @brief HDLC frame check sequence
+ *
+ * Add a block of data to a 16 bit PPP frame check sequence (RFC 1662) using
+ * the selected engine.  Start with HDLC_FCS16_INIT; running the FCS over a
+ * message followed by its transmitted FCS gives HDLC_FCS16_GOOD.
+ *
+ * @param[in] fcs  - current frame check sequence
+ * @param[in] *buf - data to add to the frame check sequence
+ * @param[in] len  - size of data
+ *
+ * @return updated frame check sequence
+ *
+ * @note Every engine is bit exact with the byte at a time table loop
+ * @warning None
+ */
+unsigned short hdlc_fcs16(unsigned short fcs, const unsigned char *buf, int len)
+{
+    pthread_once(&fcs_once, hdlc_fcs_init);
+    return fcs16(fcs, buf, len);
+}
+
+/**
+ * @brief HDLC 32 bit frame check sequence
+ *
+ * Add a block of data to a 32 bit PPP frame check sequence (RFC 1662, the
+ * IEEE 802.3 CRC-32) using the selected engine.  Start with HDLC_FCS32_INIT;
+ * running the FCS over a message followed by its transmitted FCS gives
+ * HDLC_FCS32_GOOD.
+ *
+ * @param[in] fcs  - current frame check sequence
+ * @param[in] *buf - data to add to the frame check sequence
+ * @param[in] len  - size of data
+ *
+ * @return updated frame check sequence
+ *
+ * @note Every engine is bit exact with the byte at a time table loop
+ * @warning None
+ */
+unsigned int hdlc_fcs32(unsigned int fcs, const unsigned char *buf, int len)
+{
+    pthread_once(&fcs_once, hdlc_fcs_init);
+    return fcs32(fcs, buf, len);
+}
+
+/**
+ * @brief HDLC select frame check sequence engine
+ *
+ * Force a specific engine (benchmarks, comparisons) or go back to the
+ * automatic choice, which is the fastest engine the CPU supports.  The
+ * choice applies to both FCS widths.
+ *
+ * @param[in] engine - HDLC_FCS_AUTO or a specific engine
+ *
+ * @return engine now in use
+ *        -1 engine not supported by this CPU or build
+ *
+ * @note Select the engine before starting threads that use the codec
+ * @warning None
+ */
+int hdlc_fcs_select(enum hdlc_fcs_engine engine)
+{
+    pthread_once(&fcs_once, hdlc_fcs_init);
+    return hdlc_fcs_use(engine);
+}
+
+/**
+ * @brief HDLC switch the frame check sequence engine
+ *
+ * @param[in] engine - HDLC_FCS_AUTO or a specific engine
+ *
+ * @return engine now in use
+ *        -1 engine not supported by this CPU or build
+ */
+static int hdlc_fcs_use(enum hdlc_fcs_engine engine)
+{
+    switch (engine)
+    {
+        case HDLC_FCS_AUTO:
+#ifdef HDLC_HAVE_CLMUL
+            if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1"))
+                return hdlc_fcs_use(HDLC_FCS_CLMUL);
+#endif
+            return hdlc_fcs_use(HDLC_FCS_SLICE16);
+        case HDLC_FCS_BYTE:
+            fcs16 = hdlc_fcs16_byte;
+            fcs32 = hdlc_fcs32_byte;
+            break;
+        case HDLC_FCS_SLICE8:
+            fcs16 = hdlc_fcs16_slice8;
+            fcs32 = hdlc_fcs32_slice8;
+            break;
+        case HDLC_FCS_SLICE16:
+            fcs16 = hdlc_fcs16_slice16;
+            fcs32 = hdlc_fcs32_slice16;
+            break;
+        case HDLC_FCS_CLMUL:
+#ifdef HDLC_HAVE_CLMUL
+            if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1"))
+            {
+                fcs16 = hdlc_fcs16_clmul;
+                fcs32 = hdlc_fcs32_clmul;
+                break;
+            }
+#endif
+            return -1; // Not supported
+        default:
+            return -1; // Unknown engine
+    }
+    fcs16engine = engine;
+    return engine;
+}
+
+/**
+ * @brief HDLC frame check sequence engine in use
+ *
+ * @return engine selected by hdlc_fcs_select (never HDLC_FCS_AUTO)
+ */
+enum hdlc_fcs_engine hdlc_fcs_selected(void)
+{
+    pthread_once(&fcs_once, hdlc_fcs_init);
+    return fcs16engine;
+}
+
+/**
+ * @brief HDLC x^n modulo an FCS polynomial
+ *
+ * @param[in] n    - power of x
+ * @param[in] rpoly - polynomial, bit reversed without the x^w term
+ * @param[in] w    - degree of the polynomial (FCS width in bits)
+ *
+ * @return x^n mod P as a bit reflected 64 bit folding constant (x^0 in bit 63)
+ */
+static unsigned long long hdlc_fcs_xpow(int n, unsigned int rpoly, int w)
+{
+    unsigned long long poly = 0, r = 1, k = 0;
+    int i;
+
+    for (i = 0; i < w; i++) // Normal (not reflected) form of the polynomial
+        if (rpoly & (1u << i))
+            poly |= 1ull << (w - 1 - i);
+
+    while (n--)
+    {
+        r <<= 1;
+        if (r & (1ull << w))
+            r ^= (1ull << w) | poly;
+    }
+    for (i = 0; i < w; i++)
+        if (r & (1ull << i))
+            k |= 1ull << (63 - i);
+    return k;
+}
+
+/**
+ * @brief HDLC frame check sequence engine init
+ *
+ * Build the slice tables and folding constants, then pick the engine.
+ * Runs once per process.
+ */
+static void hdlc_fcs_init(void)
+{
+    int i, k;
+
+    for (i = 0; i < 256; i++)
+        fcs16slice[0][i] = fcstab[i];
+    for (k = 1; k < 16; k++)
+        for (i = 0; i < 256; i++)
+            fcs16slice[k][i] = (fcs16slice[k-1][i] >> 8) ^ fcstab[fcs16slice[k-1][i] & 0xff];
+
+    for (i = 0; i < 256; i++)
+    { // No FCS-32 table in the source, RFC 1662 builds it from the polynomial too
+        unsigned int c = i;
+        for (k = 0; k < 8; k++)
+            c = (c & 1) ? (c >> 1) ^ FCS32_POLY : c >> 1;
+        fcs32slice[0][i] = c;
+    }
+    for (k = 1; k < 16; k++)
+        for (i = 0; i < 256; i++)
+            fcs32slice[k][i] = (fcs32slice[k-1][i] >> 8) ^ fcs32slice[0][fcs32slice[k-1][i] & 0xff];
+
+    fcs16fold.k512[0] = hdlc_fcs_xpow(512 + 63, FCS16_POLY, 16);
+    fcs16fold.k512[1] = hdlc_fcs_xpow(512 - 1, FCS16_POLY, 16);
+    fcs16fold.k128[0] = hdlc_fcs_xpow(128 + 63, FCS16_POLY, 16);
+    fcs16fold.k128[1] = hdlc_fcs_xpow(128 - 1, FCS16_POLY, 16);
+    fcs32fold.k512[0] = hdlc_fcs_xpow(512 + 63, FCS32_POLY, 32);
+    fcs32fold.k512[1] = hdlc_fcs_xpow(512 - 1, FCS32_POLY, 32);
+    fcs32fold.k128[0] = hdlc_fcs_xpow(128 + 63, FCS32_POLY, 32);
+    fcs32fold.k128[1] = hdlc_fcs_xpow(128 - 1, FCS32_POLY, 32);
+
+    hdlc_fcs_use(HDLC_FCS_AUTO);
+}
+
+/**
+ * @brief HDLC frame check sequence, one byte per table lookup (reference)
+ *
+ * @param[in] fcs  - current frame check sequence
+ * @param[in] *buf - data to add to the frame check sequence
+ * @param[in] len  - size of data
+ *
+ * @return updated frame check sequence
+ */
+static unsigned short hdlc_fcs16_byte(unsigned short fcs, const unsigned char *buf, int len)
+{
+    while (len-- > 0)
+        fcs = (fcs >> 8) ^ fcstab[(fcs ^ *buf++) & 0xff];
+    return fcs;
+}
+
+/**
+ * @brief HDLC frame check sequence, eight bytes per step
+ *
+ * The eight table lookups of a step are independent of each other, only the
+ * first two bytes depend on the running FCS.
+ *
+ * @param[in] fcs  - current frame check sequence
+ * @param[in] *buf - data to add to the frame check sequence
+ * @param[in] len  - size of data
+ *
+ * @return updated frame check sequence
+ */
+static unsigned short hdlc_fcs16_slice8(unsigned short fcs, const unsigned char *buf, int len)
+{
+    unsigned int c;
+
+    while (len >= 8)
+    {
+        c = fcs ^ (buf[0] | buf[1] << 8);
+        fcs = fcs16slice[7][c & 0xff] ^ fcs16slice[6][c >> 8] ^
+              fcs16slice[5][buf[2]]   ^ fcs16slice[4][buf[3]] ^
+              fcs16slice[3][buf[4]]   ^ fcs16slice[2][buf[5]] ^
+              fcs16slice[1][buf[6]]   ^ fcs16slice[0][buf[7]];
+        buf += 8;
+        len -= 8;
+    }
+    return hdlc_fcs16_byte(fcs, buf, len);
+}
+
+/**
+ * @brief HDLC frame check sequence, sixteen bytes per step
+ *
+ * @param[in] fcs  - current frame check sequence
+ * @param[in] *buf - data to add to the frame check sequence
+ * @param[in] len  - size of data
+ *
+ * @return updated frame check sequence
+ */
+static unsigned short hdlc_fcs16_slice16(unsigned short fcs, const unsigned char *buf, int len)
+{
+    unsigned int c;
+
+    while (len >= 16)
+    {
+        c = fcs ^ (buf[0] | buf[1] << 8);
+        fcs = fcs16slice[15][c & 0xff] ^ fcs16slice[14][c >> 8]  ^
+              fcs16slice[13][buf[2]]   ^ fcs16slice[12][buf[3]]  ^
+              fcs16slice[11][buf[4]]   ^ fcs16slice[10][buf[5]]  ^
+              fcs16slice[9][buf[6]]    ^ fcs16slice[8][buf[7]]   ^
+              fcs16slice[7][buf[8]]    ^ fcs16slice[6][buf[9]]   ^
+              fcs16slice[5][buf[10]]   ^ fcs16slice[4][buf[11]]  ^
+              fcs16slice[3][buf[12]]   ^ fcs16slice[2][buf[13]]  ^
+              fcs16slice[1][buf[14]]   ^ fcs16slice[0][buf[15]];
+        buf += 16;
+        len -= 16;
+    }
+    return hdlc_fcs16_slice8(fcs, buf, len);
+}
+
+#ifdef HDLC_HAVE_CLMUL
+/**
+ * @brief HDLC fold a 128 bit remainder ahead
+ *
+ * Multiply the low (earlier) half by x^(D+63) and the high half by x^(D-1),
+ * which is congruent to moving the remainder D bits further into the message.
+ *
+ * @param[in] x - remainder
+ * @param[in] k - folding constants for distance D
+ *
+ * @return folded remainder, at most 64 bits plus the FCS width wide
+ */
+__attribute__((target("pclmul,sse4.1")))
+static inline __m128i hdlc_fold(__m128i x, __m128i k)
+{
+    return _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00), _mm_clmulepi64_si128(x, k, 0x11));
+}
+
+/**
+ * @brief HDLC fold a message down to one 128 bit remainder
+ *
+ * Fold four independent 128 bit lanes over the message, then fold them into
+ * one, with the constants of the FCS polynomial.
+ *
+ * @param[out] *rem   - remainder, 16 bytes
+ * @param[in] fcs     - current frame check sequence
+ * @param[in] *buf    - data, at least CLMUL_MIN bytes
+ * @param[in] len     - size of data, multiple of 16
+ * @param[in] *consts - folding constants
+ */
+__attribute__((target("pclmul,sse4.1")))
+static inline void hdlc_fold_all(unsigned char *rem, unsigned int fcs, const unsigned char *buf, int len,
+                                 const struct hdlc_fold *consts)
+{
+    __m128i x0, x1, x2, x3, k;
+
+    x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)buf), _mm_cvtsi32_si128(fcs));
+    x1 = _mm_loadu_si128((const __m128i *)(buf + 16));
+    x2 = _mm_loadu_si128((const __m128i *)(buf + 32));
+    x3 = _mm_loadu_si128((const __m128i *)(buf + 48));
+    buf += 64;
+    len -= 64;
+
+    k = _mm_loadu_si128((const __m128i *)consts->k512);
+    while (len >= 64)
+    { // Four lanes, each folded 512 bits ahead
+        x0 = _mm_xor_si128(hdlc_fold(x0, k), _mm_loadu_si128((const __m128i *)buf));
+        x1 = _mm_xor_si128(hdlc_fold(x1, k), _mm_loadu_si128((const __m128i *)(buf + 16)));
+        x2 = _mm_xor_si128(hdlc_fold(x2, k), _mm_loadu_si128((const __m128i *)(buf + 32)));
+        x3 = _mm_xor_si128(hdlc_fold(x3, k), _mm_loadu_si128((const __m128i *)(buf + 48)));
+        buf += 64;
+        len -= 64;
+    }
+
+    k = _mm_loadu_si128((const __m128i *)consts->k128);
+    x0 = _mm_xor_si128(hdlc_fold(x0, k), x1);
+    x0 = _mm_xor_si128(hdlc_fold(x0, k), x2);
+    x0 = _mm_xor_si128(hdlc_fold(x0, k), x3);
+    while (len >= 16)
+    {
+        x0 = _mm_xor_si128(hdlc_fold(x0, k), _mm_loadu_si128((const __m128i *)buf));
+        buf += 16;
+        len -= 16;
+    }
+
+    _mm_storeu_si128((__m128i *)rem, x0);
+}
+
+/**
+ * @brief HDLC frame check sequence, carry-less multiply folding
+ *
+ * Fold four independent 128 bit lanes over the message, then fold them into
+ * one.  The last remainder is congruent to the whole message, so running the
+ * slice tables over its 16 bytes from zero gives the frame check sequence.
+ * The starting FCS is xored into the first two bytes, as the table loop does.
+ *
+ * @param[in] fcs  - current frame check sequence
+ * @param[in] *buf - data to add to the frame check sequence
+ * @param[in] len  - size of data
+ *
+ * @return updated frame check sequence
+ */
+__attribute__((target("pclmul,sse4.1")))
+static unsigned short hdlc_fcs16_clmul(unsigned short fcs, const unsigned char *buf, int len)
+{
+    unsigned char rem[16];
+
+    if (len < CLMUL_MIN)
+        return hdlc_fcs16_slice16(fcs, buf, len);
+
+    hdlc_fold_all(rem, fcs, buf, len & ~15, &fcs16fold);
+    fcs = hdlc_fcs16_slice16(0, rem, 16);
+    return hdlc_fcs16_byte(fcs, buf + (len & ~15), len & 15);
+}
+
+/**
+ * @brief HDLC 32 bit frame check sequence, carry-less multiply folding
+ *
+ * Same folding as the 16 bit FCS with the CRC-32 constants, the starting FCS
+ * is xored into the first four bytes.
+ *
+ * @param[in] fcs  - current frame check sequence
+ * @param[in] *buf - data to add to the frame check sequence
+ * @param[in] len  - size of data
+ *
+ * @return updated frame check sequence
+ */
+__attribute__((target("pclmul,sse4.1")))
+static unsigned int hdlc_fcs32_clmul(unsigned int fcs, const unsigned char *buf, int len)
+{
+    unsigned char rem[16];
+
+    if (len < CLMUL_MIN)
+        return hdlc_fcs32_slice16(fcs, buf, len);
+
+    hdlc_fold_all(rem, fcs, buf, len & ~15, &fcs32fold);
+    fcs = hdlc_fcs32_slice16(0, rem, 16);
+    return hdlc_fcs32_byte(fcs, buf + (len & ~15), len & 15);
+}
+#endif
+
+/**
+ * @brief HDLC 32 bit frame check sequence, one byte per table lookup (reference)
+ *
+ * @param[in] fcs  - current frame check sequence
+ * @param[in] *buf - data to add to the frame check sequence
+ * @param[in] len  - size of data
+ *
+ * @return updated frame check sequence
+ */
+static unsigned int hdlc_fcs32_byte(unsigned int fcs, const unsigned char *buf, int len)
+{
+    while (len-- > 0)
+        fcs = (fcs >> 8) ^ fcs32slice[0][(fcs ^ *buf++) & 0xff];
+    return fcs;
+}
+
+/**
+ * @brief HDLC 32 bit frame check sequence, eight bytes per step
+ *
+ * @param[in] fcs  - current frame check sequence
+ * @param[in] *buf - data to add to the frame check sequence
+ * @param[in] len  - size of data
+ *
+ * @return updated frame check sequence
+ */
+static unsigned int hdlc_fcs32_slice8(unsigned int fcs, const unsigned char *buf, int len)
+{
+    unsigned int c;
+
+    while (len >= 8)
+    {
+        c = fcs ^ (buf[0] | buf[1] << 8 | buf[2] << 16 | (unsigned int)buf[3] << 24);
+        fcs = fcs32slice[7][c & 0xff]         ^ fcs32slice[6][(c >> 8) & 0xff] ^
+              fcs32slice[5][(c >> 16) & 0xff] ^ fcs32slice[4][c >> 24]         ^
+              fcs32slice[3][buf[4]]           ^ fcs32slice[2][buf[5]]          ^
+              fcs32slice[1][buf[6]]           ^ fcs32slice[0][buf[7]];
+        buf += 8;
+        len -= 8;
+    }
+    return hdlc_fcs32_byte(fcs, buf, len);
+}
+
+/**
+ * @brief HDLC 32 bit frame check sequence, sixteen bytes per step
+ *
+ * @param[in] fcs  - current frame check sequence
+ * @param[in] *buf - data to add to the frame check sequence
+ * @param[in] len  - size of data
+ *
+ * @return updated frame check sequence
+ */
+static unsigned int hdlc_fcs32_slice16(unsigned int fcs, const unsigned char *buf, int len)
+{
+    unsigned int c;
+
+    while (len >= 16)
+    {
+        c = fcs ^ (buf[0] | buf[1] << 8 | buf[2] << 16 | (unsigned int)buf[3] << 24);
+        fcs = fcs32slice[15][c & 0xff]         ^ fcs32slice[14][(c >> 8) & 0xff] ^
+              fcs32slice[13][(c >> 16) & 0xff] ^ fcs32slice[12][c >> 24]         ^
+              fcs32slice[11][buf[4]]           ^ fcs32slice[10][buf[5]]          ^
+              fcs32slice[9][buf[6]]            ^ fcs32slice[8][buf[7]]           ^
+              fcs32slice[7][buf[8]]            ^ fcs32slice[6][buf[9]]           ^
+              fcs32slice[5][buf[10]]           ^ fcs32slice[4][buf[11]]          ^
+              fcs32slice[3][buf[12]]           ^ fcs32slice[2][buf[13]]          ^
+              fcs32slice[1][buf[14]]           ^ fcs32slice[0][buf[15]];
+        buf += 16;
+        len -= 16;
+    }
+    return hdlc_fcs32_slice8(fcs, buf, len);
+}
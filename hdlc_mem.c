@@ -0,0 +1,175 @@
+/*!
+ * @file
+ * @author Mark Koi
+ *
+ * This file holds the buffer pool shared by all channels.  Channels borrow
+ * their ring and decode storage only while data is in flight and give it
+ * back when the link goes idle, so thousands of quiet links cost little more
+ * than their context.  The encode buffer handed out by hdlc_msg_encode_chan
+ * is held until hdlc_msg_encode_release, since the caller keeps pointing
+ * into it.  Buffers come in power of two classes, each a LIFO
+ * list under its own lock; the locks are only taken when a link goes busy
+ * or idle, never per byte.  The module also keeps the memory accounting.
+ */
+#include <stdlib.h>
+#include <pthread.h>
+#include "hdlc.h"
+#include "hdlc_priv.h"
+
+#define CACHE_LINE      64
+#define MEM_MIN_SHIFT   6       // Smallest class, 64 bytes (room for the free list link)
+#define MEM_MAX_SHIFT   24      // Largest class, 16 MiB, bigger buffers go straight to malloc
+#define MEM_CLASSES     (MEM_MAX_SHIFT - MEM_MIN_SHIFT + 1)
+
+// Free buffers of one size
+struct hdlc_mem_class
+{
+    pthread_mutex_t lock;
+    void           *free;       // Newest first, linked through their first word
+} __attribute__((aligned(CACHE_LINE)));
+
+// Locally defined variables
+static struct hdlc_mem_class memClass[MEM_CLASSES] = {
+    [0 ... MEM_CLASSES - 1] = {PTHREAD_MUTEX_INITIALIZER, NULL}
+};
+static unsigned long long memUsed;      // Channel contexts and borrowed buffers
+static unsigned long long memCached;    // Free buffers kept in the classes
+static int memChans;                    // Channels alive
+
+/**
+ * @brief HDLC borrow a buffer from the shared pool
+ *
+ * @param[in] len   - bytes needed
+ * @param[out] *cap - bytes actually available (the class size)
+ *
+ * @return NULL failure
+ *         x    buffer, give it back with hdlc_mem_put and the same cap
+ */
+unsigned char *hdlc_mem_get(int len, int *cap)
+{
+    struct hdlc_mem_class *c;
+    unsigned char *buf;
+    int shift = MEM_MIN_SHIFT;
+
+    if (len <= 0) return NULL;
+    while (shift <= MEM_MAX_SHIFT && (1 << shift) < len)
+        shift++;
+    if (shift > MEM_MAX_SHIFT)
+    { // Too big to keep around
+        if ((buf = malloc(len)) == NULL) return NULL;
+        *cap = len;
+        __atomic_add_fetch(&memUsed, len, __ATOMIC_RELAXED);
+        return buf;
+    }
+
+    c = &memClass[shift - MEM_MIN_SHIFT];
+    pthread_mutex_lock(&c->lock);
+    if ((buf = c->free) != NULL)
+    {
+        c->free = *(void **)buf;
+        __atomic_sub_fetch(&memCached, 1ULL << shift, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&c->lock);
+
+    if (buf == NULL && (buf = malloc(1 << shift)) == NULL) return NULL;
+    *cap = 1 << shift;
+    __atomic_add_fetch(&memUsed, 1ULL << shift, __ATOMIC_RELAXED);
+    return buf;
+}
+
+/**
+ * @brief HDLC give a buffer back to the shared pool
+ *
+ * @param[in] *buf - buffer from hdlc_mem_get (NULL is ignored)
+ * @param[in] cap  - its cap, or the len it was asked for
+ */
+void hdlc_mem_put(unsigned char *buf, int cap)
+{
+    struct hdlc_mem_class *c;
+    int shift;
+
+    if (buf == NULL) return;
+
+    if (cap > (1 << MEM_MAX_SHIFT))
+    {
+        __atomic_sub_fetch(&memUsed, cap, __ATOMIC_RELAXED);
+        free(buf);
+        return;
+    }
+    for (shift = MEM_MIN_SHIFT; (1 << shift) < cap; shift++)
+        ; // Class it came from, cap may be what was asked for
+    c = &memClass[shift - MEM_MIN_SHIFT];
+    pthread_mutex_lock(&c->lock);
+    *(void **)buf = c->free;
+    c->free = buf;
+    pthread_mutex_unlock(&c->lock);
+    __atomic_sub_fetch(&memUsed, 1ULL << shift, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&memCached, 1ULL << shift, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief HDLC account for a channel context
+ *
+ * @param[in] bytes - size of the context, negative when it is freed
+ */
+void hdlc_mem_chan_account(int bytes)
+{
+    __atomic_add_fetch(&memUsed, (long long)bytes, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&memChans, bytes > 0 ? 1 : -1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief HDLC memory in use by all channels
+ *
+ * @param[out] *mem - bytes used by the channels and kept in the shared pool
+ *
+ * @return 0 pass
+ *        -1 failure
+ *
+ * @note Any thread, the numbers are a snapshot
+ * @warning None
+ */
+int hdlc_mem_stats(struct hdlc_mem *mem)
+{
+    if (mem == NULL) return -1;
+
+    mem->used = __atomic_load_n(&memUsed, __ATOMIC_RELAXED);
+    mem->cached = __atomic_load_n(&memCached, __ATOMIC_RELAXED);
+    mem->channels = __atomic_load_n(&memChans, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/**
+ * @brief HDLC free the buffers kept in the shared pool
+ *
+ * Hand the memory of idle buffers back to the system, for instance after a
+ * burst of traffic on many links
+ *
+ * @return bytes freed
+ *
+ * @note Any thread
+ * @warning None
+ */
+long long hdlc_mem_trim(void)
+{
+    void *buf, *next;
+    long long freed = 0;
+    int i;
+
+    for (i = 0; i < MEM_CLASSES; i++)
+    {
+        pthread_mutex_lock(&memClass[i].lock);
+        buf = memClass[i].free;
+        memClass[i].free = NULL;
+        pthread_mutex_unlock(&memClass[i].lock);
+
+        for (; buf != NULL; buf = next)
+        {
+            next = *(void **)buf;
+            free(buf);
+            freed += 1LL << (i + MEM_MIN_SHIFT);
+        }
+    }
+    __atomic_sub_fetch(&memCached, freed, __ATOMIC_RELAXED);
+    return freed;
+}
@@ -0,0 +1,348 @@
+/*!
+ * @file
+ * @author Mark Koi
+ *
+ * This file holds the frame buffer pool.  Buffers are cut from cache line
+ * aligned slabs and sit on one of two free lists: the owner's own list, only
+ * ever touched by the owner thread, and a Treiber stack for buffers released
+ * by other threads.  The owner takes the stack whole with one exchange when
+ * its list runs dry, so neither side ever pops a shared list (no ABA).  The
+ * pool lives until it is deleted and the last buffer is back.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "hdlc.h"
+#include "hdlc_priv.h"
+#include "hdlc_pool.h"
+
+#define CACHE_LINE          64
+#define SLAB_HEAD           CACHE_LINE  // Slab link, keeps the buffers line aligned
+#define POOL_TAIL           4           // Spare bytes after the data, the FCS of a message decoded in place
+
+struct hdlc_pool
+{
+    int              size;      // Data bytes per buffer
+    int              count;     // Buffers per slab
+    int              stride;    // Bytes per buffer, header included
+    pthread_t        owner;     // Thread taking buffers
+    struct hdlc_buf *free;      // Owner's free list, newest first
+    void            *slabs;     // Allocated slabs, linked through their first word
+    int              total;     // Buffers carved
+    int              nslabs;    // Slabs allocated
+    int              highWater; // Most buffers held at once
+    unsigned long long oversize; // Requests served by malloc
+
+    struct hdlc_buf *remote __attribute__((aligned(CACHE_LINE))); // Released by other threads, newest first
+    int              live __attribute__((aligned(CACHE_LINE)));   // Buffers held, plus one until deleted
+};
+
+// Locally defined functions (see below for function header information)
+static int hdlc_pool_grow(hdlc_pool_t *pool);
+static void hdlc_pool_free(hdlc_pool_t *pool);
+static void hdlc_pool_put(void *arg);
+
+/**
+ * @brief HDLC frame buffer pool init
+ *
+ * Create a pool owned by the calling thread
+ *
+ * @param[in] size  - data bytes per buffer (largest frame expected)
+ * @param[in] count - buffers per slab, the pool grows a slab at a time
+ *
+ * @return NULL failure
+ *         x    pool
+ *
+ * @note The first slab is allocated right away
+ * @warning Only the owner thread may call hdlc_pool_get
+ */
+hdlc_pool_t *hdlc_pool_init(int size, int count)
+{
+    hdlc_pool_t *pool;
+
+    if (size <= 0 || count <= 0) return NULL;
+    if ((pool = aligned_alloc(CACHE_LINE, sizeof(*pool))) == NULL) return NULL;
+
+    memset(pool, 0, sizeof(*pool));
+    pool->size = size;
+    pool->count = count;
+    pool->stride = (sizeof(struct hdlc_buf) + size + POOL_TAIL + CACHE_LINE - 1) & ~(CACHE_LINE - 1);
+    pool->owner = pthread_self();
+    pool->live = 1;
+    if (hdlc_pool_grow(pool) != 0)
+    {
+        free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+/**
+ * @brief HDLC frame buffer pool delete
+ *
+ * Let go of the pool.  The memory is freed now when every buffer is back,
+ * otherwise by the last hdlc_buf_release.
+ *
+ * @param[in] *pool - pool
+ *
+ * @return 0 pass
+ *        -1 failure
+ *
+ * @note Buffers still held stay valid
+ * @warning No hdlc_pool_get after the delete
+ */
+int hdlc_pool_delete(hdlc_pool_t *pool)
+{
+    if (pool == NULL) return -1;
+
+    if (__atomic_sub_fetch(&pool->live, 1, __ATOMIC_ACQ_REL) == 0)
+        hdlc_pool_free(pool);
+    return 0;
+}
+
+/**
+ * @brief HDLC frame buffer get
+ *
+ * Take the most recently released buffer, growing the pool by a slab when
+ * there is none.  Requests bigger than the pool's size get a buffer of their
+ * own from malloc, freed on release.
+ *
+ * @param[in] *pool - pool
+ * @param[in] len   - data bytes needed
+ *
+ * @return NULL failure
+ *         x    buffer with one reference, len and status 0
+ *
+ * @note None
+ * @warning Owner thread only
+ */
+struct hdlc_buf *hdlc_pool_get(hdlc_pool_t *pool, int len)
+{
+    struct hdlc_buf *buf;
+    int held;
+
+    if (pool == NULL || len < 0) return NULL;
+
+    if (len > pool->size)
+    { // One off
+        if ((buf = malloc(sizeof(*buf) + len + POOL_TAIL)) == NULL) return NULL;
+        buf->cap = len;
+        __atomic_store_n(&pool->oversize, pool->oversize + 1, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        if (pool->free == NULL)
+            pool->free = __atomic_exchange_n(&pool->remote, NULL, __ATOMIC_ACQUIRE);
+        if (pool->free == NULL && hdlc_pool_grow(pool) != 0) return NULL;
+        buf = pool->free;
+        pool->free = buf->next;
+        buf->cap = pool->size;
+    }
+    buf->next = NULL;
+    buf->pool = pool;
+    buf->refs = 1;
+    buf->len = 0;
+    buf->status = 0;
+
+    held = __atomic_add_fetch(&pool->live, 1, __ATOMIC_RELAXED) - 1;
+    if (held > pool->highWater)
+        __atomic_store_n(&pool->highWater, held, __ATOMIC_RELAXED);
+    return buf;
+}
+
+/**
+ * @brief HDLC frame buffer add a reference
+ *
+ * @param[in] *buf - buffer
+ *
+ * @note Any thread holding a reference
+ * @warning None
+ */
+void hdlc_buf_ref(struct hdlc_buf *buf)
+{
+    if (buf != NULL)
+        __atomic_add_fetch(&buf->refs, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief HDLC frame buffer release
+ *
+ * Drop a reference, the last one gives the buffer back to its pool
+ *
+ * @param[in] *buf - buffer
+ *
+ * @note Any thread
+ * @warning None
+ */
+void hdlc_buf_release(struct hdlc_buf *buf)
+{
+    hdlc_pool_t *pool;
+    struct hdlc_buf *top;
+
+    if (buf == NULL || __atomic_sub_fetch(&buf->refs, 1, __ATOMIC_ACQ_REL) != 0) return;
+
+    pool = buf->pool;
+    if (buf->cap > pool->size)
+        free(buf);
+    else if (pthread_equal(pthread_self(), pool->owner))
+    {
+        buf->next = pool->free;
+        pool->free = buf;
+    }
+    else
+    {
+        top = __atomic_load_n(&pool->remote, __ATOMIC_RELAXED);
+        do
+            buf->next = top;
+        while (!__atomic_compare_exchange_n(&pool->remote, &top, buf, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+
+    if (__atomic_sub_fetch(&pool->live, 1, __ATOMIC_ACQ_REL) == 0)
+        hdlc_pool_free(pool); // Deleted and this was the last one
+}
+
+/**
+ * @brief HDLC frame buffer pool occupancy
+ *
+ * @param[in] *pool   - pool
+ * @param[out] *stats - occupancy
+ *
+ * @return 0 pass
+ *        -1 failure
+ *
+ * @note Any thread, the numbers are a snapshot
+ * @warning None
+ */
+int hdlc_pool_stats(hdlc_pool_t *pool, struct hdlc_pool_stats *stats)
+{
+    if (pool == NULL || stats == NULL) return -1;
+
+    stats->size = pool->size;
+    stats->total = __atomic_load_n(&pool->total, __ATOMIC_RELAXED);
+    stats->inUse = __atomic_load_n(&pool->live, __ATOMIC_RELAXED) - 1;
+    stats->highWater = __atomic_load_n(&pool->highWater, __ATOMIC_RELAXED);
+    stats->slabs = __atomic_load_n(&pool->nslabs, __ATOMIC_RELAXED);
+    stats->oversize = __atomic_load_n(&pool->oversize, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/**
+ * @brief HDLC decode into frame buffers
+ *
+ * Decode the complete messages buffered in a channel straight into buffers
+ * from the pool, which the caller keeps past the next decode and releases
+ * with hdlc_buf_release.  Messages that fail the FCS are returned as well,
+ * with status HDLC_FRAME_BAD_FCS.  A message still arriving stays in its
+ * buffer, held by the channel until the next call completes it.  A message
+ * bigger than the pool size moves to a buffer of its own part way.
+ *
+ * @param[in] *pool   - pool
+ * @param[in] *chan   - channel to decode
+ * @param[out] out[]  - decoded messages
+ * @param[in] max     - size of out[]
+ *
+ * @return 0-max number of messages decoded
+ *        -1 failure
+ *
+ * @note A message that finds no buffer (out of memory) is lost and counted
+ *       in the channel's framesDropped
+ * @warning Owner thread only, releases any batch held on the channel
+ */
+int hdlc_pool_decode(hdlc_pool_t *pool, hdlc_chan_t *chan, struct hdlc_buf *out[], int max)
+{
+    struct hdlc_frame frame;
+    struct hdlc_buf *buf;
+    int n = 0, ret, fcsLen;
+
+    if (pool == NULL || chan == NULL || out == NULL || max < 0) return -1;
+    fcsLen = hdlc_fcs_chan(chan) / 8; // Unescaped along with the message, in the tail
+
+    while (n < max && hdlc_msg_pending_chan(chan) > 0)
+    {
+        if ((buf = hdlc_decode_held(chan)) == NULL) // Else carry on with the open message
+            buf = hdlc_pool_get(pool, pool->size);
+        if (buf != NULL &&
+            (ret = hdlc_decode_into(chan, buf->data, buf->cap + fcsLen, buf, hdlc_pool_put, &frame)) == HDLC_ERR_NO_ROOM)
+        { // Bigger than the pool size, frame.len is the room it may take
+            if (hdlc_decode_held(chan) != buf)
+                hdlc_buf_release(buf);
+            if ((buf = hdlc_pool_get(pool, frame.len)) != NULL)
+                ret = hdlc_decode_into(chan, buf->data, buf->cap + fcsLen, buf, hdlc_pool_put, &frame);
+        }
+        if (buf == NULL)
+        { // Out of memory, decode the message anyway to drop it
+            ret = hdlc_msg_decode_batch(chan, &frame, 1);
+            hdlc_msg_release_batch(chan);
+            if (ret != 1) break;
+            hdlc_count_dropped(chan, 1);
+            continue;
+        }
+        if (ret != 1)
+        { // Nothing more buffered, an open message keeps its buffer
+            if (hdlc_decode_held(chan) != buf)
+                hdlc_buf_release(buf);
+            break;
+        }
+        buf->len = frame.len;
+        buf->status = frame.status;
+        out[n++] = buf;
+    }
+    return n;
+}
+
+/**
+ * @brief HDLC frame buffer pool add a slab
+ *
+ * @param[in] *pool - pool
+ *
+ * @return 0 pass
+ *        -1 failure
+ */
+static int hdlc_pool_grow(hdlc_pool_t *pool)
+{
+    unsigned char *slab;
+    struct hdlc_buf *buf;
+    int i;
+
+    if ((slab = aligned_alloc(CACHE_LINE, SLAB_HEAD + (size_t)pool->count * pool->stride)) == NULL)
+        return -1;
+
+    *(void **)slab = pool->slabs;
+    pool->slabs = slab;
+    for (i = pool->count - 1; i >= 0; i--)
+    { // First buffer of the slab on top
+        buf = (struct hdlc_buf *)(slab + SLAB_HEAD + (size_t)i * pool->stride);
+        buf->next = pool->free;
+        pool->free = buf;
+    }
+    __atomic_store_n(&pool->total, pool->total + pool->count, __ATOMIC_RELAXED);
+    __atomic_store_n(&pool->nslabs, pool->nslabs + 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/**
+ * @brief HDLC frame buffer pool free the memory
+ *
+ * @param[in] *pool - pool, deleted with every buffer back
+ */
+static void hdlc_pool_free(hdlc_pool_t *pool)
+{
+    void *slab, *next;
+
+    for (slab = pool->slabs; slab != NULL; slab = next)
+    {
+        next = *(void **)slab;
+        free(slab);
+    }
+    free(pool);
+}
+
+/**
+ * @brief HDLC frame buffer pool give back a buffer kept by a channel
+ *
+ * @param[in] *arg - buffer (hdlc_decode_into)
+ */
+static void hdlc_pool_put(void *arg)
+{
+    hdlc_buf_release(arg);
+}
@@ -0,0 +1,58 @@
+/*!
+ * @file
+ * @author Mark Koi
+ *
+ * This is the header file for the frame buffer pool.  Frames are decoded
+ * straight into reference counted buffers that the consumer keeps as long as it
+ * likes, across decode calls and threads, and gives back with
+ * hdlc_buf_release.
+ *
+ *  - A pool belongs to the thread that takes buffers from it (the one that
+ *    called hdlc_pool_init), typically one pool per decoding thread.
+ *  - Buffers are carved from slabs and recycled newest first, so the buffer
+ *    handed out next is the one still warm in the cache.  Once the pool has
+ *    grown to the steady state, getting and releasing never calls malloc.
+ *  - Any thread may release; buffers released by other threads go back
+ *    through a lock-free stack the owner takes whole when it runs dry.
+ *  - hdlc_pool_delete may come before the last release, the memory goes away
+ *    with the last buffer.
+ */
+#ifndef HDLC_POOL_H
+#define HDLC_POOL_H
+
+#include "hdlc.h"
+
+typedef struct hdlc_pool hdlc_pool_t;
+
+// Frame buffer, data is 16 byte aligned
+struct hdlc_buf
+{
+    struct hdlc_buf *next;      // Free list link (internal), free for the holder's queues
+    hdlc_pool_t     *pool;      // Pool it goes back to
+    int              refs;      // References, hdlc_buf_ref and hdlc_buf_release
+    int              cap;       // Size of data
+    int              len;       // Bytes used
+    int              status;    // enum hdlc_frame_status for decoded frames
+    unsigned char    data[];
+};
+
+// Pool occupancy
+struct hdlc_pool_stats
+{
+    int                size;        // Data bytes per buffer
+    int                total;       // Buffers carved so far
+    int                inUse;       // Buffers held right now
+    int                highWater;   // Most buffers held at once
+    int                slabs;       // Slabs allocated
+    unsigned long long oversize;    // Requests bigger than size, served by malloc
+};
+
+hdlc_pool_t *hdlc_pool_init(int size, int count);
+int hdlc_pool_delete(hdlc_pool_t *pool);
+struct hdlc_buf *hdlc_pool_get(hdlc_pool_t *pool, int len);
+void hdlc_buf_ref(struct hdlc_buf *buf);
+void hdlc_buf_release(struct hdlc_buf *buf);
+int hdlc_pool_stats(hdlc_pool_t *pool, struct hdlc_pool_stats *stats);
+int hdlc_pool_decode(hdlc_pool_t *pool, hdlc_chan_t *chan, struct hdlc_buf *out[], int max);
+
+#endif
@@ -0,0 +1,107 @@
+/*!
+ * @file
+ * @author Mark Koi
+ *
+ * This is the internal header file shared by the hdlc modules.  Nothing in
+ * here is part of the API, applications include hdlc.h only.
+ */
+#ifndef HDLC_PRIV_H
+#define HDLC_PRIV_H
+
+#define FLAG_SEQUENCE   0x7e    // Async HDLC flag
+#define CONTROL_ESCAPE  0x7d    // Control Sequence flag
+#define PPPINITFCS16    0xffff  // Initial FCS value
+#define PPPGOODFCS16    0xf0b8  // Good final FCS value
+#define PPPINITFCS32    0xffffffff // Initial FCS-32 value
+#define PPPGOODFCS32    0xdebb20e3 // Good final FCS-32 value
+
+// Character map of the ACCM kernels, laid out for a nibble table lookup
+struct hdlc_accm
+{
+    unsigned char lo[16];   // Bit (c >> 4) of lo[c & 15]: c (0x00-0x7F) is in the map
+    unsigned char hi[16];   // Bit (c >> 4) - 8 of hi[c & 15]: same for 0x80-0xFF
+};
+
+// Escape kernels (hdlc_escape.c)
+int hdlc_escape(unsigned char *out, int cap, const unsigned char *in, int len, int avail);
+int hdlc_unescape(unsigned char *out, int cap, const unsigned char *in, int len, int *used);
+int hdlc_scan(const unsigned char *in, int len);
+int hdlc_escape_map(unsigned char *out, int cap, const unsigned char *in, int len, int avail,
+                    const struct hdlc_accm *map);
+int hdlc_unescape_map(unsigned char *out, int cap, const unsigned char *in, int len, int *used,
+                      const struct hdlc_accm *map);
+int hdlc_scan_map(const unsigned char *in, int len, const struct hdlc_accm *map);
+
+// Bit synchronous transmit state (hdlc_sync.c)
+struct hdlc_sync_tx
+{
+    unsigned long long acc;     // Line bits not written yet, the oldest in bit 0
+    int                bits;    // Bits in acc
+    unsigned int       ones;    // Ones sent in a row, a zero goes in after five
+};
+
+// Bit synchronous receive state (hdlc_sync.c)
+struct hdlc_sync_rx
+{
+    unsigned int  acc;          // Data bits not stored yet, the oldest in bit 0
+    unsigned char accBits;      // Bits in acc
+    unsigned char raw;          // Flag detector, the last 8 line bits with the newest in bit 7
+    unsigned char ones;         // Data ones in a row leaving the detector, a zero after five is dropped
+    unsigned char skip;         // Flag bits still in the detector
+    unsigned char inFrame;      // Flag seen, no abort since
+};
+
+// Bit synchronous receiver stops (hdlc_sync_destuff)
+#define SYNC_MORE       0       // Input consumed
+#define SYNC_FRAME      1       // Closing flag after a whole number of bytes
+#define SYNC_BAD        2       // Closing flag after a partial byte
+#define SYNC_ABORT      3       // Seven ones in a row ended the message
+#define SYNC_FULL       4       // Message bigger than the storage, hunting for a flag
+
+// Bit stuffing kernels (hdlc_sync.c)
+int hdlc_sync_stuff(struct hdlc_sync_tx *tx, unsigned char *out, int cap, const unsigned char *in, int len);
+int hdlc_sync_flag(struct hdlc_sync_tx *tx, unsigned char *out, int cap);
+int hdlc_sync_pad(struct hdlc_sync_tx *tx, unsigned char *out, int cap);
+int hdlc_sync_destuff(struct hdlc_sync_rx *rx, unsigned char *out, int cap, int *fill,
+                      const unsigned char *in, int len, int *used);
+
+// Decoding for the modules that hand decoded messages over in their own buffers (hdlc.c)
+typedef void (*hdlc_put_cb)(void *arg);
+int hdlc_decode_into(struct hdlc_buffer *p, unsigned char *dst, int cap, void *arg, hdlc_put_cb put,
+                     struct hdlc_frame *frame);
+void *hdlc_decode_held(struct hdlc_buffer *p);
+void hdlc_count_dropped(struct hdlc_buffer *p, int n);
+
+// Buffer pool shared by the channels (hdlc_mem.c)
+unsigned char *hdlc_mem_get(int len, int *cap);
+void hdlc_mem_put(unsigned char *buf, int cap);
+void hdlc_mem_chan_account(int bytes);
+
+/**
+ * @brief HDLC add a character to an ACCM map
+ *
+ * @param[in,out] *map - character map
+ * @param[in] c        - character
+ */
+static inline void hdlc_accm_add(struct hdlc_accm *map, unsigned char c)
+{
+    if (c < 0x80)
+        map->lo[c & 15] |= 1 << (c >> 4);
+    else
+        map->hi[c & 15] |= 1 << ((c >> 4) - 8);
+}
+
+/**
+ * @brief HDLC test a character against an ACCM map
+ *
+ * @param[in] *map - character map
+ * @param[in] c    - character
+ *
+ * @return non zero when c is in the map
+ */
+static inline int hdlc_accm_has(const struct hdlc_accm *map, unsigned char c)
+{
+    return (c < 0x80) ? (map->lo[c & 15] >> (c >> 4)) & 1 : (map->hi[c & 15] >> ((c >> 4) - 8)) & 1;
+}
+
+#endif
@@ -0,0 +1,450 @@
+/*!
+ * @file
+ * @author Mark Koi
+ *
+ * This file holds the epoll reactor.  Each bound descriptor is a link between
+ * the fd and one channel: reads go straight into the channel's ring, frames
+ * are decoded in batches and handed to the link callback, and encoded frames
+ * are queued per link and written out as the descriptor drains.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include "hdlc.h"
+#include "hdlc_reactor.h"
+
+#define RUN_EVENTS      64      // Descriptors serviced per epoll_wait
+#define READ_BUDGET     4       // Reads per descriptor and round, keeps busy links from starving others
+#define DISPATCH_FRAMES 32      // Frames decoded per batch
+
+struct hdlc_reactor
+{
+    int          epfd;          // epoll instance
+    int          running;       // Inside hdlc_reactor_run, unbound links are freed on the way out
+    hdlc_link_t *links;         // Bound links
+    hdlc_link_t *zombies;       // Unbound links waiting to be freed
+};
+
+struct hdlc_link
+{
+    hdlc_reactor_t *r;          // Reactor the link is bound to
+    int             fd;         // Descriptor read and written
+    hdlc_chan_t    *chan;       // Channel decoding and encoding for the link
+    hdlc_recv_cb    cb;         // Frame and hang up notification
+    void           *arg;        // Argument handed to cb
+    int             dead;       // Unbound, waiting to be freed
+    int             armed;      // Waiting for EPOLLOUT
+
+    unsigned char  *tx;         // Encoded frames waiting to be written
+    int             txCap;      // Size of tx
+    int             txHead;     // Next byte to write
+    int             txTail;     // End of the queued data
+
+    hdlc_link_t    *prev, *next; // Bound links (or zombies, next only)
+};
+
+// Locally defined functions (see below for function header information)
+static void hdlc_reactor_recv(hdlc_link_t *link);
+static void hdlc_reactor_dispatch(hdlc_link_t *link);
+static int hdlc_reactor_flush(hdlc_link_t *link);
+static int hdlc_reactor_arm(hdlc_link_t *link, int out);
+static void hdlc_reactor_hangup(hdlc_link_t *link);
+static void hdlc_reactor_reap(hdlc_reactor_t *r);
+
+/**
+ * @brief HDLC reactor init
+ *
+ * @return NULL failure
+ *         x    reactor
+ *
+ * @note None
+ * @warning None
+ */
+hdlc_reactor_t *hdlc_reactor_init(void)
+{
+    hdlc_reactor_t *r;
+
+    if ((r = calloc(1, sizeof(*r))) == NULL) return NULL;
+    if ((r->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    {
+        free(r);
+        return NULL;
+    }
+    return r;
+}
+
+/**
+ * @brief HDLC reactor delete
+ *
+ * Unbind every link and free the reactor.  The descriptors and channels
+ * belong to the caller and are left open.
+ *
+ * @param[in] *r - reactor
+ *
+ * @return 0 pass
+ *        -1 failure
+ *
+ * @note None
+ * @warning Not from a callback
+ */
+int hdlc_reactor_delete(hdlc_reactor_t *r)
+{
+    if (r == NULL || r->running) return -1;
+
+    while (r->links != NULL)
+        hdlc_reactor_unbind(r->links);
+    close(r->epfd);
+    free(r);
+    return 0;
+}
+
+/**
+ * @brief HDLC reactor bind
+ *
+ * Drive a channel from a descriptor.  The descriptor is switched to
+ * non-blocking mode.
+ *
+ * @param[in] *r    - reactor
+ * @param[in] fd    - serial port, pty or socket
+ * @param[in] *chan - channel to decode and encode with
+ * @param[in] cb    - called for every received frame and on hang up
+ * @param[in] *arg  - argument handed to cb
+ *
+ * @return NULL failure
+ *         x    link
+ *
+ * @note None
+ * @warning A channel must only be bound once
+ */
+hdlc_link_t *hdlc_reactor_bind(hdlc_reactor_t *r, int fd, hdlc_chan_t *chan, hdlc_recv_cb cb, void *arg)
+{
+    struct epoll_event ev;
+    hdlc_link_t *link;
+    int flags;
+
+    if (r == NULL || fd < 0 || chan == NULL || cb == NULL) return NULL;
+    if ((flags = fcntl(fd, F_GETFL)) < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+        return NULL;
+    if ((link = calloc(1, sizeof(*link))) == NULL) return NULL;
+
+    link->r = r;
+    link->fd = fd;
+    link->chan = chan;
+    link->cb = cb;
+    link->arg = arg;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = link;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+        free(link);
+        return NULL;
+    }
+
+    link->next = r->links;
+    if (r->links != NULL) r->links->prev = link;
+    r->links = link;
+    return link;
+}
+
+/**
+ * @brief HDLC reactor unbind
+ *
+ * Stop servicing a link.  Queued frames not written yet are dropped.  The
+ * descriptor and channel are left as they are.
+ *
+ * @param[in] *link - link
+ *
+ * @return 0 pass
+ *        -1 failure
+ *
+ * @note Allowed from a callback, the link is freed once the round is over
+ * @warning None
+ */
+int hdlc_reactor_unbind(hdlc_link_t *link)
+{
+    hdlc_reactor_t *r;
+
+    if (link == NULL || link->dead) return -1;
+
+    r = link->r;
+    epoll_ctl(r->epfd, EPOLL_CTL_DEL, link->fd, NULL);
+    if (link->prev != NULL) link->prev->next = link->next;
+    else r->links = link->next;
+    if (link->next != NULL) link->next->prev = link->prev;
+
+    link->dead = 1;
+    link->next = r->zombies;
+    r->zombies = link;
+    hdlc_reactor_reap(r);
+    return 0;
+}
+
+/**
+ * @brief HDLC reactor send
+ *
+ * Encode a message and queue it on the link.  Written at once if nothing is
+ * queued ahead of it, the rest goes out when the descriptor is writable.
+ *
+ * @param[in] *link - link
+ * @param[in] *in   - message
+ * @param[in] len   - size of message
+ *
+ * @return HDLC_ERR_PARAM   invalid argument or link unbound
+ *         HDLC_ERR_MAX_LEN message bigger than the channel size
+ *         HDLC_ERR_NO_ROOM queue full (HDLC_REACTOR_TX_MAX), retry once drained
+ *         HDLC_ERR_NO_MEM  no memory to grow the queue
+ *         HDLC_ERR_IO      write failed, the link hangs up on the next round
+ *         x                size of the encoded message
+ *
+ * @note None
+ * @warning None
+ */
+int hdlc_reactor_send(hdlc_link_t *link, const unsigned char *in, int len)
+{
+    unsigned char *grown;
+    int need, cap, w;
+
+    if (link == NULL || link->dead || len < 0) return HDLC_ERR_PARAM;
+    if (len > HDLC_REACTOR_TX_MAX / 2) return HDLC_ERR_NO_ROOM;
+
+    need = hdlc_encoded_bound(len, hdlc_fcs_chan(link->chan));
+    if (link->txTail - link->txHead + need > HDLC_REACTOR_TX_MAX) return HDLC_ERR_NO_ROOM;
+    if (link->txTail + need > link->txCap)
+    { // Move the queued data to the front, then grow
+        if (link->txHead > 0)
+        {
+            memmove(link->tx, link->tx + link->txHead, link->txTail - link->txHead);
+            link->txTail -= link->txHead;
+            link->txHead = 0;
+        }
+        for (cap = link->txCap ? link->txCap : 4096; cap < link->txTail + need; cap *= 2)
+            ;
+        if (cap > link->txCap)
+        {
+            if ((grown = realloc(link->tx, cap)) == NULL) return HDLC_ERR_NO_MEM;
+            link->tx = grown;
+            link->txCap = cap;
+        }
+    }
+
+    w = hdlc_msg_encode_buf(link->chan, in, len, link->tx + link->txTail, link->txCap - link->txTail);
+    if (w < 0) return w;
+    link->txTail += w;
+
+    if (!link->armed && hdlc_reactor_flush(link) < 0) return HDLC_ERR_IO;
+    return w;
+}
+
+/**
+ * @brief HDLC reactor queued data
+ *
+ * @param[in] *link - link
+ *
+ * @return -1 failure
+ *          x encoded bytes waiting to be written
+ *
+ * @note None
+ * @warning None
+ */
+int hdlc_reactor_queued(hdlc_link_t *link)
+{
+    if (link == NULL || link->dead) return -1;
+    return link->txTail - link->txHead;
+}
+
+/**
+ * @brief HDLC reactor run
+ *
+ * Wait for the descriptors and service them once: read and dispatch frames,
+ * write queued frames.
+ *
+ * @param[in] *r      - reactor
+ * @param[in] timeout - milliseconds to wait, -1 forever, 0 poll
+ *
+ * @return -1 failure
+ *          x number of descriptors serviced
+ *
+ * @note Interrupted waits return 0
+ * @warning None
+ */
+int hdlc_reactor_run(hdlc_reactor_t *r, int timeout)
+{
+    struct epoll_event ev[RUN_EVENTS];
+    hdlc_link_t *link;
+    int i, n;
+
+    if (r == NULL || r->running) return -1;
+
+    n = epoll_wait(r->epfd, ev, RUN_EVENTS, timeout);
+    if (n < 0) return (errno == EINTR) ? 0 : -1;
+
+    r->running = 1;
+    for (i = 0; i < n; i++)
+    {
+        link = ev[i].data.ptr;
+        if (!link->dead && (ev[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+            hdlc_reactor_recv(link);
+        if (!link->dead && (ev[i].events & EPOLLOUT))
+            hdlc_reactor_flush(link);
+    }
+    r->running = 0;
+    hdlc_reactor_reap(r);
+    return n;
+}
+
+/**
+ * @brief HDLC reactor read a descriptor
+ *
+ * Read straight into the channel's ring and dispatch the frames after each
+ * read.  End of file, read errors and a ring that cannot be borrowed hang
+ * the link up.
+ *
+ * @param[in] *link - link
+ */
+static void hdlc_reactor_recv(hdlc_link_t *link)
+{
+    unsigned char *span;
+    int k, n, space;
+
+    for (k = 0; k < READ_BUDGET && !link->dead; k++)
+    {
+        if ((space = hdlc_msg_add_span(link->chan, &span)) <= 0)
+        { // No ring from the shared pool, unread data would wake epoll forever
+            hdlc_reactor_hangup(link);
+            return;
+        }
+
+        n = read(link->fd, span, space);
+        if (n > 0)
+        {
+            hdlc_msg_add_commit(link->chan, n);
+            hdlc_reactor_dispatch(link);
+            if (n < space) return; // Drained
+        }
+        else if (n < 0 && errno == EINTR)
+            continue;
+        else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        else
+        { // End of file, or error (EIO on a pty whose other side closed)
+            hdlc_reactor_hangup(link);
+            return;
+        }
+    }
+}
+
+/**
+ * @brief HDLC reactor dispatch decoded frames
+ *
+ * @param[in] *link - link
+ */
+static void hdlc_reactor_dispatch(hdlc_link_t *link)
+{
+    struct hdlc_frame frames[DISPATCH_FRAMES];
+    int i, n;
+
+    do
+    {
+        n = hdlc_msg_decode_batch(link->chan, frames, DISPATCH_FRAMES);
+        for (i = 0; i < n && !link->dead; i++)
+            link->cb(link, &frames[i], link->arg);
+        hdlc_msg_release_batch(link->chan);
+    } while (n == DISPATCH_FRAMES && !link->dead);
+}
+
+/**
+ * @brief HDLC reactor write queued frames
+ *
+ * Write until the queue is empty or the descriptor is full, and wait for
+ * EPOLLOUT only while something is left.
+ *
+ * @param[in] *link - link
+ *
+ * @return 0 pass
+ *        -1 write failed, queue dropped
+ */
+static int hdlc_reactor_flush(hdlc_link_t *link)
+{
+    int n;
+
+    while (link->txHead < link->txTail)
+    {
+        n = write(link->fd, link->tx + link->txHead, link->txTail - link->txHead);
+        if (n > 0)
+            link->txHead += n;
+        else if (n < 0 && errno == EINTR)
+            continue;
+        else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return hdlc_reactor_arm(link, 1);
+        else
+        { // The hang up is reported on the read side
+            link->txHead = link->txTail = 0;
+            hdlc_reactor_arm(link, 0);
+            return -1;
+        }
+    }
+    link->txHead = link->txTail = 0;
+    return hdlc_reactor_arm(link, 0);
+}
+
+/**
+ * @brief HDLC reactor wait for writable or not
+ *
+ * @param[in] *link - link
+ * @param[in] out   - 1 wait for EPOLLOUT, 0 stop waiting for it
+ *
+ * @return 0 pass
+ *        -1 failure
+ */
+static int hdlc_reactor_arm(hdlc_link_t *link, int out)
+{
+    struct epoll_event ev;
+
+    if (link->armed == out) return 0;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = out ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    ev.data.ptr = link;
+    if (epoll_ctl(link->r->epfd, EPOLL_CTL_MOD, link->fd, &ev) < 0) return -1;
+    link->armed = out;
+    return 0;
+}
+
+/**
+ * @brief HDLC reactor hang up a link
+ *
+ * Unbind the link and tell the application with a NULL frame
+ *
+ * @param[in] *link - link
+ */
+static void hdlc_reactor_hangup(hdlc_link_t *link)
+{
+    hdlc_reactor_unbind(link); // Still allocated, only freed once the round is over
+    link->cb(link, NULL, link->arg);
+}
+
+/**
+ * @brief HDLC reactor free unbound links
+ *
+ * Nothing is freed during a round, epoll may still hand out the link.
+ *
+ * @param[in] *r - reactor
+ */
+static void hdlc_reactor_reap(hdlc_reactor_t *r)
+{
+    hdlc_link_t *link;
+
+    if (r->running) return;
+
+    while ((link = r->zombies) != NULL)
+    {
+        r->zombies = link->next;
+        free(link->tx);
+        free(link);
+    }
+}
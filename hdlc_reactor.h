@@ -0,0 +1,40 @@
+/*!
+ * @file
+ * @author Mark Koi
+ *
+ * This is the header file for the optional epoll reactor that drives hdlc
+ * channels straight from file descriptors (serial ports, ptys, sockets).
+ *
+ * One thread calls hdlc_reactor_run in a loop.  Received data is read into
+ * the channel's ring, decoded frames are handed to the link's callback and
+ * queued encoded frames are written out when the descriptor is writable.
+ * Everything on a reactor (bind, unbind, send, run) belongs to that thread;
+ * callbacks may send and unbind, including on their own link.  Writing to a
+ * socket whose peer is gone raises SIGPIPE, ignore it in the application.
+ */
+#ifndef HDLC_REACTOR_H
+#define HDLC_REACTOR_H
+
+#include "hdlc.h"
+
+#define HDLC_REACTOR_TX_MAX (1 << 20) // Default limit of encoded data queued on a link
+
+typedef struct hdlc_reactor hdlc_reactor_t;
+typedef struct hdlc_link hdlc_link_t;
+
+// Frame received on a link (good or bad FCS, see status).  NULL frame: the
+// descriptor hung up or failed, or no receive ring could be borrowed (out of
+// memory), the link is already unbound, close the fd.
+typedef void (*hdlc_recv_cb)(hdlc_link_t *link, const struct hdlc_frame *frame, void *arg);
+
+hdlc_reactor_t *hdlc_reactor_init(void);
+int hdlc_reactor_delete(hdlc_reactor_t *r);
+hdlc_link_t *hdlc_reactor_bind(hdlc_reactor_t *r, int fd, hdlc_chan_t *chan, hdlc_recv_cb cb, void *arg);
+int hdlc_reactor_unbind(hdlc_link_t *link);
+// Send returns HDLC_ERR_NO_ROOM when the link queue is full (retry once it
+// drains) and HDLC_ERR_NO_MEM when the queue could not be grown.
+int hdlc_reactor_send(hdlc_link_t *link, const unsigned char *in, int len);
+int hdlc_reactor_queued(hdlc_link_t *link);
+int hdlc_reactor_run(hdlc_reactor_t *r, int timeout);
+
+#endif
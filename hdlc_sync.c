@@ -0,0 +1,453 @@
+/*!
+ * @file
+ * @author Mark Koi
+ *
+ * This file holds the bit stuffing kernels of the bit synchronous framing
+ * mode.  On a synchronous line the flag is the bit pattern 01111110, a zero
+ * is inserted after five ones in a row anywhere else, and seven ones in a
+ * row abort the message.  Bits go out least significant first and frames
+ * need not start on a byte boundary of the capture.  The kernels move a
+ * whole byte per table lookup: the transmit table gives the stuffed bits of
+ * a byte for each count of ones already sent, the receive table the data
+ * bits of a byte leaving the flag detector for each count of ones already
+ * received.  Runs of eight bytes with no five ones in a row go through as
+ * one 64 bit word, and only bytes where a flag or an abort can end are
+ * taken a bit at a time.
+ */
+#include <pthread.h>
+#include "hdlc.h"
+#include "hdlc_priv.h"
+
+#define SYNC_FLAG       0x7e    // 01111110, the same both ways round
+#define SYNC_RUN_MASK   0x7fc   // Six ones starting at bit 2-10 of the detector window end in the new byte
+#define SYNC_RUN5_MASK  0x0fffffffffffffffULL // Five ones starting at bit 0-59 of a 64 bit word
+#define SYNC_RUN6_MASK  0x07ffffffffffffffULL // Six ones starting at bit 0-58 of a 64 bit word
+#define SYNC_RUN5(x)    ((x) & (x) >> 1 & (x) >> 2 & (x) >> 3 & (x) >> 4) // Bit k set: ones at bits k to k+4
+#define SYNC_RUN6(x)    (SYNC_RUN5(x) & (x) >> 5)
+
+// Locally defined variables
+static pthread_once_t sync_once = PTHREAD_ONCE_INIT;
+static unsigned int stuffTab[5][256];       // Stuffed bits (0-15), bit count (16-19), ones sent after (20-23)
+static unsigned short destuffTab[6][256];   // Data bits (0-7), bit count (8-11), ones received after (12-14)
+
+// Locally defined functions (see below for function header information)
+static void hdlc_sync_tables(void);
+static int hdlc_sync_put(struct hdlc_sync_tx *tx, unsigned char *out, int cap);
+static inline unsigned long long hdlc_sync_load(const unsigned char *p);
+static inline void hdlc_sync_store(unsigned char *p, unsigned long long v);
+static inline int hdlc_sync_run6(unsigned int raw, unsigned long long w);
+
+/**
+ * @brief HDLC build the bit stuffing tables
+ *
+ * Run each byte through the bit at a time rules once per count of ones
+ * carried in from the previous byte
+ */
+static void hdlc_sync_tables(void)
+{
+    unsigned int bits, n, ones, s, c, k, b;
+
+    for (s = 0; s < 5; s++)
+        for (c = 0; c < 256; c++)
+        {
+            bits = n = 0;
+            ones = s;
+            for (k = 0; k < 8; k++)
+            {
+                b = (c >> k) & 1;
+                bits |= b << n++;
+                if (b == 0)
+                    ones = 0;
+                else if (++ones == 5)
+                { // Stuffed zero
+                    n++;
+                    ones = 0;
+                }
+            }
+            stuffTab[s][c] = bits | n << 16 | ones << 20;
+        }
+
+    for (s = 0; s < 6; s++)
+        for (c = 0; c < 256; c++)
+        {
+            bits = n = 0;
+            ones = s;
+            for (k = 0; k < 8; k++)
+            {
+                b = (c >> k) & 1;
+                if (b)
+                {
+                    bits |= 1 << n++;
+                    if (ones < 5) ones++; // A sixth one is a flag, never data
+                }
+                else
+                {
+                    if (ones < 5) n++; // Else the stuffed zero is dropped
+                    ones = 0;
+                }
+            }
+            destuffTab[s][c] = bits | n << 8 | ones << 12;
+        }
+}
+
+/**
+ * @brief HDLC write the whole bytes held by the transmit state
+ *
+ * @param[in,out] *tx - transmit state
+ * @param[out] *out   - line bytes
+ * @param[in] cap     - size of out
+ *
+ * @return -1 not enough room
+ *          x bytes written
+ */
+static int hdlc_sync_put(struct hdlc_sync_tx *tx, unsigned char *out, int cap)
+{
+    int w = 0;
+
+    for (; tx->bits >= 8; tx->bits -= 8)
+    {
+        if (w == cap) return -1;
+        out[w++] = tx->acc;
+        tx->acc >>= 8;
+    }
+    return w;
+}
+
+/**
+ * @brief HDLC bit stuff data onto a synchronous line
+ *
+ * Append the bits of in, with a zero after every five ones in a row, behind
+ * the bits already held.  Whole bytes are written, less than eight bits stay
+ * in tx for the next call.
+ *
+ * @param[in,out] *tx - transmit state, zeroed before the first call
+ * @param[out] *out   - line bytes
+ * @param[in] cap     - size of out
+ * @param[in] *in     - data
+ * @param[in] len     - size of data
+ *
+ * @return -1 not enough room, tx is undefined
+ *          x bytes written
+ */
+int hdlc_sync_stuff(struct hdlc_sync_tx *tx, unsigned char *out, int cap, const unsigned char *in, int len)
+{
+    unsigned long long acc = tx->acc, v;
+    unsigned int e, k, ones = tx->ones;
+    int bits = tx->bits, i = 0, w = 0, n;
+
+    pthread_once(&sync_once, hdlc_sync_tables);
+
+    if (bits < 8 && cap >= len*2 + 8)
+    { // Room for the worst case, eight bytes at a time without checks
+        for (; len - i >= 8; i += 8)
+        {
+            v = hdlc_sync_load(in + i);
+            if ((SYNC_RUN5(v) & SYNC_RUN5_MASK) == 0 && ones + __builtin_ctzll(~v) < 5)
+            { // Nothing to stuff, the bits go out as they are
+                hdlc_sync_store(out + w, acc | v << bits);
+                acc = bits ? v >> (64 - bits) : 0;
+                w += 8;
+                ones = __builtin_clzll(~v);
+                continue;
+            }
+            for (k = 0; k < 64; k += 8)
+            {
+                e = stuffTab[ones][(v >> k) & 0xff];
+                acc |= (unsigned long long)(e & 0xffff) << bits;
+                bits += (e >> 16) & 15;
+                ones = e >> 20;
+                if (k == 24 || k == 56)
+                {
+                    hdlc_sync_store(out + w, acc);
+                    w += bits >> 3;
+                    acc >>= bits & ~7;
+                    bits &= 7;
+                }
+            }
+        }
+    }
+
+    tx->acc = acc;
+    tx->bits = bits;
+    for (;;)
+    {
+        if ((n = hdlc_sync_put(tx, out + w, cap - w)) < 0) return -1;
+        w += n;
+        if (i == len) break;
+        e = stuffTab[ones][in[i++]];
+        tx->acc |= (unsigned long long)(e & 0xffff) << tx->bits;
+        tx->bits += (e >> 16) & 15;
+        ones = e >> 20;
+    }
+    tx->ones = ones;
+    return w;
+}
+
+/**
+ * @brief HDLC send a flag on a synchronous line
+ *
+ * @param[in,out] *tx - transmit state
+ * @param[out] *out   - line bytes
+ * @param[in] cap     - size of out
+ *
+ * @return -1 not enough room
+ *          x bytes written
+ */
+int hdlc_sync_flag(struct hdlc_sync_tx *tx, unsigned char *out, int cap)
+{
+    tx->acc |= (unsigned long long)SYNC_FLAG << tx->bits;
+    tx->bits += 8;
+    tx->ones = 0;
+    return hdlc_sync_put(tx, out, cap);
+}
+
+/**
+ * @brief HDLC fill the last line byte with idle ones
+ *
+ * Less than seven ones, the receiver takes them as idle line between frames
+ *
+ * @param[in,out] *tx - transmit state
+ * @param[out] *out   - line bytes
+ * @param[in] cap     - size of out
+ *
+ * @return -1 not enough room
+ *          x bytes written (0 or 1)
+ */
+int hdlc_sync_pad(struct hdlc_sync_tx *tx, unsigned char *out, int cap)
+{
+    if (tx->bits == 0) return 0;
+
+    tx->acc |= 0xffULL << tx->bits;
+    tx->bits = 8;
+    tx->ones = 0;
+    return hdlc_sync_put(tx, out, cap);
+}
+
+/**
+ * @brief HDLC bit destuff a synchronous line
+ *
+ * Shift the line through an eight bit flag detector and destuff the bits
+ * that leave it while a message is open.  Bytes where no run of six ones
+ * can end are destuffed with one table lookup, the others a bit at a time.
+ * Stops after the byte that ends a message, the message is then in
+ * out[0..*fill).
+ *
+ * @param[in,out] *rx   - receive state, zeroed before the first call
+ * @param[out] *out     - message data
+ * @param[in] cap       - size of out
+ * @param[in,out] *fill - bytes of the message in out
+ * @param[in] *in       - line bytes
+ * @param[in] len       - size of in
+ * @param[out] *used    - line bytes consumed
+ *
+ * @return SYNC_MORE  all of in consumed, the message is still open (if any)
+ *         SYNC_FRAME closing flag after a whole number of bytes
+ *         SYNC_BAD   closing flag after a partial byte
+ *         SYNC_ABORT seven ones in a row ended the message
+ *         SYNC_FULL  out filled up, hunting for the next flag
+ *
+ * @note Flags and aborts with less than a byte since the last flag are idle
+ *       line, not messages
+ */
+int hdlc_sync_destuff(struct hdlc_sync_rx *rx, unsigned char *out, int cap, int *fill,
+                      const unsigned char *in, int len, int *used)
+{
+    unsigned long long acc = rx->acc, w, v;
+    unsigned int raw = rx->raw, accBits = rx->accBits, ones = rx->ones, inFrame = rx->inFrame, skip = rx->skip;
+    unsigned int c, win, e, k, leave;
+    int i = 0, n = *fill, stop = SYNC_MORE;
+
+    pthread_once(&sync_once, hdlc_sync_tables);
+
+    while (i < len && stop == SYNC_MORE)
+    {
+        while (len - i >= 8)
+        { // Eight bytes at a time while no flag or abort can end in them
+            w = hdlc_sync_load(in + i);
+            if (hdlc_sync_run6(raw, w))
+            {
+                if (inFrame || w != ~0ULL || raw != 0xff) break;
+                i += 8; // Idle line
+                continue;
+            }
+            if (inFrame)
+            {
+                if (skip || cap - n < 16) break;
+                v = raw | w << 8; // Leaving the detector, all data
+                if ((SYNC_RUN5(v) & SYNC_RUN5_MASK) == 0 && ones + __builtin_ctzll(~v) < 5)
+                { // No stuffed zero, the bits go through as they are
+                    hdlc_sync_store(out + n, acc | v << accBits);
+                    acc = accBits ? v >> (64 - accBits) : 0;
+                    n += 8;
+                    ones = __builtin_clzll(~v);
+                }
+                else
+                {
+                    for (k = 0; k < 64; k += 8)
+                    {
+                        c = (v >> k) & 0xff;
+                        e = destuffTab[ones][c];
+                        acc |= (unsigned long long)(e & 0xff) << accBits;
+                        accBits += (e >> 8) & 15;
+                        ones = destuffTab[0][c] >> 12; // The byte has a zero, the count does not chain
+                        if (k == 24 || k == 56)
+                        {
+                            hdlc_sync_store(out + n, acc);
+                            n += accBits >> 3;
+                            acc >>= accBits & ~7;
+                            accBits &= 7;
+                        }
+                    }
+                }
+            }
+            raw = w >> 56;
+            i += 8;
+        }
+        if (i == len) break;
+
+        c = in[i++];
+        win = raw | c << 8;
+        if ((SYNC_RUN6(win) & SYNC_RUN_MASK) == 0)
+        {
+            if (!inFrame)
+            { // No flag in this byte
+                raw = c;
+                continue;
+            }
+            if (skip == 0)
+            { // The byte leaving the detector is all data
+                e = destuffTab[ones][raw];
+                acc |= (unsigned long long)(e & 0xff) << accBits;
+                accBits += (e >> 8) & 15;
+                ones = e >> 12;
+                raw = c;
+                if (accBits >= 8)
+                {
+                    if (n == cap)
+                    { // Message bigger than the storage
+                        stop = SYNC_FULL;
+                        inFrame = 0;
+                        continue;
+                    }
+                    out[n++] = acc;
+                    acc >>= 8;
+                    accBits -= 8;
+                }
+                continue;
+            }
+        }
+
+        for (k = 0; k < 8; k++)
+        { // A flag or an abort may end in this byte
+            leave = raw & 1;
+            raw = raw >> 1 | ((c >> k) & 1) << 7;
+            if (inFrame)
+            {
+                if (skip)
+                    skip--; // Opening flag leaving
+                else if (leave)
+                {
+                    acc |= 1 << accBits++;
+                    if (ones < 5) ones++;
+                }
+                else if (ones == 5)
+                    ones = 0; // Stuffed zero
+                else
+                {
+                    accBits++;
+                    ones = 0;
+                }
+                if (accBits == 8)
+                {
+                    if (n == cap)
+                    {
+                        stop = SYNC_FULL;
+                        inFrame = 0;
+                    }
+                    else
+                        out[n++] = acc;
+                    acc = 0;
+                    accBits = 0;
+                }
+            }
+
+            if (raw == SYNC_FLAG)
+            { // Closes the message (if any) and opens the next one
+                if (inFrame && stop == SYNC_MORE && n > 0) // Idle bits shorter than a byte are not a message
+                    stop = accBits ? SYNC_BAD : SYNC_FRAME;
+                inFrame = 1;
+                skip = 8;
+                acc = 0;
+                accBits = 0;
+                ones = 0;
+            }
+            else if ((raw & 0xfe) == 0xfe)
+            { // Seven ones
+                if (inFrame && stop == SYNC_MORE && n > 0)
+                    stop = SYNC_ABORT;
+                inFrame = 0;
+            }
+        }
+    }
+
+    rx->raw = raw;
+    rx->acc = acc;
+    rx->accBits = accBits;
+    rx->ones = ones;
+    rx->inFrame = inFrame;
+    rx->skip = skip;
+    *fill = n;
+    *used = i;
+    return stop;
+}
+
+/**
+ * @brief HDLC eight line bytes, the first one in the low bits
+ *
+ * @param[in] *p - line bytes
+ *
+ * @return 64 bit word
+ */
+static inline unsigned long long hdlc_sync_load(const unsigned char *p)
+{
+    return (unsigned long long)p[0]       | (unsigned long long)p[1] << 8  |
+           (unsigned long long)p[2] << 16 | (unsigned long long)p[3] << 24 |
+           (unsigned long long)p[4] << 32 | (unsigned long long)p[5] << 40 |
+           (unsigned long long)p[6] << 48 | (unsigned long long)p[7] << 56;
+}
+
+/**
+ * @brief HDLC store a 64 bit word as eight bytes, the low bits first
+ *
+ * @param[out] *p - bytes
+ * @param[in] v   - word
+ */
+static inline void hdlc_sync_store(unsigned char *p, unsigned long long v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+    p[4] = v >> 32;
+    p[5] = v >> 40;
+    p[6] = v >> 48;
+    p[7] = v >> 56;
+}
+
+/**
+ * @brief HDLC test eight line bytes for the end of a flag or an abort
+ *
+ * Six ones in a row ending in the bytes, or at the last bit of the detector
+ * where the zero of a flag would come next
+ *
+ * @param[in] raw - flag detector
+ * @param[in] w   - next eight line bytes
+ *
+ * @return non zero when the bytes must be taken a bit at a time
+ */
+static inline int hdlc_sync_run6(unsigned int raw, unsigned long long w)
+{
+    unsigned int win = raw | (w & 0xff) << 8;
+
+    return (SYNC_RUN6(win) & 0xfc) != 0 || (SYNC_RUN6(w) & SYNC_RUN6_MASK) != 0;
+}
@@ -17,12 +17,74 @@
 #include <unistd.h>
 #include <errno.h>
 #include <limits.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
 #include "hdlc.h"
+#include "hdlc_priv.h"
+#include "hdlc_reactor.h"
+#include "hdlc_workers.h"
+#include "hdlc_pool.h"
+#include "hdlc_capture.h"
 
-#define DEFAULT_BUFF_SIZE 2048
+#define DEFAULT_BUFF_SIZE  2048
+#define REACTOR_FRAMES     64      // Frames sent through the reactor, more than a socket buffer holds
+#define REACTOR_EVERY      16      // Iterations between reactor checks
+#define HANDLE_RACE_ROUNDS 2000    // Handles created and deleted under a concurrent lookup
+#define CAPTURE_FRAMES     16      // Messages written to the capture by check_capture
+#define WORKERS_FRAMES     64      // Frames encoded before the worker pool run, the channels send them in turn
+
+// Frames seen by the reactor test callback
+struct reactor_rx
+{
+    unsigned char *buf;     // Expected message
+    int            size;    // Size of the expected message
+    int            frames;  // Good frames received
+    int            hangup;  // Hang up reported
+};
+
+// Worker pool scenario shared with the consumer thread
+struct workers_run
+{
+    hdlc_workers_t *w;          // Pool
+    int             num;        // Channels
+    int             iterate;    // Frames per channel
+    unsigned char  *frame[WORKERS_FRAMES]; // Frames sent, see workers_frame
+    int             len[WORKERS_FRAMES];   // Size of each frame
+};
 
 // Local functions
 void print_usage(char *argv[]);
+void check_fcs_engines(unsigned char *buf, int size);
+void check_simd_levels(unsigned char *buf, int size);
+void check_encode_iov(hdlc_chan_t *chan, unsigned char *buf, int size);
+void check_reactor(unsigned char *buf, int size);
+void check_stats(unsigned char *buf, int size);
+void check_fcs32(unsigned char *buf, int size);
+void check_accm(unsigned char *buf, int size);
+void check_pool(unsigned char *buf, int size);
+void check_pool_split(unsigned char *buf, int size);
+void check_mem(unsigned char *buf, int size);
+void check_stream(unsigned char *buf, int size);
+void check_segments(unsigned char *buf, int size);
+void segment_cb(hdlc_chan_t *chan, int event, const unsigned char *seg, int len, void *arg);
+void check_sync(unsigned char *buf, int size);
+void sync_cb(hdlc_chan_t *chan, const struct hdlc_frame *frame, void *arg);
+void sync_bits(unsigned char *line, long *bit, const unsigned char *src, long nbits);
+int sync_reference(unsigned char *buf, int size, int fcs32, unsigned char *line);
+void check_capture(unsigned char *buf, int size);
+int capture_cb(const struct hdlc_cap_frame *frame, void *arg);
+int capture_stop_cb(const struct hdlc_cap_frame *frame, void *arg);
+void check_hpp(const unsigned char *buf, int size); // hdlc_test_hpp.cpp
+void *pool_release_thread(void *arg);
+void check_handle_race(int buff_size);
+void *handle_lookup_thread(void *arg);
+void stats_log_cb(hdlc_chan_t *chan, int event, const char *msg, void *arg);
+void reactor_rx_cb(hdlc_link_t *link, const struct hdlc_frame *frame, void *arg);
+int run_workers(int *block, int num, int threads, int iterate, int buff_size);
+void *workers_consumer(void *arg);
+int workers_frame(int k, int buff_size, unsigned char *out);
 
 
 /**
@@ -44,12 +106,12 @@ void print_usage(char *argv[]);
  */
 int main (int argc, char *argv[])
 {
-    int count=0, debug=0, *block,opt,buff_size=DEFAULT_BUFF_SIZE,iterate=10000, i, num=1, out_size;
+    int count=0, debug=0, *block,opt,buff_size=DEFAULT_BUFF_SIZE,iterate=10000, i, num=1, out_size, threads=0;
     unsigned char *buf, *out;
     char *data_decode=NULL, *data_encode=NULL;
 
     // Parse some arguments (if necessary)
-    while( (opt = getopt(argc, argv, "hb:D:i:n:s:S:")) != -1)
+    while( (opt = getopt(argc, argv, "hb:D:i:n:s:S:t:")) != -1)
     {
         switch (opt)
         {
@@ -75,6 +137,9 @@ int main (int argc, char *argv[])
             case 'S':
                 data_decode = optarg; // This is the string to decode
                 break;
+            case 't':
+                threads = strtol(optarg,NULL,10);
+                break;
             default:
                 print_usage(argv);
                 exit(1);
@@ -86,6 +151,7 @@ int main (int argc, char *argv[])
     printf("debug        = %d\n",debug);
     printf("iterate      = %d\n",iterate);
     printf("num buffers  = %d\n",num);
+    if (threads > 0) printf("threads      = %d\n",threads);
     if (data_encode != NULL) printf("encode data  = \"%s\"\n",data_encode);
     if (data_decode != NULL) printf("decode data  = \"%s\"\n",data_decode);
 
@@ -160,15 +226,21 @@ int main (int argc, char *argv[])
     {
         assert((block[i]=hdlc_init(buff_size)) >= 0); // Must be successfull to continue, Create multiple hdlc buffers
         assert(hdlc_delete_num(block[i]) == 0); // Try to delete buffer for each block number, as test
+        assert(hdlc_msg_pending_num(block[i]) == -1); // Deleted handle must not reach a reused block
     }
     
     assert(hdlc_delete_num(0)== -1);     // Try to delete all buffers
+    check_handle_race(buff_size);
 
     for (i=0; i < num; i++)
         assert((block[i]=hdlc_init(buff_size)) >= 0); // Re-create buffer
 
     for (i=0; i < num; i++)
         printf("Allocated an HDLC buffer called block(%d)\n",block[i]);
+
+    // The same channels decoded by a pool of worker threads instead
+    if (threads > 0)
+        return run_workers(block, num, threads, iterate, buff_size);
     printf("  Creating random HDLC buffers from size 1-%d\n",buff_size);
     printf("  Encoding....  Decoding....\n");
     printf("  CURRENT STATUS:  PASSED\n");
@@ -185,10 +257,39 @@ int main (int argc, char *argv[])
         }
         if (debug > 2) printf("\n");
 
+        // All frame check sequence engines must agree on the random buffer
+        check_fcs_engines(buf, buff_size);
+        check_simd_levels(buf, buff_size);
+        check_encode_iov(hdlc_chan_get(block[0]), buf, buff_size);
+        check_stats(buf, buff_size);
+        check_fcs32(buf, buff_size);
+        check_accm(buf, buff_size);
+        check_pool(buf, buff_size);
+        check_mem(buf, buff_size);
+        check_stream(buf, buff_size);
+        check_segments(buf, buff_size);
+        check_sync(buf, buff_size);
+        check_capture(buf, buff_size);
+        check_hpp(buf, buff_size);
+
         // Get an encoded message
         assert((out_size = hdlc_msg_encode(buf,buff_size,&out)) > 0);
         o = out; // Keep original preserved
 
+        // Same frame written to caller memory sized with the worst case bound
+        {
+            hdlc_chan_t *chan = hdlc_chan_get(block[0]);
+            int bound = hdlc_encoded_bound(buff_size, hdlc_fcs_chan(chan));
+            unsigned char *enc;
+
+            assert((enc = malloc(bound)) != NULL);
+            assert(hdlc_msg_encode_buf(chan,buf,buff_size,enc,bound) == out_size);
+            assert(memcmp(enc,o,out_size) == 0);
+            assert(hdlc_msg_encode_buf(chan,buf,buff_size,enc,out_size-1) == HDLC_ERR_NO_ROOM);
+            assert(hdlc_msg_encode_buf(chan,buf,buff_size+1,enc,bound) == HDLC_ERR_MAX_LEN);
+            free(enc);
+        }
+
         if (debug > 2) {
             printf ("Encoded HDLC frame: ");
             for (i=0; i < out_size; i++)
@@ -238,12 +339,1390 @@ int main (int argc, char *argv[])
         // Compare memory and keep going if matches
         assert(memcmp(buf,out,buff_size) == 0);
 
+        // Several messages back to back come out of one batch call
+        for (i=0; i < num; i++)
+        {
+            struct hdlc_frame frames[4];
+            int j;
+
+            for (j=0; j < 3; j++)
+                assert(hdlc_msg_add_num(block[i],o,out_size) == out_size);
+            assert(hdlc_msg_decode_batch(hdlc_chan_get(block[i]),frames,4) == 3);
+            for (j=0; j < 3; j++)
+            {
+                assert(frames[j].status == HDLC_FRAME_OK && frames[j].len == buff_size);
+                assert(memcmp(buf,frames[j].ptr,buff_size) == 0);
+            }
+            assert(hdlc_msg_release_batch(hdlc_chan_get(block[i])) == 0);
+        }
+
+        // Decoding straight from the encoded buffer, without the ring
+        for (i=0; i < num; i++)
+        {
+            struct hdlc_frame frames[2];
+            int used;
+
+            assert(hdlc_msg_decode_view(hdlc_chan_get(block[i]),o,out_size,frames,2,&used) == 1);
+            assert(used == out_size && frames[0].status == HDLC_FRAME_OK && frames[0].len == buff_size);
+            assert(memcmp(buf,frames[0].ptr,buff_size) == 0);
+            if (out_size == buff_size + 4) // No escapes, left where it was
+                assert(frames[0].ptr == o + 1);
+            assert(hdlc_msg_release_batch(hdlc_chan_get(block[i])) == 0);
+        }
+
+        // Messages sharing flags are all decoded, from the ring and in place
+        {
+            struct iovec msgs[3];
+            struct hdlc_frame frames[4];
+            unsigned char *enc;
+            int bound = 3*hdlc_encoded_bound(buff_size, HDLC_FCS16), enc_size, used, j;
+
+            for (j=0; j < 3; j++)
+            {
+                msgs[j].iov_len = (buff_size + 2)/3; // Never empty
+                msgs[j].iov_base = buf + j*(buff_size - msgs[j].iov_len)/2;
+            }
+            assert((enc = malloc(bound)) != NULL);
+            assert((enc_size = hdlc_msg_encode_batch(hdlc_chan_get(block[0]),msgs,3,enc,bound)) > 0);
+            for (i=0; i < num; i++)
+            {
+                hdlc_chan_t *chan = hdlc_chan_get(block[i]);
+
+                assert(hdlc_msg_add_chan(chan,enc,enc_size) == enc_size);
+                assert(hdlc_msg_decode_batch(chan,frames,4) == 3);
+                for (j=0; j < 3; j++)
+                {
+                    assert(frames[j].status == HDLC_FRAME_OK && frames[j].len == (int)msgs[j].iov_len);
+                    assert(memcmp(msgs[j].iov_base,frames[j].ptr,frames[j].len) == 0);
+                }
+                assert(hdlc_msg_release_batch(chan) == 0);
+
+                assert(hdlc_msg_decode_view(chan,enc,enc_size,frames,4,&used) == 3 && used == enc_size);
+                for (j=0; j < 3; j++)
+                    assert(memcmp(msgs[j].iov_base,frames[j].ptr,frames[j].len) == 0);
+                assert(hdlc_msg_release_batch(chan) == 0);
+            }
+            free(enc);
+        }
+
+        if (count % REACTOR_EVERY == 0)
+            check_reactor(buf, buff_size);
+
         ++count; // Increase until done
     }
 
     return 0; // Successfully terminated
 }
 
+/**
+ * @brief check_fcs_engines
+ *
+ * Run every frame check sequence engine supported by this CPU over the
+ * buffer and all of its prefixes up to 256 bytes, and compare with the
+ * byte at a time reference, for both widths.  The automatic engine is
+ * selected on return.
+ *
+ * @param[in] *buf - data to run the frame check sequence over
+ * @param[in] size - size of data
+ *
+ * @note None
+ * @warning None
+ */
+void check_fcs_engines(unsigned char *buf, int size)
+{
+    unsigned short ref, fcs;
+    unsigned int ref32;
+    int engine, len;
+
+    for (len = 0; len <= size; len = (len < 256) ? len + 1 : size + (len == size))
+    {
+        assert(hdlc_fcs_select(HDLC_FCS_BYTE) == HDLC_FCS_BYTE);
+        ref = hdlc_fcs16(HDLC_FCS16_INIT, buf, len);
+        ref32 = hdlc_fcs32(HDLC_FCS32_INIT, buf, len);
+        for (engine = HDLC_FCS_SLICE8; engine <= HDLC_FCS_CLMUL; engine++)
+        {
+            if (hdlc_fcs_select(engine) < 0) continue; // Not supported by this CPU
+            fcs = hdlc_fcs16(HDLC_FCS16_INIT, buf, len);
+            assert(fcs == ref);
+            assert(hdlc_fcs32(HDLC_FCS32_INIT, buf, len) == ref32);
+        }
+    }
+    assert(~hdlc_fcs32(HDLC_FCS32_INIT, (const unsigned char *)"123456789", 9) == 0xcbf43926); // CRC-32 check value
+    assert(hdlc_fcs_select(HDLC_FCS_AUTO) > 0);
+}
+
+/**
+ * @brief check_simd_levels
+ *
+ * Encode the buffer with every SIMD level supported by this CPU and compare
+ * with the scalar encoding, then the same for the unescape kernel over runs
+ * of flags, escapes and escaped escapes at random densities and output room.
+ * The automatic level is selected on return.
+ *
+ * @param[in] *buf - data to encode
+ * @param[in] size - size of data
+ *
+ * @note None
+ * @warning None
+ */
+void check_simd_levels(unsigned char *buf, int size)
+{
+    static const unsigned char special[] = {0x7d, 0x7d, 0x7d, 0x7e, 0x5d, 0x5e};
+    unsigned char *ref, *out, in[512], un[512], un_ref[512];
+    int level, ref_size, len, cap, density, used, ref_used, n, i;
+
+    assert(hdlc_simd_select(HDLC_SIMD_SCALAR) == HDLC_SIMD_SCALAR);
+    assert((ref_size = hdlc_msg_encode(buf, size, &out)) > 0);
+    assert((ref = malloc(ref_size)) != NULL);
+    memcpy(ref, out, ref_size);
+
+    for (level = HDLC_SIMD_SSE2; level <= HDLC_SIMD_AVX2; level++)
+    {
+        if (hdlc_simd_select(level) < 0) continue; // Not supported by this CPU
+        assert(hdlc_msg_encode(buf, size, &out) == ref_size);
+        assert(memcmp(ref, out, ref_size) == 0);
+    }
+
+    for (n = 0; n < 16; n++)
+    {
+        len = rand() % (sizeof(in) + 1);
+        cap = rand() % (len + 1);
+        density = rand() % 101;
+        for (i = 0; i < len; i++)
+            in[i] = (rand() % 100 < density) ? special[rand() % sizeof(special)] : rand();
+        if (rand() % 2) // Mostly escape pairs, the collapsed block case
+            for (i = 0; i + 1 < len; i += 2 + rand() % 3)
+            {
+                in[i] = CONTROL_ESCAPE;
+                if (in[i + 1] == FLAG_SEQUENCE) in[i + 1] = 0x5e;
+            }
+        hdlc_simd_select(HDLC_SIMD_SCALAR);
+        ref_size = hdlc_unescape(un_ref, cap, in, len, &ref_used);
+        for (level = HDLC_SIMD_SSE2; level <= HDLC_SIMD_AVX2; level++)
+        {
+            if (hdlc_simd_select(level) < 0) continue; // Not supported by this CPU
+            assert(hdlc_unescape(un, cap, in, len, &used) == ref_size);
+            assert(used == ref_used);
+            assert(memcmp(un, un_ref, ref_size) == 0);
+        }
+    }
+    assert(hdlc_simd_select(HDLC_SIMD_AUTO) > 0);
+    free(ref);
+}
+
+/**
+ * @brief check_encode_iov
+ *
+ * Encode the buffer split in three segments into gather lists of various
+ * lengths and compare the gathered bytes with the contiguous encoding.
+ *
+ * @param[in] *chan - channel to encode on
+ * @param[in] *buf  - data to encode
+ * @param[in] size  - size of data
+ *
+ * @note None
+ * @warning None
+ */
+void check_encode_iov(hdlc_chan_t *chan, unsigned char *buf, int size)
+{
+    struct iovec in[3], out[16];
+    unsigned char *ref, *out_buf;
+    int ref_size, cut1, cut2, outmax, n, i, pos;
+
+    assert((ref_size = hdlc_msg_encode_chan(chan, buf, size, &out_buf)) > 0);
+    assert((ref = malloc(ref_size)) != NULL);
+    memcpy(ref, out_buf, ref_size);
+
+    cut1 = rand() % (size + 1);
+    cut2 = cut1 + rand() % (size - cut1 + 1);
+    in[0].iov_base = buf;        in[0].iov_len = cut1;
+    in[1].iov_base = buf + cut1; in[1].iov_len = cut2 - cut1;
+    in[2].iov_base = buf + cut2; in[2].iov_len = size - cut2;
+
+    for (outmax = 1; outmax <= 16; outmax *= 2)
+    {
+        assert((n = hdlc_msg_encode_iov(chan, in, 3, out, outmax)) > 0 && n <= outmax);
+        for (i = 0, pos = 0; i < n; pos += out[i].iov_len, i++)
+        {
+            assert(pos + (int)out[i].iov_len <= ref_size);
+            assert(memcmp(ref + pos, out[i].iov_base, out[i].iov_len) == 0);
+        }
+        assert(pos == ref_size);
+    }
+    free(ref);
+}
+
+/**
+ * @brief check_fcs32
+ *
+ * Encode the buffer on a 32 bit FCS channel and decode it back from the
+ * ring and in place.  A 16 bit FCS channel takes the FCS-32 as data.
+ *
+ * @param[in] *buf - message
+ * @param[in] size - size of message
+ *
+ * @note None
+ * @warning None
+ */
+void check_fcs32(unsigned char *buf, int size)
+{
+    struct hdlc_frame frame;
+    hdlc_chan_t *chan, *chan16;
+    unsigned char *enc, *out;
+    int enc_size, used;
+
+    assert((chan = hdlc_chan_init_fcs(size, 0, HDLC_FCS32)) != NULL && hdlc_fcs_chan(chan) == HDLC_FCS32);
+    assert((chan16 = hdlc_chan_init(size + 2, 0)) != NULL && hdlc_fcs_chan(chan16) == HDLC_FCS16);
+    assert((enc = malloc(hdlc_encoded_bound(size, HDLC_FCS32))) != NULL);
+    assert((enc_size = hdlc_msg_encode_buf(chan, buf, size, enc, hdlc_encoded_bound(size, HDLC_FCS32))) >= size + 6);
+    assert(hdlc_encoded_bound(size, HDLC_FCS32) == hdlc_encoded_bound(size, HDLC_FCS16) + 4);
+    assert(hdlc_encoded_bound(-1, HDLC_FCS16) == HDLC_ERR_PARAM && hdlc_encoded_bound(size, 8) == HDLC_ERR_PARAM);
+    assert(hdlc_encoded_bound((INT_MAX - 10) / 2, HDLC_FCS32) > 0 && hdlc_encoded_bound((INT_MAX - 10) / 2 + 1, HDLC_FCS16) == HDLC_ERR_PARAM);
+    check_encode_iov(chan, buf, size);
+
+    assert(hdlc_msg_add_chan(chan, enc, enc_size) == enc_size);
+    assert(hdlc_msg_decode_chan(chan, &out) == size && memcmp(out, buf, size) == 0);
+    assert(hdlc_msg_decode_view(chan, enc, enc_size, &frame, 1, &used) == 1 && used == enc_size);
+    assert(frame.status == HDLC_FRAME_OK && frame.len == size && memcmp(frame.ptr, buf, size) == 0);
+    assert(hdlc_msg_release_batch(chan) == 0);
+
+    assert(hdlc_msg_decode_view(chan16, enc, enc_size, &frame, 1, &used) == 1);
+    assert(frame.len == size + 2); // Two bytes of the FCS-32 left in the message
+    assert(hdlc_msg_release_batch(chan16) == 0);
+
+    free(enc);
+    assert(hdlc_chan_delete(chan) == 0 && hdlc_chan_delete(chan16) == 0);
+}
+
+/**
+ * @brief check_accm
+ *
+ * Encode the buffer with every control character and an extended map
+ * escaped, on every SIMD level, and check nothing mapped is left.  Then
+ * scatter XON characters over the encoded frame, as a modem would, and
+ * decode it back from the ring and in place.
+ *
+ * @param[in] *buf - message
+ * @param[in] size - size of message
+ *
+ * @note None
+ * @warning None
+ */
+void check_accm(unsigned char *buf, int size)
+{
+    struct hdlc_frame frame;
+    hdlc_chan_t *chan;
+    unsigned char ext[32] = {0}, *enc, *ref, *noisy, *out;
+    int bound = hdlc_encoded_bound(size, HDLC_FCS16), enc_size, noisy_size, level, used, i;
+
+    assert((chan = hdlc_chan_init(size, 0)) != NULL);
+    ext[0x5e >> 3] = 1 << (0x5e & 7);
+    assert(hdlc_accm_chan(chan, HDLC_ACCM_ALL, HDLC_ACCM_ALL, ext) == -1); // Would escape to an abort
+    ext[0x5e >> 3] = 0;
+    ext[0x41 >> 3] |= 1 << (0x41 & 7);
+    ext[0xff >> 3] |= 1 << (0xff & 7);
+    assert(hdlc_accm_chan(chan, HDLC_ACCM_ALL, HDLC_ACCM_ALL, ext) == 0);
+
+    assert((enc = malloc(bound)) != NULL && (ref = malloc(bound)) != NULL);
+    assert((noisy = malloc(bound * 2)) != NULL);
+    assert(hdlc_simd_select(HDLC_SIMD_SCALAR) == HDLC_SIMD_SCALAR);
+    assert((enc_size = hdlc_msg_encode_buf(chan, buf, size, ref, bound)) > 0);
+    for (i = 1; i < enc_size - 1; i++)
+        assert(ref[i] >= 0x20 && ref[i] != 0x41 && ref[i] != 0xff && ref[i] != 0x7e);
+    check_encode_iov(chan, buf, size);
+
+    for (i = 0, noisy_size = 0; i < enc_size; i++)
+    { // XON after every seventh byte, escapes included
+        noisy[noisy_size++] = ref[i];
+        if (i % 7 == 6 && i < enc_size - 1) noisy[noisy_size++] = 0x11;
+    }
+
+    for (level = HDLC_SIMD_SCALAR; level <= HDLC_SIMD_AVX2; level++)
+    {
+        if (hdlc_simd_select(level) < 0) continue; // Not supported by this CPU
+        assert(hdlc_msg_encode_buf(chan, buf, size, enc, bound) == enc_size);
+        assert(memcmp(ref, enc, enc_size) == 0);
+
+        assert(hdlc_msg_add_chan(chan, noisy, noisy_size) == noisy_size);
+        assert(hdlc_msg_decode_chan(chan, &out) == size && memcmp(out, buf, size) == 0);
+        assert(hdlc_msg_decode_view(chan, noisy, noisy_size, &frame, 1, &used) == 1 && used == noisy_size);
+        assert(frame.status == HDLC_FRAME_OK && frame.len == size && memcmp(frame.ptr, buf, size) == 0);
+        assert(hdlc_msg_release_batch(chan) == 0);
+    }
+    assert(hdlc_simd_select(HDLC_SIMD_AUTO) > 0);
+
+    free(enc);
+    free(ref);
+    free(noisy);
+    assert(hdlc_chan_delete(chan) == 0);
+}
+
+/**
+ * @brief check_pool_split
+ *
+ * Decode escaped messages handed over in small pieces into pooled buffers,
+ * and one bigger than the pool size, which moves to a buffer of its own part
+ * way.  Then finish a message the pool left open with the batch decoder.
+ *
+ * @param[in] *buf - message
+ * @param[in] size - size of message
+ *
+ * @note None
+ * @warning None
+ */
+void check_pool_split(unsigned char *buf, int size)
+{
+    struct hdlc_frame frame;
+    struct hdlc_stats st;
+    struct hdlc_buf *b;
+    hdlc_pool_t *pool;
+    hdlc_chan_t *chan;
+    unsigned char *msg, *out;
+    int enc_size, pos, piece, got = 0, len;
+
+    assert((msg = malloc(2 * size)) != NULL);
+    memcpy(msg, buf, size);
+    memcpy(msg + size, buf, size);
+    assert((pool = hdlc_pool_init(size, 4)) != NULL);
+    assert((chan = hdlc_chan_init(2 * size, 0)) != NULL);
+    assert(hdlc_accm_chan(chan, HDLC_ACCM_ALL, HDLC_ACCM_ALL, NULL) == 0);
+    for (len = size; len <= 2 * size; len += size)
+    {
+        assert((enc_size = hdlc_msg_encode_chan(chan, msg, len, &out)) > 0);
+        for (pos = 0; pos < enc_size; pos += piece)
+        {
+            piece = enc_size - pos < 7 ? enc_size - pos : 7; // Pieces end inside escapes too
+            assert(hdlc_msg_add_chan(chan, out + pos, piece) == piece);
+            if (hdlc_pool_decode(pool, chan, &b, 1) == 1)
+            {
+                assert(b->len == len && b->status == HDLC_FRAME_OK && b->cap >= len);
+                assert(memcmp(b->data, msg, len) == 0);
+                hdlc_buf_release(b);
+                got++;
+            }
+        }
+        assert(got == len / size);
+    }
+    assert((enc_size = hdlc_msg_encode_chan(chan, msg, size, &out)) > 0);
+    assert(hdlc_msg_add_chan(chan, out, enc_size / 2) == enc_size / 2);
+    assert(hdlc_pool_decode(pool, chan, &b, 1) == 0);
+    assert(hdlc_msg_add_chan(chan, out + enc_size / 2, enc_size - enc_size / 2) == enc_size - enc_size / 2);
+    assert(hdlc_msg_decode_batch(chan, &frame, 1) == 1);
+    assert(frame.len == size && frame.status == HDLC_FRAME_OK && memcmp(frame.ptr, msg, size) == 0);
+    assert(hdlc_msg_release_batch(chan) == 0);
+    assert(hdlc_stats_chan(chan, &st, 0) == 0 && st.framesOk == 3 && st.framesDropped == 0);
+    assert(hdlc_chan_delete(chan) == 0);
+    assert(hdlc_pool_delete(pool) == 0);
+    free(msg);
+}
+
+/**
+ * @brief check_pool
+ *
+ * Decode messages into pooled buffers, keep them across decodes, and check
+ * the reuse order, references, releases from another thread, growth and a
+ * delete with buffers still held.
+ *
+ * @param[in] *buf - message
+ * @param[in] size - size of message
+ *
+ * @note None
+ * @warning None
+ */
+void check_pool(unsigned char *buf, int size)
+{
+    struct hdlc_pool_stats st;
+    struct hdlc_buf *held[8], *b;
+    hdlc_pool_t *pool;
+    hdlc_chan_t *chan;
+    pthread_t thread;
+    unsigned char *out;
+    int enc_size, i;
+
+    assert((chan = hdlc_chan_init(size, 0)) != NULL);
+    assert((pool = hdlc_pool_init(size, 4)) != NULL);
+    assert((enc_size = hdlc_msg_encode_chan(chan, buf, size, &out)) > 0);
+    for (i = 0; i < 3; i++)
+        assert(hdlc_msg_add_chan(chan, out, enc_size) == enc_size);
+    assert(hdlc_pool_decode(pool, chan, held, 8) == 3);
+    assert(hdlc_msg_add_chan(chan, out, enc_size) == enc_size);
+    assert(hdlc_pool_decode(pool, chan, &held[3], 1) == 1);
+    assert(hdlc_pool_decode(pool, chan, &held[4], 1) == 0);
+    for (i = 0; i < 4; i++) // Still there after the later decodes
+        assert(held[i]->len == size && held[i]->status == HDLC_FRAME_OK && memcmp(held[i]->data, buf, size) == 0);
+
+    assert(hdlc_pool_stats(pool, &st) == 0);
+    assert(st.size == size && st.total == 4 && st.inUse == 4 && st.highWater == 4 && st.slabs == 1);
+
+    b = held[3]; // Newest released comes back first
+    hdlc_buf_release(b);
+    assert((held[3] = hdlc_pool_get(pool, size)) == b && held[3]->refs == 1 && held[3]->len == 0);
+    hdlc_buf_ref(held[0]);
+    hdlc_buf_release(held[0]);
+    assert(held[0]->refs == 1);
+
+    assert(pthread_create(&thread, NULL, pool_release_thread, held[1]) == 0);
+    assert(pthread_join(thread, NULL) == 0);
+    assert((b = hdlc_pool_get(pool, size)) == held[1]); // Back from the other thread
+    held[1] = b;
+    for (i = 4; i < 8; i++)
+        assert((held[i] = hdlc_pool_get(pool, size)) != NULL);
+    assert((b = hdlc_pool_get(pool, size + 1)) != NULL && b->cap == size + 1);
+    hdlc_buf_release(b);
+    assert(hdlc_pool_stats(pool, &st) == 0);
+    assert(st.total == 8 && st.inUse == 8 && st.slabs == 2 && st.oversize == 1);
+
+    for (i = 1; i < 8; i++)
+        hdlc_buf_release(held[i]);
+    assert(hdlc_pool_delete(pool) == 0);
+    assert(memcmp(held[0]->data, buf, size) == 0); // Outlives the pool handle
+    hdlc_buf_release(held[0]);
+    assert(hdlc_chan_delete(chan) == 0);
+    check_pool_split(buf, size);
+}
+
+/**
+ * @brief check_mem
+ *
+ * Check a channel holds its buffers only while a message is in flight, and
+ * that the memory accounting follows it from creation to delete.
+ *
+ * @param[in] *buf - message
+ * @param[in] size - size of message
+ *
+ * @note None
+ * @warning None
+ */
+void check_mem(unsigned char *buf, int size)
+{
+    struct hdlc_mem before, during, after;
+    hdlc_chan_t *chan;
+    unsigned char *enc, *out;
+    long long idle;
+    int enc_size, half;
+
+    assert(hdlc_mem_stats(&before) == 0);
+    assert((chan = hdlc_chan_init(size, 0)) != NULL);
+    assert((idle = hdlc_mem_chan(chan)) > 0);
+    assert(idle < 4096); // Context only
+    assert(hdlc_msg_decode_chan(chan, &out) == 0 && hdlc_mem_chan(chan) == idle);
+
+    assert((enc = malloc(hdlc_encoded_bound(size, HDLC_FCS16))) != NULL);
+    assert((enc_size = hdlc_msg_encode_buf(chan, buf, size, enc, hdlc_encoded_bound(size, HDLC_FCS16))) > 0);
+    half = enc_size / 2;
+    assert(hdlc_msg_add_chan(chan, enc, half) == half);
+    assert(hdlc_mem_chan(chan) >= idle + hdlc_msg_space_chan(chan) + half); // Ring
+    assert(hdlc_msg_decode_chan(chan, &out) == 0);
+    assert(hdlc_mem_chan(chan) > idle); // Partial message kept, ring given back
+    assert(hdlc_msg_add_chan(chan, enc + half, enc_size - half) == enc_size - half);
+    assert(hdlc_msg_decode_chan(chan, &out) == size && memcmp(out, buf, size) == 0);
+    assert(hdlc_mem_stats(&during) == 0);
+    assert(during.channels == before.channels + 1);
+    assert(during.used >= before.used + hdlc_mem_chan(chan));
+    assert(hdlc_msg_decode_chan(chan, &out) == 0 && hdlc_mem_chan(chan) == idle);
+
+    assert(hdlc_msg_encode_chan(chan, buf, size, &out) == enc_size);
+    assert(hdlc_mem_chan(chan) >= idle + enc_size); // Encode buffer stays
+    assert(hdlc_msg_encode_buf(chan, buf, size, enc, hdlc_encoded_bound(size, HDLC_FCS16)) == enc_size);
+    assert(memcmp(out, enc, enc_size) == 0); // Left alone by the encoders writing to caller memory
+    assert(hdlc_msg_encode_release(chan) == 0 && hdlc_mem_chan(chan) == idle);
+    assert(hdlc_msg_encode_chan(chan, buf, size, &out) == enc_size && memcmp(out, enc, enc_size) == 0);
+    assert(hdlc_chan_delete(chan) == 0);
+    assert(hdlc_mem_stats(&after) == 0);
+    assert(after.used == before.used && after.channels == before.channels);
+    assert(hdlc_mem_trim() >= 0 && hdlc_mem_stats(&after) == 0 && after.cached == 0);
+    free(enc);
+}
+
+/**
+ * @brief check_stream
+ *
+ * Stream the message through windows of 1 to 16 bytes (a different size on
+ * each call), then 64 and 4096 bytes, in pieces, on a channel smaller than
+ * the message, and compare with hdlc_msg_encode_buf.
+ * 16 bit FCS with and without the control character map, then 32 bit.
+ *
+ * @param[in] *buf - message
+ * @param[in] size - size of message
+ *
+ * @note None
+ * @warning None
+ */
+void check_stream(unsigned char *buf, int size)
+{
+    static const int windows[] = {0, 64, 4096}; // 0: 1 to 16 bytes, changing on every call
+    struct hdlc_stats ref_st, st;
+    hdlc_chan_t *chan, *big;
+    unsigned char *ref, *enc;
+    int k, w, win, n, pos, used, ref_size, txCnt, bound = hdlc_encoded_bound(size, HDLC_FCS32); // Both widths
+
+    assert((ref = malloc(bound)) != NULL && (enc = malloc(bound)) != NULL);
+    for (k = 0; k < 3; k++)
+    {
+        assert((chan = hdlc_chan_init_fcs(1, 0, k == 2 ? HDLC_FCS32 : HDLC_FCS16)) != NULL); // Size does not apply
+        assert((big = hdlc_chan_init_fcs(size, 0, k == 2 ? HDLC_FCS32 : HDLC_FCS16)) != NULL);
+        assert(hdlc_accm_chan(chan, k ? HDLC_ACCM_ALL : 0, 0, NULL) == 0);
+        assert(hdlc_accm_chan(big, k ? HDLC_ACCM_ALL : 0, 0, NULL) == 0);
+        assert((ref_size = hdlc_msg_encode_buf(big, buf, size, ref, bound)) > 0);
+        assert(hdlc_msg_encode_feed(chan, buf, size, enc, bound, &used) == HDLC_ERR_PARAM); // Not started
+
+        for (w = 0; w < (int)(sizeof(windows) / sizeof(windows[0])); w++)
+        {
+            win = windows[w] ? windows[w] : 1;
+            assert(hdlc_msg_encode_begin(chan) == 0);
+            for (txCnt = 0, pos = 0; pos < size; pos += used)
+            {
+                n = hdlc_msg_encode_feed(chan, buf + pos, (size - pos < win * 3 + 1) ? size - pos : win * 3 + 1,
+                                         enc + txCnt, win, &used);
+                assert(n > 0 && n <= win);
+                txCnt += n;
+                if (windows[w] == 0) win = win % 16 + 1;
+            }
+            while ((n = hdlc_msg_encode_finish(chan, enc + txCnt, win)) > 0)
+            {
+                txCnt += n;
+                if (windows[w] == 0) win = win % 16 + 1;
+            }
+            assert(n == 0 && txCnt == ref_size && memcmp(enc, ref, ref_size) == 0);
+        }
+
+        assert(hdlc_stats_chan(big, &ref_st, 0) == 0 && hdlc_stats_chan(chan, &st, 0) == 0);
+        assert(st.bytesOut == ref_st.bytesOut * w && st.escapesOut == ref_st.escapesOut * w);
+        assert(hdlc_chan_delete(chan) == 0 && hdlc_chan_delete(big) == 0);
+    }
+    free(ref);
+    free(enc);
+}
+
+// Message put back together by segment_cb
+struct segment_sink
+{
+    const unsigned char *msg; // Message expected
+    int            size;    // Size of the message expected
+    unsigned char *buf;     // Segments received
+    int            len;     // Bytes in buf
+    int            verdicts[HDLC_SEGMENT_ABORT + 1]; // Events seen, by enum hdlc_segment_event
+};
+
+/**
+ * @brief check_segments
+ *
+ * Encode the message twice back to back (shared flag), then a corrupted copy
+ * and an aborted one, on a channel smaller than the message, and decode it
+ * all in segment mode in chunks of 1 to 16 bytes (a different size on each
+ * call), 4096 bytes and whole.  16 bit FCS with and without the control
+ * character map, then 32 bit.
+ *
+ * @param[in] *buf - message
+ * @param[in] size - size of message
+ *
+ * @note None
+ * @warning None
+ */
+void check_segments(unsigned char *buf, int size)
+{
+    static const int chunks[] = {0, 4096, 1 << 30}; // 0: 1 to 16 bytes, changing on every call
+    struct segment_sink sink;
+    struct hdlc_stats st;
+    hdlc_chan_t *enc, *dec;
+    unsigned char *stream;
+    int k, c, pos, n, len, one, bad, piece, total, bound = hdlc_encoded_bound(size, HDLC_FCS32); // Both widths
+
+    assert((stream = malloc(bound * 4)) != NULL && (sink.buf = malloc(size + 1)) != NULL);
+    sink.msg = buf;
+    sink.size = size;
+    for (k = 0; k < 3; k++)
+    {
+        assert((enc = hdlc_chan_init_fcs(size, 0, k == 2 ? HDLC_FCS32 : HDLC_FCS16)) != NULL);
+        assert(hdlc_accm_chan(enc, k ? HDLC_ACCM_ALL : 0, 0, NULL) == 0);
+        assert((one = hdlc_msg_encode_buf(enc, buf, size, stream, bound)) > 0);
+        memmove(stream + one - 1, stream, one); // Second copy opens on the first one's closing flag
+        total = one * 2 - 1;
+        memcpy(stream + total, stream, one);
+        for (pos = one / 2, bad = 0; pos < one - 1 && !bad; pos++)
+        { // One bit error, not on a flag, escape or mapped character
+            c = stream[total + pos];
+            if (c >= 0x20 && (c ^ 1) >= 0x20 && c != 0x7d && c != 0x7e && (c ^ 1) != 0x7d && (c ^ 1) != 0x7e)
+            {
+                stream[total + pos] ^= 1;
+                bad = 1;
+            }
+        }
+        total += one;
+        memcpy(stream + total, stream, one - 1);
+        stream[total + one - 1] = 0x7d; // Aborted
+        stream[total + one] = 0x7e;
+        total += one + 1;
+
+        for (c = 0; c < (int)(sizeof(chunks) / sizeof(chunks[0])); c++)
+        {
+            assert((dec = hdlc_chan_init_fcs(1, 0, k == 2 ? HDLC_FCS32 : HDLC_FCS16)) != NULL); // Size does not apply
+            assert(hdlc_accm_chan(dec, 0, k ? HDLC_ACCM_ALL : 0, NULL) == 0);
+            sink.len = 0;
+            memset(sink.verdicts, 0, sizeof(sink.verdicts));
+            for (pos = 0, n = 0, piece = 1; pos < total; pos += len, piece = piece % 16 + 1)
+            {
+                len = chunks[c] ? chunks[c] : piece;
+                if (len > total - pos) len = total - pos;
+                n += hdlc_msg_decode_segments(dec, stream + pos, len, segment_cb, &sink);
+            }
+            assert(n == 3);
+            assert(sink.verdicts[HDLC_SEGMENT_OK] == 3 - bad && sink.verdicts[HDLC_SEGMENT_BAD_FCS] == bad);
+            assert(sink.verdicts[HDLC_SEGMENT_ABORT] <= 1); // Only when some of it was delivered
+            assert(hdlc_stats_chan(dec, &st, 0) == 0 && st.aborts == 1 && st.framesOk == (unsigned)(3 - bad));
+            assert(hdlc_msg_decode_segments(dec, NULL, 0, NULL, NULL) == HDLC_ERR_PARAM);
+            assert(hdlc_chan_delete(dec) == 0);
+        }
+        assert(hdlc_chan_delete(enc) == 0);
+    }
+    free(stream);
+    free(sink.buf);
+}
+
+/**
+ * @brief segment_cb
+ *
+ * Put the segments of a message back together and check it on a good FCS
+ *
+ * @param[in] *chan - channel
+ * @param[in] event - enum hdlc_segment_event
+ * @param[in] *seg  - segment
+ * @param[in] len   - size of segment
+ * @param[in] *arg  - struct segment_sink
+ */
+void segment_cb(hdlc_chan_t *chan, int event, const unsigned char *seg, int len, void *arg)
+{
+    struct segment_sink *sink = arg;
+
+    (void)chan;
+    if (event == HDLC_SEGMENT_DATA)
+    {
+        assert(seg != NULL && len > 0);
+        memcpy(sink->buf + sink->len, seg, len);
+        sink->len += len;
+        return;
+    }
+    assert(event != HDLC_SEGMENT_ABORT || sink->len > 0);
+    if (event == HDLC_SEGMENT_OK)
+        assert(sink->len == sink->size && memcmp(sink->buf, sink->msg, sink->size) == 0);
+    sink->verdicts[event]++;
+    sink->len = 0;
+}
+
+// Messages seen by sync_cb
+struct sync_sink
+{
+    const unsigned char *msg; // Message expected
+    int            size;    // Size of the message expected
+    int            ok;      // Good messages
+    int            bad;     // Messages off a byte boundary
+};
+
+/**
+ * @brief check_sync
+ *
+ * Encode the message for a bit synchronous line and compare with a bit at a
+ * time reference, then build a line that starts off a byte boundary with two
+ * frames back to back, a frame off a byte boundary, an aborted frame and a
+ * last frame, and decode it in chunks of 1 to 16 bytes (a different size on
+ * each call), 4096 bytes and whole.  16 and 32 bit FCS, the message then
+ * one made of mostly ones.
+ *
+ * @param[in] *buf - message
+ * @param[in] size - size of message
+ *
+ * @note None
+ * @warning None
+ */
+void check_sync(unsigned char *buf, int size)
+{
+    static const int chunks[] = {0, 4096, 1 << 30}; // 0: 1 to 16 bytes, changing on every call
+    static const unsigned char ones[] = {0xff, 0xff}, flag = 0x7e, odd[] = {0x55, 0x05};
+    struct sync_sink sink = {buf, size, 0, 0};
+    struct hdlc_stats st;
+    hdlc_chan_t *enc, *dec;
+    unsigned char *one, *ref, *line, *dense, *msg;
+    long bit;
+    int k, c, pos, n, len, piece, step, total, bound = hdlc_sync_encoded_bound(size);
+
+    assert((one = malloc(bound)) != NULL && (ref = malloc(bound)) != NULL && (line = malloc(bound * 4 + 8)) != NULL);
+    assert((dense = malloc(size)) != NULL);
+    for (k = 0; k < size; k++) // Mostly runs of ones, for the stuffing
+        dense[k] = "\xff\x7e\xfe\x3f"[buf[k] & 3];
+    for (k = 0; k < 4; k++)
+    {
+        sink.msg = msg = (k & 2) ? dense : buf;
+        assert((enc = hdlc_chan_init_fcs(size, 0, (k & 1) ? HDLC_FCS32 : HDLC_FCS16)) != NULL);
+        assert((len = hdlc_sync_encode_buf(enc, msg, size, one, bound)) > 0);
+        assert(sync_reference(msg, size, k & 1, ref) == len && memcmp(one, ref, len) == 0);
+        assert(hdlc_sync_encode_buf(enc, msg, size, one, len - 1) == HDLC_ERR_NO_ROOM);
+
+        bit = 0;
+        sync_bits(line, &bit, ones, size % 8 + 1); // Off a byte boundary
+        sync_bits(line, &bit, one, len * 8L);
+        sync_bits(line, &bit, one, len * 8L);
+        sync_bits(line, &bit, &flag, 8);
+        sync_bits(line, &bit, odd, 12);            // One byte and four bits
+        sync_bits(line, &bit, one, (len - 1) * 8L); // No closing flag
+        sync_bits(line, &bit, ones, 8);            // Abort
+        sync_bits(line, &bit, one, len * 8L);
+        sync_bits(line, &bit, ones, 16);
+        total = (bit + 7) / 8;
+
+        for (c = 0; c < (int)(sizeof(chunks) / sizeof(chunks[0])); c++)
+        {
+            assert((dec = hdlc_chan_init_fcs(size, 0, (k & 1) ? HDLC_FCS32 : HDLC_FCS16)) != NULL);
+            sink.ok = sink.bad = 0;
+            for (pos = 0, n = 0, piece = 1; pos < total; pos += step, piece = piece % 16 + 1)
+            {
+                step = chunks[c] ? chunks[c] : piece;
+                if (step > total - pos) step = total - pos;
+                n += hdlc_sync_decode(dec, line + pos, step, sync_cb, &sink);
+            }
+            assert(n == 4 && sink.ok == 3 && sink.bad == 1);
+            assert(hdlc_stats_chan(dec, &st, 0) == 0 && st.framesOk == 3 && st.fcsErrors == 1 && st.aborts == 1);
+            assert(hdlc_sync_decode(dec, line, total, NULL, NULL) == HDLC_ERR_PARAM);
+            assert(hdlc_chan_delete(dec) == 0);
+        }
+
+        if (size > 1)
+        { // Every message too big
+            assert((dec = hdlc_chan_init_fcs(size - 1, 0, (k & 1) ? HDLC_FCS32 : HDLC_FCS16)) != NULL);
+            sink.ok = sink.bad = 0;
+            assert(hdlc_sync_decode(dec, line, total, sync_cb, &sink) == 1 && sink.bad == 1);
+            assert(hdlc_stats_chan(dec, &st, 0) == 0 && st.framesOk == 0 && st.overruns >= 3);
+            assert(hdlc_chan_delete(dec) == 0);
+        }
+        assert(hdlc_chan_delete(enc) == 0);
+    }
+    free(dense);
+    free(one);
+    free(ref);
+    free(line);
+}
+
+/**
+ * @brief sync_cb
+ *
+ * Check a message from the bit synchronous decoder
+ *
+ * @param[in] *chan  - channel
+ * @param[in] *frame - message
+ * @param[in] *arg   - struct sync_sink
+ */
+void sync_cb(hdlc_chan_t *chan, const struct hdlc_frame *frame, void *arg)
+{
+    struct sync_sink *sink = arg;
+
+    (void)chan;
+    if (frame->status == HDLC_FRAME_OK)
+    {
+        assert(frame->len == sink->size && memcmp(frame->ptr, sink->msg, sink->size) == 0);
+        sink->ok++;
+    }
+    else
+    {
+        assert(frame->len == 1 && frame->ptr[0] == 0x55);
+        sink->bad++;
+    }
+}
+
+/**
+ * @brief sync_bits
+ *
+ * Append bits to a line, least significant first
+ *
+ * @param[in,out] *line - line bytes
+ * @param[in,out] *bit  - bits in line
+ * @param[in] *src      - bits to append
+ * @param[in] nbits     - number of bits
+ */
+void sync_bits(unsigned char *line, long *bit, const unsigned char *src, long nbits)
+{
+    long k;
+    int s;
+
+    for (k = 0; k + 8 <= nbits; k += 8, *bit += 8)
+    { // Whole bytes of src, shifted into place
+        s = *bit & 7;
+        line[*bit >> 3] = (line[*bit >> 3] & ((1 << s) - 1)) | (src[k >> 3] << s);
+        if (s != 0)
+            line[(*bit >> 3) + 1] = src[k >> 3] >> (8 - s);
+    }
+    for (; k < nbits; k++, (*bit)++)
+    {
+        if ((src[k >> 3] >> (k & 7)) & 1)
+            line[*bit >> 3] |= 1 << (*bit & 7);
+        else
+            line[*bit >> 3] &= ~(1 << (*bit & 7));
+    }
+}
+
+/**
+ * @brief sync_reference
+ *
+ * Bit synchronous frame a bit at a time: flag, stuffed message and FCS,
+ * flag, ones up to the byte boundary
+ *
+ * @param[in] *buf   - message
+ * @param[in] size   - size of message
+ * @param[in] fcs32  - 1 for the 32 bit FCS
+ * @param[out] *line - line bytes
+ *
+ * @return size of the line
+ */
+int sync_reference(unsigned char *buf, int size, int fcs32, unsigned char *line)
+{
+    static const unsigned char flag = 0x7e, one = 0xff;
+    unsigned char fcs[4];
+    unsigned int f;
+    long bit = 0;
+    int k, b, run = 0, fcsLen = fcs32 ? 4 : 2;
+
+    f = fcs32 ? ~hdlc_fcs32(HDLC_FCS32_INIT, buf, size) : (unsigned short)~hdlc_fcs16(HDLC_FCS16_INIT, buf, size);
+    for (k = 0; k < fcsLen; k++)
+        fcs[k] = f >> (8*k);
+
+    sync_bits(line, &bit, &flag, 8);
+    for (k = 0; k < (size + fcsLen) * 8; k++)
+    {
+        b = (((k < size * 8) ? buf[k >> 3] : fcs[(k >> 3) - size]) >> (k & 7)) & 1;
+        if (b)
+            line[bit >> 3] |= 1 << (bit & 7);
+        else
+            line[bit >> 3] &= ~(1 << (bit & 7));
+        bit++;
+        run = b ? run + 1 : 0;
+        if (run == 5)
+        { // Stuffed zero
+            line[bit >> 3] &= ~(1 << (bit & 7));
+            bit++;
+            run = 0;
+        }
+    }
+    sync_bits(line, &bit, &flag, 8);
+    while (bit & 7)
+        sync_bits(line, &bit, &one, 1);
+    return bit / 8;
+}
+
+// Frames of a capture, decoded one at a time by check_capture, then checked by capture_cb
+struct capture_sink
+{
+    const unsigned char *cap;   // Capture
+    int                  n;     // Frames expected
+    int                  seen;  // Frames checked
+    long long            last;  // Offset of the last frame checked
+    int                  len[CAPTURE_FRAMES];    // Size of each frame
+    int                  status[CAPTURE_FRAMES]; // enum hdlc_frame_status of each frame
+    unsigned short       sum[CAPTURE_FRAMES];    // FCS of each message, as a digest
+};
+
+/**
+ * @brief check_capture
+ *
+ * Build a capture of messages of many sizes, escaped ones, idle flags, a
+ * corrupted and an aborted message, with data before the first flag and an
+ * unfinished message at the end.  Decode it with a channel, then in shards
+ * smaller and bigger than the messages on one and three threads, and
+ * through a saved index, which no longer opens once the capture grows.
+ *
+ * @param[in] *buf - message
+ * @param[in] size - size of message
+ *
+ * @note None
+ * @warning None
+ */
+void check_capture(unsigned char *buf, int size)
+{
+    static const int threads[] = {1, 3};
+    struct hdlc_cap_conf conf = {size, HDLC_FCS16, 0, 0};
+    long long shards[] = {1 + size / 8, size * 3LL, 1 << 20}; // Several shards per message to one for the capture
+    struct capture_sink sink;
+    struct hdlc_frame frames[8];
+    struct hdlc_cap_frame frame;
+    struct hdlc_stats st, ref;
+    hdlc_index_t *ix;
+    hdlc_chan_t *chan;
+    FILE *f;
+    unsigned char *cap, *dense, *msg;
+    char path[] = "/tmp/hdlc_capXXXXXX", index[sizeof(path) + 4];
+    int j, k, c, fd, len, pos, used, bad = 0, total = 0, bound = hdlc_encoded_bound(size, HDLC_FCS16);
+
+    assert((cap = malloc(bound * (CAPTURE_FRAMES + 1) + 64)) != NULL && (dense = malloc(size)) != NULL);
+    for (k = 0; k < size; k++) // Mostly escapes
+        dense[k] = "\x7d\x7e\x11\x41"[buf[k] & 3];
+    assert((chan = hdlc_chan_init_fcs(size, 0, HDLC_FCS16)) != NULL);
+    memset(cap, 0x11, 5); // Before the first flag
+    total = 5;
+    for (j = 0; j < CAPTURE_FRAMES - 2; j++)
+    {
+        msg = (j % 3 == 2) ? dense : buf;
+        assert((len = hdlc_msg_encode_buf(chan, msg, 1 + (j * 131) % size, cap + total, bound)) > 0);
+        if (j == 4)
+        { // One bit error, not on a flag or escape
+            for (pos = 1; pos < len - 1 && !bad; pos++)
+            {
+                c = cap[total + pos];
+                if (c != 0x7d && c != 0x7e && (c ^ 1) != 0x7d && (c ^ 1) != 0x7e && cap[total + pos - 1] != 0x7d)
+                {
+                    cap[total + pos] ^= 1;
+                    bad = 1;
+                }
+            }
+        }
+        if (j == 7)
+        { // Aborted
+            cap[total + len - 1] = 0x7d;
+            cap[total + len++] = 0x7e;
+        }
+        total += len;
+        if (j % 4 == 1)
+            cap[total++] = 0x7e; // Idle
+    }
+    assert((len = hdlc_msg_encode_buf(chan, buf, size, cap + total, bound)) > 0);
+    total += len - 1; // No closing flag
+    assert(hdlc_chan_delete(chan) == 0);
+
+    // Reference, the whole capture through a channel
+    assert((chan = hdlc_chan_init_fcs(size, 0, HDLC_FCS16)) != NULL);
+    memset(&sink, 0, sizeof(sink));
+    sink.cap = cap;
+    for (pos = 0; pos < total; pos += used)
+    {
+        assert((k = hdlc_msg_decode_view(chan, cap + pos, total - pos, frames, 8, &used)) >= 0 && used > 0);
+        for (j = 0; j < k; j++, sink.n++)
+        {
+            assert(sink.n < CAPTURE_FRAMES);
+            sink.len[sink.n] = frames[j].len;
+            sink.status[sink.n] = frames[j].status;
+            sink.sum[sink.n] = hdlc_fcs16(HDLC_FCS16_INIT, frames[j].ptr, frames[j].len);
+        }
+        assert(hdlc_msg_release_batch(chan) == 0);
+    }
+    assert(hdlc_stats_chan(chan, &ref, 0) == 0 && ref.aborts == 1 && ref.fcsErrors == (unsigned)bad);
+    assert(sink.n == CAPTURE_FRAMES - 2 - 1 && ref.framesOk == (unsigned)(sink.n - bad));
+    assert(hdlc_chan_delete(chan) == 0);
+
+    for (j = 0; j < (int)(sizeof(shards) / sizeof(shards[0])); j++)
+    {
+        for (k = 0; k < (int)(sizeof(threads) / sizeof(threads[0])); k++)
+        {
+            conf.shard = shards[j];
+            conf.threads = threads[k];
+            sink.seen = 0;
+            sink.last = 0;
+            assert(hdlc_capture_decode(cap, total, &conf, capture_cb, &sink, &st) == sink.n && sink.seen == sink.n);
+            assert(st.framesOk == ref.framesOk && st.fcsErrors == ref.fcsErrors && st.aborts == ref.aborts);
+            assert(st.bytesIn == (unsigned)total && st.escapesIn <= ref.escapesIn); // Not the unfinished one
+        }
+    }
+    sink.seen = 0;
+    assert(hdlc_capture_decode(cap, total, &conf, capture_stop_cb, &sink, NULL) == 2);
+    assert(hdlc_capture_decode(cap, 0, &conf, capture_cb, &sink, &st) == 0 && st.bytesIn == 0);
+    assert(hdlc_capture_decode(NULL, total, &conf, capture_cb, &sink, NULL) == HDLC_ERR_PARAM);
+
+    // Saved index, then every frame again from its own bytes
+    assert((fd = mkstemp(path)) >= 0);
+    assert(write(fd, cap, total) == total && close(fd) == 0);
+    snprintf(index, sizeof(index), "%s.idx", path);
+    conf.shard = 64;
+    conf.threads = 2;
+    assert(hdlc_capture_index(path, index, &conf, &st) == sink.n && st.framesOk == ref.framesOk);
+    assert((ix = hdlc_index_open(index, path)) != NULL && hdlc_index_count(ix) == sink.n);
+    sink.seen = 0;
+    sink.last = 0;
+    for (j = 0; j < sink.n; j++)
+    {
+        assert(hdlc_index_frame(ix, j, &frame) == 0);
+        capture_cb(&frame, &sink);
+    }
+    assert(hdlc_index_frame(ix, sink.n, &frame) == -1);
+    assert(hdlc_index_close(ix) == 0);
+    assert((f = fopen(path, "ab")) != NULL && fputc(0x7e, f) == 0x7e && fclose(f) == 0);
+    assert(hdlc_index_open(index, path) == NULL); // Not the capture indexed any more
+    assert(unlink(index) == 0 && unlink(path) == 0);
+    assert(hdlc_capture_file(path, &conf, capture_cb, &sink, NULL) == HDLC_ERR_IO);
+    free(cap);
+    free(dense);
+}
+
+/**
+ * @brief capture_cb
+ *
+ * Check a capture frame against the next one decoded by the channel, and
+ * its offset against the capture
+ *
+ * @param[in] *frame - frame
+ * @param[in] *arg   - struct capture_sink
+ *
+ * @return 0 continue
+ */
+int capture_cb(const struct hdlc_cap_frame *frame, void *arg)
+{
+    struct capture_sink *sink = arg;
+
+    assert(sink->seen < sink->n);
+    assert(frame->len == sink->len[sink->seen] && frame->status == sink->status[sink->seen]);
+    assert(hdlc_fcs16(HDLC_FCS16_INIT, frame->ptr, frame->len) == sink->sum[sink->seen]);
+    assert(frame->offset > sink->last && frame->raw > frame->len);
+    assert(sink->cap[frame->offset - 1] == 0x7e && sink->cap[frame->offset + frame->raw] == 0x7e);
+    assert(memchr(sink->cap + frame->offset, 0x7e, frame->raw) == NULL);
+    sink->last = frame->offset;
+    sink->seen++;
+    return 0;
+}
+
+/**
+ * @brief capture_stop_cb
+ *
+ * Stop the capture decoding at the second frame
+ *
+ * @param[in] *frame - frame
+ * @param[in] *arg   - struct capture_sink
+ *
+ * @return 1 at the second frame
+ */
+int capture_stop_cb(const struct hdlc_cap_frame *frame, void *arg)
+{
+    struct capture_sink *sink = arg;
+
+    (void)frame;
+    return ++sink->seen == 2;
+}
+
+/**
+ * @brief check_handle_race
+ *
+ * Look up handles from another thread while they are created and deleted,
+ * the lookups must only ever fail, never reach a freed channel (run under
+ * a memory checker to see it)
+ *
+ * @param[in] buff_size - channel size
+ *
+ * @note None
+ * @warning None
+ */
+void check_handle_race(int buff_size)
+{
+    pthread_t thread;
+    int handle = 0, i;
+
+    assert(pthread_create(&thread, NULL, handle_lookup_thread, &handle) == 0);
+    for (i = 0; i < HANDLE_RACE_ROUNDS; i++)
+    {
+        __atomic_store_n(&handle, hdlc_init(buff_size), __ATOMIC_RELAXED);
+        assert(hdlc_delete_num(__atomic_load_n(&handle, __ATOMIC_RELAXED)) == 0);
+    }
+    __atomic_store_n(&handle, -1, __ATOMIC_RELAXED);
+    pthread_join(thread, NULL);
+}
+
+/**
+ * @brief handle_lookup_thread
+ *
+ * Look the shared handle up until it turns negative
+ *
+ * @param[in] *arg - handle
+ *
+ * @return NULL
+ */
+void *handle_lookup_thread(void *arg)
+{
+    int *handle = arg, h;
+
+    while ((h = __atomic_load_n(handle, __ATOMIC_RELAXED)) >= 0)
+        assert(hdlc_msg_pending_num(h) >= -1);
+    return NULL;
+}
+
+/**
+ * @brief pool_release_thread
+ *
+ * Release a pooled buffer away from the pool's owner
+ *
+ * @param[in] *arg - buffer
+ *
+ * @return NULL
+ */
+void *pool_release_thread(void *arg)
+{
+    hdlc_buf_release(arg);
+    return NULL;
+}
+
+/**
+ * @brief check_stats
+ *
+ * Feed a good message, a bad FCS and an aborted message behind some noise
+ * and check the channel counters and the rate limited log.
+ *
+ * @param[in] *buf - message
+ * @param[in] size - size of message
+ *
+ * @note None
+ * @warning None
+ */
+void check_stats(unsigned char *buf, int size)
+{
+    static const unsigned char noise[] = {0x01, 0x02};
+    static const unsigned char bad[] = {0x7E, 0x01, 0x02, 0x03, 0x04, 0x7E};
+    static const unsigned char abort[] = {0x11, 0x7D, 0x7E};
+    struct hdlc_stats st;
+    hdlc_chan_t *chan;
+    unsigned char *out;
+    int enc_size, logged = 0, i;
+
+    assert((chan = hdlc_chan_init(size, 0)) != NULL);
+    assert(hdlc_log_chan(chan, stats_log_cb, &logged, 1) == 0);
+    assert((enc_size = hdlc_msg_encode_chan(chan, buf, size, &out)) > 0);
+
+    assert(hdlc_msg_add_chan(chan, noise, sizeof(noise)) == sizeof(noise));
+    assert(hdlc_msg_add_chan(chan, out, enc_size) == enc_size);
+    for (i = 0; i < 8; i++) // Over the rate
+        assert(hdlc_msg_add_chan(chan, bad, sizeof(bad)) == sizeof(bad));
+    assert(hdlc_msg_add_chan(chan, abort, sizeof(abort)) == sizeof(abort));
+    assert(hdlc_msg_decode_chan(chan, &out) == size);
+    assert(memcmp(out, buf, size) == 0);
+    while (hdlc_msg_decode_chan(chan, &out) > 0)
+        ;
+
+    assert(hdlc_stats_chan(chan, &st, 1) == 0);
+    assert(st.framesOk == 1 && st.fcsErrors == 8 && st.aborts == 1 && st.resyncs == 1);
+    assert(st.overruns == 0 && st.droppedInput == 0);
+    assert(st.bytesIn == sizeof(noise) + enc_size + 8*sizeof(bad) + sizeof(abort));
+    assert(st.bytesOut == (unsigned long long)enc_size);
+    assert(st.escapesOut == (unsigned long long)(enc_size - size - 4));
+    assert(st.escapesIn == st.escapesOut + 1);
+    assert(logged >= 1 && logged <= 2); // Unless a second went by
+
+    assert(hdlc_stats_chan(chan, &st, 0) == 0);
+    assert(st.framesOk == 0 && st.bytesIn == 0 && st.escapesOut == 0);
+    assert(hdlc_chan_delete(chan) == 0);
+}
+
+/**
+ * @brief stats_log_cb
+ *
+ * Count the FCS events that got through the rate limit
+ *
+ * @param[in] *chan - channel
+ * @param[in] event - enum hdlc_log_event
+ * @param[in] *msg  - event text
+ * @param[in] *arg  - event count
+ *
+ * @note None
+ * @warning None
+ */
+void stats_log_cb(hdlc_chan_t *chan, int event, const char *msg, void *arg)
+{
+    (void)chan;
+    (void)msg;
+    if (event == HDLC_LOG_FCS) ++*(int *)arg;
+}
+
+/**
+ * @brief check_reactor
+ *
+ * Send the buffer many times over a socket pair driven by the reactor, more
+ * than the socket holds so the queue drains on EPOLLOUT, and check every
+ * frame arrives.  Then close one end and check the other one hangs up.
+ *
+ * @param[in] *buf - message
+ * @param[in] size - size of message
+ *
+ * @note None
+ * @warning None
+ */
+void check_reactor(unsigned char *buf, int size)
+{
+    struct reactor_rx rx = {buf, size, 0, 0}, tx = {buf, size, 0, 0};
+    hdlc_chan_t *a, *b;
+    hdlc_reactor_t *r;
+    hdlc_link_t *la, *lb;
+    int sv[2], i, rounds;
+
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    assert((r = hdlc_reactor_init()) != NULL);
+    assert((a = hdlc_chan_init(size, 0)) != NULL && (b = hdlc_chan_init(size, 0)) != NULL);
+    assert((la = hdlc_reactor_bind(r, sv[0], a, reactor_rx_cb, &tx)) != NULL);
+    assert((lb = hdlc_reactor_bind(r, sv[1], b, reactor_rx_cb, &rx)) != NULL);
+
+    for (i = 0; i < REACTOR_FRAMES; i++)
+        assert(hdlc_reactor_send(la, buf, size) > 0);
+    for (rounds = 0; rx.frames < REACTOR_FRAMES && rounds < 10000; rounds++)
+        assert(hdlc_reactor_run(r, 1000) > 0);
+    assert(rx.frames == REACTOR_FRAMES && hdlc_reactor_queued(la) == 0);
+
+    close(sv[1]);
+    assert(hdlc_reactor_unbind(lb) == 0);
+    for (rounds = 0; !tx.hangup && rounds < 100; rounds++)
+        assert(hdlc_reactor_run(r, 1000) >= 0);
+    assert(tx.hangup && tx.frames == 0);
+
+    close(sv[0]);
+    assert(hdlc_reactor_delete(r) == 0);
+    assert(hdlc_chan_delete(a) == 0 && hdlc_chan_delete(b) == 0);
+}
+
+/**
+ * @brief reactor_rx_cb
+ *
+ * Count the frames matching the expected message and the hang ups
+ *
+ * @param[in] *link  - link the frame arrived on
+ * @param[in] *frame - frame, NULL on hang up
+ * @param[in] *arg   - struct reactor_rx
+ *
+ * @note None
+ * @warning None
+ */
+void reactor_rx_cb(hdlc_link_t *link, const struct hdlc_frame *frame, void *arg)
+{
+    struct reactor_rx *rx = arg;
+
+    (void)link;
+    if (frame == NULL)
+    {
+        rx->hangup = 1;
+        return;
+    }
+    assert(frame->status == HDLC_FRAME_OK && frame->len == rx->size);
+    assert(memcmp(frame->ptr, rx->buf, rx->size) == 0);
+    rx->frames++;
+}
+
+/**
+ * @brief run_workers
+ *
+ * Feed <iterate> frames to every channel through a worker pool from this
+ * thread, check on a consumer thread that each channel gets its frames in
+ * order and report the throughput.  The frames are encoded before the run,
+ * so the feed and the check are only copies and compares.
+ *
+ * @param[in] *block    - channel handles
+ * @param[in] num       - number of channels
+ * @param[in] threads   - number of worker threads
+ * @param[in] iterate   - frames per channel
+ * @param[in] buff_size - largest frame
+ *
+ * @return 0 successful
+ *
+ * @note None
+ * @warning None
+ */
+int run_workers(int *block, int num, int threads, int iterate, int buff_size)
+{
+    struct workers_run run = {NULL, num, iterate};
+    struct timespec start, end;
+    pthread_t consumer;
+    unsigned char *enc[WORKERS_FRAMES];
+    int enc_size[WORKERS_FRAMES];
+    long bytes = 0;
+    double secs;
+    int seq, i, k, done, bound = hdlc_encoded_bound(buff_size, HDLC_FCS16);
+
+    assert(iterate > 0);
+    for (k=0; k < WORKERS_FRAMES; k++)
+    { // Every channel has the same settings, any of them encodes
+        assert((run.frame[k] = malloc(buff_size)) != NULL && (enc[k] = malloc(bound)) != NULL);
+        run.len[k] = workers_frame(k, buff_size, run.frame[k]);
+        assert((enc_size[k] = hdlc_msg_encode_buf(hdlc_chan_get(block[0]), run.frame[k], run.len[k], enc[k], bound)) > 0);
+    }
+    assert((run.w = hdlc_workers_init(threads, num, 1)) != NULL);
+    for (i=0; i < num; i++)
+        assert(hdlc_workers_attach(run.w, block[i], 0) == i);
+    assert(pthread_create(&consumer, NULL, workers_consumer, &run) == 0);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (seq=0; seq < iterate; seq++)
+    {
+        for (i=0; i < num; i++)
+        {
+            k = (seq + i) % WORKERS_FRAMES; // Channels out of step, frame sizes mixed across the workers
+            for (done=0; done < enc_size[k]; )
+            { // Short when the worker is behind
+                done += hdlc_workers_add(run.w, i, enc[k] + done, enc_size[k] - done);
+                if (done < enc_size[k]) sched_yield();
+            }
+            bytes += run.len[k];
+        }
+    }
+    assert(pthread_join(consumer, NULL) == 0);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("  %d frames on %d channels with %d threads: %.0f frames/s, %.1f MB/s\n",
+           iterate*num, num, threads, iterate*num / secs, bytes / secs / 1e6);
+    printf("  CURRENT STATUS:  PASSED\n");
+
+    assert(hdlc_workers_delete(run.w) == 0);
+    for (k=0; k < WORKERS_FRAMES; k++)
+    {
+        free(run.frame[k]);
+        free(enc[k]);
+    }
+    return 0;
+}
+
+/**
+ * @brief workers_consumer
+ *
+ * Take every frame of the pool scenario and check it is the next one of
+ * its channel
+ *
+ * @param[in] *arg - struct workers_run
+ *
+ * @return NULL
+ *
+ * @note None
+ * @warning None
+ */
+void *workers_consumer(void *arg)
+{
+    struct workers_run *run = arg;
+    struct hdlc_msg *msg;
+    int *next, left = run->num * run->iterate, k;
+
+    assert((next = calloc(run->num, sizeof(int))) != NULL);
+    while (left > 0)
+    {
+        assert((msg = hdlc_workers_recv(run->w, 0, 1)) != NULL);
+        assert(msg->id >= 0 && msg->id < run->num && msg->status == HDLC_FRAME_OK);
+        k = (next[msg->id]++ + msg->id) % WORKERS_FRAMES;
+        assert(msg->len == run->len[k] && memcmp(msg->data, run->frame[k], run->len[k]) == 0);
+        hdlc_msg_free(msg);
+        left--;
+    }
+    free(next);
+    return NULL;
+}
+
+/**
+ * @brief workers_frame
+ *
+ * Frame <k> of the pool scenario.  Channel c sends frame
+ * (seq + c) % WORKERS_FRAMES as its frame number seq, so the consumer can
+ * check the order.
+ *
+ * @param[in] k         - frame
+ * @param[in] buff_size - largest frame
+ * @param[out] *out     - frame
+ *
+ * @return size of the frame
+ *
+ * @note None
+ * @warning None
+ */
+int workers_frame(int k, int buff_size, unsigned char *out)
+{
+    int len = 1 + (k*131) % buff_size, j;
+
+    for (j=0; j < len; j++)
+        out[j] = k*7 + j*11; // Covers the flag and escape values
+    return len;
+}
+
 /**
  * @brief print_usage
  *
@@ -258,7 +1737,7 @@ int main (int argc, char *argv[])
 void print_usage(char *argv[])
 {
         printf("Usage:\n");
-        printf("%s [-bhDin]\n", *argv);
+        printf("%s [-bhDint]\n", *argv);
         printf("%s -h\n", *argv);
         printf("   -b <buff_size>      max buffer size to test\n");
         printf("   -D <debug>          set <debug> value\n");
@@ -267,4 +1746,5 @@ void print_usage(char *argv[])
         printf("   -n <num>            number of hdlc io handlers to test.  Default = 1\n");
         printf("   -s <string: 01 fe>  string in quotes, and generate an ENCODED single HDLC frame with checksum in hex\n");
         printf("   -S <string: 7e ..>  string in quotes, and generate a  DECODED single packet if HDLC frame valid\n");
+        printf("   -t <threads>        decode the -n handlers with a pool of worker threads, <iterate> frames each\n");
 }
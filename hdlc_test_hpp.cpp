@@ -0,0 +1,115 @@
+/*!
+ * @file
+ * @author Mark Koi
+ *
+ * This file holds the checks of the C++ codec (hdlc.hpp) run by the hdlc
+ * test program: frames must be the same bytes as the C channel's, and each
+ * side must decode what the other encoded.
+ */
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "hdlc.h"
+#include "hdlc.hpp"
+
+#define HPP_MAX_FRAME 65536     // Largest message the checks run on
+
+extern "C" void check_hpp(const unsigned char *buf, int size);
+
+/**
+ * @brief check_codec
+ *
+ * Encode with both codecs and compare, then decode the C frame with the
+ * Codec in pieces of 1 to 16 bytes and whole, a corrupted copy included, and
+ * the Codec frame with the C channel.
+ *
+ * @param[in] *buf - message
+ * @param[in] size - size of message
+ * @param[in] fcs  - HDLC_FCS16 or HDLC_FCS32, matching Fcs
+ * @param[in] accm - HDLC_ACCM_ALL or 0, matching Map
+ *
+ * @note None
+ * @warning None
+ */
+template <class Fcs, class Map>
+static void check_codec(const unsigned char *buf, int size, int fcs, unsigned int accm)
+{
+    using Codec = hdlc::Codec<Fcs, Map, HPP_MAX_FRAME>;
+    static Codec dec; // Too big for the stack
+    std::vector<unsigned char> ref(hdlc_encoded_bound(size, fcs)), enc(Codec::encoded_bound(size));
+    std::span<const unsigned char> in(buf, size);
+    hdlc_chan_t *chan;
+    unsigned char *out, c;
+    int enc_size, good = 0, bad = 0, i, piece;
+    auto onFrame = [&](std::span<const unsigned char> msg, bool ok)
+    {
+        assert(msg.size() == (size_t)size);
+        if (ok)
+        {
+            assert(memcmp(msg.data(), buf, size) == 0);
+            good++;
+        }
+        else
+            bad++;
+    };
+
+    assert(ref.size() == Codec::encoded_bound(size));
+    assert((chan = hdlc_chan_init_fcs(size, 0, fcs)) != NULL);
+    assert(hdlc_accm_chan(chan, accm, accm, NULL) == 0);
+    assert((enc_size = hdlc_msg_encode_buf(chan, buf, size, ref.data(), ref.size())) > 0);
+    assert(Codec::encode(in, enc) == enc_size);
+    assert(memcmp(ref.data(), enc.data(), enc_size) == 0);
+    assert(Codec::encode(in, std::span<unsigned char>(enc.data(), enc_size - 1)) == hdlc::ErrNoRoom);
+
+    dec.reset();
+    for (i = 0, piece = 1; i < enc_size; i += piece, piece = piece % 16 + 1) // Pieces end inside escapes too
+        dec.decode(std::span<const unsigned char>(ref.data() + i, std::min(piece, enc_size - i)), onFrame);
+    assert(dec.decode(std::span<const unsigned char>(ref.data(), enc_size), onFrame) == 1); // Shared flag
+    assert(good == 2 && bad == 0);
+    c = ref[enc_size / 2];
+    ref[enc_size / 2] ^= 0x01;
+    if (c != 0x7e && c != 0x7d && (c ^ 0x01) != 0x7e && (c ^ 0x01) != 0x7d && ((c ^ 0x01) >= 0x20 || !accm))
+    { // Still one message of the same size, failing the FCS
+        assert(dec.decode(std::span<const unsigned char>(ref.data() + 1, enc_size - 1), onFrame) == 1);
+        assert(bad == 1);
+    }
+
+    assert(hdlc_msg_add_chan(chan, enc.data(), enc_size) == enc_size);
+    assert(hdlc_msg_decode_chan(chan, &out) == size && memcmp(out, buf, size) == 0);
+    assert(hdlc_chan_delete(chan) == 0);
+}
+
+/**
+ * @brief check_hpp
+ *
+ * Run the C++ codec against the C channel for both FCS widths, with a full,
+ * partial and empty control character map.  Each map runs on the message
+ * and on a copy made mostly of escapes; the full and empty maps switch FCS
+ * width between the two.
+ *
+ * @param[in] *buf - message
+ * @param[in] size - size of message
+ *
+ * @note None
+ * @warning None
+ */
+void check_hpp(const unsigned char *buf, int size)
+{
+    if (size > HPP_MAX_FRAME) return;
+
+    assert(hdlc::FcsEngine<hdlc::Fcs16>::update(0xffff, buf, size) == hdlc_fcs16(0xffff, buf, size));
+    assert(hdlc::FcsEngine<hdlc::Fcs32>::update(0xffffffff, buf, size) == hdlc_fcs32(0xffffffff, buf, size));
+    static_assert(hdlc::FcsEngine<hdlc::Fcs32>::tab[0][1] == 0x77073096, "CRC-32 table");
+
+    check_codec<hdlc::Fcs16, hdlc::AccmNone>(buf, size, HDLC_FCS16, 0);
+    check_codec<hdlc::Fcs32, hdlc::AccmAll>(buf, size, HDLC_FCS32, HDLC_ACCM_ALL);
+    check_codec<hdlc::Fcs16, hdlc::Accm<0x000a0000>>(buf, size, HDLC_FCS16, 0x000a0000); // XON/XOFF only
+
+    std::vector<unsigned char> dense(size);
+    for (int i = 0; i < size; i++) // Mostly escapes, for the branch free paths
+        dense[i] = "\x7d\x7e\x11\x41"[buf[i] & 3];
+    check_codec<hdlc::Fcs16, hdlc::AccmAll>(dense.data(), size, HDLC_FCS16, HDLC_ACCM_ALL);
+    check_codec<hdlc::Fcs32, hdlc::AccmNone>(dense.data(), size, HDLC_FCS32, 0);
+    check_codec<hdlc::Fcs16, hdlc::Accm<0x000a0000>>(dense.data(), size, HDLC_FCS16, 0x000a0000);
+}
@@ -0,0 +1,659 @@
+/*!
+ * @file
+ * @author Mark Koi
+ *
+ * This file holds the decode worker pool.  Every pool channel has a single
+ * producer / single consumer ring of received data (producer thread to the
+ * worker decoding it) and an owner worker.  A channel with data is queued
+ * once on its owner's ready stack, so a worker only visits the channels
+ * that have something to decode, however many are attached.  A worker
+ * decodes a channel only while holding its busy flag, which keeps the
+ * frames in order even while the channel moves to another worker.  Frames
+ * that find no buffer are counted in the channel's framesDropped.  Frames go to the consumers through
+ * lock-free stacks that the consumer takes whole and turns back into FIFO.
+ * Each worker copies its frames into buffers from its own frame pool, so the
+ * steady state runs without malloc and the consumer's frees go back to the
+ * worker that will reuse them.
+ */
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "hdlc.h"
+#include "hdlc_workers.h"
+#include "hdlc_pool.h"
+#include "hdlc_priv.h"
+
+#define CACHE_LINE      64
+#define VISIT_BUDGET    65536   // Bytes decoded per channel visit before moving on
+#define VISIT_FRAMES    32      // Frames decoded per batch
+#define IDLE_WAIT_NS    1000000 // Idle workers look for channels to steal this often
+#define MSG_BUF_SIZE    (2048 - (int)sizeof(struct hdlc_buf)) // Pooled message, header included, bigger ones use malloc
+#define MSG_BUF_SLAB    64      // Pooled messages per slab
+
+struct hdlc_wchan
+{
+    hdlc_chan_t   *chan;        // Decoder
+    int            number;      // Channel handle
+    int            consumer;    // Queue the frames go to
+    int            owner;       // Worker decoding the channel, changes when stolen
+    int            busy;        // A worker is decoding it right now
+    int            queued;      // On its owner's ready stack
+    struct hdlc_wchan *nextReady; // Ready stack link, only valid while queued
+
+    unsigned char *in;          // Received data, single producer / single consumer
+    unsigned int   inSize;      // Capacity (power of two)
+    unsigned int   inHead __attribute__((aligned(CACHE_LINE))); // Written by the producer
+    unsigned int   inTail __attribute__((aligned(CACHE_LINE))); // Written by the decoding worker
+} __attribute__((aligned(CACHE_LINE)));
+
+struct hdlc_worker
+{
+    struct hdlc_workers *w;     // Pool
+    int             id;         // Index in the pool
+    pthread_t       thread;
+    pthread_mutex_t lock;       // Sleep and wake up
+    pthread_cond_t  cond;
+    int             sleeping;   // Waiting on cond, producers have to signal
+    int             ready;      // Started: 1 running, -1 failed
+    hdlc_pool_t    *pool;       // Message buffers, owned by the worker thread
+    struct hdlc_wchan *readyStack __attribute__((aligned(CACHE_LINE))); // Channels with data, pushed by anyone, newest first
+} __attribute__((aligned(CACHE_LINE)));
+
+struct hdlc_consumer
+{
+    struct hdlc_msg *stack;     // Pushed by the workers, newest first
+    struct hdlc_msg *list;      // Taken by the consumer, oldest first
+    pthread_mutex_t  lock;      // Sleep and wake up
+    pthread_cond_t   cond;
+    int              waiting;   // Waiting on cond, workers have to signal
+} __attribute__((aligned(CACHE_LINE)));
+
+struct hdlc_workers
+{
+    int                   nworkers;
+    int                   nconsumers;
+    int                   maxchans;
+    int                   nchans;       // Attached so far, published after the channel is set up
+    int                   stop;         // Workers exit
+    int                   backlog;      // Channels queued and not taken yet, idle workers look for one to steal
+    struct hdlc_worker   *workers;
+    struct hdlc_consumer *consumers;
+    struct hdlc_wchan    *chans;
+    pthread_mutex_t       attachLock;   // Serializes attach
+};
+
+// Locally defined functions (see below for function header information)
+static void *hdlc_worker_main(void *arg);
+static int hdlc_worker_decode(struct hdlc_worker *me, struct hdlc_wchan *c);
+static int hdlc_worker_steal(struct hdlc_worker *me);
+static void hdlc_worker_sleep(struct hdlc_worker *me);
+static unsigned int hdlc_wchan_pending(struct hdlc_wchan *c);
+static void hdlc_wchan_kick(struct hdlc_workers *w, struct hdlc_wchan *c);
+static void hdlc_consumer_push(struct hdlc_consumer *q, struct hdlc_msg *msg);
+static void hdlc_wake(pthread_mutex_t *lock, pthread_cond_t *cond);
+
+/**
+ * @brief HDLC worker pool init
+ *
+ * Start the worker threads
+ *
+ * @param[in] workers   - number of worker threads (one per core)
+ * @param[in] channels  - maximum number of channels attached
+ * @param[in] consumers - number of consumer queues
+ *
+ * @return NULL failure
+ *         x    pool
+ *
+ * @note None
+ * @warning None
+ */
+hdlc_workers_t *hdlc_workers_init(int workers, int channels, int consumers)
+{
+    hdlc_workers_t *w;
+    int i;
+
+    if (workers <= 0 || channels <= 0 || consumers <= 0) return NULL;
+    if ((w = calloc(1, sizeof(*w))) == NULL) return NULL;
+
+    w->nworkers = workers;
+    w->nconsumers = consumers;
+    w->maxchans = channels;
+    w->workers = aligned_alloc(CACHE_LINE, workers * sizeof(*w->workers));
+    w->consumers = aligned_alloc(CACHE_LINE, consumers * sizeof(*w->consumers));
+    w->chans = aligned_alloc(CACHE_LINE, channels * sizeof(*w->chans));
+    if (w->workers == NULL || w->consumers == NULL || w->chans == NULL)
+    {
+        free(w->workers);
+        free(w->consumers);
+        free(w->chans);
+        free(w);
+        return NULL;
+    }
+    memset(w->consumers, 0, consumers * sizeof(*w->consumers));
+    memset(w->chans, 0, channels * sizeof(*w->chans));
+    pthread_mutex_init(&w->attachLock, NULL);
+    for (i = 0; i < consumers; i++)
+    {
+        pthread_mutex_init(&w->consumers[i].lock, NULL);
+        pthread_cond_init(&w->consumers[i].cond, NULL);
+    }
+
+    for (i = 0; i < workers; i++)
+    {
+        memset(&w->workers[i], 0, sizeof(w->workers[i]));
+        w->workers[i].w = w;
+        w->workers[i].id = i;
+        pthread_mutex_init(&w->workers[i].lock, NULL);
+        pthread_cond_init(&w->workers[i].cond, NULL);
+        if (pthread_create(&w->workers[i].thread, NULL, hdlc_worker_main, &w->workers[i]) != 0)
+        {
+            w->nworkers = i; // Stop the ones already running
+            hdlc_workers_delete(w);
+            return NULL;
+        }
+        pthread_mutex_lock(&w->workers[i].lock); // Wait for its frame pool
+        while (w->workers[i].ready == 0)
+            pthread_cond_wait(&w->workers[i].cond, &w->workers[i].lock);
+        pthread_mutex_unlock(&w->workers[i].lock);
+        if (w->workers[i].ready < 0)
+        {
+            w->nworkers = i + 1;
+            hdlc_workers_delete(w);
+            return NULL;
+        }
+    }
+    return w;
+}
+
+/**
+ * @brief HDLC worker pool delete
+ *
+ * Stop the workers and drop the frames nobody took.  The channels are left
+ * to the caller.
+ *
+ * @param[in] *w - pool
+ *
+ * @return 0 pass
+ *        -1 failure
+ *
+ * @note None
+ * @warning Producers and consumers must be done with the pool
+ */
+int hdlc_workers_delete(hdlc_workers_t *w)
+{
+    struct hdlc_msg *msg;
+    int i;
+
+    if (w == NULL) return -1;
+
+    __atomic_store_n(&w->stop, 1, __ATOMIC_SEQ_CST);
+    for (i = 0; i < w->nworkers; i++)
+    {
+        pthread_mutex_lock(&w->workers[i].lock);
+        pthread_cond_signal(&w->workers[i].cond);
+        pthread_mutex_unlock(&w->workers[i].lock);
+        pthread_join(w->workers[i].thread, NULL);
+    }
+
+    for (i = 0; i < w->nconsumers; i++)
+    {
+        while ((msg = hdlc_workers_recv(w, i, 0)) != NULL)
+            hdlc_msg_free(msg);
+        pthread_mutex_destroy(&w->consumers[i].lock);
+        pthread_cond_destroy(&w->consumers[i].cond);
+    }
+    for (i = 0; i < w->nchans; i++)
+        free(w->chans[i].in);
+    pthread_mutex_destroy(&w->attachLock);
+    free(w->workers);
+    free(w->consumers);
+    free(w->chans);
+    free(w);
+    return 0;
+}
+
+/**
+ * @brief HDLC worker pool attach a channel
+ *
+ * Hand a channel from hdlc_init to the pool.  It goes to the worker with
+ * the fewest channels, its frames to the given consumer.
+ *
+ * @param[in] *w       - pool
+ * @param[in] number   - channel handle
+ * @param[in] consumer - consumer queue for the frames
+ *
+ * @return -1 failure
+ *          x pool channel id for hdlc_workers_add
+ *
+ * @note None
+ * @warning None
+ */
+int hdlc_workers_attach(hdlc_workers_t *w, int number, int consumer)
+{
+    struct hdlc_wchan *c;
+    hdlc_chan_t *chan;
+    unsigned int size;
+    int id, *count, i, owner = 0;
+
+    if (w == NULL || consumer < 0 || consumer >= w->nconsumers) return -1;
+    if ((chan = hdlc_chan_get(number)) == NULL) return -1;
+
+    pthread_mutex_lock(&w->attachLock);
+    id = w->nchans;
+    if (id >= w->maxchans || (count = calloc(w->nworkers, sizeof(int))) == NULL)
+    {
+        pthread_mutex_unlock(&w->attachLock);
+        return -1;
+    }
+    for (i = 0; i < id; i++)
+        count[__atomic_load_n(&w->chans[i].owner, __ATOMIC_RELAXED)]++;
+    for (i = 1; i < w->nworkers; i++)
+        if (count[i] < count[owner]) owner = i;
+    free(count);
+
+    c = &w->chans[id];
+    for (size = 4096; size < (unsigned int)hdlc_msg_space_chan(chan); size *= 2)
+        ; // Same capacity as the channel ring
+    if ((c->in = malloc(size)) == NULL)
+    {
+        pthread_mutex_unlock(&w->attachLock);
+        return -1;
+    }
+    c->inSize = size;
+    c->inHead = c->inTail = 0;
+    c->chan = chan;
+    c->number = number;
+    c->consumer = consumer;
+    c->owner = owner;
+    c->busy = 0;
+    c->queued = 0;
+    c->nextReady = NULL;
+    __atomic_store_n(&w->nchans, id + 1, __ATOMIC_RELEASE); // Workers see it set up
+    pthread_mutex_unlock(&w->attachLock);
+    return id;
+}
+
+/**
+ * @brief HDLC worker pool add received data
+ *
+ * Copy received data for a channel and wake the worker that owns it
+ *
+ * @param[in] *w   - pool
+ * @param[in] id   - pool channel
+ * @param[in] *in  - received data
+ * @param[in] size - size of data
+ *
+ * @return -1 failure
+ *          x size copied, less than size when the channel is backed up
+ *
+ * @note One producer thread per channel
+ * @warning None
+ */
+int hdlc_workers_add(hdlc_workers_t *w, int id, const unsigned char *in, int size)
+{
+    struct hdlc_wchan *c;
+    unsigned int head, tail, off, first;
+
+    if (w == NULL || id < 0 || id >= __atomic_load_n(&w->nchans, __ATOMIC_ACQUIRE) || in == NULL || size < 0)
+        return -1;
+
+    c = &w->chans[id];
+    head = c->inHead;
+    tail = __atomic_load_n(&c->inTail, __ATOMIC_ACQUIRE);
+    if ((unsigned int)size > c->inSize - (head - tail))
+        size = c->inSize - (head - tail); // Short copy, caller retries with the rest
+    if (size == 0) return 0;
+
+    off = head & (c->inSize - 1);
+    first = c->inSize - off;
+    if (first > (unsigned int)size)
+        first = size;
+    memcpy(c->in + off, in, first);
+    memcpy(c->in, in + first, size - first);
+    __atomic_store_n(&c->inHead, head + size, __ATOMIC_SEQ_CST); // Ordered before the queued check
+    hdlc_wchan_kick(w, c);
+    return size;
+}
+
+/**
+ * @brief HDLC worker pool take a decoded frame
+ *
+ * @param[in] *w       - pool
+ * @param[in] consumer - consumer queue
+ * @param[in] wait     - 1 block until a frame arrives, 0 return at once
+ *
+ * @return NULL nothing queued (or failure)
+ *         x    frame, in order per channel, free with hdlc_msg_free
+ *
+ * @note One thread per consumer
+ * @warning None
+ */
+struct hdlc_msg *hdlc_workers_recv(hdlc_workers_t *w, int consumer, int wait)
+{
+    struct hdlc_consumer *q;
+    struct hdlc_msg *grab, *msg, *list = NULL;
+
+    if (w == NULL || consumer < 0 || consumer >= w->nconsumers) return NULL;
+
+    q = &w->consumers[consumer];
+    if (q->list == NULL)
+    {
+        grab = __atomic_exchange_n(&q->stack, NULL, __ATOMIC_ACQUIRE);
+        if (grab == NULL && wait)
+        {
+            pthread_mutex_lock(&q->lock);
+            __atomic_store_n(&q->waiting, 1, __ATOMIC_SEQ_CST);
+            while ((grab = __atomic_exchange_n(&q->stack, NULL, __ATOMIC_SEQ_CST)) == NULL &&
+                   !__atomic_load_n(&w->stop, __ATOMIC_RELAXED))
+                pthread_cond_wait(&q->cond, &q->lock);
+            __atomic_store_n(&q->waiting, 0, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&q->lock);
+        }
+        while (grab != NULL)
+        { // Newest first, turn it around
+            msg = grab;
+            grab = grab->next;
+            msg->next = list;
+            list = msg;
+        }
+        q->list = list;
+    }
+
+    if ((msg = q->list) != NULL)
+        q->list = msg->next;
+    return msg;
+}
+
+/**
+ * @brief HDLC free a decoded frame
+ *
+ * Give the frame's buffer back to the pool of the worker that decoded it
+ *
+ * @param[in] *msg - frame from hdlc_workers_recv
+ *
+ * @note Any thread, also after hdlc_workers_delete
+ * @warning None
+ */
+void hdlc_msg_free(struct hdlc_msg *msg)
+{
+    if (msg != NULL)
+        hdlc_buf_release((struct hdlc_buf *)((unsigned char *)msg - offsetof(struct hdlc_buf, data)));
+}
+
+/**
+ * @brief HDLC worker thread
+ *
+ * Decode the channels on the ready stack, steal a backed up channel when
+ * there is nothing to do, sleep when there is nothing to steal either.  A
+ * channel leaves the stack before it is decoded and goes back (to whoever
+ * owns it by then) when data is left.
+ *
+ * @param[in] *arg - struct hdlc_worker
+ *
+ * @return NULL
+ */
+static void *hdlc_worker_main(void *arg)
+{
+    struct hdlc_worker *me = arg;
+    struct hdlc_workers *w = me->w;
+    struct hdlc_wchan *c, *grab, *list;
+    int did;
+
+    me->pool = hdlc_pool_init(MSG_BUF_SIZE, MSG_BUF_SLAB);
+    pthread_mutex_lock(&me->lock);
+    me->ready = me->pool != NULL ? 1 : -1;
+    pthread_cond_signal(&me->cond);
+    pthread_mutex_unlock(&me->lock);
+    if (me->pool == NULL) return NULL;
+
+    while (!__atomic_load_n(&w->stop, __ATOMIC_RELAXED))
+    {
+        grab = __atomic_exchange_n(&me->readyStack, NULL, __ATOMIC_ACQUIRE);
+        for (list = NULL; grab != NULL; )
+        { // Newest first, turn it around
+            c = grab;
+            grab = grab->nextReady;
+            c->nextReady = list;
+            list = c;
+        }
+        for (did = 0; list != NULL; )
+        {
+            c = list;
+            list = list->nextReady; // Before the channel can be queued again
+            __atomic_store_n(&c->queued, 0, __ATOMIC_SEQ_CST);
+            __atomic_sub_fetch(&w->backlog, 1, __ATOMIC_RELAXED);
+            did += hdlc_worker_decode(me, c);
+            hdlc_wchan_kick(w, c); // Data left, or stolen meanwhile
+        }
+
+        if (did == 0 && !hdlc_worker_steal(me))
+            hdlc_worker_sleep(me);
+    }
+    hdlc_pool_delete(me->pool); // Freed once the consumers gave every frame back
+    return NULL;
+}
+
+/**
+ * @brief HDLC worker decode a channel
+ *
+ * Decode the received data in place in the channel ring, copy the frames
+ * out to the consumer and give the room back to the producer.
+ *
+ * @param[in] *me - worker
+ * @param[in] *c  - pool channel
+ *
+ * @return bytes decoded
+ */
+static int hdlc_worker_decode(struct hdlc_worker *me, struct hdlc_wchan *c)
+{
+    struct hdlc_consumer *q = &me->w->consumers[c->consumer];
+    struct hdlc_frame frames[VISIT_FRAMES];
+    struct hdlc_msg *msg;
+    struct hdlc_buf *buf;
+    unsigned int head, tail, off, span;
+    int done = 0, pushed = 0, k, i, used, idle = 0;
+
+    if (hdlc_wchan_pending(c) == 0) return 0;
+    if (!__atomic_compare_exchange_n(&c->busy, &idle, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return 0; // Another worker has it
+    if (__atomic_load_n(&c->owner, __ATOMIC_RELAXED) != me->id)
+    { // Stolen in the meantime
+        __atomic_store_n(&c->busy, 0, __ATOMIC_RELEASE);
+        return 0;
+    }
+
+    while (done < VISIT_BUDGET)
+    {
+        head = __atomic_load_n(&c->inHead, __ATOMIC_ACQUIRE);
+        tail = c->inTail;
+        if (head == tail) break;
+
+        off = tail & (c->inSize - 1);
+        span = head - tail;
+        if (span > c->inSize - off)
+            span = c->inSize - off;
+
+        k = hdlc_msg_decode_view(c->chan, c->in + off, span, frames, VISIT_FRAMES, &used);
+        for (i = 0; i < k; i++)
+        {
+            if ((buf = hdlc_pool_get(me->pool, sizeof(*msg) + frames[i].len)) == NULL)
+            { // Frame lost
+                hdlc_count_dropped(c->chan, 1);
+                continue;
+            }
+            msg = (struct hdlc_msg *)buf->data;
+            msg->id = c - me->w->chans;
+            msg->number = c->number;
+            msg->len = frames[i].len;
+            msg->status = frames[i].status;
+            memcpy(msg->data, frames[i].ptr, frames[i].len);
+            hdlc_consumer_push(q, msg);
+            pushed++;
+        }
+        hdlc_msg_release_batch(c->chan);
+        if (k < 0) break;
+
+        __atomic_store_n(&c->inTail, tail + used, __ATOMIC_RELEASE); // Room back to the producer
+        done += used;
+    }
+    __atomic_store_n(&c->busy, 0, __ATOMIC_RELEASE);
+
+    if (pushed && __atomic_load_n(&q->waiting, __ATOMIC_SEQ_CST))
+        hdlc_wake(&q->lock, &q->cond);
+    return done;
+}
+
+/**
+ * @brief HDLC worker steal a channel
+ *
+ * Take over the channel with the largest backlog (at least a quarter of its
+ * ring) whose owner is not decoding it right now, and decode it.  Only
+ * queued channels can qualify, the channels are not looked at while no
+ * worker has any queued.
+ *
+ * @param[in] *me - worker
+ *
+ * @return 1 channel stolen
+ *         0 nothing worth stealing
+ */
+static int hdlc_worker_steal(struct hdlc_worker *me)
+{
+    struct hdlc_workers *w = me->w;
+    struct hdlc_wchan *c, *best = NULL;
+    unsigned int pending, most = 0;
+    int i, n, owner;
+
+    if (__atomic_load_n(&w->backlog, __ATOMIC_RELAXED) <= 0) return 0;
+    n = __atomic_load_n(&w->nchans, __ATOMIC_ACQUIRE);
+    for (i = 0; i < n; i++)
+    {
+        c = &w->chans[i];
+        if (!__atomic_load_n(&c->queued, __ATOMIC_RELAXED) ||
+            __atomic_load_n(&c->owner, __ATOMIC_RELAXED) == me->id ||
+            __atomic_load_n(&c->busy, __ATOMIC_RELAXED))
+            continue;
+        pending = hdlc_wchan_pending(c);
+        if (pending >= c->inSize / 4 && pending > most)
+        {
+            best = c;
+            most = pending;
+        }
+    }
+    if (best == NULL) return 0;
+
+    owner = __atomic_load_n(&best->owner, __ATOMIC_RELAXED);
+    if (owner == me->id ||
+        !__atomic_compare_exchange_n(&best->owner, &owner, me->id, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        return 0;
+    hdlc_worker_decode(me, best); // Still on the old owner's stack, which forwards it here when data is left
+    hdlc_wchan_kick(w, best);
+    return 1;
+}
+
+/**
+ * @brief HDLC worker sleep
+ *
+ * Wait for a producer, or a while to look for channels to steal again
+ *
+ * @param[in] *me - worker
+ */
+static void hdlc_worker_sleep(struct hdlc_worker *me)
+{
+    struct hdlc_workers *w = me->w;
+    struct timespec ts;
+
+    pthread_mutex_lock(&me->lock);
+    __atomic_store_n(&me->sleeping, 1, __ATOMIC_SEQ_CST);
+
+    // Nothing queued before the flag was seen
+    if (__atomic_load_n(&me->readyStack, __ATOMIC_SEQ_CST) == NULL && !__atomic_load_n(&w->stop, __ATOMIC_SEQ_CST))
+    {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += IDLE_WAIT_NS;
+        if (ts.tv_nsec >= 1000000000)
+        {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&me->cond, &me->lock, &ts);
+    }
+    __atomic_store_n(&me->sleeping, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&me->lock);
+}
+
+/**
+ * @brief HDLC pool channel received data not decoded yet
+ *
+ * @param[in] *c - pool channel
+ *
+ * @return bytes waiting
+ */
+static unsigned int hdlc_wchan_pending(struct hdlc_wchan *c)
+{
+    return __atomic_load_n(&c->inHead, __ATOMIC_SEQ_CST) - __atomic_load_n(&c->inTail, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief HDLC queue a pool channel
+ *
+ * Push a channel with data on its owner's ready stack, unless it is queued
+ * already, and wake the owner
+ *
+ * @param[in] *w - pool
+ * @param[in] *c - pool channel
+ */
+static void hdlc_wchan_kick(struct hdlc_workers *w, struct hdlc_wchan *c)
+{
+    struct hdlc_worker *owner;
+    struct hdlc_wchan *top;
+    int idle = 0;
+
+    if (hdlc_wchan_pending(c) == 0) return;
+    if (!__atomic_compare_exchange_n(&c->queued, &idle, 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return;
+    __atomic_add_fetch(&w->backlog, 1, __ATOMIC_RELAXED);
+
+    owner = &w->workers[__atomic_load_n(&c->owner, __ATOMIC_RELAXED)];
+    top = __atomic_load_n(&owner->readyStack, __ATOMIC_RELAXED);
+    do
+        c->nextReady = top;
+    while (!__atomic_compare_exchange_n(&owner->readyStack, &top, c, 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+    if (__atomic_load_n(&owner->sleeping, __ATOMIC_SEQ_CST))
+        hdlc_wake(&owner->lock, &owner->cond);
+}
+
+/**
+ * @brief HDLC push a frame to a consumer
+ *
+ * Lock-free stack push, the consumer takes the whole stack at once
+ *
+ * @param[in] *q   - consumer
+ * @param[in] *msg - frame
+ */
+static void hdlc_consumer_push(struct hdlc_consumer *q, struct hdlc_msg *msg)
+{
+    struct hdlc_msg *top = __atomic_load_n(&q->stack, __ATOMIC_RELAXED);
+
+    do
+        msg->next = top;
+    while (!__atomic_compare_exchange_n(&q->stack, &top, msg, 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+}
+
+/**
+ * @brief HDLC wake a sleeping thread
+ *
+ * Signal under the lock so the wake up cannot slip in between the sleeper's
+ * last check and its wait
+ *
+ * @param[in] *lock - sleeper's lock
+ * @param[in] *cond - sleeper's condition
+ */
+static void hdlc_wake(pthread_mutex_t *lock, pthread_cond_t *cond)
+{
+    pthread_mutex_lock(lock);
+    pthread_cond_signal(cond);
+    pthread_mutex_unlock(lock);
+}
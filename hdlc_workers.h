@@ -0,0 +1,46 @@
+/*!
+ * @file
+ * @author Mark Koi
+ *
+ * This is the header file for the decode worker pool.  Each attached channel
+ * is decoded by one worker thread at a time, so the frames of a channel come
+ * out in order, while different channels spread over all the cores.
+ *
+ *  - Producers hand received data to a channel with hdlc_workers_add, one
+ *    producer thread per channel (lock-free single producer ring).
+ *  - Decoded frames are queued to the consumer picked at attach time and
+ *    taken with hdlc_workers_recv, one thread per consumer.
+ *  - An idle worker steals whole channels with a backlog from busy workers,
+ *    never single frames.
+ *  - A frame that finds no buffer to be queued in is dropped and counted in
+ *    the channel's framesDropped (hdlc_stats_num).
+ *  - Attached channels belong to the pool until it is deleted, do not add or
+ *    decode on them directly.  Encoding is stateless and stays on the caller
+ *    (hdlc_msg_encode_buf).
+ */
+#ifndef HDLC_WORKERS_H
+#define HDLC_WORKERS_H
+
+#include "hdlc.h"
+
+typedef struct hdlc_workers hdlc_workers_t;
+
+// Decoded frame handed to a consumer, give it back with hdlc_msg_free
+struct hdlc_msg
+{
+    struct hdlc_msg *next;      // Consumer queue link (internal)
+    int              id;        // Pool channel, as returned by hdlc_workers_attach
+    int              number;    // Channel handle
+    int              len;       // Size of data
+    int              status;    // enum hdlc_frame_status
+    unsigned char    data[];    // Message (FCS removed)
+};
+
+hdlc_workers_t *hdlc_workers_init(int workers, int channels, int consumers);
+int hdlc_workers_delete(hdlc_workers_t *w);
+int hdlc_workers_attach(hdlc_workers_t *w, int number, int consumer);
+int hdlc_workers_add(hdlc_workers_t *w, int id, const unsigned char *in, int size);
+struct hdlc_msg *hdlc_workers_recv(hdlc_workers_t *w, int consumer, int wait);
+void hdlc_msg_free(struct hdlc_msg *msg);
+
+#endif